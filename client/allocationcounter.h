@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/// Replaces the global operator new and delete of the binary allocationcounter.cpp is linked
+/// into with ones that count every allocation, a relaxed add on paths that are allocation free
+/// once warmed up. Only the bench and the tests link it.
+class AllocationCounter
+{
+public:
+    /// allocations made by the process so far
+    static uint64_t allocations();
+};
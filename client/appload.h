@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+// Header only, for the services on a node to publish their load to mclearcli. Link with -lrt on
+// glibc older than 2.34.
+//
+//     AppLoadPublisher load("checkout");
+//     load.started();
+//     ...
+//     load.finished(latencyUs);
+//
+// Every call is a relaxed atomic add on a cache line of the service's own.
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct alignas(64) AppLoadSlot
+{
+    enum State : uint32_t { Free, Claiming, Active };
+
+    std::atomic<uint32_t> state;
+    std::atomic<int32_t> pid;
+    char service[56];
+
+    // written by the service, on a cache line of their own
+    alignas(64) std::atomic<int64_t> inFlight;
+    std::atomic<int64_t> queueDepth;
+    std::atomic<uint64_t> completed;
+    std::atomic<uint64_t> latencyUs;
+};
+
+/// A fixed size table in POSIX shared memory, created by whichever side comes first
+struct AppLoadSegment
+{
+    static constexpr uint64_t segmentMagic = 0x44414f4c5050414dull;    // "MAPPLOAD"
+    static constexpr uint32_t slotCount = 64;
+    static constexpr const char* defaultName = "/mclear-appload";
+
+    std::atomic<uint64_t> magic;
+    alignas(64) AppLoadSlot slots[slotCount];
+
+    /// maps the segment, creating it when it does not exist. nullptr when it cannot be mapped.
+    static AppLoadSegment* map(const char* name = defaultName)
+    {
+        // any local service may publish, the numbers are only load signals
+        const int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if(fd == -1)
+            return nullptr;
+        fchmod(fd, 0666);
+
+        struct stat status;
+        if(fstat(fd, &status) == -1 || (status.st_size < off_t(sizeof(AppLoadSegment)) && ftruncate(fd, sizeof(AppLoadSegment)) == -1))
+        {
+            close(fd);
+            return nullptr;
+        }
+
+        void* mapped = mmap(nullptr, sizeof(AppLoadSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(mapped == MAP_FAILED)
+            return nullptr;
+
+        // a new segment is all zeroes, which is a valid empty table
+        AppLoadSegment* segment = static_cast<AppLoadSegment*>(mapped);
+        uint64_t expected = 0;
+        segment->magic.compare_exchange_strong(expected, segmentMagic);
+        if(segment->magic.load() != segmentMagic)
+        {
+            munmap(mapped, sizeof(AppLoadSegment));
+            return nullptr;
+        }
+        return segment;
+    }
+
+    static void unmap(AppLoadSegment* segment)
+    {
+        if(segment)
+            munmap(segment, sizeof(AppLoadSegment));
+    }
+
+    /// frees the slots of processes that went away without releasing them
+    void reap()
+    {
+        for(AppLoadSlot& slot : slots)
+        {
+            uint32_t state = AppLoadSlot::Active;
+            if(slot.state.load(std::memory_order_acquire) == state && kill(slot.pid.load(std::memory_order_relaxed), 0) == -1 && errno == ESRCH)
+                slot.state.compare_exchange_strong(state, AppLoadSlot::Free);
+        }
+    }
+};
+
+/// The load of one service. When there is no segment or no free slot the counters go to a slot
+/// of the publisher itself, so a service never has to check.
+class AppLoadPublisher
+{
+    AppLoadSegment* segment_;
+    AppLoadSlot* slot_;
+    AppLoadSlot local_{};
+
+public:
+    explicit AppLoadPublisher(const char* service, const char* segmentName = AppLoadSegment::defaultName):
+        segment_(AppLoadSegment::map(segmentName)),
+        slot_(&local_)
+    {
+        if(!segment_)
+            return;
+
+        for(AppLoadSlot& slot : segment_->slots)
+        {
+            uint32_t state = AppLoadSlot::Free;
+            if(!slot.state.compare_exchange_strong(state, AppLoadSlot::Claiming, std::memory_order_acquire))
+                continue;
+
+            slot.pid.store(getpid(), std::memory_order_relaxed);
+            strncpy(slot.service, service, sizeof(slot.service) - 1);
+            slot.service[sizeof(slot.service) - 1] = '\0';
+            slot.inFlight.store(0, std::memory_order_relaxed);
+            slot.queueDepth.store(0, std::memory_order_relaxed);
+            slot.completed.store(0, std::memory_order_relaxed);
+            slot.latencyUs.store(0, std::memory_order_relaxed);
+            slot.state.store(AppLoadSlot::Active, std::memory_order_release);
+            slot_ = &slot;
+            return;
+        }
+    }
+
+    ~AppLoadPublisher()
+    {
+        if(slot_ != &local_)
+            slot_->state.store(AppLoadSlot::Free, std::memory_order_release);
+        AppLoadSegment::unmap(segment_);
+    }
+
+    AppLoadPublisher(const AppLoadPublisher&) = delete;
+    AppLoadPublisher& operator=(const AppLoadPublisher&) = delete;
+
+    /// false when the load goes nowhere
+    bool published() const { return slot_ != &local_; }
+
+    void started() { slot_->inFlight.fetch_add(1, std::memory_order_relaxed); }
+    void finished(uint64_t latencyUs)
+    {
+        slot_->inFlight.fetch_sub(1, std::memory_order_relaxed);
+        slot_->completed.fetch_add(1, std::memory_order_relaxed);
+        slot_->latencyUs.fetch_add(latencyUs, std::memory_order_relaxed);
+    }
+    void queued(int64_t count = 1) { slot_->queueDepth.fetch_add(count, std::memory_order_relaxed); }
+    void dequeued(int64_t count = 1) { slot_->queueDepth.fetch_sub(count, std::memory_order_relaxed); }
+};
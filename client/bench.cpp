@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "bench.h"
+#include "allocationcounter.h"
+#include "options.h"
+#include "procfile.h"
+#include "sampler.h"
+
+#include <mcproto/infoupdate.pb.h>
+
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    /// hardware counter of the calling thread, reads 0 where perf events are not permitted
+    class PerfCounter
+    {
+        int fd_;
+
+    public:
+        explicit PerfCounter(uint64_t config)
+        {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        }
+
+        ~PerfCounter()
+        {
+            if(fd_ != -1)
+                close(fd_);
+        }
+
+        bool available() const { return fd_ != -1; }
+
+        uint64_t read() const
+        {
+            uint64_t value = 0;
+            if(fd_ != -1 && ::read(fd_, &value, sizeof(value)) != sizeof(value))
+                value = 0;
+            return value;
+        }
+    };
+
+    struct Counters
+    {
+        uint64_t cpuNs;
+        uint64_t allocations;
+        uint64_t syscalls;
+        uint64_t pageFaults;
+        uint64_t contextSwitches;
+        uint64_t instructions;
+        uint64_t cycles;
+    };
+
+    class Profiler
+    {
+        ProcFile io_;
+        PerfCounter instructions_;
+        PerfCounter cycles_;
+        uint64_t syscallOverhead_;
+
+        uint64_t syscalls()
+        {
+            // syscr and syscw
+            uint64_t total = 0;
+            if(!io_.read())
+                return 0;
+
+            TextScanner scanner(io_.content());
+            std::string_view word;
+            while(scanner.readWord(word))
+            {
+                uint64_t value;
+                if((word == "syscr:" || word == "syscw:") && scanner.readUint(value))
+                    total += value;
+                scanner.nextLine();
+            }
+            return total;
+        }
+
+    public:
+        Profiler() : io_("/proc/self/io"), instructions_(PERF_COUNT_HW_INSTRUCTIONS), cycles_(PERF_COUNT_HW_CPU_CYCLES)
+        {
+            // the syscalls reading the counters takes, the first read opens the file
+            syscalls();
+            const uint64_t first = syscalls();
+            syscallOverhead_ = syscalls() - first;
+        }
+
+        bool perfAvailable() const { return instructions_.available(); }
+        uint64_t syscallOverhead() const { return syscallOverhead_; }
+
+        Counters read()
+        {
+            Counters counters;
+            counters.syscalls = syscalls();
+            timespec cpu;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+            counters.cpuNs = uint64_t(cpu.tv_sec) * 1000000000 + cpu.tv_nsec;
+            rusage usage;
+            getrusage(RUSAGE_THREAD, &usage);
+            counters.pageFaults = usage.ru_minflt + usage.ru_majflt;
+            counters.contextSwitches = usage.ru_nvcsw + usage.ru_nivcsw;
+            counters.instructions = instructions_.read();
+            counters.cycles = cycles_.read();
+            counters.allocations = AllocationCounter::allocations();
+            return counters;
+        }
+    };
+
+    struct Stage
+    {
+        const char* name;
+        std::function<void()> run;
+        double cpuUsPerTick = 0;
+    };
+
+    void profile(Profiler& profiler, Stage& stage, uint32_t iterations, std::vector<uint32_t>& latencies, bool perf)
+    {
+        using namespace std::chrono;
+        // settles buffers and first time allocations
+        for(int idx = 0 ; idx < 3 ; idx++)
+            stage.run();
+
+        latencies.clear();
+        const Counters before = profiler.read();
+        for(uint32_t idx = 0 ; idx < iterations ; idx++)
+        {
+            const auto start = steady_clock::now();
+            stage.run();
+            latencies.push_back(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+        }
+        const Counters after = profiler.read();
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](size_t percent){ return latencies[(latencies.size() - 1) * percent / 100] / 1000.; };
+        const double ticks = iterations;
+        stage.cpuUsPerTick = (after.cpuNs - before.cpuNs) / 1000. / ticks;
+
+        std::printf("%-14s %9.1f %9.1f %9.1f %9.1f %9.1f %8.2f %8.2f %8.2f %8.2f",
+                    stage.name, percentile(50), percentile(90), percentile(99), latencies.back() / 1000., stage.cpuUsPerTick,
+                    (after.allocations - before.allocations) / ticks,
+                    (after.syscalls - before.syscalls - profiler.syscallOverhead()) / ticks,
+                    (after.pageFaults - before.pageFaults) / ticks,
+                    (after.contextSwitches - before.contextSwitches) / ticks);
+        if(perf)
+            std::printf(" %10.0f %10.0f", (after.instructions - before.instructions) / ticks, (after.cycles - before.cycles) / ticks);
+        std::printf("\n");
+    }
+}
+
+int Bench::run(const Options& options)
+{
+    Sampler sampler(options.cgroups);
+    for(const CollectorSetting& setting : options.collectors)
+        sampler.configure(setting.name, setting.enabled, setting.periodMs);
+    if(options.ioUring && !sampler.useIoRing())
+        std::printf("io_uring unavailable, reading synchronously\n");
+    std::string encoded;
+    encoded.reserve(Sampler::arenaBlockSize);
+
+    // every collector that is on on its own, then what a tick costs as a whole
+    std::vector<Stage> stages;
+    sampler.collectors().forEach([&stages](auto& collector){
+        stages.push_back({collector.name, [&collector]{ collector.update(); }});
+    });
+    stages.push_back({"serialize", [&]{ sampler.stats().SerializeToString(&encoded); }});
+    stages.push_back({"tick", [&]{ sampler.update(0); sampler.stats().SerializeToString(&encoded); }});
+
+    Profiler profiler;
+    const bool perf = profiler.perfAvailable();
+    const uint32_t iterations = std::max<uint32_t>(options.benchIterations, 1);
+    std::vector<uint32_t> latencies;
+    latencies.reserve(iterations);
+
+    std::printf("%u iterations per stage, per tick figures%s\n", iterations, perf ? "" : ", perf events not permitted");
+    std::printf("%-14s %9s %9s %9s %9s %9s %8s %8s %8s %8s", "stage", "p50(us)", "p90(us)", "p99(us)", "max(us)", "cpu(us)", "allocs", "rw-sys", "faults", "ctxsw");
+    if(perf)
+        std::printf(" %10s %10s", "instr", "cycles");
+    std::printf("\n");
+
+    for(Stage& stage : stages)
+        profile(profiler, stage, iterations, latencies, perf);
+
+    // the whole tick is what the daemon spends per report, sending aside
+    const double tickUs = stages.back().cpuUsPerTick;
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::printf("\noverhead: %.1fus cpu per tick, %.4f%% of a core at the %ums interval, %.4f%% at the %ums floor, max rss %ldKB\n",
+                tickUs, tickUs / (options.reportIntervalMs * 10.), options.reportIntervalMs,
+                tickUs / (options.minReportIntervalMs * 10.), options.minReportIntervalMs, usage.ru_maxrss);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+struct Options;
+
+/// Runs every collector and the serialization of a report in the foreground, without
+/// daemonizing or sending anything, and prints what each costs per tick: latency percentiles,
+/// cpu time, allocations, read/write syscalls, page faults and, where perf events are
+/// permitted, instructions and cycles.
+class Bench
+{
+public:
+    /// returns the exit code of the process
+    static int run(const Options& options);
+};
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "bench.h"
+#include "options.h"
+
+#include <iostream>
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try
+    {
+        options = Options::parse(argc, argv);
+    }
+    catch(const std::invalid_argument& e)
+    {
+        std::cerr << e.what() << '\n' << Options::usage();
+        return EXIT_FAILURE;
+    }
+
+    return Bench::run(options);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "cgroupinfo.h"
+
+#include <algorithm>
+#include <unistd.h>
+
+namespace
+{
+    /// reads the value of key from a flat keyed file like cpu.stat
+    /// usage_usec 8474393
+    /// throttled_usec 0
+    bool readKey(std::string_view content, std::string_view key, uint64_t& value)
+    {
+        TextScanner scanner(content);
+        std::string_view name;
+        do
+        {
+            if(scanner.readWord(name) && name == key)
+                return scanner.readUint(value);
+        }
+        while(scanner.nextLine());
+        return false;
+    }
+
+    /// reads a single value file like memory.max, which holds "max" when there is no limit
+    bool readLimit(ProcFile& file, uint64_t& value)
+    {
+        if(!file.read())
+            return false;
+        TextScanner scanner(file.content());
+        std::string_view word;
+        if(!scanner.readWord(word))
+            return false;
+        if(word == "max")
+        {
+            value = 0;
+            return true;
+        }
+        return TextScanner(word).readUint(value);
+    }
+}
+
+CgroupInfo::CgroupInfo(const std::string& cgroup, const char* cgroupRoot, const char* release):
+    cgroup_(cgroup),
+    path_(std::string(cgroupRoot) + '/' + cgroup),
+    pressure_(path_.c_str(), release, ".pressure"),
+    cpuMaxFile_(path_ + "/cpu.max"),
+    cpuStatFile_(path_ + "/cpu.stat"),
+    memoryCurrentFile_(path_ + "/memory.current"),
+    memoryMaxFile_(path_ + "/memory.max"),
+    onlineCpus_(std::max(1L, sysconf(_SC_NPROCESSORS_ONLN))),
+    previousUsageUs_(0),
+    previousThrottledUs_(0),
+    hasPrevious_(false),
+    cpuUsage_(0),
+    cpuLimit_(onlineCpus_ * 10000),
+    cpuThrottled_(0),
+    memoryCurrent_(0),
+    memoryMax_(0)
+{}
+
+CgroupInfo::~CgroupInfo()
+{}
+
+bool CgroupInfo::update(std::chrono::steady_clock::time_point now)
+{
+    // cpu.max holds "$MAX $PERIOD", $MAX being "max" when there is no quota
+    uint64_t quota = 0, period = 0;
+    if(readLimit(cpuMaxFile_, quota) && quota)
+    {
+        TextScanner scanner(cpuMaxFile_.content());
+        std::string_view word;
+        if(scanner.readWord(word) && scanner.readUint(period) && period)
+            cpuLimit_ = quota * 10000 / period;
+    }
+    else
+    {
+        cpuLimit_ = onlineCpus_ * 10000;
+    }
+
+    uint64_t usageUs = 0, throttledUs = 0;
+    if(!cpuStatFile_.read() || !readKey(cpuStatFile_.content(), "usage_usec", usageUs))
+        return false;
+    // only present with the cpu controller enabled on the parent
+    readKey(cpuStatFile_.content(), "throttled_usec", throttledUs);
+
+    using namespace std::chrono;
+    const auto elapsedUs = duration_cast<microseconds>(now - previousUpdate_).count();
+    if(hasPrevious_ && elapsedUs > 0)
+    {
+        cpuUsage_ = (usageUs - previousUsageUs_) * 10000 / elapsedUs;
+        cpuThrottled_ = std::min<uint64_t>(10000, (throttledUs - previousThrottledUs_) * 10000 / elapsedUs);
+    }
+    previousUsageUs_ = usageUs;
+    previousThrottledUs_ = throttledUs;
+    previousUpdate_ = now;
+    hasPrevious_ = true;
+
+    if(!readLimit(memoryCurrentFile_, memoryCurrent_) || !readLimit(memoryMaxFile_, memoryMax_))
+        return false;
+
+    return pressure_.update();
+}
+
+void CgroupInfo::files(std::vector<ProcFile*>& files)
+{
+    files.push_back(&cpuMaxFile_);
+    files.push_back(&cpuStatFile_);
+    files.push_back(&memoryCurrentFile_);
+    files.push_back(&memoryMaxFile_);
+    pressure_.files(files);
+}
+
+uint32_t CgroupInfo::cpuHeadroom() const
+{
+    if(!cpuLimit_ || cpuUsage_ >= cpuLimit_)
+        return 0;
+    return uint64_t(cpuLimit_ - cpuUsage_) * 10000 / cpuLimit_;
+}
+
+uint32_t CgroupInfo::memoryHeadroomPercent() const
+{
+    if(!memoryMax_)
+        return 100;
+    if(memoryCurrent_ >= memoryMax_)
+        return 0;
+    return (memoryMax_ - memoryCurrent_) * 100 / memoryMax_;
+}
+
+std::ostream& operator<<(std::ostream& out, const CgroupInfo& info)
+{
+    out << "Cgroup               :" << info.cgroup_ << '\n';
+    out << "Cpu usage(%)         :" << info.cpuUsage_ / 100. << '\n';
+    out << "Cpu limit(%)         :" << info.cpuLimit_ / 100. << '\n';
+    out << "Cpu throttled(%)     :" << info.cpuThrottled_ / 100. << '\n';
+    out << "Memory current(MB)   :" << info.memoryCurrent() << '\n';
+    out << "Memory limit(MB)     :" << info.memoryLimit() << '\n';
+    out << info.pressure_;
+    return out;
+}
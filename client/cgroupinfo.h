@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include "pressureinfo.h"
+#include "procfile.h"
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// Load of a cgroup v2 slice relative to its own limits. On hosts where the workload is
+/// confined to a slice the host wide numbers can look idle while the slice is throttled.
+class CgroupInfo
+{
+    std::string cgroup_;
+    std::string path_;
+    PressureInfo pressure_;
+    ProcFile cpuMaxFile_;
+    ProcFile cpuStatFile_;
+    ProcFile memoryCurrentFile_;
+    ProcFile memoryMaxFile_;
+    uint32_t onlineCpus_;
+
+    uint64_t previousUsageUs_;
+    uint64_t previousThrottledUs_;
+    std::chrono::steady_clock::time_point previousUpdate_;
+    bool hasPrevious_;
+
+    uint32_t cpuUsage_;
+    uint32_t cpuLimit_;
+    uint32_t cpuThrottled_;
+    uint64_t memoryCurrent_;
+    uint64_t memoryMax_;
+
+public:
+    /// cgroup is the path of the slice below the cgroup2 mount, e.g. system.slice/nginx.service
+    CgroupInfo(const std::string& cgroup, const char* cgroupRoot = "/sys/fs/cgroup", const char* release = 0);
+    CgroupInfo(CgroupInfo&&) = default;
+    ~CgroupInfo();
+
+    /// cpu figures are over the time since the previous update, the first update only takes a baseline
+    bool update(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    /// the files update() reads, for an IoRing to read ahead
+    void files(std::vector<ProcFile*>& files);
+
+    const std::string& cgroup() const { return cgroup_; }
+    /// in 1/100th of a percent of one cpu, 20000 is two cpus fully used
+    uint32_t cpuUsage() const { return cpuUsage_; }
+    /// in 1/100th of a percent of one cpu as set by cpu.max, the online cpus when there is no quota
+    uint32_t cpuLimit() const { return cpuLimit_; }
+    /// in 1/100th of a percent of the limit left unused
+    uint32_t cpuHeadroom() const;
+    /// in 1/100th of a percent of the time the slice spent throttled
+    uint32_t cpuThrottled() const { return cpuThrottled_; }
+    uint64_t memoryCurrent() const { return memoryCurrent_ / (1000 * 1000); }
+    /// 0 when memory.max is not set
+    uint64_t memoryLimit() const { return memoryMax_ / (1000 * 1000); }
+    /// percentage of memory.max left unused, 100 when memory.max is not set
+    uint32_t memoryHeadroomPercent() const;
+    float memoryPressure() const { return pressure_.avg10(PressureInfo::Memory); }
+    float ioPressure() const { return pressure_.avg10(PressureInfo::Io); }
+
+    friend std::ostream& operator<<(std::ostream& out, const CgroupInfo& info);
+};
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "collectors.h"
+
+#include <mcproto/infoupdate.pb.h>
+
+#include <cstring>
+
+void CpuLoadCollector::fill(mcproto::Stats& stats) const
+{
+    stats.mutable_cpuload()->set_cpuload(info.cpuLoad());
+}
+
+void CpuLoadCollector::clear(mcproto::Stats& stats) const
+{
+    stats.mutable_cpuload()->Clear();
+}
+
+void NetworkCollector::fill(mcproto::Stats& stats) const
+{
+    stats.mutable_netinfo()->set_bandwidthusage(info.bandwidthUsage());
+}
+
+void NetworkCollector::clear(mcproto::Stats& stats) const
+{
+    stats.mutable_netinfo()->Clear();
+}
+
+void MemoryCollector::fill(mcproto::Stats& stats) const
+{
+    mcproto::MemoryInfo* protomemoryinfo = stats.mutable_meminfo();
+    protomemoryinfo->set_availableswap(info.availableSwap());
+    protomemoryinfo->set_availableram(info.availableRam());
+    protomemoryinfo->set_availablerampercent(info.availableRamPercent());
+    protomemoryinfo->set_availableswappercent(info.availableSwapPercent());
+    protomemoryinfo->set_avg10processstalltime(info.avg10ProcessStallTime());
+}
+
+void MemoryCollector::clear(mcproto::Stats& stats) const
+{
+    stats.mutable_meminfo()->Clear();
+}
+
+void DiskSpaceCollector::fill(mcproto::Stats& stats) const
+{
+    stats.mutable_diskinfo()->set_availablespace(info.availableSpace());
+}
+
+void DiskSpaceCollector::clear(mcproto::Stats& stats) const
+{
+    stats.mutable_diskinfo()->Clear();
+}
+
+void PressureCollector::fill(mcproto::Stats& stats) const
+{
+    mcproto::PressureInfo* protopressureinfo = stats.mutable_pressure();
+    protopressureinfo->set_cpuavg10(info.avg10(PressureInfo::Cpu));
+    protopressureinfo->set_memoryavg10(info.avg10(PressureInfo::Memory));
+    protopressureinfo->set_ioavg10(info.avg10(PressureInfo::Io));
+}
+
+CgroupCollector::CgroupCollector(const CollectorContext& context):
+    updated(context.cgroups.size(), false)
+{
+    infos.reserve(context.cgroups.size());
+    for(const std::string& cgroup : context.cgroups)
+        infos.emplace_back(cgroup, context.cgroupRoot);
+}
+
+void CgroupCollector::files(std::vector<ProcFile*>& files)
+{
+    for(CgroupInfo& info : infos)
+        info.files(files);
+}
+
+bool CgroupCollector::update()
+{
+    for(size_t idx = 0 ; idx < infos.size() ; idx++)
+    {
+        updated[idx] = infos[idx].update();
+        if(!updated[idx])
+            std::cerr << "CgroupInfo update failed for " << infos[idx].cgroup() << '\n';
+    }
+    return true;
+}
+
+void CgroupCollector::fill(mcproto::Stats& stats) const
+{
+    // the entries are added once, later reports only overwrite them
+    for(size_t idx = stats.cgroups_size() ; idx < infos.size() ; idx++)
+        stats.add_cgroups()->set_cgroup(infos[idx].cgroup());
+
+    for(size_t idx = 0 ; idx < infos.size() ; idx++)
+    {
+        const CgroupInfo& cgroupinfo = infos[idx];
+        mcproto::CgroupInfo* protocgroupinfo = stats.mutable_cgroups(idx);
+        if(!updated[idx])
+        {
+            // a cleared string keeps its buffer, setting the name again does not allocate
+            protocgroupinfo->Clear();
+            protocgroupinfo->set_cgroup(cgroupinfo.cgroup());
+            continue;
+        }
+        protocgroupinfo->set_cpuusage(cgroupinfo.cpuUsage());
+        protocgroupinfo->set_cpulimit(cgroupinfo.cpuLimit());
+        protocgroupinfo->set_cpuheadroom(cgroupinfo.cpuHeadroom());
+        protocgroupinfo->set_cputhrottled(cgroupinfo.cpuThrottled());
+        protocgroupinfo->set_memorycurrent(cgroupinfo.memoryCurrent());
+        protocgroupinfo->set_memorylimit(cgroupinfo.memoryLimit());
+        protocgroupinfo->set_memoryheadroompercent(cgroupinfo.memoryHeadroomPercent());
+        protocgroupinfo->set_memorypressureavg10(cgroupinfo.memoryPressure());
+        protocgroupinfo->set_iopressureavg10(cgroupinfo.ioPressure());
+    }
+}
+
+void CgroupCollector::clear(mcproto::Stats& stats) const
+{
+    // update() never fails as a whole, the failed slices are cleared one by one
+    fill(stats);
+}
+
+AppLoadCollector::AppLoadCollector(const CollectorContext& context):
+    segment(AppLoadSegment::map(context.appLoadSegment))
+{
+    if(!segment)
+        std::cerr << "AppLoad segment " << context.appLoadSegment << " not available, no service load is reported\n";
+}
+
+AppLoadCollector::~AppLoadCollector()
+{
+    AppLoadSegment::unmap(segment);
+}
+
+bool AppLoadCollector::update(std::chrono::steady_clock::time_point now)
+{
+    using namespace std::chrono;
+    if(!segment)
+        return true;
+
+    segment->reap();
+    const uint64_t elapsedMs = duration_cast<milliseconds>(now - previousUpdate).count();
+    previousUpdate = now;
+
+    for(size_t idx = 0 ; idx < AppLoadSegment::slotCount ; idx++)
+    {
+        AppLoadSlot& slot = segment->slots[idx];
+        Snapshot& snapshot = snapshots[idx];
+        if(slot.state.load(std::memory_order_acquire) != AppLoadSlot::Active)
+        {
+            active[idx] = false;
+            continue;
+        }
+
+        const uint64_t completed = slot.completed.load(std::memory_order_relaxed);
+        const uint64_t latencyUs = slot.latencyUs.load(std::memory_order_relaxed);
+        const int32_t pid = slot.pid.load(std::memory_order_relaxed);
+
+        // a slot taken over by another service starts from scratch
+        const bool baseline = active[idx] && snapshot.pid == pid && completed >= snapshot.completed;
+        const uint64_t completedSince = baseline ? completed - snapshot.completed : 0;
+        snapshot.requestsPerSec = baseline && elapsedMs ? completedSince * 1000 / elapsedMs : 0;
+        snapshot.meanLatencyUs = completedSince ? (latencyUs - snapshot.latencyUs) / completedSince : 0;
+
+        if(!baseline)
+            memcpy(snapshot.service, slot.service, sizeof(snapshot.service));
+        snapshot.service[sizeof(snapshot.service) - 1] = '\0';
+        snapshot.pid = pid;
+        snapshot.inFlight = slot.inFlight.load(std::memory_order_relaxed);
+        snapshot.queueDepth = slot.queueDepth.load(std::memory_order_relaxed);
+        snapshot.completed = completed;
+        snapshot.latencyUs = latencyUs;
+        active[idx] = true;
+    }
+    return true;
+}
+
+void AppLoadCollector::fill(mcproto::Stats& stats) const
+{
+    // entries dropped from the end are kept around for reuse, the steady state does not allocate
+    int used = 0;
+    for(size_t idx = 0 ; idx < AppLoadSegment::slotCount ; idx++)
+    {
+        if(!active[idx])
+            continue;
+
+        const Snapshot& snapshot = snapshots[idx];
+        mcproto::AppLoad* protoappload = used < stats.apploads_size() ? stats.mutable_apploads(used) : stats.add_apploads();
+        used++;
+        protoappload->set_service(snapshot.service);
+        protoappload->set_inflight(snapshot.inFlight);
+        protoappload->set_queuedepth(snapshot.queueDepth);
+        protoappload->set_requestspersec(snapshot.requestsPerSec);
+        protoappload->set_meanlatencyus(snapshot.meanLatencyUs);
+    }
+
+    while(stats.apploads_size() > used)
+        stats.mutable_apploads()->RemoveLast();
+}
+
+void AppLoadCollector::clear(mcproto::Stats& stats) const
+{
+    stats.clear_apploads();
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include "appload.h"
+#include "cgroupinfo.h"
+#include "cpuloadinfo.h"
+#include "diskspaceinfo.h"
+#include "memoryinfo.h"
+#include "networkinfo.h"
+#include "pressureinfo.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace mcproto
+{
+    class Stats;
+}
+
+/// what the collectors are built from
+struct CollectorContext
+{
+    const std::vector<std::string>& cgroups;
+    const char* cgroupRoot;
+    const char* appLoadSegment = AppLoadSegment::defaultName;
+};
+
+/// A collector is one source of metrics. It has a static name, is built from the
+/// CollectorContext, re-reads its source in update() and copies the values into the report in
+/// fill(), or clears its part of the report when the source could not be read. It lists the
+/// files update() reads in files(), so they can be read ahead all at once. Collectors are
+/// listed in a CollectorSet and called directly, without virtual dispatch.
+struct CpuLoadCollector
+{
+    static constexpr const char* name = "cpu";
+    CpuLoadInfo info;
+
+    explicit CpuLoadCollector(const CollectorContext&) {}
+    bool update() { return info.update(); }
+    void files(std::vector<ProcFile*>& files) { info.files(files); }
+    void fill(mcproto::Stats& stats) const;
+    void clear(mcproto::Stats& stats) const;
+};
+
+struct NetworkCollector
+{
+    static constexpr const char* name = "network";
+    NetworkInfo info;
+
+    explicit NetworkCollector(const CollectorContext&) {}
+    bool update() { return info.update(); }
+    void files(std::vector<ProcFile*>& files) { info.files(files); }
+    void fill(mcproto::Stats& stats) const;
+    void clear(mcproto::Stats& stats) const;
+};
+
+struct MemoryCollector
+{
+    static constexpr const char* name = "memory";
+    MemoryInfo info;
+
+    explicit MemoryCollector(const CollectorContext&) {}
+    bool update() { return info.update(); }
+    void files(std::vector<ProcFile*>& files) { info.files(files); }
+    void fill(mcproto::Stats& stats) const;
+    void clear(mcproto::Stats& stats) const;
+};
+
+struct DiskSpaceCollector
+{
+    static constexpr const char* name = "disk";
+    DiskSpaceInfo info;
+
+    explicit DiskSpaceCollector(const CollectorContext&) {}
+    bool update() { return info.update(); }
+    /// statvfs, nothing to read ahead
+    void files(std::vector<ProcFile*>&) {}
+    void fill(mcproto::Stats& stats) const;
+    void clear(mcproto::Stats& stats) const;
+};
+
+struct PressureCollector
+{
+    static constexpr const char* name = "pressure";
+    PressureInfo info;
+
+    explicit PressureCollector(const CollectorContext&) {}
+    bool update() { return info.update(); }
+    void files(std::vector<ProcFile*>& files) { info.files(files); }
+    /// the averages of resources without pressure information go out as -1
+    void fill(mcproto::Stats& stats) const;
+    void clear(mcproto::Stats& stats) const { fill(stats); }
+};
+
+/// the slices given on the command line, one failing does not take the others with it
+struct CgroupCollector
+{
+    static constexpr const char* name = "cgroup";
+    std::vector<CgroupInfo> infos;
+    std::vector<char> updated;
+
+    explicit CgroupCollector(const CollectorContext& context);
+    bool update();
+    void files(std::vector<ProcFile*>& files);
+    void fill(mcproto::Stats& stats) const;
+    void clear(mcproto::Stats& stats) const;
+};
+
+/// the load the services on the node publish through appload.h
+struct AppLoadCollector
+{
+    struct Snapshot
+    {
+        char service[sizeof(AppLoadSlot::service)];
+        int32_t pid;
+        int64_t inFlight;
+        int64_t queueDepth;
+        uint64_t completed;
+        uint64_t latencyUs;
+        uint32_t requestsPerSec;
+        uint32_t meanLatencyUs;
+    };
+
+    static constexpr const char* name = "app";
+    AppLoadSegment* segment;
+    // by slot, the previous reading is what the rates are worked out against
+    std::array<Snapshot, AppLoadSegment::slotCount> snapshots{};
+    std::array<bool, AppLoadSegment::slotCount> active{};
+    std::chrono::steady_clock::time_point previousUpdate;
+
+    explicit AppLoadCollector(const CollectorContext& context);
+    ~AppLoadCollector();
+    AppLoadCollector(const AppLoadCollector&) = delete;
+    AppLoadCollector& operator=(const AppLoadCollector&) = delete;
+
+    bool update(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    /// shared memory, nothing to read ahead
+    void files(std::vector<ProcFile*>&) {}
+    void fill(mcproto::Stats& stats) const;
+    void clear(mcproto::Stats& stats) const;
+};
+
+/// The collectors of a report, fixed at compile time. Each one can be turned off or given a
+/// sampling period of its own, a collector that is not due keeps its last values in the report.
+template <typename... Collectors>
+class CollectorSet
+{
+    template <typename Collector>
+    struct Slot
+    {
+        Collector collector;
+        bool enabled = true;
+        std::chrono::milliseconds period{0};
+        std::chrono::steady_clock::time_point due;
+
+        explicit Slot(const CollectorContext& context) : collector(context) {}
+    };
+
+    std::tuple<Slot<Collectors>...> slots_;
+
+    template <typename Collector>
+    static void update(Slot<Collector>& slot, mcproto::Stats& stats, std::chrono::steady_clock::time_point now)
+    {
+        if(!slot.enabled || now < slot.due)
+            return;
+
+        slot.due = now + slot.period;
+        if(slot.collector.update())
+        {
+            slot.collector.fill(stats);
+        }
+        else
+        {
+            slot.collector.clear(stats);
+            std::cerr << Collector::name << " update failed\n";
+        }
+    }
+
+    template <typename Collector>
+    static bool configure(Slot<Collector>& slot, std::string_view name, bool enabled, uint32_t periodMs)
+    {
+        if(name != Collector::name)
+            return false;
+        slot.enabled = enabled;
+        slot.period = std::chrono::milliseconds(periodMs);
+        return true;
+    }
+
+public:
+    explicit CollectorSet(const CollectorContext& context) : slots_(((void)sizeof(Collectors), context)...) {}
+
+    static bool has(std::string_view name)
+    {
+        return ((name == Collectors::name) || ...);
+    }
+
+    /// a period of 0 samples on every tick, false for an unknown collector
+    bool configure(std::string_view name, bool enabled, uint32_t periodMs)
+    {
+        return std::apply([&](auto&... slot){ return (configure(slot, name, enabled, periodMs) || ...); }, slots_);
+    }
+
+    /// updates the collectors that are on and due into stats, in the order they are listed
+    void update(mcproto::Stats& stats, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+    {
+        std::apply([&](auto&... slot){ (update(slot, stats, now), ...); }, slots_);
+    }
+
+    template <typename Collector>
+    Collector& get() { return std::get<Slot<Collector>>(slots_).collector; }
+    template <typename Collector>
+    const Collector& get() const { return std::get<Slot<Collector>>(slots_).collector; }
+    template <typename Collector>
+    bool enabled() const { return std::get<Slot<Collector>>(slots_).enabled; }
+
+    /// the files of the collectors that update() is going to update at now
+    void dueFiles(std::vector<ProcFile*>& files, std::chrono::steady_clock::time_point now)
+    {
+        std::apply([&](auto&... slot){ ((slot.enabled && now >= slot.due ? slot.collector.files(files) : void()), ...); }, slots_);
+    }
+
+    /// calls function with every collector that is on
+    template <typename Function>
+    void forEach(Function&& function)
+    {
+        std::apply([&](auto&... slot){ ((slot.enabled ? function(slot.collector) : void()), ...); }, slots_);
+    }
+};
@@ -14,56 +14,51 @@
 
 #include "cpuloadinfo.h"
 
-#include <chrono>
-#include <thread>
-#include <vector>
-#include <fstream>
-#include <numeric>
+CpuLoadInfo::CpuLoadInfo(const char* procStat): procStat_(procStat), cpuLoad_(0), previousIdleTime_(0), previousTotalTime_(0)
+{
+    getCpuTimes(previousIdleTime_, previousTotalTime_);
+}
+
+CpuLoadInfo::~CpuLoadInfo()
+{}
 
-namespace
+/// the first line of /proc/stat holds the aggregate of all the cpus
+/// cpu  10132153 290696 3084719 46828483 16683 0 25195 0 175628 0
+bool CpuLoadInfo::getCpuTimes(size_t& idleTime, size_t& totalTime)
 {
-    inline std::vector<size_t> getCpuTimes()
-    {
-        std::vector<size_t> times;
-        {
-            std::ifstream procStat("/proc/stat");
-            procStat.ignore(5, ' '); // skip the 'cpu ' prefix
-            for(size_t time ; procStat >> time ; times.push_back(time));
-        }
-        return times;
-    }
+    if(!procStat_.read())
+        return false;
 
-    inline bool getCpuTimes(size_t& idleTime, size_t& totalTime)
-    {
-        const std::vector<size_t> cpuTimes = getCpuTimes();
-        if(cpuTimes.size() < 4)
-            return false;
-        
-        idleTime = cpuTimes[3];
-        totalTime = std::accumulate(cpuTimes.begin(), cpuTimes. end(), 0);
-        return true;
-    }
+    TextScanner scanner(procStat_.content());
+    std::string_view prefix;
+    if(!scanner.readWord(prefix) || prefix != "cpu")
+        return false;
 
-    void update(uint32_t& cpuLoad)
+    size_t count = 0;
+    totalTime = 0;
+    for(uint64_t time ; scanner.readUint(time) ; count++)
     {
-        using namespace std::chrono_literals;
-        size_t previousIdleTime = 0;
-        size_t previousTotalTime = 0;
-        for(size_t idleTime, totalTime ; getCpuTimes(idleTime, totalTime) ; std::this_thread::sleep_for(5s))
-        {
-            const size_t idleTimeDelta = idleTime - previousIdleTime;
-            const size_t totalTimeDelta = totalTime - previousTotalTime;
-            cpuLoad = 10000. * (1. - double(idleTimeDelta) / totalTimeDelta);
-            previousIdleTime = idleTime;
-            previousTotalTime = totalTime;
-        }
+        if(count == 3)
+            idleTime = time;
+        totalTime += time;
     }
+    return count >= 4;
 }
 
-CpuLoadInfo::CpuLoadInfo(): cpuLoad_(0.f)
+bool CpuLoadInfo::update()
 {
-    std::thread(update, std::ref(cpuLoad_)).detach();
-}
+    size_t idleTime, totalTime;
+    if(!getCpuTimes(idleTime, totalTime))
+        return false;
 
-CpuLoadInfo::~CpuLoadInfo()
-{}
+    const size_t idleTimeDelta = idleTime - previousIdleTime_;
+    const size_t totalTimeDelta = totalTime - previousTotalTime_;
+    // two updates within the same jiffy keep the previous value
+    if(totalTimeDelta)
+    {
+        cpuLoad_ = 10000. * (1. - double(idleTimeDelta) / totalTimeDelta);
+        previousIdleTime_ = idleTime;
+        previousTotalTime_ = totalTime;
+    }
+    return true;
+}
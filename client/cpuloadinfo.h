@@ -14,16 +14,30 @@
 
 #pragma once
 
+#include "procfile.h"
+
+#include <cstddef>
 #include <cstdint>
+#include <vector>
 
 class CpuLoadInfo
 {
+    ProcFile procStat_;
     uint32_t cpuLoad_;
+    size_t previousIdleTime_;
+    size_t previousTotalTime_;
+
+    bool getCpuTimes(size_t& idleTime, size_t& totalTime);
+
 public:
-    /// starts a detached thread
-    CpuLoadInfo();
+    /// takes the first /proc/stat reading so that the first update has a baseline
+    CpuLoadInfo(const char* procStat = "/proc/stat");
     ~CpuLoadInfo();
 
+    /// load since the previous update
+    bool update();
+    /// the files update() reads, for an IoRing to read ahead
+    void files(std::vector<ProcFile*>& files) { files.push_back(&procStat_); }
     /// divide bu 100. to get the percentage load
     uint32_t cpuLoad() const { return cpuLoad_; }
 };
\ No newline at end of file
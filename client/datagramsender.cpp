@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "datagramsender.h"
+#include "ipv4address.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+
+namespace
+{
+    // datagrams per sendmmsg call
+    constexpr size_t batchSize = 64;
+}
+
+DatagramSender::DatagramSender(const std::string& hostPort, std::optional<mcproto::StatsDatagram::Key> key):
+    socket_(-1),
+    key_(key),
+    buffers_(batchSize * mcproto::StatsDatagram::maxSize)
+{
+    const sockaddr_in address = Ipv4Address::resolve(hostPort);
+
+    socket_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(socket_ == -1)
+        throw std::system_error(std::error_code(errno, std::system_category()), "cannot create datagram socket");
+
+    // connected, so the kernel looks the route up once and not per datagram
+    if(connect(socket_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1)
+    {
+        std::system_error error(std::error_code(errno, std::system_category()), "cannot address " + hostPort);
+        close(socket_);
+        throw error;
+    }
+}
+
+DatagramSender::~DatagramSender()
+{
+    close(socket_);
+}
+
+bool DatagramSender::send(const mcproto::Stats& stats)
+{
+    const size_t size = mcproto::StatsDatagram::from(stats).encode(buffers_.data(), mcproto::StatsDatagram::maxSize, key_ ? &*key_ : nullptr);
+    return size && ::send(socket_, buffers_.data(), size, MSG_DONTWAIT) == ssize_t(size);
+}
+
+size_t DatagramSender::send(const mcproto::Stats* const* stats, size_t count)
+{
+    iovec vectors[batchSize];
+    mmsghdr messages[batchSize];
+    size_t sent = 0;
+    while(sent < count)
+    {
+        unsigned int pending = 0;
+        for( ; sent + pending < count && pending < batchSize ; )
+        {
+            char* buffer = buffers_.data() + pending * mcproto::StatsDatagram::maxSize;
+            const size_t size = mcproto::StatsDatagram::from(*stats[sent + pending]).encode(buffer, mcproto::StatsDatagram::maxSize, key_ ? &*key_ : nullptr);
+            if(!size)
+                break;
+            vectors[pending] = {buffer, size};
+            messages[pending] = {};
+            messages[pending].msg_hdr.msg_iov = &vectors[pending];
+            messages[pending].msg_hdr.msg_iovlen = 1;
+            pending++;
+        }
+        if(!pending)
+            break;
+
+        const int accepted = sendmmsg(socket_, messages, pending, 0);
+        if(accepted <= 0)
+            break;
+        sent += accepted;
+        if(unsigned(accepted) < pending)
+            break;
+    }
+    return sent;
+}
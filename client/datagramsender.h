@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <mcproto/statsdatagram.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace mcproto
+{
+    class Stats;
+}
+
+/// Sends samples to a server's datagram port as mcproto::StatsDatagram, fire and forget. There
+/// is no reply, a lost datagram is replaced by the next report, the server's interval floor
+/// and the spool are for the gRPC path only.
+class DatagramSender
+{
+public:
+    /// throws std::invalid_argument for addresses that do not resolve to IPv4, std::system_error
+    /// when no socket can be had
+    DatagramSender(const std::string& hostPort, std::optional<mcproto::StatsDatagram::Key> key = std::nullopt);
+    ~DatagramSender();
+
+    DatagramSender(const DatagramSender&) = delete;
+    DatagramSender& operator=(const DatagramSender&) = delete;
+
+    /// false when the sample does not fit into a datagram or the kernel would not take it
+    bool send(const mcproto::Stats& stats);
+    /// all of them with one sendmmsg call, returns how many the kernel took
+    size_t send(const mcproto::Stats* const* stats, size_t count);
+
+private:
+    int socket_;
+    std::optional<mcproto::StatsDatagram::Key> key_;
+    std::vector<char> buffers_;
+};
@@ -14,8 +14,8 @@
 
 #include "diskspaceinfo.h"
 
-#include <filesystem>
 #include <iostream>
+#include <sys/statvfs.h>
 
 DiskSpaceInfo::DiskSpaceInfo(const char* diskMount):
     availableDiskSpaceKb_(0),
@@ -27,14 +27,15 @@ DiskSpaceInfo::~DiskSpaceInfo()
 
 bool DiskSpaceInfo::update()
 {
-    std::error_code ec;
-    auto spaceInfo = std::filesystem::space(diskMountPath_, ec);
-    if(spaceInfo.available == -1)
+    // statvfs directly rather than std::filesystem::space, which builds a path on every call
+    struct statvfs spaceInfo;
+    if(statvfs(diskMountPath_, &spaceInfo) == -1)
     {
         std::cerr << "could not calculate disk space info\n";
         return false;
     }
 
-    availableDiskSpaceKb_ = spaceInfo.available / 1000;
+    // the space available to unprivileged users, as std::filesystem::space reports it
+    availableDiskSpaceKb_ = uint64_t(spaceInfo.f_bavail) * spaceInfo.f_frsize / 1000;
     return true;
 }
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "endpointset.h"
+
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include <grpcpp/support/channel_arguments.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    // fewer calls than this and the percentiles say nothing yet
+    constexpr size_t minLatencies = 8;
+    // hedging earlier than this only doubles the load on a healthy fleet
+    constexpr auto minHedgeBudget = std::chrono::milliseconds(5);
+    constexpr auto maxBackoff = std::chrono::seconds(30);
+
+    uint32_t percentile(const std::array<uint32_t, 64>& latencies, size_t count, size_t percent)
+    {
+        if(!count)
+            return 0;
+
+        std::array<uint32_t, 64> sorted = latencies;
+        const size_t used = std::min(count, sorted.size());
+        const size_t rank = (used - 1) * percent / 100;
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.begin() + used);
+        return sorted[rank];
+    }
+}
+
+/// one in-flight call of a report, the completion queue tag is the call
+struct EndpointSet::Call
+{
+    EndpointSet::Endpoint* endpoint = nullptr;
+    grpc::ClientContext context;
+    mcproto::StatsReply reply;
+    grpc::Status status;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<mcproto::StatsReply>> reader;
+    Clock::time_point start;
+};
+
+void EndpointSet::Endpoint::answered(Clock::duration latency)
+{
+    latencies[latencyCount++ % latencies.size()] = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+}
+
+void EndpointSet::Endpoint::succeeded(Clock::duration latency)
+{
+    answered(latency);
+    failures = 0;
+    retryAt = Clock::time_point();
+}
+
+void EndpointSet::Endpoint::failed(Clock::time_point now)
+{
+    // backs off exponentially, a server that is down is only tried again when nothing else works
+    failures = std::min<uint32_t>(failures + 1, 16);
+    retryAt = now + std::min<Clock::duration>(maxBackoff, std::chrono::milliseconds(500 << (failures - 1)));
+}
+
+uint32_t EndpointSet::Endpoint::p95Us() const
+{
+    return latencyCount < minLatencies ? 0 : percentile(latencies, latencyCount, 95);
+}
+
+uint32_t EndpointSet::Endpoint::medianUs() const
+{
+    return percentile(latencies, latencyCount, 50);
+}
+
+EndpointSet::EndpointSet(const std::vector<std::string>& addresses, uint32_t deadlineMs):
+    deadline_(deadlineMs)
+{
+    if(addresses.empty())
+        throw std::invalid_argument("no server to report to");
+
+    grpc::ChannelArguments arguments;
+    // keeps the idle channels connected so that a hedge or a failover does not pay for a handshake
+    arguments.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, 30000);
+    arguments.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+    arguments.SetInt(GRPC_ARG_CLIENT_IDLE_TIMEOUT_MS, INT32_MAX);
+
+    endpoints_.resize(addresses.size());
+    ranked_.reserve(addresses.size());
+    for(size_t idx = 0 ; idx < addresses.size() ; idx++)
+    {
+        Endpoint& endpoint = endpoints_[idx];
+        endpoint.address = addresses[idx];
+        endpoint.channel = grpc::CreateCustomChannel(endpoint.address, grpc::InsecureChannelCredentials(), arguments);
+        endpoint.channel->GetState(true);
+        endpoint.stub = mcproto::InfoUpdate::NewStub(endpoint.channel);
+        ranked_.push_back(&endpoint);
+    }
+}
+
+EndpointSet::~EndpointSet()
+{
+    queue_.Shutdown();
+    void* tag;
+    bool ok;
+    while(queue_.Next(&tag, &ok))
+        ;
+}
+
+void EndpointSet::rank()
+{
+    // healthy ones first, the ones without enough history yet are tried before slower known ones.
+    // stable so that the configured order breaks ties
+    const Clock::time_point now = Clock::now();
+    std::stable_sort(ranked_.begin(), ranked_.end(), [now](const Endpoint* lhs, const Endpoint* rhs){
+        if(lhs->healthy(now) != rhs->healthy(now))
+            return lhs->healthy(now);
+        if(!lhs->healthy(now))
+            return lhs->retryAt < rhs->retryAt;
+        return lhs->medianUs() < rhs->medianUs();
+    });
+}
+
+EndpointSet::Clock::duration EndpointSet::hedgeBudget(const Endpoint& endpoint) const
+{
+    const uint32_t p95Us = endpoint.p95Us();
+    // no history, wait a good part of the deadline before doubling up
+    if(!p95Us)
+        return deadline_ / 4;
+    return std::clamp<Clock::duration>(std::chrono::microseconds(p95Us), minHedgeBudget, deadline_);
+}
+
+const std::string& EndpointSet::preferred()
+{
+    rank();
+    return ranked_.front()->address;
+}
+
+bool EndpointSet::send(const mcproto::Stats& stats, mcproto::StatsReply& reply)
+{
+    rank();
+
+    // gRPC takes its deadlines on the system clock, latencies are on the steady one
+    using SystemClock = std::chrono::system_clock;
+    const SystemClock::time_point deadline = SystemClock::now() + deadline_;
+    std::array<Call, 2> calls;
+    size_t started = 0;
+    size_t pending = 0;
+
+    auto startCall = [&](Endpoint* endpoint){
+        Call& call = calls[started++];
+        call.endpoint = endpoint;
+        call.start = Clock::now();
+        call.context.set_deadline(deadline);
+        call.reader = endpoint->stub->AsyncSendStats(&call.context, stats, &queue_);
+        call.reader->Finish(&call.reply, &call.status, &call);
+        pending++;
+    };
+
+    startCall(ranked_[0]);
+    const SystemClock::time_point hedgeAt = SystemClock::now() + hedgeBudget(*ranked_[0]);
+    // ranked healthy first, a runner-up that is backed off would only take another failed call
+    const bool canHedge = ranked_.size() > 1 && ranked_[1]->healthy(Clock::now());
+
+    bool delivered = false;
+    while(pending)
+    {
+        void* tag;
+        bool ok;
+        const bool hedgePending = canHedge && started < calls.size();
+        const grpc::CompletionQueue::NextStatus status = queue_.AsyncNext(&tag, &ok, hedgePending ? hedgeAt : deadline + std::chrono::seconds(1));
+        if(status == grpc::CompletionQueue::SHUTDOWN)
+            break;
+
+        if(status == grpc::CompletionQueue::TIMEOUT)
+        {
+            if(hedgePending)
+                startCall(ranked_[1]);
+            continue;
+        }
+
+        pending--;
+        Call& call = *static_cast<Call*>(tag);
+        const Clock::time_point now = Clock::now();
+        if(call.status.ok())
+        {
+            call.endpoint->succeeded(now - call.start);
+            if(!delivered)
+            {
+                delivered = true;
+                reply.Swap(&call.reply);
+                // the other one is not needed anymore, its completion still has to be drained
+                for(size_t idx = 0 ; idx < started ; idx++)
+                    if(&calls[idx] != &call)
+                        calls[idx].context.TryCancel();
+            }
+        }
+        else if(delivered && call.status.error_code() == grpc::StatusCode::CANCELLED)
+        {
+            // lost the race, it took at least as long as the winner let it run
+            call.endpoint->answered(now - call.start);
+        }
+        else
+        {
+            call.endpoint->failed(now);
+            // fail over right away instead of waiting for the hedge
+            if(!delivered && hedgePending)
+                startCall(ranked_[1]);
+        }
+    }
+
+    return delivered;
+}
+
+bool EndpointSet::send(const mcproto::StatsBatch& batch, mcproto::StatsReply& reply)
+{
+    rank();
+
+    Endpoint& endpoint = *ranked_.front();
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + deadline_);
+    const grpc::Status status = endpoint.stub->SendStatsBatch(&context, batch, &reply);
+    if(!status.ok())
+        endpoint.failed(Clock::now());
+    return status.ok();
+}
+
+bool EndpointSet::send(const mcproto::Inventory& inventory)
+{
+    bool delivered = false;
+    const Clock::time_point now = Clock::now();
+    for(Endpoint& endpoint : endpoints_)
+    {
+        if(!endpoint.healthy(now))
+            continue;
+        grpc::ClientContext context;
+        context.set_deadline(std::chrono::system_clock::now() + deadline_);
+        mcproto::InventoryReply reply;
+        const grpc::Status status = endpoint.stub->SendInventory(&context, inventory, &reply);
+        if(status.ok())
+            delivered = true;
+        else
+            endpoint.failed(Clock::now());
+    }
+    return delivered;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <mcproto/infoupdate.grpc.pb.h>
+
+#include <grpcpp/channel.h>
+#include <grpcpp/completion_queue.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// The servers a client reports to, each with a channel that is kept connected. A report goes
+/// to the healthy server that answered fastest lately and is hedged to a healthy runner-up when the
+/// first one takes longer than its own 95th percentile, so a server that hangs costs a report
+/// its p95 instead of the whole deadline.
+class EndpointSet
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Endpoint
+    {
+        std::string address;
+        std::shared_ptr<grpc::Channel> channel;
+        std::unique_ptr<mcproto::InfoUpdate::Stub> stub;
+        // round trips of the last answered calls, in us
+        std::array<uint32_t, 64> latencies{};
+        size_t latencyCount = 0;
+        uint32_t failures = 0;
+        Clock::time_point retryAt;
+
+        void answered(Clock::duration latency);
+        void succeeded(Clock::duration latency);
+        void failed(Clock::time_point now);
+        bool healthy(Clock::time_point now) const { return now >= retryAt; }
+        /// 0 before there are enough calls to go by
+        uint32_t p95Us() const;
+        /// 0 before the first call
+        uint32_t medianUs() const;
+    };
+
+    struct Call;
+
+    std::vector<Endpoint> endpoints_;
+    std::vector<Endpoint*> ranked_;
+    grpc::CompletionQueue queue_;
+    std::chrono::milliseconds deadline_;
+
+    void rank();
+    Clock::duration hedgeBudget(const Endpoint& endpoint) const;
+
+public:
+    /// addresses are host:port, deadlineMs bounds every call
+    EndpointSet(const std::vector<std::string>& addresses, uint32_t deadlineMs = 2000);
+    ~EndpointSet();
+    EndpointSet(const EndpointSet&) = delete;
+    EndpointSet& operator=(const EndpointSet&) = delete;
+
+    /// hedged, false when no server answered within the deadline
+    bool send(const mcproto::Stats& stats, mcproto::StatsReply& reply);
+    /// goes to the preferred server only, a replay can as well wait for the next tick
+    bool send(const mcproto::StatsBatch& batch, mcproto::StatsReply& reply);
+    /// to every healthy server, reports may go to any of them. False when none took it
+    bool send(const mcproto::Inventory& inventory);
+
+    /// address the next report goes to first
+    const std::string& preferred();
+};
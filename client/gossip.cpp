@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "gossip.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    // type, entry count, 2 spare, sequence number, target ip and port, 2 spare
+    constexpr size_t headerSize = 16;
+    // id, ip, port, state, ram, incarnation, version, cpu load, bandwidth, pressure, 3 spare
+    constexpr size_t entrySize = 32;
+    constexpr uint32_t maxEntries = (GossipNode::maxMessageSize - headerSize) / entrySize;
+    static_assert(GossipNode::maxQueryResults <= maxEntries);
+
+    // a member alone in its group asks its seeds again after that many periods
+    constexpr int rejoinPeriods = 5;
+
+    // older ones are dropped first when more members change than the gossip can carry
+    constexpr size_t maxPendingUpdates = 1024;
+
+    // little endian on the wire whatever the host
+    void put16(char* out, uint16_t value)
+    {
+        out[0] = char(value);
+        out[1] = char(value >> 8);
+    }
+
+    void put32(char* out, uint32_t value)
+    {
+        for(int idx = 0 ; idx < 4 ; idx++)
+            out[idx] = char(value >> (8 * idx));
+    }
+
+    uint16_t get16(const char* in)
+    {
+        return uint16_t(uint8_t(in[0]) | uint8_t(in[1]) << 8);
+    }
+
+    uint32_t get32(const char* in)
+    {
+        uint32_t value = 0;
+        for(int idx = 0 ; idx < 4 ; idx++)
+            value |= uint32_t(uint8_t(in[idx])) << (8 * idx);
+        return value;
+    }
+
+    void putHeader(char* out, uint8_t type, uint8_t count, uint32_t seq, const GossipAddress& target)
+    {
+        memset(out, 0, headerSize);
+        out[0] = char(type);
+        out[1] = char(count);
+        put32(out + 4, seq);
+        put32(out + 8, target.ip);
+        put16(out + 12, target.port);
+    }
+
+    void putEntry(char* out, const GossipNode::Member& member)
+    {
+        memset(out, 0, entrySize);
+        put32(out, member.id);
+        put32(out + 4, member.address.ip);
+        put16(out + 8, member.address.port);
+        out[10] = char(member.state);
+        out[11] = char(member.load.ramAvailablePercent);
+        put32(out + 12, member.incarnation);
+        put32(out + 16, member.version);
+        put32(out + 20, member.load.cpuLoad);
+        put32(out + 24, member.load.bandwidthUsage);
+        out[28] = char(member.load.pressure);
+    }
+
+    bool getEntry(const char* in, GossipNode::Member& member)
+    {
+        if(uint8_t(in[10]) > uint8_t(GossipNode::State::Dead))
+            return false;
+        member.id = get32(in);
+        member.address.ip = get32(in + 4);
+        member.address.port = get16(in + 8);
+        member.state = GossipNode::State(in[10]);
+        member.load.ramAvailablePercent = uint8_t(in[11]);
+        member.incarnation = get32(in + 12);
+        member.version = get32(in + 16);
+        member.load.cpuLoad = get32(in + 20);
+        member.load.bandwidthUsage = get32(in + 24);
+        member.load.pressure = uint8_t(in[28]);
+        return true;
+    }
+
+    bool alive(const GossipNode::Member& member)
+    {
+        return member.state != GossipNode::State::Dead;
+    }
+}
+
+GossipNode::GossipNode(uint32_t id, GossipAddress address, GossipTransport& transport, Config config, uint64_t seed):
+    self_{id, address, State::Alive, 0, 0, {}, {}},
+    transport_(transport),
+    config_(config),
+    random_(seed ? seed : id),
+    probeNext_(0),
+    probe_{},
+    nextProbe_(),
+    nextJoin_(),
+    nextSync_(),
+    seq_(0),
+    bytesSent_(0)
+{
+    config_.piggyback = std::min(config_.piggyback, maxEntries - 1);
+    updates_.reserve(maxPendingUpdates + maxEntries);
+}
+
+float GossipNode::score(const LoadDigest& load)
+{
+    // the weights of the server's ranking, for what a digest carries
+    const float cpuIdlePercent = 100.f - std::min(10000u, load.cpuLoad) / 100.f;
+    const float bandwidthMb = std::min(100.f, load.bandwidthUsage / (1000.f * 1000.f));
+    const float headroom = 0.5f * cpuIdlePercent + 0.35f * std::min<uint8_t>(100, load.ramAvailablePercent) + 0.15f * (100.f - bandwidthMb);
+    return headroom * (1.f - std::min<uint8_t>(100, load.pressure) / 100.f);
+}
+
+const GossipNode::Member* GossipNode::member(uint32_t id) const
+{
+    auto iter = index_.find(id);
+    return iter != index_.end() ? &members_[iter->second] : nullptr;
+}
+
+GossipNode::Member* GossipNode::find(uint32_t id)
+{
+    auto iter = index_.find(id);
+    return iter != index_.end() ? &members_[iter->second] : nullptr;
+}
+
+size_t GossipNode::aliveCount() const
+{
+    return std::count_if(members_.begin(), members_.end(), alive);
+}
+
+void GossipNode::best(size_t count, std::vector<const Member*>& result) const
+{
+    result.clear();
+    result.push_back(&self_);
+    for(const Member& member : members_)
+        if(member.state == State::Alive)
+            result.push_back(&member);
+
+    count = std::min(count, result.size());
+    std::partial_sort(result.begin(), result.begin() + count, result.end(), [](const Member* lhs, const Member* rhs) {
+        return score(lhs->load) > score(rhs->load);
+    });
+    result.resize(count);
+}
+
+void GossipNode::join(const GossipAddress& seed, Clock::time_point now)
+{
+    if(std::find(seeds_.begin(), seeds_.end(), seed) == seeds_.end())
+        seeds_.push_back(seed);
+    nextJoin_ = now + config_.period * rejoinPeriods;
+    send(Type::Ping, ++seq_, seed);
+}
+
+void GossipNode::setLoad(const LoadDigest& load)
+{
+    // the own entry leads every message, the others pass it on from there
+    self_.load = load;
+    self_.version++;
+}
+
+void GossipNode::enqueue(uint32_t id)
+{
+    const uint32_t transmits = config_.retransmitMultiplier * uint32_t(std::ceil(std::log2(members_.size() + 2)));
+    for(Update& update : updates_)
+        if(update.id == id)
+        {
+            update.transmitsLeft = transmits;
+            return;
+        }
+
+    if(updates_.size() >= maxPendingUpdates)
+    {
+        auto oldest = std::min_element(updates_.begin(), updates_.end(), [](const Update& lhs, const Update& rhs) {
+            return lhs.transmitsLeft < rhs.transmitsLeft;
+        });
+        updates_.erase(oldest);
+    }
+    updates_.push_back({id, transmits});
+}
+
+void GossipNode::suspect(Member& member, Clock::time_point now)
+{
+    if(member.state != State::Alive)
+        return;
+    member.state = State::Suspect;
+    member.changedAt = now;
+    suspects_.push_back(member.id);
+    enqueue(member.id);
+}
+
+void GossipNode::merge(const Member& entry, Clock::time_point now)
+{
+    if(entry.id == self_.id)
+    {
+        // refuted by outliving the rumour, the next message carries the new incarnation
+        if(entry.state != State::Alive && entry.incarnation >= self_.incarnation)
+            self_.incarnation = entry.incarnation + 1;
+        return;
+    }
+
+    Member* member = find(entry.id);
+    if(!member)
+    {
+        if(entry.state == State::Dead)
+            return;
+        index_.emplace(entry.id, members_.size());
+        members_.push_back(entry);
+        members_.back().changedAt = now;
+        // joins the probe round at a random place so new members are not all probed last
+        std::uniform_int_distribution<size_t> position(0, probeOrder_.size());
+        probeOrder_.insert(probeOrder_.begin() + position(random_), entry.id);
+        enqueue(entry.id);
+        return;
+    }
+
+    bool changed = false;
+    // the load is only ever updated by the member itself, the latest version is the latest load
+    if(entry.version > member->version)
+    {
+        member->version = entry.version;
+        member->load = entry.load;
+        changed = true;
+    }
+
+    // a higher incarnation overrides any state, at the same one dead beats suspect beats alive
+    if(entry.incarnation > member->incarnation || (entry.incarnation == member->incarnation && entry.state > member->state))
+    {
+        if(entry.state != member->state)
+            member->changedAt = now;
+        member->address = entry.address;
+        if(entry.state == State::Suspect && member->state != State::Suspect)
+            suspects_.push_back(entry.id);
+        member->incarnation = entry.incarnation;
+        member->state = entry.state;
+        changed = true;
+    }
+
+    if(changed)
+        enqueue(entry.id);
+}
+
+void GossipNode::send(Type type, uint32_t seq, const GossipAddress& to, const GossipAddress& target, const Member* recipient)
+{
+    char* out = buffer_ + headerSize;
+    putEntry(out, self_);
+    out += entrySize;
+    uint32_t count = 1;
+
+    // a member still around while suspected or declared dead hears so first hand and refutes
+    if(recipient && recipient->state != State::Alive)
+    {
+        putEntry(out, *recipient);
+        out += entrySize;
+        count++;
+    }
+    else
+        recipient = nullptr;
+
+    // the updates passed on the least often so far go first
+    std::sort(updates_.begin(), updates_.end(), [](const Update& lhs, const Update& rhs) {
+        return lhs.transmitsLeft > rhs.transmitsLeft;
+    });
+    for(Update& update : updates_)
+    {
+        if(count > config_.piggyback)
+            break;
+        const Member* member = this->member(update.id);
+        if(!member || member == recipient)
+            continue;
+        putEntry(out, *member);
+        out += entrySize;
+        update.transmitsLeft--;
+        count++;
+    }
+    updates_.erase(std::remove_if(updates_.begin(), updates_.end(), [](const Update& update) {
+        return !update.transmitsLeft;
+    }), updates_.end());
+
+    putHeader(buffer_, uint8_t(type), uint8_t(count), seq, target);
+    transport_.send(to, buffer_, out - buffer_);
+    bytesSent_ += out - buffer_;
+}
+
+void GossipNode::receive(const char* data, size_t size, const GossipAddress& from, Clock::time_point now)
+{
+    if(size < headerSize)
+        return;
+    const Type type = Type(data[0]);
+    const uint32_t count = uint8_t(data[1]);
+    const uint32_t seq = get32(data + 4);
+    const GossipAddress target{get32(data + 8), get16(data + 12)};
+
+    if(type == Type::Query)
+    {
+        // a router on the node, answered from the table without going onto the network
+        std::vector<const Member*> ranked;
+        best(std::min(seq, maxQueryResults), ranked);
+        char* out = buffer_ + headerSize;
+        for(const Member* member : ranked)
+        {
+            putEntry(out, *member);
+            out += entrySize;
+        }
+        putHeader(buffer_, uint8_t(Type::Table), uint8_t(ranked.size()), 0, {});
+        transport_.send(from, buffer_, out - buffer_);
+        return;
+    }
+
+    if(type < Type::Ping || type == Type::Query || type == Type::Table || type > Type::Sync || !count || size < headerSize + count * entrySize)
+        return;
+
+    const uint32_t senderId = get32(data + headerSize);
+    const bool stranger = senderId != self_.id && !member(senderId);
+    Member entry;
+    for(uint32_t idx = 0 ; idx < count ; idx++)
+    {
+        if(!getEntry(data + headerSize + idx * entrySize, entry))
+            return;
+        // the sender cannot know the address it is seen under behind NAT or bound to any address
+        if(!idx)
+            entry.address = from;
+        merge(entry, now);
+    }
+
+    switch(type)
+    {
+    case Type::Ping:
+        send(Type::Ack, seq, from, {}, member(senderId));
+        if(stranger)
+            sync(from, false);
+        break;
+    case Type::Sync:
+        // the first datagram of a table sent by anti-entropy asks for ours in return
+        if(seq)
+            sync(from, false);
+        break;
+    case Type::PingReq:
+        relays_.push_back({++seq_, seq, from, now});
+        send(Type::Ping, seq_, target);
+        break;
+    case Type::Ack:
+        if(probe_.active && seq == probe_.seq)
+        {
+            probe_.acked = true;
+            probe_.active = false;
+            break;
+        }
+        for(auto relay = relays_.begin() ; relay != relays_.end() ; ++relay)
+            if(relay->seq == seq)
+            {
+                send(Type::Ack, relay->originalSeq, relay->requester);
+                relays_.erase(relay);
+                break;
+            }
+        break;
+    default:
+        break;
+    }
+}
+
+void GossipNode::sync(const GossipAddress& to, bool pull)
+{
+    // a member joining learns the whole table at once instead of one rumour after the other.
+    // Rumours only go out a few times and more members changing at once than the piggybacked
+    // updates can carry, a rollout, drops some of them; the occasional exchange of the whole
+    // table with a random member makes up for those
+    putEntry(buffer_ + headerSize, self_);
+    uint32_t count = 1;
+    auto flush = [&]{
+        putHeader(buffer_, uint8_t(Type::Sync), uint8_t(count), pull, {});
+        pull = false;
+        transport_.send(to, buffer_, headerSize + count * entrySize);
+        bytesSent_ += headerSize + count * entrySize;
+        count = 1;
+    };
+
+    for(const Member& member : members_)
+    {
+        if(!alive(member) || member.address == to)
+            continue;
+        putEntry(buffer_ + headerSize + count * entrySize, member);
+        if(++count == maxEntries)
+            flush();
+    }
+    if(count > 1)
+        flush();
+}
+
+uint32_t GossipNode::nextTarget()
+{
+    // a shuffled round robin, every member is probed within one round and in no fixed order
+    for(size_t tries = 0 ; tries < probeOrder_.size() ; tries++)
+    {
+        if(probeNext_ >= probeOrder_.size())
+        {
+            probeOrder_.erase(std::remove_if(probeOrder_.begin(), probeOrder_.end(), [this](uint32_t id) {
+                const Member* member = this->member(id);
+                return !member || !alive(*member);
+            }), probeOrder_.end());
+            std::shuffle(probeOrder_.begin(), probeOrder_.end(), random_);
+            probeNext_ = 0;
+            if(probeOrder_.empty())
+                break;
+        }
+        const Member* member = this->member(probeOrder_[probeNext_++]);
+        if(member && alive(*member))
+            return member->id;
+    }
+    return 0;
+}
+
+void GossipNode::tick(Clock::time_point now)
+{
+    if(nextProbe_ == Clock::time_point())
+        nextProbe_ = now + config_.period;
+
+    if(config_.syncInterval.count() && now >= nextSync_)
+    {
+        if(nextSync_ != Clock::time_point())
+        {
+            std::vector<const Member*> peers;
+            for(const Member& member : members_)
+                if(member.state == State::Alive)
+                    peers.push_back(&member);
+            if(!peers.empty())
+                sync(peers[std::uniform_int_distribution<size_t>(0, peers.size() - 1)(random_)]->address, true);
+            nextSync_ = now + config_.syncInterval;
+        }
+        else
+        {
+            // spread over the interval, members started together do not exchange tables together
+            nextSync_ = now + std::chrono::milliseconds(std::uniform_int_distribution<int64_t>(1, config_.syncInterval.count())(random_));
+        }
+    }
+
+    // the join ping or its answer got lost or the seed was not up yet, or everyone else is gone
+    if(!seeds_.empty() && now >= nextJoin_ && !aliveCount())
+        for(const GossipAddress& seed : std::vector<GossipAddress>(seeds_))
+            join(seed, now);
+
+    // the rumour takes longer to reach the suspect in a larger group, it gets longer to refute
+    const auto suspicionTimeout = config_.suspicionTimeout * std::max(1., std::log10(members_.size() + 1));
+    suspects_.erase(std::remove_if(suspects_.begin(), suspects_.end(), [&](uint32_t id) {
+        Member* member = find(id);
+        if(!member || member->state != State::Suspect)
+            return true;
+        if(now - member->changedAt < suspicionTimeout)
+            return false;
+        member->state = State::Dead;
+        member->changedAt = now;
+        enqueue(id);
+        return true;
+    }), suspects_.end());
+    relays_.erase(std::remove_if(relays_.begin(), relays_.end(), [&](const Relay& relay) {
+        return now - relay.since >= config_.period;
+    }), relays_.end());
+
+    if(probe_.active)
+    {
+        Member* target = find(probe_.target);
+        if(!target || !alive(*target))
+            probe_.active = false;
+        else if(!probe_.indirectSent && now - probe_.sentAt >= config_.pingTimeout)
+        {
+            // someone else may still get through, a lossy path between two members is not a failure
+            probe_.indirectSent = true;
+            std::vector<const Member*> helpers;
+            for(const Member& member : members_)
+                if(member.state == State::Alive && member.id != probe_.target)
+                    helpers.push_back(&member);
+            const size_t count = std::min<size_t>(config_.indirectProbes, helpers.size());
+            for(size_t idx = 0 ; idx < count ; idx++)
+            {
+                std::uniform_int_distribution<size_t> pick(idx, helpers.size() - 1);
+                std::swap(helpers[idx], helpers[pick(random_)]);
+                send(Type::PingReq, probe_.seq, helpers[idx]->address, target->address);
+            }
+        }
+        else if(now >= nextProbe_)
+        {
+            suspect(*target, now);
+            probe_.active = false;
+        }
+    }
+
+    if(now < nextProbe_)
+        return;
+    nextProbe_ = now + config_.period;
+
+    const uint32_t target = nextTarget();
+    const Member* member = target ? this->member(target) : nullptr;
+    if(!member)
+        return;
+    probe_ = {target, ++seq_, now, false, false, true};
+    send(Type::Ping, probe_.seq, member->address, {}, member);
+}
+
+size_t GossipNode::encodeQuery(char* buffer, uint32_t count)
+{
+    putHeader(buffer, uint8_t(Type::Query), 0, std::min(count, maxQueryResults), {});
+    return headerSize;
+}
+
+bool GossipNode::decodeTable(const char* data, size_t size, std::vector<Member>& members)
+{
+    members.clear();
+    if(size < headerSize || Type(data[0]) != Type::Table)
+        return false;
+    const uint32_t count = uint8_t(data[1]);
+    if(size < headerSize + count * entrySize)
+        return false;
+
+    Member entry{};
+    for(uint32_t idx = 0 ; idx < count ; idx++)
+        if(getEntry(data + headerSize + idx * entrySize, entry))
+            members.push_back(entry);
+    return true;
+}
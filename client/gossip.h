@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+struct GossipAddress
+{
+    uint32_t ip = 0;        // host byte order
+    uint16_t port = 0;
+
+    bool operator==(const GossipAddress& other) const { return ip == other.ip && port == other.port; }
+};
+
+/// the load a node gossips about itself, in the units of mcproto::Stats
+struct LoadDigest
+{
+    uint32_t cpuLoad = 0;               // 1/100th of a percent
+    uint32_t bandwidthUsage = 0;        // bytes/sec
+    uint8_t ramAvailablePercent = 0;
+    uint8_t pressure = 0;               // highest avg10 stall percentage
+};
+
+/// protocol timings, the defaults suit a datacenter network
+struct GossipConfig
+{
+    std::chrono::milliseconds period{200};
+    std::chrono::milliseconds pingTimeout{60};
+    uint32_t indirectProbes = 3;
+    // scaled by log10 of the group size
+    std::chrono::milliseconds suspicionTimeout{1000};
+    // updates per message besides the sender itself
+    uint32_t piggyback = 6;
+    // an update is passed on retransmitMultiplier * log2(n) times
+    uint32_t retransmitMultiplier = 4;
+    // the whole table is exchanged with a random member that often, 0 never
+    std::chrono::milliseconds syncInterval{10000};
+};
+
+class GossipTransport
+{
+public:
+    virtual ~GossipTransport() = default;
+    virtual void send(const GossipAddress& to, const char* data, size_t size) = 0;
+};
+
+/// One member of a SWIM style group (Das, Gupta, Motivala: "SWIM: Scalable Weakly-consistent
+/// Infection-style Process Group Membership Protocol"). Every protocol period a member pings
+/// another one, has k others ping it on its behalf when it does not answer in time and suspects
+/// it when none of them got an answer either. A suspect that does not refute in time is taken
+/// to be dead. Membership changes and load digests ride along on the pings and acks, every
+/// update is passed on a logarithmic number of times, so it reaches all n members in O(log n)
+/// periods at a constant number of bytes per member and period. A member joining gets the
+/// table of the one it joins through in full, and every now and then two members swap tables.
+///
+/// Not thread safe, driven by tick() and receive() from one thread.
+class GossipNode
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State : uint8_t { Alive, Suspect, Dead };
+
+    struct Member
+    {
+        uint32_t id;
+        GossipAddress address;
+        State state;
+        uint32_t incarnation;
+        uint32_t version;           // bumped with every load update of the member
+        LoadDigest load;
+        Clock::time_point changedAt;
+    };
+
+    using Config = GossipConfig;
+
+    /// the largest datagram sent
+    static constexpr size_t maxMessageSize = 512;
+    /// entries a query reply carries at most
+    static constexpr uint32_t maxQueryResults = 15;
+
+    GossipNode(uint32_t id, GossipAddress address, GossipTransport& transport, Config config = {}, uint64_t seed = 0);
+
+    /// contacts a member of the group, the rest of it is learned from there. Asked again as
+    /// long as no other member is known
+    void join(const GossipAddress& seed, Clock::time_point now = Clock::now());
+    void setLoad(const LoadDigest& load);
+
+    void receive(const char* data, size_t size, const GossipAddress& from, Clock::time_point now = Clock::now());
+    /// runs the failure detector, due every few ms at least
+    void tick(Clock::time_point now = Clock::now());
+
+    uint32_t id() const { return self_.id; }
+    const Member& self() const { return self_; }
+    /// other members, dead ones included
+    const std::vector<Member>& members() const { return members_; }
+    const Member* member(uint32_t id) const;
+    size_t aliveCount() const;
+    /// the k alive members, this one included, with the most headroom
+    void best(size_t count, std::vector<const Member*>& result) const;
+    uint64_t bytesSent() const { return bytesSent_; }
+
+    /// higher is better
+    static float score(const LoadDigest& load);
+
+    /// a datagram a local router sends to ask for the count best members, answered with a
+    /// table of entries in the same format as the gossip itself
+    static size_t encodeQuery(char* buffer, uint32_t count);
+    /// false when data is not a reply to a query
+    static bool decodeTable(const char* data, size_t size, std::vector<Member>& members);
+
+private:
+    enum class Type : uint8_t { Ping = 1, Ack, PingReq, Query, Table, Sync };
+
+    struct Update
+    {
+        uint32_t id;
+        uint32_t transmitsLeft;
+    };
+
+    struct Probe
+    {
+        uint32_t target;
+        uint32_t seq;
+        Clock::time_point sentAt;
+        bool indirectSent;
+        bool acked;
+        bool active;
+    };
+
+    struct Relay
+    {
+        uint32_t seq;
+        uint32_t originalSeq;
+        GossipAddress requester;
+        Clock::time_point since;
+    };
+
+    Member self_;
+    GossipTransport& transport_;
+    Config config_;
+    std::mt19937_64 random_;
+    std::vector<Member> members_;
+    std::unordered_map<uint32_t, size_t> index_;
+    std::vector<Update> updates_;
+    std::vector<Relay> relays_;
+    std::vector<uint32_t> suspects_;
+    std::vector<uint32_t> probeOrder_;
+    size_t probeNext_;
+    Probe probe_;
+    Clock::time_point nextProbe_;
+    std::vector<GossipAddress> seeds_;
+    Clock::time_point nextJoin_;
+    Clock::time_point nextSync_;
+    uint32_t seq_;
+    uint64_t bytesSent_;
+    char buffer_[maxMessageSize];
+
+    Member* find(uint32_t id);
+    void enqueue(uint32_t id);
+    void merge(const Member& entry, Clock::time_point now);
+    void suspect(Member& member, Clock::time_point now);
+    void sync(const GossipAddress& to, bool pull);
+    void send(Type type, uint32_t seq, const GossipAddress& to, const GossipAddress& target = {}, const Member* recipient = nullptr);
+    uint32_t nextTarget();
+};
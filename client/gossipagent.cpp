@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "gossipagent.h"
+#include "ipv4address.h"
+#include "snapshotpublisher.h"
+
+#include <arpa/inet.h>
+#include <climits>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+    // the failure detector needs to look at its timers a few times per ping timeout
+    constexpr int pollTimeoutMs = 10;
+
+    int bindSocket(uint16_t port)
+    {
+        const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if(fd == -1)
+            throw std::system_error(std::error_code(errno, std::system_category()), "cannot create gossip socket");
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if(bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+        {
+            std::system_error error(std::error_code(errno, std::system_category()), "cannot bind gossip port " + std::to_string(port));
+            close(fd);
+            throw error;
+        }
+        return fd;
+    }
+
+    uint16_t boundPort(int fd)
+    {
+        sockaddr_in address{};
+        socklen_t size = sizeof(address);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size);
+        return ntohs(address.sin_port);
+    }
+
+    std::string hostname()
+    {
+        char name[HOST_NAME_MAX + 1] = {};
+        gethostname(name, sizeof(name));
+        return name;
+    }
+
+    LoadDigest digest(const mcproto::Stats& stats)
+    {
+        const StatsSnapshot snapshot = SnapshotPublisher::snapshot(stats);
+        LoadDigest load;
+        load.cpuLoad = snapshot.cpuLoad;
+        load.bandwidthUsage = snapshot.bandwidthUsage;
+        load.ramAvailablePercent = uint8_t(std::min(100u, snapshot.availableRamPercent));
+        const float pressure = std::max({snapshot.cpuPressure, snapshot.memoryPressure, snapshot.ioPressure, 0.f});
+        load.pressure = uint8_t(std::min(100.f, pressure));
+        return load;
+    }
+}
+
+uint32_t GossipAgent::nodeId(const std::string& hostname, uint16_t port)
+{
+    uint32_t hash = 2166136261u;
+    for(char c : hostname + ':' + std::to_string(port))
+    {
+        hash ^= uint8_t(c);
+        hash *= 16777619u;
+    }
+    // 0 stands for no member
+    return hash ? hash : 1;
+}
+
+GossipAddress GossipAgent::resolve(const std::string& hostPort)
+{
+    const sockaddr_in address = Ipv4Address::resolve(hostPort);
+    return {ntohl(address.sin_addr.s_addr), ntohs(address.sin_port)};
+}
+
+GossipAgent::GossipAgent(uint16_t port, const std::vector<std::string>& seeds, GossipNode::Config config):
+    socket_(bindSocket(port)),
+    port_(boundPort(socket_)),
+    node_(nodeId(hostname(), port_), {0, port_}, *this, config),
+    load_{},
+    loadChanged_(false),
+    stop_(false)
+{
+    try
+    {
+        for(const std::string& seed : seeds)
+            seeds_.push_back(resolve(seed));
+    }
+    catch(...)
+    {
+        close(socket_);
+        throw;
+    }
+    thread_ = std::thread(&GossipAgent::run, this);
+}
+
+GossipAgent::~GossipAgent()
+{
+    stop_ = true;
+    thread_.join();
+    close(socket_);
+}
+
+void GossipAgent::publish(const mcproto::Stats& stats)
+{
+    const LoadDigest load = digest(stats);
+    std::lock_guard<std::mutex> lock(loadMutex_);
+    load_ = load;
+    loadChanged_ = true;
+}
+
+void GossipAgent::send(const GossipAddress& to, const char* data, size_t size)
+{
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    // our own entry goes out without an address, a router on the node asks over loopback
+    address.sin_addr.s_addr = htonl(to.ip ? to.ip : INADDR_LOOPBACK);
+    address.sin_port = htons(to.port);
+    // a full socket buffer loses the datagram like the network would, the protocol copes
+    sendto(socket_, data, size, MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+}
+
+void GossipAgent::run()
+{
+    char buffer[GossipNode::maxMessageSize];
+    pollfd pfd{socket_, POLLIN, 0};
+    for(const GossipAddress& seed : seeds_)
+        node_.join(seed);
+
+    while(!stop_)
+    {
+        if(poll(&pfd, 1, pollTimeoutMs) > 0)
+        {
+            sockaddr_in from{};
+            socklen_t fromSize = sizeof(from);
+            ssize_t size;
+            while((size = recvfrom(socket_, buffer, sizeof(buffer), MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&from), &fromSize)) >= 0)
+            {
+                node_.receive(buffer, size, {ntohl(from.sin_addr.s_addr), ntohs(from.sin_port)});
+                fromSize = sizeof(from);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(loadMutex_);
+            if(loadChanged_)
+            {
+                node_.setLoad(load_);
+                loadChanged_ = false;
+            }
+        }
+        node_.tick();
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include "gossip.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mcproto
+{
+    class Stats;
+}
+
+/// Runs a GossipNode on a UDP port in a thread of its own. The runloop hands every sample over
+/// with publish(), the thread turns it into a digest and gossips it on. A router on the node
+/// sends GossipNode::encodeQuery() to the same port and gets the best nodes of the cluster back.
+class GossipAgent: private GossipTransport
+{
+public:
+    /// seeds are host:port of members already in the group, none starts a new one. Port 0 takes
+    /// any free one. Throws std::system_error when the port cannot be bound
+    GossipAgent(uint16_t port, const std::vector<std::string>& seeds, GossipNode::Config config = {});
+    ~GossipAgent();
+
+    void publish(const mcproto::Stats& stats);
+    uint16_t port() const { return port_; }
+
+    /// FNV-1a of host:port, stable across restarts of the same member
+    static uint32_t nodeId(const std::string& hostname, uint16_t port);
+    /// throws std::invalid_argument for addresses that do not resolve to IPv4
+    static GossipAddress resolve(const std::string& hostPort);
+
+private:
+    int socket_;
+    uint16_t port_;
+    std::vector<GossipAddress> seeds_;
+    GossipNode node_;
+    std::mutex loadMutex_;
+    LoadDigest load_;
+    bool loadChanged_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+
+    void send(const GossipAddress& to, const char* data, size_t size) override;
+    void run();
+};
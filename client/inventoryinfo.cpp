@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "inventoryinfo.h"
+
+#include <sys/sysinfo.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+    bool readLine(const std::filesystem::path& path, std::string& line)
+    {
+        std::ifstream file(path);
+        return bool(std::getline(file, line));
+    }
+
+    bool readNumber(const std::filesystem::path& path, int64_t& number)
+    {
+        std::ifstream file(path);
+        return bool(file >> number);
+    }
+
+    /// the MemTotal of a NUMA node's meminfo, "Node 0 MemTotal:       16337556 kB"
+    uint64_t nodeMemoryMb(const std::filesystem::path& meminfo)
+    {
+        std::ifstream file(meminfo);
+        std::string line;
+        while(std::getline(file, line))
+        {
+            const size_t position = line.find("MemTotal:");
+            if(position != std::string::npos)
+                return std::strtoull(line.c_str() + position + strlen("MemTotal:"), nullptr, 10) / 1024;
+        }
+        return 0;
+    }
+
+    /// by name, for the same inventory on every run
+    std::vector<std::filesystem::path> entries(const std::filesystem::path& directory)
+    {
+        std::vector<std::filesystem::path> paths;
+        std::error_code error;
+        for(std::filesystem::directory_iterator entry(directory, error), end ; !error && entry != end ; entry.increment(error))
+            paths.push_back(entry->path());
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+}
+
+InventoryInfo::InventoryInfo(const char* sysfs):
+    sysfs_(sysfs)
+{
+}
+
+uint32_t InventoryInfo::countCpus(const std::string& list)
+{
+    uint32_t count = 0;
+    std::istringstream ranges(list);
+    std::string range;
+    while(std::getline(ranges, range, ','))
+    {
+        char* end;
+        const unsigned long first = std::strtoul(range.c_str(), &end, 10);
+        if(end == range.c_str())
+            continue;
+        const unsigned long last = *end == '-' ? std::strtoul(end + 1, nullptr, 10) : first;
+        if(last >= first)
+            count += uint32_t(last - first + 1);
+    }
+    return count;
+}
+
+uint32_t InventoryInfo::cores() const
+{
+    std::string online;
+    if(readLine(sysfs_ + "/devices/system/cpu/online", online))
+        if(const uint32_t count = countCpus(online))
+            return count;
+    return uint32_t(std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)));
+}
+
+void InventoryInfo::get(mcproto::Inventory& inventory) const
+{
+    inventory.set_cores(cores());
+
+    for(const std::filesystem::path& node : entries(sysfs_ + "/devices/system/node"))
+    {
+        const std::string name = node.filename().string();
+        std::string cpus;
+        if(name.compare(0, 4, "node") || name.size() == 4 || !readLine(node / "cpulist", cpus))
+            continue;
+        mcproto::NumaNode* numaNode = inventory.add_numanodes();
+        numaNode->set_cpus(countCpus(cpus));
+        numaNode->set_memorymb(nodeMemoryMb(node / "meminfo"));
+    }
+
+    struct sysinfo info;
+    if(!sysinfo(&info))
+        inventory.set_ramtotalmb(uint64_t(info.totalram) * info.mem_unit / (1024 * 1024));
+
+    for(const std::filesystem::path& interface : entries(sysfs_ + "/class/net"))
+    {
+        // virtual interfaces have no device behind them, and no line rate worth the name
+        std::error_code error;
+        if(!std::filesystem::exists(interface / "device", error))
+            continue;
+        // the driver refuses the speed of an interface that is down
+        int64_t speedMbps;
+        if(!readNumber(interface / "speed", speedMbps) || speedMbps <= 0)
+            continue;
+        mcproto::Nic* nic = inventory.add_nics();
+        nic->set_name(interface.filename().string());
+        nic->set_speedmbps(uint32_t(speedMbps));
+    }
+
+    for(const std::filesystem::path& device : entries(sysfs_ + "/block"))
+    {
+        // /sys/block lists whole devices only, partitions are below them
+        const std::string name = device.filename().string();
+        if(!name.compare(0, 4, "loop") || !name.compare(0, 3, "ram") || !name.compare(0, 4, "zram"))
+            continue;
+        int64_t sectors;
+        if(!readNumber(device / "size", sectors) || sectors <= 0)
+            continue;
+        mcproto::Disk* disk = inventory.add_disks();
+        disk->set_name(name);
+        // in 512 byte sectors whatever the device's own, KB as the disk stats count them
+        disk->set_sizekb(uint64_t(sectors) * 512 / 1000);
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <mcproto/inventory.pb.h>
+
+#include <cstdint>
+#include <string>
+
+/// The hardware of the node, read once at startup from sysfs and sysinfo. The server weighs
+/// the percentages in the stats by it, a node with many cores half idle has more room than one
+/// with a few.
+class InventoryInfo
+{
+    std::string sysfs_;
+
+public:
+    InventoryInfo(const char* sysfs = "/sys");
+
+    /// online cpus, 1 at least
+    uint32_t cores() const;
+    /// physical interfaces with a known line rate, whole disks
+    void get(mcproto::Inventory& inventory) const;
+
+    /// cpus in a list like 0-3,8,10-11
+    static uint32_t countCpus(const std::string& list);
+};
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "ioring.h"
+#include "procfile.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+namespace
+{
+    int setup(unsigned entries, io_uring_params& params)
+    {
+        return int(syscall(__NR_io_uring_setup, entries, &params));
+    }
+
+    int enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+    {
+        return int(syscall(__NR_io_uring_enter, fd, submit, complete, flags, nullptr, 0));
+    }
+
+    int registerRing(int fd, unsigned opcode, const void* arguments, unsigned count)
+    {
+        return int(syscall(__NR_io_uring_register, fd, opcode, arguments, count));
+    }
+
+    void* map(int fd, size_t size, off_t offset)
+    {
+        void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if(address == MAP_FAILED)
+            throw std::system_error(std::error_code(errno, std::system_category()), "cannot map io_uring");
+        return address;
+    }
+
+    template <typename T>
+    T* at(void* ring, uint32_t offset)
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+}
+
+IoRing::IoRing(unsigned entries):
+    fd_(-1),
+    entries_(0),
+    sqRing_(nullptr),
+    sqRingSize_(0),
+    cqRing_(nullptr),
+    cqRingSize_(0),
+    sqes_(nullptr),
+    sqesSize_(0),
+    syscalls_(0),
+    filesRegistered_(false),
+    buffersRegistered_(false)
+{
+    io_uring_params params{};
+    fd_ = setup(entries, params);
+    if(fd_ == -1)
+        throw std::system_error(std::error_code(errno, std::system_category()), "cannot set up io_uring");
+
+    try
+    {
+        entries_ = params.sq_entries;
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        // one mapping for both rings since Linux 5.4
+        if(params.features & IORING_FEAT_SINGLE_MMAP)
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        sqRing_ = map(fd_, sqRingSize_, IORING_OFF_SQ_RING);
+        cqRing_ = params.features & IORING_FEAT_SINGLE_MMAP ? sqRing_ : map(fd_, cqRingSize_, IORING_OFF_CQ_RING);
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map(fd_, sqesSize_, IORING_OFF_SQES));
+    }
+    catch(...)
+    {
+        if(cqRing_ && cqRing_ != sqRing_)
+            munmap(cqRing_, cqRingSize_);
+        if(sqRing_)
+            munmap(sqRing_, sqRingSize_);
+        close(fd_);
+        throw;
+    }
+
+    // procfs and sysfs reads cannot be done without blocking, the kernel hands each one to a
+    // worker thread. One worker going through them in turn beats waking a thread per file
+    unsigned workers[2] = {1, 1};
+    registerRing(fd_, IORING_REGISTER_IOWQ_MAX_WORKERS, workers, 2);
+    syscalls_++;
+
+    sqHead_ = at<unsigned>(sqRing_, params.sq_off.head);
+    sqTail_ = at<unsigned>(sqRing_, params.sq_off.tail);
+    sqMask_ = *at<unsigned>(sqRing_, params.sq_off.ring_mask);
+    sqArray_ = at<unsigned>(sqRing_, params.sq_off.array);
+    cqHead_ = at<unsigned>(cqRing_, params.cq_off.head);
+    cqTail_ = at<unsigned>(cqRing_, params.cq_off.tail);
+    cqMask_ = *at<unsigned>(cqRing_, params.cq_off.ring_mask);
+    cqes_ = at<io_uring_cqe>(cqRing_, params.cq_off.cqes);
+}
+
+IoRing::~IoRing()
+{
+    munmap(sqes_, sqesSize_);
+    if(cqRing_ != sqRing_)
+        munmap(cqRing_, cqRingSize_);
+    munmap(sqRing_, sqRingSize_);
+    close(fd_);
+}
+
+void IoRing::registerFiles(const std::vector<ProcFile*>& files)
+{
+    bool filesChanged = !filesRegistered_ || fds_.size() != files.size();
+    bool buffersChanged = !buffersRegistered_ || buffers_.size() != files.size();
+    for(size_t idx = 0 ; idx < files.size() && !(filesChanged && buffersChanged) ; idx++)
+    {
+        filesChanged |= fds_[idx] != files[idx]->fd();
+        buffersChanged |= buffers_[idx].iov_base != files[idx]->buffer() || buffers_[idx].iov_len != files[idx]->capacity();
+    }
+
+    // registration is an optimisation, reads go by plain fd and address when the kernel refuses,
+    // e.g. for buffers beyond RLIMIT_MEMLOCK on kernels before 5.12
+    if(filesChanged)
+    {
+        if(filesRegistered_ && registerRing(fd_, IORING_UNREGISTER_FILES, nullptr, 0) != -1)
+            syscalls_++;
+        fds_.clear();
+        for(ProcFile* file : files)
+            fds_.push_back(file->fd());
+        filesRegistered_ = registerRing(fd_, IORING_REGISTER_FILES, fds_.data(), fds_.size()) != -1;
+        syscalls_++;
+    }
+
+    if(buffersChanged)
+    {
+        if(buffersRegistered_ && registerRing(fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0) != -1)
+            syscalls_++;
+        buffers_.clear();
+        for(ProcFile* file : files)
+            buffers_.push_back({file->buffer(), file->capacity()});
+        buffersRegistered_ = registerRing(fd_, IORING_REGISTER_BUFFERS, buffers_.data(), buffers_.size()) != -1;
+        syscalls_++;
+    }
+}
+
+void IoRing::read(const std::vector<ProcFile*>& files)
+{
+    // files that cannot be opened are left to read() to fail on
+    open_.clear();
+    for(ProcFile* file : files)
+        if(file->open())
+            open_.push_back(file);
+    if(open_.empty())
+        return;
+
+    registerFiles(open_);
+    for(size_t begin = 0 ; begin < open_.size() ; begin += entries_)
+        submit(open_, begin, std::min(open_.size(), begin + entries_));
+}
+
+void IoRing::submit(const std::vector<ProcFile*>& files, size_t begin, size_t end)
+{
+    unsigned tail = *sqTail_;
+    for(size_t idx = begin ; idx < end ; idx++)
+    {
+        const unsigned index = tail & sqMask_;
+        io_uring_sqe& sqe = sqes_[index];
+        sqe = {};
+        if(buffersRegistered_)
+        {
+            sqe.opcode = IORING_OP_READ_FIXED;
+            sqe.buf_index = uint16_t(idx);
+        }
+        else
+        {
+            sqe.opcode = IORING_OP_READ;
+        }
+        if(filesRegistered_)
+        {
+            sqe.fd = int(idx);
+            sqe.flags = IOSQE_FIXED_FILE;
+        }
+        else
+        {
+            sqe.fd = files[idx]->fd();
+        }
+        // procfs, sysfs and cgroupfs regenerate the content on a read from the start
+        sqe.off = 0;
+        sqe.addr = reinterpret_cast<uint64_t>(files[idx]->buffer());
+        sqe.len = uint32_t(files[idx]->capacity());
+        sqe.user_data = idx;
+        sqArray_[index] = index;
+        tail++;
+    }
+    __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+
+    const unsigned count = unsigned(end - begin);
+    unsigned completed = 0;
+    int submitted;
+    do
+    {
+        submitted = enter(fd_, count, count, IORING_ENTER_GETEVENTS);
+        syscalls_++;
+    }
+    while(submitted == -1 && errno == EINTR);
+
+    // what did not make it into the kernel is taken back, read() reads those files itself
+    if(submitted < int(count))
+        __atomic_store_n(sqTail_, *sqTail_ - (count - std::max(submitted, 0)), __ATOMIC_RELEASE);
+    const unsigned expected = std::max(submitted, 0);
+
+    while(completed < expected)
+    {
+        unsigned head = *cqHead_;
+        const unsigned available = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        for( ; head != available ; head++, completed++)
+        {
+            const io_uring_cqe& cqe = cqes_[head & cqMask_];
+            files[cqe.user_data]->prefetched(cqe.res);
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+        if(completed < expected)
+        {
+            // only when a completion was posted after the first wait returned
+            enter(fd_, 0, expected - completed, IORING_ENTER_GETEVENTS);
+            syscalls_++;
+        }
+    }
+}
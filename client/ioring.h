@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+#include <vector>
+
+class ProcFile;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/// Reads the files of a tick through io_uring, all of them submitted at once and waited for
+/// with the same io_uring_enter call, so a tick costs one syscall where it cost a pread per
+/// file. On a host under pressure each of those can stall the reporter exactly when its report
+/// matters most. The files and their buffers are registered with the ring and only registered
+/// again when one of them was reopened or grew, so the kernel does not look them up per read.
+///
+/// procfs, sysfs and cgroupfs cannot be read without blocking, so the kernel hands every read
+/// to a worker thread of the ring. The tick then waits on that worker instead of reading
+/// itself, which costs more CPU time than the syscalls it saves on an idle host. That is why
+/// the ring is opt-in.
+///
+/// Talks to the kernel through the raw syscalls, there is no liburing on every host. Not
+/// thread safe.
+class IoRing
+{
+public:
+    /// throws std::system_error when the kernel has no io_uring or it is not allowed, the
+    /// collectors read synchronously then
+    explicit IoRing(unsigned entries = 64);
+    ~IoRing();
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    /// reads every file from its start into its buffer, read() takes the content from there.
+    /// A file the ring could not read is left to read() to read synchronously
+    void read(const std::vector<ProcFile*>& files);
+    /// io_uring_enter and register calls made so far
+    uint64_t syscalls() const { return syscalls_; }
+
+private:
+    int fd_;
+    unsigned entries_;
+    void* sqRing_;
+    size_t sqRingSize_;
+    void* cqRing_;
+    size_t cqRingSize_;
+    io_uring_sqe* sqes_;
+    size_t sqesSize_;
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned sqMask_;
+    unsigned* sqArray_;
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned cqMask_;
+    io_uring_cqe* cqes_;
+    uint64_t syscalls_;
+
+    // the files of the current read that could be opened
+    std::vector<ProcFile*> open_;
+    // what is registered, by the index the reads refer to
+    std::vector<int> fds_;
+    std::vector<iovec> buffers_;
+    bool filesRegistered_;
+    bool buffersRegistered_;
+
+    void registerFiles(const std::vector<ProcFile*>& files);
+    /// submits files [begin, end) and waits for all of them
+    void submit(const std::vector<ProcFile*>& files, size_t begin, size_t end);
+};
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "ipv4address.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <stdexcept>
+
+sockaddr_in Ipv4Address::resolve(const std::string& hostPort)
+{
+    const size_t separator = hostPort.rfind(':');
+    if(separator == std::string::npos)
+        throw std::invalid_argument("expected host:port, got " + hostPort);
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* result = nullptr;
+    if(getaddrinfo(hostPort.substr(0, separator).c_str(), hostPort.c_str() + separator + 1, &hints, &result) || !result)
+        throw std::invalid_argument("cannot resolve " + hostPort);
+
+    const sockaddr_in resolved = *reinterpret_cast<const sockaddr_in*>(result->ai_addr);
+    freeaddrinfo(result);
+    return resolved;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <netinet/in.h>
+
+#include <string>
+
+/// Resolves host:port for the client's UDP transports, the datagram reports and the gossip.
+class Ipv4Address
+{
+public:
+    /// in network byte order, throws std::invalid_argument for addresses that do not resolve
+    /// to IPv4
+    static sockaddr_in resolve(const std::string& hostPort);
+};
@@ -12,10 +12,25 @@
  * General Public License Version 3 for more details.
  */
 
+#include "options.h"
 #include "utils.h"
 
-int main()
+#include <iostream>
+
+int main(int argc, char* argv[])
 {
+    Options options;
+    try
+    {
+        // before daemonizing so that the error still makes it to the terminal
+        options = Options::parse(argc, argv);
+    }
+    catch(const std::invalid_argument& e)
+    {
+        std::cerr << e.what() << '\n' << Options::usage();
+        return EXIT_FAILURE;
+    }
+
     Utils::initializeService();
-    Utils::run(5);
+    Utils::run(options);
 }
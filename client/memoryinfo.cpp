@@ -16,7 +16,6 @@
 #include "uname.h"
 
 #include <iostream>
-#include <fstream>
 #include <sys/sysinfo.h>
 
 MemoryInfo::MemoryInfo(const char* pressurefile, const char* release):
@@ -72,14 +71,21 @@ bool MemoryInfo::update()
         // read from pressureInfoFile_ file with format:
         // some avg10=0.00 avg60=0.00 avg300=0.00 total=98028
         // full avg10=0.00 avg60=0.00 avg300=0.00 total=74503
-        std::ifstream pressInfo(pressureInfoFile_);
-        pressInfo.ignore(11, '=');
-        pressInfo >> avg10ProcessStallTimeUs_;
+        const bool read = pressureInfoFile_.read();
+        TextScanner pressInfo(pressureInfoFile_.content());
+        if(!read || !pressInfo.skipPast('=') || !pressInfo.readFloat(avg10ProcessStallTimeUs_))
+            avg10ProcessStallTimeUs_ = 0.f;
     }
 
     return true;
 }
 
+void MemoryInfo::files(std::vector<ProcFile*>& files)
+{
+    if(avg10ProcessStallTimeUs_ != -1.f)
+        files.push_back(&pressureInfoFile_);
+}
+
 std::ostream& operator<<(std::ostream& out, const MemoryInfo& info)
 {
     out << "Available Ram(MB)   :" << info.availableRamMb_ << '\n';
@@ -14,8 +14,11 @@
 
 #pragma once
 
+#include "procfile.h"
+
 #include <cstdint>
 #include <ostream>
+#include <vector>
 
 class MemoryInfo
 {
@@ -24,13 +27,15 @@ class MemoryInfo
     uint8_t availableRamPercent_;
     uint8_t availableSwapPercent_;
     float avg10ProcessStallTimeUs_;
-    const char* pressureInfoFile_;
+    ProcFile pressureInfoFile_;
 
 public:
     MemoryInfo(const char* pressurefile = "/proc/pressure/memory", const char* release = 0);
     ~MemoryInfo();
 
     bool update();
+    /// the files update() reads, for an IoRing to read ahead
+    void files(std::vector<ProcFile*>& files);
     uint64_t availableRam() const { return availableRamMb_; }
     uint64_t availableSwap() const { return availableSwapMb_; }
     uint8_t availableRamPercent() const { return availableRamPercent_; }
@@ -14,72 +14,82 @@
 
 #include "networkinfo.h"
 
-#include <thread>
 #include <fstream>
-#include <string>
-#include <sstream>
-#include <chrono>
 
-namespace
+NetworkInfo::NetworkInfo(const char* route, const char* netDev):
+    netDev_(netDev, 16384),
+    bandwidthUsageBps_(0),
+    previousBytes_(0),
+    previousUpdate_(std::chrono::steady_clock::now())
 {
-    void update(uint32_t& bps)
+    // find the default interface
+    // TODO: change interface dynamically when the default interface changes
     {
-        // find the default interface
-        // TODO: change interface dynamically when the default interface changes
-        std::string interface;
+        std::ifstream file(route);
+        std::string destination;
+        while(file >> interface_ >> destination)
         {
-            std::ifstream file("/proc/net/route");
-            std::string destination;
-            while(file >> interface >> destination)
-            {
-                if(destination == "00000000")
-                    break;
-                file.ignore(100, '\n');
-            }
-        }
-
-        uint64_t prevRx = 0, prevTx = 0;
-        for(;;)
-        {
-            {
-                std::ifstream file("/proc/net/dev");
-                std::string line;
-                while(std::getline(file, line))
-                {
-                    if(line.find(interface) != std::string::npos)
-                    {
-                        size_t pos = line.find(':');
-                        if(pos != std::string::npos)
-                        {
-                            uint64_t rx, tx, tmp;
-                            std::istringstream stream(line.substr(pos + 1));
-                            stream >> rx;
-                            stream >> tmp;
-                            stream >> tmp;
-                            stream >> tmp;
-                            stream >> tmp;
-                            stream >> tmp;
-                            stream >> tmp;
-                            stream >> tmp;
-                            stream >> tx;
-                            bps = ((rx - prevRx) + (tx - prevTx)) / 5;
-                            prevRx = rx;
-                            prevTx = tx;
-                        }
-                        break;
-                    }
-                }
-            }
-            using namespace std::chrono_literals;
-            std::this_thread::sleep_for(5s);
+            if(destination == "00000000")
+                break;
+            file.ignore(100, '\n');
         }
     }
-}
 
-NetworkInfo::NetworkInfo()
-{
-    std::thread(update, std::ref(bandwidthUsageBps_)).detach();
+    readBytes(previousBytes_);
 }
 
 NetworkInfo::~NetworkInfo()
 {}
+
+/// received + transmitted bytes of the interface, a line of /proc/net/dev reads
+///   eth0: 1215506 1204 0 0 0 0 0 0 111452 886 0 0 0 0 0 0
+/// with the 8 receive columns followed by the 8 transmit ones
+bool NetworkInfo::readBytes(uint64_t& bytes)
+{
+    if(!netDev_.read())
+        return false;
+
+    TextScanner scanner(netDev_.content());
+    std::string_view name;
+    do
+    {
+        if(!scanner.readWord(name) || name.size() <= interface_.size() || name.substr(0, interface_.size()) != interface_ || name[interface_.size()] != ':')
+            continue;
+
+        // older kernels have no blank between the colon and the first column
+        const std::string_view glued = name.substr(interface_.size() + 1);
+        uint64_t rx, tx, tmp;
+        if(!(glued.empty() ? scanner.readUint(rx) : TextScanner(glued).readUint(rx)))
+            return false;
+
+        for(int column = 1 ; column < 8 ; column++)
+            if(!scanner.readUint(tmp))
+                return false;
+
+        if(!scanner.readUint(tx))
+            return false;
+
+        bytes = rx + tx;
+        return true;
+    }
+    while(scanner.nextLine());
+
+    return false;
+}
+bool NetworkInfo::update()
+{
+    uint64_t bytes;
+    if(!readBytes(bytes))
+        return false;
+
+    using namespace std::chrono;
+    const auto now = steady_clock::now();
+    const auto elapsedMs = duration_cast<milliseconds>(now - previousUpdate_).count();
+    if(elapsedMs > 0)
+    {
+        bandwidthUsageBps_ = (bytes - previousBytes_) * 1000 / elapsedMs;
+        previousBytes_ = bytes;
+        previousUpdate_ = now;
+    }
+    return true;
+}
@@ -14,15 +14,32 @@
 
 #pragma once
 
+#include "procfile.h"
+
+#include <chrono>
 #include <cstdint>
+#include <string>
+#include <vector>
 
 class NetworkInfo
 {
+    ProcFile netDev_;
     uint32_t bandwidthUsageBps_;
+    std::string interface_;
+    uint64_t previousBytes_;
+    std::chrono::steady_clock::time_point previousUpdate_;
+
+    bool readBytes(uint64_t& bytes);
 
 public:
-    NetworkInfo();
+    /// picks the interface of the default route and takes the first reading
+    NetworkInfo(const char* route = "/proc/net/route", const char* netDev = "/proc/net/dev");
     ~NetworkInfo();
 
+    /// bandwidth used since the previous update
+    bool update();
+    /// the files update() reads, for an IoRing to read ahead
+    void files(std::vector<ProcFile*>& files) { files.push_back(&netDev_); }
     uint32_t bandwidthUsage() const { return bandwidthUsageBps_; }
+    const std::string& interface() const { return interface_; }
 };
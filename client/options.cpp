@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "options.h"
+#include "sampler.h"
+
+#include <mcproto/statsdatagram.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    const char* value(int argc, const char* const argv[], int& idx)
+    {
+        if(idx + 1 >= argc)
+            throw std::invalid_argument(std::string("missing value for ") + argv[idx]);
+        return argv[++idx];
+    }
+
+    uint32_t number(int argc, const char* const argv[], int& idx)
+    {
+        const char* option = argv[idx];
+        try
+        {
+            return std::stoul(value(argc, argv, idx));
+        }
+        catch(const std::logic_error&)
+        {
+            throw std::invalid_argument(std::string("expected a number for ") + option);
+        }
+    }
+
+    CollectorSetting& collector(Options& options, std::string name)
+    {
+        if(!Sampler::Collectors::has(name))
+            throw std::invalid_argument("unknown collector " + name);
+
+        auto setting = std::find_if(options.collectors.begin(), options.collectors.end(), [&name](const CollectorSetting& setting){ return setting.name == name; });
+        if(setting != options.collectors.end())
+            return *setting;
+
+        options.collectors.push_back({std::move(name)});
+        return options.collectors.back();
+    }
+}
+
+Options Options::parse(int argc, const char* const argv[])
+{
+    Options options;
+    for(int idx = 1 ; idx < argc ; idx++)
+    {
+        if(!strcmp(argv[idx], "--min-interval-ms"))
+            options.minReportIntervalMs = number(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--interval-ms"))
+            options.reportIntervalMs = number(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--max-interval-ms"))
+            options.maxReportIntervalMs = number(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--cgroup"))
+            options.cgroups.emplace_back(value(argc, argv, idx));
+        else if(!strcmp(argv[idx], "--server"))
+            options.servers.emplace_back(value(argc, argv, idx));
+        else if(!strcmp(argv[idx], "--deadline-ms"))
+            options.deadlineMs = number(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--disable"))
+            collector(options, value(argc, argv, idx)).enabled = false;
+        else if(!strcmp(argv[idx], "--period"))
+        {
+            // <collector>=<ms>
+            const std::string period = value(argc, argv, idx);
+            const size_t separator = period.find('=');
+            if(separator == std::string::npos)
+                throw std::invalid_argument("expected <collector>=<ms> for --period");
+            CollectorSetting& setting = collector(options, period.substr(0, separator));
+            try
+            {
+                setting.periodMs = std::stoul(period.substr(separator + 1));
+            }
+            catch(const std::logic_error&)
+            {
+                throw std::invalid_argument("expected a number for --period");
+            }
+        }
+        else if(!strcmp(argv[idx], "--spool"))
+            options.spoolPath = value(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--spool-size-kb"))
+            options.spoolSizeKb = number(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--snapshot"))
+            options.snapshotName = value(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--zone"))
+            options.zone = value(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--rack"))
+            options.rack = value(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--pool"))
+            options.pools.push_back(value(argc, argv, idx));
+        else if(!strcmp(argv[idx], "--gossip-port"))
+        {
+            const uint32_t port = number(argc, argv, idx);
+            if(port > 65535)
+                throw std::invalid_argument("--gossip-port is not a port");
+            options.gossipPort = port;
+        }
+        else if(!strcmp(argv[idx], "--gossip-seed"))
+            options.gossipSeeds.emplace_back(value(argc, argv, idx));
+        else if(!strcmp(argv[idx], "--udp"))
+            options.udpServer = value(argc, argv, idx);
+        else if(!strcmp(argv[idx], "--udp-key"))
+        {
+            options.udpKey = value(argc, argv, idx);
+            mcproto::StatsDatagram::Key key;
+            if(!mcproto::StatsDatagram::parseKey(options.udpKey, key))
+                throw std::invalid_argument("--udp-key is not 32 hex digits");
+        }
+        else if(!strcmp(argv[idx], "--io-uring"))
+            options.ioUring = true;
+        else if(!strcmp(argv[idx], "--bench-iterations"))
+            options.benchIterations = number(argc, argv, idx);
+        else
+            throw std::invalid_argument(std::string("unknown option ") + argv[idx]);
+    }
+
+    if(options.minReportIntervalMs > options.maxReportIntervalMs)
+        throw std::invalid_argument("--min-interval-ms is larger than --max-interval-ms");
+
+    if(!options.gossipSeeds.empty() && !options.gossipPort)
+        throw std::invalid_argument("--gossip-seed needs --gossip-port");
+
+    if(!options.udpKey.empty() && options.udpServer.empty())
+        throw std::invalid_argument("--udp-key needs --udp");
+
+    if(options.servers.empty())
+        options.servers.emplace_back("localhost:50051");
+
+    return options;
+}
+
+const char* Options::usage()
+{
+    return "usage: mclearcli [options]\n"
+           "  --min-interval-ms <ms>  shortest reporting interval (1000)\n"
+           "  --interval-ms <ms>      initial reporting interval (5000)\n"
+           "  --max-interval-ms <ms>  longest reporting interval (30000)\n"
+           "  --cgroup <path>         cgroup v2 slice to report on, relative to /sys/fs/cgroup,\n"
+           "                          may be given more than once\n"
+           "  --server <host:port>    server to report to, may be given more than once (localhost:50051)\n"
+           "  --deadline-ms <ms>      time a report may take (2000)\n"
+           "  --disable <collector>   turns a collector off, one of disk, memory, pressure, cpu,\n"
+           "                          network, cgroup, app\n"
+           "  --period <collector>=<ms>  samples a collector at most that often (every tick)\n"
+           "  --spool <path>          where undelivered samples are kept (mclearcli.spool)\n"
+           "  --spool-size-kb <kb>    size of the spool, 0 turns it off (4096)\n"
+           "  --snapshot <name>       shared memory the latest sample is published to for local\n"
+           "                          readers, \"\" turns it off (/mclear-stats)\n"
+           "  --zone <name>           zone the node is in, reported with every sample\n"
+           "  --rack <name>           rack the node is in within its zone\n"
+           "  --pool <name>           service pool the node is in, may be given more than once\n"
+           "  --gossip-port <port>    gossips load digests with the other clients over UDP and answers\n"
+           "                          local routers on that port (off)\n"
+           "  --gossip-seed <host:port>  member to join the gossip group through, may be given more\n"
+           "                          than once (starts a new group)\n"
+           "  --udp <host:port>       sends samples to the server's datagram port over UDP instead of\n"
+           "                          gRPC, unanswered and not spooled, but for one report over gRPC\n"
+           "                          every 30s that keeps the server's replies coming (off)\n"
+           "  --udp-key <hex>         32 hex digits the datagrams are signed with (unsigned)\n"
+           "  --io-uring              reads the collector files of a tick with one io_uring submission,\n"
+           "                          synchronously where the kernel does not allow it (off)\n"
+           "  --bench-iterations <n>  ticks mclearbench profiles every collector over (1000)\n";
+}
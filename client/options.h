@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct CollectorSetting
+{
+    std::string name;
+    bool enabled = true;
+    /// 0 samples on every tick
+    uint32_t periodMs = 0;
+};
+
+struct Options
+{
+    uint32_t minReportIntervalMs = 1000;
+    uint32_t reportIntervalMs = 5000;
+    uint32_t maxReportIntervalMs = 30000;
+    /// host:port of the servers to report to, the fastest healthy one is preferred
+    std::vector<std::string> servers;
+    /// bounds a report including a hedge to a second server
+    uint32_t deadlineMs = 2000;
+    /// cgroup v2 slices to report on, relative to the cgroup2 mount
+    std::vector<std::string> cgroups;
+    /// collectors turned off or sampling less often than every tick
+    std::vector<CollectorSetting> collectors;
+    /// samples that could not be delivered are kept here until the server is back
+    std::string spoolPath = "mclearcli.spool";
+    /// 0 turns spooling off
+    uint32_t spoolSizeKb = 4096;
+    /// shared memory page the latest sample is published to for local readers, empty turns it off
+    std::string snapshotName = "/mclear-stats";
+    /// topology labels reported with every sample, so the server can prefer nearby nodes
+    std::string zone;
+    std::string rack;
+    /// service pools the node is in, routers pick among the nodes of a pool
+    std::vector<std::string> pools;
+    /// UDP port load digests are gossiped with the other clients on, 0 turns gossip off
+    uint16_t gossipPort = 0;
+    /// host:port of members the gossip group is joined through, none starts a new group
+    std::vector<std::string> gossipSeeds;
+    /// host:port of a server's datagram port, samples go there over UDP instead of gRPC when set
+    std::string udpServer;
+    /// 32 hex digits the datagrams are signed with, empty sends them unsigned
+    std::string udpKey;
+    /// reads the collector files of a tick with one io_uring submission, synchronously when the
+    /// kernel does not have it
+    bool ioUring = false;
+    /// ticks mclearbench profiles every collector over
+    uint32_t benchIterations = 1000;
+
+    /// throws std::invalid_argument for unknown options and missing or malformed values
+    static Options parse(int argc, const char* const argv[]);
+    static const char* usage();
+};
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "pressureinfo.h"
+#include "uname.h"
+
+#include <iostream>
+
+const char* PressureInfo::resourceName(Resource resource)
+{
+    switch(resource)
+    {
+        case Cpu: return "cpu";
+        case Memory: return "memory";
+        case Io: return "io";
+        default: return "";
+    }
+}
+
+PressureInfo::PressureInfo(const char* pressureDir, const char* release, const char* fileSuffix):
+    avg10_{0.f, 0.f, 0.f},
+    pressureDir_(pressureDir),
+    fileSuffix_(fileSuffix),
+    available_(true)
+{
+    /// pressure stall information was introduced in Linux 4.20
+    if(Uname(release).parseVersion() < LinuxVersion{4, 20})
+    {
+        std::cout << "Pressure Stall Information not available\n";
+        available_ = false;
+        for(float& avg10 : avg10_)
+            avg10 = -1.f;
+        return;
+    }
+
+    files_.reserve(ResourceCount);
+    for(uint8_t resource = Cpu ; resource < ResourceCount ; resource++)
+        files_.emplace_back(resourceFile(Resource(resource)));
+}
+
+PressureInfo::~PressureInfo()
+{}
+
+bool PressureInfo::update()
+{
+    if(!available_)
+        return true;
+
+    bool updated = true;
+    for(uint8_t resource = Cpu ; resource < ResourceCount ; resource++)
+    {
+        // only the "some" line is of interest, the cpu file has no "full" line before Linux 5.13
+        // some avg10=0.00 avg60=0.00 avg300=0.00 total=98028
+        const bool read = files_[resource].read();
+        TextScanner pressInfo(files_[resource].content());
+        if(!read || !pressInfo.skipPast('=') || !pressInfo.readFloat(avg10_[resource]))
+        {
+            avg10_[resource] = 0.f;
+            updated = false;
+        }
+    }
+
+    return updated;
+}
+
+void PressureInfo::files(std::vector<ProcFile*>& files)
+{
+    if(!available_)
+        return;
+    for(ProcFile& file : files_)
+        files.push_back(&file);
+}
+
+std::ostream& operator<<(std::ostream& out, const PressureInfo& info)
+{
+    out << "Cpu avg10 stall(%)   :" << info.avg10_[PressureInfo::Cpu] << '\n';
+    out << "Memory avg10 stall(%):" << info.avg10_[PressureInfo::Memory] << '\n';
+    out << "Io avg10 stall(%)    :" << info.avg10_[PressureInfo::Io] << '\n';
+    return out;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include "procfile.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class PressureInfo
+{
+public:
+    enum Resource : uint8_t
+    {
+        Cpu = 0,
+        Memory,
+        Io,
+        ResourceCount
+    };
+
+    static const char* resourceName(Resource resource);
+
+private:
+    float avg10_[ResourceCount];
+    std::string pressureDir_;
+    std::string fileSuffix_;
+    bool available_;
+    std::vector<ProcFile> files_;
+
+public:
+    /// the files are <pressureDir>/<resource><fileSuffix>, cgroups use the ".pressure" suffix
+    PressureInfo(const char* pressureDir = "/proc/pressure", const char* release = 0, const char* fileSuffix = "");
+    PressureInfo(PressureInfo&&) = default;
+    ~PressureInfo();
+
+    bool update();
+    /// the files update() reads, for an IoRing to read ahead
+    void files(std::vector<ProcFile*>& files);
+    /// false on kernels without pressure stall information, avg10 is -1 then
+    bool available() const { return available_; }
+    /// percentage of wall time in which some task was stalled on the resource in the last 10s
+    float avg10(Resource resource) const { return avg10_[resource]; }
+    std::string resourceFile(Resource resource) const { return pressureDir_ + '/' + resourceName(resource) + fileSuffix_; }
+
+    friend std::ostream& operator<<(std::ostream& out, const PressureInfo& info);
+};
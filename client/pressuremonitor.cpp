@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "pressuremonitor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/magic.h>
+#include <sys/vfs.h>
+
+namespace
+{
+    /// triggers can only be written to the pressure files of procfs and cgroup2, a regular file
+    /// (as used by the tests) would happily accept the write and then never signal anything
+    bool isKernelPressureFile(int fd)
+    {
+        struct statfs fs;
+        if(fstatfs(fd, &fs) == -1)
+            return false;
+        return fs.f_type == PROC_SUPER_MAGIC || fs.f_type == CGROUP2_SUPER_MAGIC;
+    }
+
+    int registerTrigger(const std::string& pressureFile, uint32_t stallUs, uint32_t windowUs)
+    {
+        int fd = open(pressureFile.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if(fd == -1)
+            return -1;
+
+        if(!isKernelPressureFile(fd))
+        {
+            close(fd);
+            return -1;
+        }
+
+        std::string trigger = "some " + std::to_string(stallUs) + ' ' + std::to_string(windowUs);
+        int written = write(fd, trigger.c_str(), trigger.size() + 1);
+
+        // unprivileged processes (Linux 6.5+) may only use windows that are a multiple of 2s,
+        // stretch the window keeping the same stall ratio
+        constexpr uint32_t unprivilegedWindowUs = 2000000;
+        if(written == -1 && errno == EINVAL && windowUs % unprivilegedWindowUs)
+        {
+            const uint32_t stretchedWindowUs = (windowUs / unprivilegedWindowUs + 1) * unprivilegedWindowUs;
+            const uint64_t stretchedStallUs = uint64_t(stallUs) * stretchedWindowUs / windowUs;
+            trigger = "some " + std::to_string(stretchedStallUs) + ' ' + std::to_string(stretchedWindowUs);
+            written = write(fd, trigger.c_str(), trigger.size() + 1);
+        }
+
+        if(written == -1)
+        {
+            std::cerr << "could not register pressure trigger on " << pressureFile << ": " << strerror(errno) << '\n';
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+}
+
+PressureMonitor::PressureMonitor(PressureInfo& info, uint32_t stallUs, uint32_t windowUs, uint32_t fallbackPollMs):
+    info_(info),
+    triggerFds_{-1, -1, -1},
+    thresholdPercent_(100.f * stallUs / windowUs),
+    fallbackPollMs_(fallbackPollMs),
+    aboveThreshold_(0)
+{
+    if(!info_.available())
+        return;
+
+    for(uint8_t resource = PressureInfo::Cpu ; resource < PressureInfo::ResourceCount ; resource++)
+        triggerFds_[resource] = registerTrigger(info_.resourceFile(PressureInfo::Resource(resource)), stallUs, windowUs);
+
+    if(armedMask() != (1u << PressureInfo::ResourceCount) - 1)
+        std::cout << "Pressure triggers not available for all resources, polling avg10 every " << fallbackPollMs_ << "ms\n";
+}
+
+PressureMonitor::~PressureMonitor()
+{
+    for(int fd : triggerFds_)
+        if(fd != -1)
+            close(fd);
+}
+
+uint32_t PressureMonitor::armedMask() const
+{
+    uint32_t mask = 0;
+    for(uint8_t resource = PressureInfo::Cpu ; resource < PressureInfo::ResourceCount ; resource++)
+        if(triggerFds_[resource] != -1)
+            mask |= 1u << resource;
+    return mask;
+}
+
+/// edge triggered like the kernel triggers, a resource that stays over
+/// the threshold is reported once and not on every poll
+uint32_t PressureMonitor::crossedThreshold()
+{
+    info_.update();
+
+    uint32_t crossed = 0;
+    for(uint8_t resource = PressureInfo::Cpu ; resource < PressureInfo::ResourceCount ; resource++)
+    {
+        const uint32_t bit = 1u << resource;
+        if(triggerFds_[resource] != -1)
+            continue;
+
+        if(info_.avg10(PressureInfo::Resource(resource)) >= thresholdPercent_)
+        {
+            if(!(aboveThreshold_ & bit))
+                crossed |= bit;
+            aboveThreshold_ |= bit;
+        }
+        else
+        {
+            aboveThreshold_ &= ~bit;
+        }
+    }
+    return crossed;
+}
+
+uint32_t PressureMonitor::wait(int timeoutMs)
+{
+    using namespace std::chrono;
+    const auto deadline = steady_clock::now() + milliseconds(timeoutMs);
+
+    for(;;)
+    {
+        const bool polling = info_.available() && armedMask() != (1u << PressureInfo::ResourceCount) - 1;
+        const int remainingMs = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+        if(remainingMs <= 0)
+            return 0;
+
+        pollfd fds[PressureInfo::ResourceCount];
+        uint8_t resources[PressureInfo::ResourceCount];
+        nfds_t count = 0;
+        for(uint8_t resource = PressureInfo::Cpu ; resource < PressureInfo::ResourceCount ; resource++)
+        {
+            if(triggerFds_[resource] == -1)
+                continue;
+            fds[count] = {triggerFds_[resource], POLLPRI, 0};
+            resources[count++] = resource;
+        }
+
+        const int ready = poll(fds, count, polling ? std::min<int>(remainingMs, fallbackPollMs_) : remainingMs);
+        if(ready == -1 && errno != EINTR)
+        {
+            std::cerr << "poll on pressure triggers failed: " << strerror(errno) << '\n';
+            return 0;
+        }
+
+        uint32_t fired = 0;
+        for(nfds_t i = 0 ; ready > 0 && i < count ; i++)
+        {
+            if(fds[i].revents & POLLERR)
+            {
+                // the monitored file went away, e.g. the cgroup was removed
+                close(triggerFds_[resources[i]]);
+                triggerFds_[resources[i]] = -1;
+            }
+            else if(fds[i].revents & POLLPRI)
+            {
+                fired |= 1u << resources[i];
+            }
+        }
+
+        if(polling)
+            fired |= crossedThreshold();
+
+        if(fired)
+            return fired;
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include "pressureinfo.h"
+
+#include <cstdint>
+
+/// Registers pressure stall triggers on the cpu, memory and io pressure files so that the
+/// runloop is woken up as soon as a resource goes into distress instead of on the next tick.
+/// See Documentation/accounting/psi.rst in the kernel tree for the trigger semantics.
+/// Where the kernel does not support triggers (older than Linux 5.2, not privileged or not a
+/// kernel pressure file at all) the avg10 values are polled and compared against the same threshold.
+class PressureMonitor
+{
+    PressureInfo& info_;
+    int triggerFds_[PressureInfo::ResourceCount];
+    float thresholdPercent_;
+    uint32_t fallbackPollMs_;
+    uint32_t aboveThreshold_;
+
+    uint32_t crossedThreshold();
+
+public:
+    PressureMonitor(PressureInfo& info, uint32_t stallUs = 150000, uint32_t windowUs = 1000000, uint32_t fallbackPollMs = 500);
+    ~PressureMonitor();
+    PressureMonitor(const PressureMonitor&) = delete;
+    PressureMonitor& operator=(const PressureMonitor&) = delete;
+
+    /// bit mask of the resources with a kernel trigger registered
+    uint32_t armedMask() const;
+    /// waits at most timeoutMs for a resource to go over the threshold,
+    /// returns the bit mask (1 << PressureInfo::Resource) of the resources that did
+    uint32_t wait(int timeoutMs);
+};
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "procfile.h"
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+ProcFile::ProcFile(std::string path, size_t capacity):
+    path_(std::move(path)),
+    fd_(-1),
+    buffer_(capacity + 1, '\0'),
+    size_(0),
+    prefetched_(false)
+{}
+
+ProcFile::ProcFile(ProcFile&& other):
+    path_(std::move(other.path_)),
+    fd_(other.fd_),
+    buffer_(std::move(other.buffer_)),
+    size_(other.size_),
+    prefetched_(other.prefetched_)
+{
+    other.fd_ = -1;
+    other.size_ = 0;
+    other.prefetched_ = false;
+}
+
+ProcFile::~ProcFile()
+{
+    if(fd_ != -1)
+        close(fd_);
+}
+
+bool ProcFile::open()
+{
+    if(fd_ == -1)
+        fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    return fd_ != -1;
+}
+
+void ProcFile::prefetched(int result)
+{
+    // filling the buffer up might mean there was more
+    prefetched_ = result >= 0 && size_t(result) < capacity();
+    if(!prefetched_)
+        return;
+    size_ = result;
+    buffer_[size_] = '\0';
+}
+
+bool ProcFile::read()
+{
+    if(prefetched_)
+    {
+        prefetched_ = false;
+        return true;
+    }
+
+    if(!open())
+        return false;
+
+    for(;;)
+    {
+        // procfs, sysfs and cgroupfs regenerate the content on a read from the start
+        size_ = 0;
+        ssize_t count;
+        while((count = pread(fd_, buffer_.data() + size_, buffer_.size() - 1 - size_, size_)) > 0)
+        {
+            size_ += count;
+            if(size_ == buffer_.size() - 1)
+                break;
+        }
+
+        if(count == -1)
+        {
+            // the file went away underneath, e.g. a removed cgroup
+            close(fd_);
+            fd_ = -1;
+            size_ = 0;
+            return false;
+        }
+
+        if(size_ < buffer_.size() - 1)
+            break;
+
+        // did not fit, the content might have been cut short
+        buffer_.resize(buffer_.size() * 2);
+    }
+
+    buffer_[size_] = '\0';
+    return true;
+}
+
+void TextScanner::skipBlanks()
+{
+    while(pos_ < end_ && (*pos_ == ' ' || *pos_ == '\t'))
+        pos_++;
+}
+
+bool TextScanner::skipPast(char c)
+{
+    while(pos_ < end_)
+        if(*pos_++ == c)
+            return true;
+    return false;
+}
+
+bool TextScanner::readWord(std::string_view& word)
+{
+    skipBlanks();
+    const char* begin = pos_;
+    while(pos_ < end_ && *pos_ != ' ' && *pos_ != '\t' && *pos_ != '\n')
+        pos_++;
+    word = std::string_view(begin, pos_ - begin);
+    return pos_ != begin;
+}
+
+bool TextScanner::readUint(uint64_t& value)
+{
+    skipBlanks();
+    if(pos_ >= end_ || *pos_ < '0' || *pos_ > '9')
+        return false;
+
+    value = 0;
+    while(pos_ < end_ && *pos_ >= '0' && *pos_ <= '9')
+        value = value * 10 + (*pos_++ - '0');
+    return true;
+}
+
+bool TextScanner::readFloat(float& value)
+{
+    skipBlanks();
+    if(pos_ >= end_ || *pos_ == '\n')
+        return false;
+
+    char* parsed = nullptr;
+    value = std::strtof(pos_, &parsed);
+    if(parsed == pos_)
+        return false;
+    pos_ = parsed;
+    return true;
+}
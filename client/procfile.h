@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// A /proc, /sys or cgroup file that is kept open and re-read in place. The buffer is only
+/// grown when the file outgrows it, so after the first read the steady state does no allocation.
+/// An IoRing may read the file ahead of read(), which then takes that content instead.
+class ProcFile
+{
+    std::string path_;
+    int fd_;
+    std::vector<char> buffer_;
+    size_t size_;
+    bool prefetched_;
+
+public:
+    explicit ProcFile(std::string path, size_t capacity = 4096);
+    ProcFile(ProcFile&& other);
+    ProcFile(const ProcFile&) = delete;
+    ProcFile& operator=(const ProcFile&) = delete;
+    ~ProcFile();
+
+    /// re-reads the whole file, opening it first if that did not work out before. Takes what
+    /// was read ahead instead when there is something
+    bool read();
+    /// false when the file cannot be opened
+    bool open();
+    int fd() const { return fd_; }
+    /// where a read ahead goes, capacity() bytes from the start of the file at most
+    char* buffer() { return buffer_.data(); }
+    size_t capacity() const { return buffer_.size() - 1; }
+    /// the result of a read ahead into buffer(), bytes or -errno. One that failed or may have
+    /// been cut short is left to read() to do over
+    void prefetched(int result);
+    /// forgets a read ahead nobody took, it is stale by the next tick
+    void discard() { prefetched_ = false; }
+    /// content of the last read, followed by a nul character
+    std::string_view content() const { return {buffer_.data(), size_}; }
+    const std::string& path() const { return path_; }
+};
+
+/// Minimal allocation free scanning over the content of a ProcFile
+class TextScanner
+{
+    const char* pos_;
+    const char* end_;
+
+    void skipBlanks();
+
+public:
+    /// text must be followed by a nul character as the content of a ProcFile is
+    explicit TextScanner(std::string_view text) : pos_(text.data()), end_(text.data() + text.size()) {}
+
+    bool atEnd() const { return pos_ >= end_; }
+    /// moves past the next occurrence of c
+    bool skipPast(char c);
+    /// moves to the beginning of the next line
+    bool nextLine() { return skipPast('\n'); }
+    /// the next run of non blank characters, does not cross the end of the line
+    bool readWord(std::string_view& word);
+    /// does not cross the end of the line
+    bool readUint(uint64_t& value);
+    /// does not cross the end of the line
+    bool readFloat(float& value);
+};
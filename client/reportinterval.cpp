@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "reportinterval.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    /// bandwidth has no natural upper bound, changes are relative to the larger of the two
+    /// readings but not to anything below 1MB/s so that an idle link does not look volatile
+    inline float bandwidthChange(uint32_t previous, uint32_t current)
+    {
+        const float scale = std::max({previous, current, uint32_t(1000 * 1000)});
+        return 100.f * std::fabs(float(current) - float(previous)) / scale;
+    }
+}
+
+ReportInterval::ReportInterval(uint32_t minMs, uint32_t maxMs, uint32_t initialMs):
+    minMs_(minMs),
+    maxMs_(std::max(minMs, maxMs)),
+    intervalMs_(std::clamp(initialMs, minMs_, maxMs_)),
+    serverFloorMs_(0),
+    previous_{},
+    hasPrevious_(false)
+{}
+
+float ReportInterval::change(const Sample& previous, const Sample& current)
+{
+    return std::max({std::fabs(float(current.cpuLoad) - float(previous.cpuLoad)) / 100.f,
+                     std::fabs(float(current.ramAvailablePercent) - float(previous.ramAvailablePercent)),
+                     bandwidthChange(previous.bandwidthUsage, current.bandwidthUsage),
+                     std::fabs(current.pressure - previous.pressure)});
+}
+
+uint32_t ReportInterval::adapt(const Sample& sample)
+{
+    if(hasPrevious_)
+    {
+        const float delta = change(previous_, sample);
+        // multiplicative both ways: a node going into distress gets to the minimum within a
+        // few reports while a stable node takes a while to reach the maximum
+        if(delta >= volatileChange)
+            intervalMs_ = std::max(minMs_, intervalMs_ / 2);
+        else if(delta <= stableChange)
+            intervalMs_ = std::min(maxMs_, intervalMs_ + intervalMs_ / 2);
+    }
+
+    previous_ = sample;
+    hasPrevious_ = true;
+    return intervalMs();
+}
+
+uint32_t ReportInterval::intervalMs() const
+{
+    return std::max(intervalMs_, serverFloorMs_);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/// Decides how long to wait before the next report. A node whose metrics move a lot reports
+/// more often to keep the routing fresh, a stable node backs off to cut the fleet's RPC volume.
+/// The server can additionally hand out a floor to shed its ingest load.
+class ReportInterval
+{
+public:
+    struct Sample
+    {
+        uint32_t cpuLoad;        // in 1/100th of a percent as reported by CpuLoadInfo
+        uint32_t ramAvailablePercent;
+        uint32_t bandwidthUsage; // bytes per second
+        float pressure;          // highest avg10 of the pressure stall info
+    };
+
+private:
+    uint32_t minMs_;
+    uint32_t maxMs_;
+    uint32_t intervalMs_;
+    uint32_t serverFloorMs_;
+    Sample previous_;
+    bool hasPrevious_;
+
+public:
+    /// change of a sample over the previous one, in percentage points, below which a node is stable
+    static constexpr float stableChange = 2.f;
+    /// change of a sample over the previous one, in percentage points, above which a node reports faster
+    static constexpr float volatileChange = 10.f;
+
+    ReportInterval(uint32_t minMs, uint32_t maxMs, uint32_t initialMs);
+
+    /// largest change of the individual metrics, in percentage points
+    static float change(const Sample& previous, const Sample& current);
+
+    /// feeds the latest sample, returns the interval to wait before the next one
+    uint32_t adapt(const Sample& sample);
+    /// interval the server asked for, 0 lets the client decide on its own
+    void setServerFloor(uint32_t ms) { serverFloorMs_ = ms; }
+    uint32_t intervalMs() const;
+};
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "sampler.h"
+#include "ioring.h"
+
+#include <mcproto/infoupdate.pb.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits.h>
+#include <random>
+#include <system_error>
+#include <unistd.h>
+
+namespace
+{
+    google::protobuf::ArenaOptions arenaOptions(char* block, size_t size)
+    {
+        google::protobuf::ArenaOptions options;
+        options.initial_block = block;
+        options.initial_block_size = size;
+        return options;
+    }
+}
+
+Sampler::Sampler(const std::vector<std::string>& cgroups, const char* cgroupRoot, const char* appLoadSegment):
+    collectors_(CollectorContext{cgroups, cgroupRoot, appLoadSegment}),
+    arenaBlock_(new char[arenaBlockSize]),
+    arena_(arenaOptions(arenaBlock_.get(), arenaBlockSize)),
+    stats_(google::protobuf::Arena::CreateMessage<mcproto::Stats>(&arena_)),
+    sequence_(0)
+{
+    char hostname[HOST_NAME_MAX + 1] = {};
+    gethostname(hostname, sizeof(hostname));
+    stats_->set_hostname(hostname);
+
+    // tells this run's sequence apart from the one of the run before, whose samples may still
+    // be spooled or in flight
+    std::random_device random;
+    stats_->set_runid(uint64_t(random()) << 32 | random());
+}
+
+Sampler::~Sampler()
+{}
+
+bool Sampler::useIoRing()
+{
+    try
+    {
+        ring_ = std::make_unique<IoRing>();
+    }
+    catch(const std::system_error&)
+    {
+        return false;
+    }
+    // the cgroups come with a handful of files each
+    readAhead_.reserve(64);
+    return true;
+}
+
+void Sampler::setTopology(std::string_view zone, std::string_view rack)
+{
+    if(zone.empty() && rack.empty())
+    {
+        stats_->clear_topology();
+        return;
+    }
+    stats_->mutable_topology()->set_zone(std::string(zone));
+    stats_->mutable_topology()->set_rack(std::string(rack));
+}
+
+void Sampler::setPools(const std::vector<std::string>& pools)
+{
+    stats_->clear_pools();
+    for(const std::string& pool : pools)
+        stats_->add_pools(pool);
+}
+
+void Sampler::update(uint32_t triggered)
+{
+    using namespace std::chrono;
+    const auto now = steady_clock::now();
+    stats_->set_collectedatms(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+    stats_->set_sequence(++sequence_);
+
+    if(ring_)
+    {
+        readAhead_.clear();
+        collectors_.dueFiles(readAhead_, now);
+        ring_->read(readAhead_);
+    }
+    collectors_.update(*stats_, now);
+    // a collector that gave up half way leaves reads nobody took
+    for(ProcFile* file : readAhead_)
+        file->discard();
+    if(collectors_.enabled<PressureCollector>())
+        stats_->mutable_pressure()->set_triggered(triggered);
+}
+
+void Sampler::setNextReportMs(uint32_t ms)
+{
+    stats_->set_nextreportms(ms);
+}
+
+ReportInterval::Sample Sampler::sample() const
+{
+    const PressureInfo& pressureinfo = collectors_.get<PressureCollector>().info;
+    const float pressure = std::max({pressureinfo.avg10(PressureInfo::Cpu), pressureinfo.avg10(PressureInfo::Memory), pressureinfo.avg10(PressureInfo::Io)});
+    return {collectors_.get<CpuLoadCollector>().info.cpuLoad(),
+            collectors_.get<MemoryCollector>().info.availableRamPercent(),
+            collectors_.get<NetworkCollector>().info.bandwidthUsage(),
+            pressure};
+}
+
+uint64_t Sampler::arenaOverflow() const
+{
+    const uint64_t used = arena_.SpaceAllocated();
+    return used > arenaBlockSize ? used - arenaBlockSize : 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include "collectors.h"
+#include "reportinterval.h"
+
+#include <google/protobuf/arena.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mcproto
+{
+    class Stats;
+}
+
+class IoRing;
+
+/// Collects all the metrics of a tick into an mcproto::Stats living on a preallocated arena.
+/// Once every field has been set the first time no further allocation is done, so that the
+/// client can keep reporting with its memory locked while the host is swapping.
+class Sampler
+{
+public:
+    /// a new metric is a collector in collectors.h added here
+    using Collectors = CollectorSet<DiskSpaceCollector, MemoryCollector, PressureCollector, CpuLoadCollector, NetworkCollector, CgroupCollector, AppLoadCollector>;
+
+private:
+    Collectors collectors_;
+
+    std::unique_ptr<char[]> arenaBlock_;
+    google::protobuf::Arena arena_;
+    mcproto::Stats* stats_;
+    uint64_t sequence_;
+    std::unique_ptr<IoRing> ring_;
+    std::vector<ProcFile*> readAhead_;
+
+public:
+    /// comfortably holds the Stats of a host with a handful of cgroups
+    static constexpr size_t arenaBlockSize = 16 * 1024;
+
+    Sampler(const std::vector<std::string>& cgroups, const char* cgroupRoot = "/sys/fs/cgroup", const char* appLoadSegment = AppLoadSegment::defaultName);
+    ~Sampler();
+    Sampler(const Sampler&) = delete;
+    Sampler& operator=(const Sampler&) = delete;
+
+    /// turns a collector on or off and sets how often it samples, 0 is on every tick.
+    /// False for an unknown collector.
+    bool configure(std::string_view collector, bool enabled, uint32_t periodMs) { return collectors_.configure(collector, enabled, periodMs); }
+    Collectors& collectors() { return collectors_; }
+    /// reads the files of a tick with one io_uring submission from now on, false when the
+    /// kernel has no io_uring or does not allow it and the collectors keep reading one by one
+    bool useIoRing();
+    /// null when reading synchronously
+    const IoRing* ioRing() const { return ring_.get(); }
+    /// labels sent along with every sample, left out when both are empty
+    void setTopology(std::string_view zone, std::string_view rack);
+    /// service pools sent along with every sample
+    void setPools(const std::vector<std::string>& pools);
+
+    /// triggered is the mask of the pressure triggers that cut the wait short, 0 for a periodic tick.
+    /// Every sample is stamped with the time it was taken and the next number of this run.
+    void update(uint32_t triggered);
+    /// the wait before the next sample, sent along so the server can tell when the node is late
+    void setNextReportMs(uint32_t ms);
+    const mcproto::Stats& stats() const { return *stats_; }
+    /// shared with the PressureMonitor
+    PressureInfo& pressureInfo() { return collectors_.get<PressureCollector>().info; }
+    ReportInterval::Sample sample() const;
+    /// bytes the arena took from the heap on top of the preallocated block
+    uint64_t arenaOverflow() const;
+};
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "snapshotpublisher.h"
+
+#include <mcproto/infoupdate.pb.h>
+
+#include <sys/stat.h>
+#include <system_error>
+
+SnapshotPublisher::SnapshotPublisher(std::string name):
+    name_(std::move(name)),
+    page_(nullptr)
+{
+    const int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd == -1)
+        throw std::system_error(std::error_code(errno, std::system_category()), "cannot open " + name_);
+
+    // readable by everyone whatever the umask, writable by us only
+    fchmod(fd, 0644);
+    if(ftruncate(fd, sizeof(StatsSnapshotPage)) == -1)
+    {
+        std::system_error error(std::error_code(errno, std::system_category()), "cannot size " + name_);
+        close(fd);
+        throw error;
+    }
+
+    void* mapped = mmap(nullptr, sizeof(StatsSnapshotPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED)
+        throw std::system_error(std::error_code(errno, std::system_category()), "cannot map " + name_);
+
+    page_ = static_cast<StatsSnapshotPage*>(mapped);
+    // left behind by an earlier run, readers keep the mapping they have and see the next sample
+    if(page_->sequence.load(std::memory_order_relaxed) & 1)
+        page_->sequence.fetch_add(1, std::memory_order_release);
+    page_->magic.store(StatsSnapshotPage::pageMagic, std::memory_order_release);
+}
+
+SnapshotPublisher::~SnapshotPublisher()
+{
+    munmap(page_, sizeof(StatsSnapshotPage));
+}
+
+void SnapshotPublisher::publish(const StatsSnapshot& snapshot)
+{
+    uint64_t words[StatsSnapshotPage::wordCount];
+    memcpy(words, &snapshot, sizeof(snapshot));
+
+    const uint64_t sequence = page_->sequence.load(std::memory_order_relaxed);
+    page_->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for(size_t idx = 0 ; idx < StatsSnapshotPage::wordCount ; idx++)
+        page_->words[idx].store(words[idx], std::memory_order_relaxed);
+    page_->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void SnapshotPublisher::publish(const mcproto::Stats& stats)
+{
+    publish(snapshot(stats));
+}
+
+StatsSnapshot SnapshotPublisher::snapshot(const mcproto::Stats& stats)
+{
+    StatsSnapshot snapshot{};
+    snapshot.collectedAtMs = stats.collectedatms();
+    snapshot.cpuPressure = snapshot.memoryPressure = snapshot.ioPressure = -1.f;
+
+    // a collector that failed leaves its message cleared and one turned off leaves it out. A
+    // cleared message reads as zeroes, which cpu, memory and disk do not report in practice
+    if(stats.has_cpuload() && stats.cpuload().ByteSizeLong())
+    {
+        snapshot.cpuLoad = stats.cpuload().cpuload();
+        snapshot.valid |= StatsSnapshot::CpuLoad;
+    }
+
+    if(stats.has_meminfo() && stats.meminfo().ByteSizeLong())
+    {
+        snapshot.availableRam = stats.meminfo().availableram();
+        snapshot.availableSwap = stats.meminfo().availableswap();
+        snapshot.availableRamPercent = stats.meminfo().availablerampercent();
+        snapshot.availableSwapPercent = stats.meminfo().availableswappercent();
+        snapshot.valid |= StatsSnapshot::Memory;
+    }
+
+    if(stats.has_diskinfo() && stats.diskinfo().ByteSizeLong())
+    {
+        snapshot.diskSpaceAvailable = stats.diskinfo().availablespace();
+        snapshot.valid |= StatsSnapshot::DiskSpace;
+    }
+
+    if(stats.has_netinfo())
+    {
+        snapshot.bandwidthUsage = stats.netinfo().bandwidthusage();
+        snapshot.valid |= StatsSnapshot::Network;
+    }
+
+    if(stats.has_pressure())
+    {
+        snapshot.cpuPressure = stats.pressure().cpuavg10();
+        snapshot.memoryPressure = stats.pressure().memoryavg10();
+        snapshot.ioPressure = stats.pressure().ioavg10();
+        snapshot.valid |= StatsSnapshot::Pressure;
+    }
+
+    return snapshot;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include "statssnapshot.h"
+
+#include <string>
+
+namespace mcproto
+{
+    class Stats;
+}
+
+/// Writes every sample into the page StatsSnapshotReader reads from. There is one writer, the
+/// page is read-only for everyone else.
+class SnapshotPublisher
+{
+    std::string name_;
+    StatsSnapshotPage* page_;
+
+public:
+    /// throws std::system_error when the page cannot be created
+    explicit SnapshotPublisher(std::string name = StatsSnapshotPage::defaultName);
+    ~SnapshotPublisher();
+    SnapshotPublisher(const SnapshotPublisher&) = delete;
+    SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+
+    void publish(const StatsSnapshot& snapshot);
+    void publish(const mcproto::Stats& stats);
+
+    /// the part of the report readers get
+    static StatsSnapshot snapshot(const mcproto::Stats& stats);
+};
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "spool.h"
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace
+{
+    constexpr uint64_t spoolMagic = 0x314c4f4f5053434dull;     // "MCSPOOL1"
+    constexpr size_t headerSize = 4096;
+    constexpr size_t alignment = 8;
+    // marks the unused end of the ring a record did not fit into
+    constexpr uint32_t wrapMarker = ~uint32_t(0);
+
+    struct RecordHeader
+    {
+        uint32_t size;
+        uint32_t crc;
+    };
+
+    constexpr std::array<uint32_t, 256> crcTable()
+    {
+        std::array<uint32_t, 256> table{};
+        for(uint32_t idx = 0 ; idx < 256 ; idx++)
+        {
+            uint32_t crc = idx;
+            for(int bit = 0 ; bit < 8 ; bit++)
+                crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+            table[idx] = crc;
+        }
+        return table;
+    }
+
+    /// CRC-32C
+    uint32_t checksum(const char* data, size_t size)
+    {
+        static constexpr std::array<uint32_t, 256> table = crcTable();
+        uint32_t crc = ~0u;
+        for(size_t idx = 0 ; idx < size ; idx++)
+            crc = table[(crc ^ uint8_t(data[idx])) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    std::system_error lastError(const std::string& what)
+    {
+        return std::system_error(std::error_code(errno, std::system_category()), what);
+    }
+}
+
+/// head and tail run on as byte offsets, their difference is the part of the ring in use
+struct Spool::Header
+{
+    uint64_t magic;
+    uint64_t capacity;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t count;
+};
+
+Spool::Spool(std::string path, size_t capacity):
+    path_(std::move(path)),
+    fd_(-1),
+    capacity_((capacity + alignment - 1) / alignment * alignment),
+    header_(nullptr),
+    data_(nullptr),
+    dropped_(0)
+{
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd_ == -1)
+        throw lastError("cannot open spool " + path_);
+
+    struct stat status;
+    if(fstat(fd_, &status) == -1 || (size_t(status.st_size) != headerSize + capacity_ && ftruncate(fd_, headerSize + capacity_) == -1))
+    {
+        std::system_error error = lastError("cannot size spool " + path_);
+        close(fd_);
+        throw error;
+    }
+
+    void* mapped = mmap(nullptr, headerSize + capacity_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(mapped == MAP_FAILED)
+    {
+        std::system_error error = lastError("cannot map spool " + path_);
+        close(fd_);
+        throw error;
+    }
+
+    header_ = static_cast<Header*>(mapped);
+    data_ = static_cast<char*>(mapped) + headerSize;
+    recover();
+}
+
+Spool::~Spool()
+{
+    munmap(header_, headerSize + capacity_);
+    close(fd_);
+}
+
+void Spool::recover()
+{
+    if(header_->magic != spoolMagic || header_->capacity != capacity_ || header_->tail < header_->head
+       || header_->tail - header_->head > capacity_ || header_->head % alignment || header_->tail % alignment)
+    {
+        header_->head = header_->tail = header_->count = 0;
+        header_->capacity = capacity_;
+        header_->magic = spoolMagic;
+        return;
+    }
+
+    // a crash between writing a record and moving the tail leaves nothing to repair, the
+    // checksums are there for a record torn by a write back that did not finish
+    uint64_t offset = header_->head;
+    uint64_t intact = offset;
+    uint64_t count = 0;
+    while(offset < header_->tail)
+    {
+        const uint64_t following = next(offset);
+        if(following == npos || following > header_->tail)
+            break;
+        if(reinterpret_cast<const RecordHeader*>(data_ + offset % capacity_)->size != wrapMarker)
+        {
+            count++;
+            intact = following;
+        }
+        offset = following;
+    }
+    header_->tail = intact;
+    header_->count = count;
+}
+
+size_t Spool::recordSize(size_t size) const
+{
+    return (sizeof(RecordHeader) + size + alignment - 1) / alignment * alignment;
+}
+
+uint64_t Spool::next(uint64_t offset) const
+{
+    const size_t position = offset % capacity_;
+    const RecordHeader* record = reinterpret_cast<const RecordHeader*>(data_ + position);
+    if(record->size == wrapMarker)
+        return offset + (capacity_ - position);
+
+    if(record->size > capacity_ - position - sizeof(RecordHeader))
+        return npos;
+
+    const char* payload = data_ + position + sizeof(RecordHeader);
+    if(checksum(payload, record->size) != record->crc)
+        return npos;
+
+    return offset + recordSize(record->size);
+}
+
+uint64_t Spool::skip(uint64_t offset) const
+{
+    const size_t position = offset % capacity_;
+    const RecordHeader* record = reinterpret_cast<const RecordHeader*>(data_ + position);
+    if(record->size == wrapMarker)
+        offset += capacity_ - position;
+
+    return offset + recordSize(reinterpret_cast<const RecordHeader*>(data_ + offset % capacity_)->size);
+}
+
+void Spool::dropOldest()
+{
+    header_->head = skip(header_->head);
+    header_->count--;
+    dropped_++;
+}
+
+bool Spool::push(std::string_view record)
+{
+    const size_t size = recordSize(record.size());
+    if(size > capacity_ / 2)
+        return false;
+
+    // records are never split, one that would run over the end of the ring starts over at the beginning
+    const size_t position = header_->tail % capacity_;
+    const size_t padding = capacity_ - position < size ? capacity_ - position : 0;
+
+    // make room before anything is overwritten so a crash in between loses the oldest records only
+    while(header_->tail + padding + size - header_->head > capacity_)
+        dropOldest();
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // a wrap marker is only ever published together with the record behind it
+    if(padding)
+        reinterpret_cast<RecordHeader*>(data_ + position)->size = wrapMarker;
+
+    char* target = data_ + (header_->tail + padding) % capacity_;
+    memcpy(target + sizeof(RecordHeader), record.data(), record.size());
+    RecordHeader* recordHeader = reinterpret_cast<RecordHeader*>(target);
+    recordHeader->size = record.size();
+    recordHeader->crc = checksum(record.data(), record.size());
+    std::atomic_thread_fence(std::memory_order_release);
+
+    header_->count++;
+    header_->tail += padding + size;
+    return true;
+}
+
+size_t Spool::peek(std::vector<std::string_view>& records, size_t maxBytes) const
+{
+    records.clear();
+    size_t bytes = 0;
+    for(uint64_t offset = header_->head ; offset != header_->tail ; offset = skip(offset))
+    {
+        size_t position = offset % capacity_;
+        if(reinterpret_cast<const RecordHeader*>(data_ + position)->size == wrapMarker)
+            position = 0;
+
+        const uint32_t size = reinterpret_cast<const RecordHeader*>(data_ + position)->size;
+        if(!records.empty() && bytes + size > maxBytes)
+            break;
+
+        records.emplace_back(data_ + position + sizeof(RecordHeader), size);
+        bytes += size;
+    }
+    return records.size();
+}
+
+void Spool::pop(size_t count)
+{
+    for( ; count && !empty() ; count--)
+    {
+        header_->head = skip(header_->head);
+        header_->count--;
+    }
+}
+
+bool Spool::empty() const
+{
+    return header_->head == header_->tail;
+}
+
+size_t Spool::size() const
+{
+    return header_->count;
+}
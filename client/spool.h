@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// A fixed size ring of records in a memory mapped file that outlives the process. Samples that
+/// could not be delivered are spooled here and replayed from the oldest on once the server is
+/// back. A full spool drops its oldest records, so a long outage keeps the most recent history.
+///
+/// The mapping is shared, whatever was pushed survives the process dying at any point. Every
+/// record carries a checksum and the ring bounds only move once a record is complete, so a spool
+/// left behind by a crash of the host, with pages only partially written back, is cut back to
+/// its last intact record on opening.
+class Spool
+{
+    struct Header;
+
+    std::string path_;
+    int fd_;
+    size_t capacity_;
+    Header* header_;
+    char* data_;
+    uint64_t dropped_;
+
+    static constexpr uint64_t npos = ~uint64_t(0);
+
+    size_t recordSize(size_t size) const;
+    /// steps over the record at offset, npos when it is not intact
+    uint64_t next(uint64_t offset) const;
+    /// steps over the record at offset and the end of the ring in front of it, if any
+    uint64_t skip(uint64_t offset) const;
+    void dropOldest();
+    void recover();
+
+public:
+    /// capacity is the size of the ring in bytes, a spool of a different size is started over.
+    /// Throws std::system_error when the file cannot be opened or mapped.
+    explicit Spool(std::string path, size_t capacity = 4 << 20);
+    Spool(const Spool&) = delete;
+    Spool& operator=(const Spool&) = delete;
+    ~Spool();
+
+    /// false when the record does not fit even into an empty spool
+    bool push(std::string_view record);
+    /// views of the oldest records as long as they add up to no more than maxBytes, but at least
+    /// one. Returns their number, the views are only valid until the next push.
+    size_t peek(std::vector<std::string_view>& records, size_t maxBytes) const;
+    /// drops the oldest count records
+    void pop(size_t count = 1);
+
+    bool empty() const;
+    /// number of records spooled
+    size_t size() const;
+    /// records dropped to make room since the spool was opened
+    uint64_t dropped() const { return dropped_; }
+    const std::string& path() const { return path_; }
+};
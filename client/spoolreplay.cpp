@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "spoolreplay.h"
+#include "endpointset.h"
+#include "spool.h"
+
+SpoolReplay::SpoolReplay(size_t batchBytes):
+    batchBytes_(batchBytes)
+{
+    backlog_.reserve(1024);
+    batch_.set_backfill(true);
+}
+
+bool SpoolReplay::send(Spool& spool, EndpointSet& endpoints, mcproto::StatsReply& reply)
+{
+    if(!spool.peek(backlog_, batchBytes_))
+        return false;
+
+    // a cleared repeated field keeps its messages around to parse into
+    batch_.mutable_stats()->Clear();
+    for(std::string_view record : backlog_)
+        if(!batch_.add_stats()->ParseFromArray(record.data(), record.size()))
+            batch_.mutable_stats()->RemoveLast();
+
+    if(!endpoints.send(batch_, reply))
+        return false;
+    spool.pop(backlog_.size());
+    return true;
+}
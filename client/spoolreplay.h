@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include <mcproto/infoupdate.pb.h>
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+class EndpointSet;
+class Spool;
+
+/// Sends the samples a spool kept through an outage to the server once reports get through
+/// again, a batch at a time. They are older than the report that just went out, so the batches
+/// are flagged as backfill for the server to keep them in the history only.
+class SpoolReplay
+{
+    size_t batchBytes_;
+    std::vector<std::string_view> backlog_;
+    mcproto::StatsBatch batch_;
+
+public:
+    /// batchBytes bounds the spooled records that go into one batch
+    explicit SpoolReplay(size_t batchBytes = 64 * 1024);
+
+    /// sends the oldest records of the spool and pops them once the server took them. False
+    /// when the spool is empty or the batch did not get through
+    bool send(Spool& spool, EndpointSet& endpoints, mcproto::StatsReply& reply);
+    /// samples in the last batch sent, records that did not parse are left out
+    size_t sent() const { return batch_.stats_size(); }
+};
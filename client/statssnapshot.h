@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+// Header only, for the processes on a node that want its current load without parsing /proc
+// themselves. mclearcli publishes every sample it takes into a read-only shared memory page:
+//
+//     StatsSnapshotReader reader;
+//     StatsSnapshot snapshot;
+//     if(reader.read(snapshot))
+//         ... snapshot.cpuLoad ...
+//
+// A read is a handful of loads from the page and takes no syscall, and gives up rather than
+// wait on a writer that died in the middle of an update. Link with -lrt on glibc
+// older than 2.34.
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <type_traits>
+#include <unistd.h>
+
+/// the latest sample of the node, the units are those of mcproto::Stats
+struct StatsSnapshot
+{
+    enum Valid : uint32_t { CpuLoad = 1, Memory = 2, DiskSpace = 4, Network = 8, Pressure = 16 };
+
+    uint64_t collectedAtMs;         // ms since the epoch
+    uint64_t diskSpaceAvailable;    // KB
+    uint64_t availableRam;          // MB
+    uint64_t availableSwap;         // MB
+    uint32_t cpuLoad;               // 1/100th of a percent
+    uint32_t bandwidthUsage;        // bytes/sec
+    uint32_t availableRamPercent;
+    uint32_t availableSwapPercent;
+    float cpuPressure;              // avg10 stall percentage, -1 without pressure information
+    float memoryPressure;
+    float ioPressure;
+    uint32_t valid;                 // Valid bits of the collectors that succeeded
+};
+
+/// The shared page. The snapshot is kept as atomic words behind a sequence number that is odd
+/// while the writer is in the middle of an update, a reader that saw the same even number
+/// before and after copying the words has a coherent snapshot.
+struct StatsSnapshotPage
+{
+    static constexpr uint64_t pageMagic = 0x5354415453434d00ull | 1;      // "MCSTATS" version 1
+    static constexpr const char* defaultName = "/mclear-stats";
+    static constexpr size_t wordCount = sizeof(StatsSnapshot) / sizeof(uint64_t);
+    static_assert(sizeof(StatsSnapshot) % sizeof(uint64_t) == 0 && std::is_trivially_copyable<StatsSnapshot>::value);
+
+    std::atomic<uint64_t> magic;
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> words[wordCount];
+};
+
+class StatsSnapshotReader
+{
+    const StatsSnapshotPage* page_;
+
+public:
+    /// a writer is done with an update in well under this many looks at the sequence, one
+    /// that is not died in the middle of it
+    static constexpr unsigned maxAttempts = 1 << 16;
+
+    explicit StatsSnapshotReader(const char* name = StatsSnapshotPage::defaultName):
+        page_(nullptr)
+    {
+        const int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+        if(fd == -1)
+            return;
+
+        void* mapped = mmap(nullptr, sizeof(StatsSnapshotPage), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(mapped != MAP_FAILED)
+            page_ = static_cast<const StatsSnapshotPage*>(mapped);
+    }
+
+    ~StatsSnapshotReader()
+    {
+        if(page_)
+            munmap(const_cast<StatsSnapshotPage*>(page_), sizeof(StatsSnapshotPage));
+    }
+
+    StatsSnapshotReader(const StatsSnapshotReader&) = delete;
+    StatsSnapshotReader& operator=(const StatsSnapshotReader&) = delete;
+
+    /// false when mclearcli has not published yet
+    bool available() const
+    {
+        return page_ && page_->magic.load(std::memory_order_acquire) == StatsSnapshotPage::pageMagic;
+    }
+
+    /// changes with every sample published, cheaper than a read to poll for a new one
+    uint64_t sequence() const
+    {
+        return page_ ? page_->sequence.load(std::memory_order_acquire) : 0;
+    }
+
+    /// false when there is no sample yet, or when the writer stayed in the middle of an update
+    /// for maxAttempts tries, as one that died there does until mclearcli starts again
+    bool read(StatsSnapshot& snapshot) const
+    {
+        if(!available())
+            return false;
+
+        uint64_t words[StatsSnapshotPage::wordCount];
+        for(unsigned attempt = 0 ; attempt < maxAttempts ; attempt++)
+        {
+            const uint64_t before = page_->sequence.load(std::memory_order_acquire);
+            if(!before)
+                return false;
+            if(before & 1)
+                continue;
+
+            for(size_t idx = 0 ; idx < StatsSnapshotPage::wordCount ; idx++)
+                words[idx] = page_->words[idx].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(page_->sequence.load(std::memory_order_relaxed) == before)
+            {
+                memcpy(&snapshot, words, sizeof(snapshot));
+                return true;
+            }
+        }
+        return false;
+    }
+};
@@ -16,24 +16,46 @@
 #include <unistd.h>
 
 #include <iostream>
-#include "cpuloadinfo.h"
-#include "networkinfo.h"
-#include "diskspaceinfo.h"
-#include "memoryinfo.h"
+#include "pressuremonitor.h"
+#include "sampler.h"
+#include "reportinterval.h"
+#include "endpointset.h"
+#include "datagramsender.h"
+#include "gossipagent.h"
+#include "inventoryinfo.h"
+#include "options.h"
+#include "snapshotpublisher.h"
+#include "spool.h"
+#include "spoolreplay.h"
 
 #include <mcproto/networkinfo.grpc.pb.h>
 #include <mcproto/cpuloadinfo.grpc.pb.h>
+#include <mcproto/cgroupinfo.grpc.pb.h>
 #include <mcproto/diskinfo.grpc.pb.h>
 #include <mcproto/memoryinfo.grpc.pb.h>
+#include <mcproto/pressureinfo.grpc.pb.h>
 #include <mcproto/infoupdate.grpc.pb.h>
 
-#include <grpc/grpc.h>
-#include <grpcpp/create_channel.h>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
 
 #include "adjustoomscore.h"
 #include "daemonize.h"
 #include "lockmemory.h"
 
+namespace
+{
+    // a client reporting over udp still sends a report over grpc this often, the reply is the
+    // only way it learns of the interval floor and of a server that wants the inventory again,
+    // and delivering it is what the spool is replayed behind
+    constexpr std::chrono::milliseconds udpControlInterval{30000};
+}
+
 uint32_t Utils::effectiveUserId()
 {
     return geteuid();
@@ -49,76 +71,171 @@ void Utils::initializeService()
     Daemonize::initiate("mclearcli.out", "mclearcli.err", "mclearcli.pid");
     std::cout << "Daemonize suceeded!" << std::endl;
 
-    //LockMemory::lock();
-    //std::cout << "Memory locking succeeded" << std::endl;
+    // the runloop is allocation free once warmed up, what gets locked is the
+    // binary, the thread stacks as far as they are touched and the preallocated buffers
+    try
+    {
+        LockMemory::lock();
+        std::cout << "Memory locking succeeded" << std::endl;
+    }
+    catch(const std::system_error& e)
+    {
+        // RLIMIT_MEMLOCK too low for an unprivileged user, reporting without is still better than not at all
+        std::cerr << "Memory locking failed: " << e.what() << std::endl;
+    }
     AdjOOMScore::adjust(-500);
     std::cout << "oom score adjust succeeded" << std::endl;
 }
 
-void Utils::run(uint32_t sec)
+void Utils::run(const Options& options)
 {
-    std::cout << "Starting runloop with sleep time:" << sec << std::endl;
-
-    char hostname[HOST_NAME_MAX + 1] = {};
-    gethostname(hostname, sizeof(hostname));
-    NetworkInfo netinfo;
-    CpuLoadInfo cpuinfo;
-    DiskSpaceInfo diskinfo;
-    MemoryInfo meminfo;
-
-    auto channel = grpc::CreateChannel("localhost:50051", grpc::InsecureChannelCredentials());
-    std::unique_ptr<mcproto::InfoUpdate::Stub> stub = mcproto::InfoUpdate::NewStub(channel);
-    mcproto::Empty result;
-
-    mcproto::Stats stats;
-    mcproto::DiskInfo* protodiskinfo = new mcproto::DiskInfo;
-    mcproto::CpuLoadInfo* protocpuloadinfo = new mcproto::CpuLoadInfo;
-    mcproto::NetworkInfo* protonetworkinfo = new mcproto::NetworkInfo;
-    mcproto::MemoryInfo* protomemoryinfo = new mcproto::MemoryInfo;
-    stats.set_allocated_cpuload(protocpuloadinfo);
-    stats.set_allocated_netinfo(protonetworkinfo);
-    stats.set_allocated_meminfo(protomemoryinfo);
-    stats.set_allocated_diskinfo(protodiskinfo);
-    stats.set_hostname(hostname);
-
-    for(;;)
+    std::cout << "Starting runloop with report interval(ms):" << options.minReportIntervalMs << '-' << options.maxReportIntervalMs << std::endl;
+
+    Sampler sampler(options.cgroups);
+    for(const CollectorSetting& setting : options.collectors)
+        sampler.configure(setting.name, setting.enabled, setting.periodMs);
+    sampler.setTopology(options.zone, options.rack);
+    sampler.setPools(options.pools);
+    if(options.ioUring)
     {
-        sleep(sec);
+        if(sampler.useIoRing())
+            std::cout << "Reading collector files through io_uring" << std::endl;
+        else
+            std::cerr << "io_uring unavailable, reading collector files synchronously" << std::endl;
+    }
+    PressureMonitor pressuremonitor(sampler.pressureInfo());
+    ReportInterval interval(options.minReportIntervalMs, options.maxReportIntervalMs, options.reportIntervalMs);
+
+    EndpointSet endpoints(options.servers, options.deadlineMs);
+    mcproto::StatsReply result;
+
+    // sent ahead of the first report, and again to a server that asks for it
+    mcproto::Inventory inventory;
+    InventoryInfo().get(inventory);
+    inventory.set_hostname(sampler.stats().hostname());
+    inventory.set_defaultinterface(sampler.collectors().get<NetworkCollector>().info.interface());
+    bool inventoryWanted = !endpoints.send(inventory);
+    std::cout << "Inventory of " << inventory.cores() << " cores, " << inventory.ramtotalmb() << "MB RAM"
+              << (inventoryWanted ? " not delivered yet" : " delivered") << std::endl;
+
+    std::unique_ptr<Spool> spool;
+    if(options.spoolSizeKb)
+    {
+        try
+        {
+            spool = std::make_unique<Spool>(options.spoolPath, size_t(options.spoolSizeKb) * 1024);
+            std::cout << "Spooling undelivered samples to " << options.spoolPath << ", " << spool->size() << " waiting for replay" << std::endl;
+        }
+        catch(const std::system_error& e)
+        {
+            std::cerr << "Spooling disabled: " << e.what() << std::endl;
+        }
+    }
+    std::unique_ptr<SnapshotPublisher> snapshot;
+    if(!options.snapshotName.empty())
+    {
+        try
+        {
+            snapshot = std::make_unique<SnapshotPublisher>(options.snapshotName);
+        }
+        catch(const std::system_error& e)
+        {
+            std::cerr << "Snapshot publishing disabled: " << e.what() << std::endl;
+        }
+    }
 
-        if(!diskinfo.update())
+    std::unique_ptr<GossipAgent> gossip;
+    if(options.gossipPort)
+    {
+        try
         {
-            protodiskinfo->Clear();
-            std::cerr << "DiskInfo Update failed\n";
+            gossip = std::make_unique<GossipAgent>(options.gossipPort, options.gossipSeeds);
+            std::cout << "Gossiping load on udp port " << options.gossipPort << std::endl;
         }
-        else
+        catch(const std::exception& e)
         {
-            protodiskinfo->set_availablespace(diskinfo.availableSpace());            
+            std::cerr << "Gossip disabled: " << e.what() << std::endl;
         }
+    }
 
-        if(!meminfo.update())
+    std::unique_ptr<DatagramSender> datagrams;
+    if(!options.udpServer.empty())
+    {
+        try
         {
-            protomemoryinfo->Clear();
-            std::cerr << "MemInfo update failed\n";
+            std::optional<mcproto::StatsDatagram::Key> key;
+            if(!options.udpKey.empty())
+                mcproto::StatsDatagram::parseKey(options.udpKey, key.emplace());
+            datagrams = std::make_unique<DatagramSender>(options.udpServer, key);
+            std::cout << "Reporting over udp to " << options.udpServer << std::endl;
         }
-        else
+        catch(const std::exception& e)
         {
-            protomemoryinfo->set_availableswap(meminfo.availableSwap());
-            protomemoryinfo->set_availableram(meminfo.availableRam());
-            protomemoryinfo->set_availablerampercent(meminfo.availableRamPercent());
-            protomemoryinfo->set_availableswappercent(meminfo.availableSwapPercent());
-            protomemoryinfo->set_avg10processstalltime(meminfo.avg10ProcessStallTime());
+            std::cerr << "Datagram reports disabled: " << e.what() << std::endl;
         }
+    }
 
-        protocpuloadinfo->set_cpuload(cpuinfo.cpuLoad());
-        protonetworkinfo->set_bandwidthusage(netinfo.bandwidthUsage());
+    std::string encoded;
+    encoded.reserve(Sampler::arenaBlockSize);
+    SpoolReplay replay;
 
-        grpc::ClientContext context;
-        grpc::Status status = stub->SendStats(&context, stats, &result);
-        
-        if(!status.ok())
+    using namespace std::chrono;
+    auto nextTick = steady_clock::now() + milliseconds(interval.intervalMs());
+    auto nextControl = steady_clock::now() + udpControlInterval;
+    for(;;)
+    {
+        // a pressure trigger firing cuts the wait short and the report goes out of band
+        const uint32_t triggered = pressuremonitor.wait(duration_cast<milliseconds>(nextTick - steady_clock::now()).count());
+        if(triggered)
+            std::cout << "pressure trigger fired, sending out-of-band report" << std::endl;
+
+        sampler.update(triggered);
+        if(snapshot)
+            snapshot->publish(sampler.stats());
+        if(gossip)
+            gossip->publish(sampler.stats());
+        interval.adapt(sampler.sample());
+        sampler.setNextReportMs(interval.intervalMs());
+
+        // a datagram the kernel took is as good as delivered, one it refused goes the gRPC way,
+        // and so does one report per control interval
+        const bool control = steady_clock::now() >= nextControl;
+        if(datagrams && !control && datagrams->send(sampler.stats()))
+        {
+            // no reply to ask for it, only the first delivery is retried
+            if(inventoryWanted)
+                inventoryWanted = !endpoints.send(inventory);
+            nextTick = steady_clock::now() + milliseconds(interval.intervalMs());
+            continue;
+        }
+        if(control)
+            nextControl = steady_clock::now() + udpControlInterval;
+
+        if(!endpoints.send(sampler.stats(), result))
         {
-            // TODO: send the update to the backup server
-            std::cerr << "rpc failed!\n";
+            std::cerr << "rpc failed on all servers!\n";
+            if(spool && (!sampler.stats().SerializeToString(&encoded) || !spool->push(encoded)))
+                std::cerr << "sample could not be spooled\n";
         }
+        else
+        {
+            interval.setServerFloor(result.reportintervalms());
+            // a server that restarted or a failover to one that never heard of the node
+            if(inventoryWanted || result.inventorywanted())
+                inventoryWanted = !endpoints.send(inventory);
+            // a batch per delivered report, the interval floor the server hands back paces the replay
+            if(spool && !spool->empty())
+            {
+                if(replay.send(*spool, endpoints, result))
+                {
+                    interval.setServerFloor(result.reportintervalms());
+                    std::cout << "replayed " << replay.sent() << " spooled samples, " << spool->size() << " left" << std::endl;
+                }
+                else
+                    std::cerr << "replay rpc failed!\n";
+            }
+        }
+
+        nextTick = steady_clock::now() + milliseconds(interval.intervalMs());
     }
 }
@@ -16,6 +16,8 @@
 
 #include <cstdint>
 
+struct Options;
+
 class Utils
 {
     static uint32_t effectiveUserId();
@@ -23,5 +25,5 @@ class Utils
 public:
     static bool runningAsSudo();
     static void initializeService();
-    static void run(uint32_t sec);
+    static void run(const Options& options);
 };
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "statsdatagram.h"
+
+#include <mcproto/infoupdate.pb.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    // flags
+    constexpr uint8_t signedPacket = 1;
+
+    void put32(char* out, uint32_t value)
+    {
+        for(int idx = 0 ; idx < 4 ; idx++)
+            out[idx] = char(value >> (8 * idx));
+    }
+
+    void put64(char* out, uint64_t value)
+    {
+        for(int idx = 0 ; idx < 8 ; idx++)
+            out[idx] = char(value >> (8 * idx));
+    }
+
+    void putFloat(char* out, float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put32(out, bits);
+    }
+
+    uint32_t get32(const char* in)
+    {
+        uint32_t value = 0;
+        for(int idx = 0 ; idx < 4 ; idx++)
+            value |= uint32_t(uint8_t(in[idx])) << (8 * idx);
+        return value;
+    }
+
+    uint64_t get64(const char* in)
+    {
+        uint64_t value = 0;
+        for(int idx = 0 ; idx < 8 ; idx++)
+            value |= uint64_t(uint8_t(in[idx])) << (8 * idx);
+        return value;
+    }
+
+    float getFloat(const char* in)
+    {
+        const uint32_t bits = get32(in);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    /// looks at every byte whatever the first difference, so the time taken tells nothing about
+    /// how much of a forged tag was right
+    bool sameTag(const char* received, uint64_t expected)
+    {
+        uint8_t difference = 0;
+        for(int idx = 0 ; idx < 8 ; idx++)
+            difference |= uint8_t(received[idx]) ^ uint8_t(expected >> (8 * idx));
+        return !difference;
+    }
+
+    uint64_t rotate(uint64_t value, int bits)
+    {
+        return value << bits | value >> (64 - bits);
+    }
+
+    void sipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+    {
+        v0 += v1; v1 = rotate(v1, 13); v1 ^= v0; v0 = rotate(v0, 32);
+        v2 += v3; v3 = rotate(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotate(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotate(v1, 17); v1 ^= v2; v2 = rotate(v2, 32);
+    }
+}
+
+namespace mcproto
+{
+    StatsDatagram StatsDatagram::from(const Stats& stats)
+    {
+        StatsDatagram datagram;
+        datagram.hostname = stats.hostname();
+        datagram.zone = stats.topology().zone();
+        datagram.rack = stats.topology().rack();
+        datagram.runId = stats.runid();
+        datagram.sequence = stats.sequence();
+        datagram.collectedAtMs = stats.collectedatms();
+        datagram.nextReportMs = stats.nextreportms();
+
+        if(stats.has_cpuload())
+            datagram.cpuIdlePercent = 100. - double(stats.cpuload().cpuload()) / 100.;
+
+        if(stats.has_diskinfo())
+            datagram.diskSpaceAvailable = stats.diskinfo().availablespace();
+
+        if(stats.has_netinfo())
+            datagram.networkBandwidthUsed = stats.netinfo().bandwidthusage();
+
+        if(stats.has_meminfo())
+        {
+            datagram.ramAvailable = stats.meminfo().availableram();
+            datagram.ramAvailablePercent = stats.meminfo().availablerampercent();
+            datagram.swapAvailablePercent = stats.meminfo().availableswappercent();
+        }
+
+        if(stats.has_pressure())
+            datagram.pressure = std::max({stats.pressure().cpuavg10(), stats.pressure().memoryavg10(), stats.pressure().ioavg10()});
+
+        for(const AppLoad& appload : stats.apploads())
+            datagram.appInFlight += appload.inflight();
+
+        for(const CgroupInfo& cgroup : stats.cgroups())
+        {
+            datagram.cpuIdlePercent = std::min(datagram.cpuIdlePercent, float(cgroup.cpuheadroom() / 100.));
+            datagram.ramAvailablePercent = std::min<uint32_t>(datagram.ramAvailablePercent, cgroup.memoryheadroompercent());
+            if(cgroup.memorylimit())
+                datagram.ramAvailable = std::min<uint64_t>(datagram.ramAvailable, (cgroup.memorylimit() - std::min(cgroup.memorylimit(), cgroup.memorycurrent())) >> 20);
+        }
+
+        return datagram;
+    }
+
+    size_t StatsDatagram::encode(char* buffer, size_t size, const Key* key) const
+    {
+        if(hostname.size() > maxNameLength || zone.size() > maxNameLength || rack.size() > maxNameLength)
+            return 0;
+        const size_t length = fixedSize + hostname.size() + zone.size() + rack.size() + (key ? macSize : 0);
+        if(length > size)
+            return 0;
+
+        put32(buffer, magic);
+        buffer[4] = char(hostname.size());
+        buffer[5] = char(zone.size());
+        buffer[6] = char(rack.size());
+        buffer[7] = char(key ? signedPacket : 0);
+        put64(buffer + 8, runId);
+        put64(buffer + 16, sequence);
+        put64(buffer + 24, collectedAtMs);
+        put64(buffer + 32, diskSpaceAvailable);
+        put64(buffer + 40, ramAvailable);
+        putFloat(buffer + 48, cpuIdlePercent);
+        putFloat(buffer + 52, pressure);
+        put32(buffer + 56, networkBandwidthUsed);
+        put32(buffer + 60, nextReportMs);
+        put64(buffer + 64, uint64_t(appInFlight));
+        buffer[72] = char(ramAvailablePercent);
+        buffer[73] = char(swapAvailablePercent);
+        buffer[74] = buffer[75] = 0;
+
+        char* names = buffer + fixedSize;
+        std::memcpy(names, hostname.data(), hostname.size());
+        std::memcpy(names + hostname.size(), zone.data(), zone.size());
+        std::memcpy(names + hostname.size() + zone.size(), rack.data(), rack.size());
+        if(key)
+            put64(buffer + length - macSize, mac(*key, buffer, length - macSize));
+        return length;
+    }
+
+    bool StatsDatagram::decode(const char* buffer, size_t size, const Key* key)
+    {
+        if(size < fixedSize || get32(buffer) != magic)
+            return false;
+        const size_t hostnameLength = uint8_t(buffer[4]);
+        const size_t zoneLength = uint8_t(buffer[5]);
+        const size_t rackLength = uint8_t(buffer[6]);
+        const bool isSigned = buffer[7] & signedPacket;
+        if(size != fixedSize + hostnameLength + zoneLength + rackLength + (isSigned ? macSize : 0) || !hostnameLength)
+            return false;
+        // a server with a key takes nothing unsigned, one without does not check
+        if(key && (!isSigned || !sameTag(buffer + size - macSize, mac(*key, buffer, size - macSize))))
+            return false;
+
+        runId = get64(buffer + 8);
+        sequence = get64(buffer + 16);
+        collectedAtMs = get64(buffer + 24);
+        diskSpaceAvailable = get64(buffer + 32);
+        ramAvailable = get64(buffer + 40);
+        cpuIdlePercent = getFloat(buffer + 48);
+        pressure = getFloat(buffer + 52);
+        networkBandwidthUsed = get32(buffer + 56);
+        nextReportMs = get32(buffer + 60);
+        appInFlight = int64_t(get64(buffer + 64));
+        ramAvailablePercent = uint8_t(buffer[72]);
+        swapAvailablePercent = uint8_t(buffer[73]);
+        // a NaN would get past every comparison of the ranking, an infinity to its top
+        if(!std::isfinite(cpuIdlePercent) || !std::isfinite(pressure))
+            return false;
+
+        const char* names = buffer + fixedSize;
+        hostname = std::string_view(names, hostnameLength);
+        zone = std::string_view(names + hostnameLength, zoneLength);
+        rack = std::string_view(names + hostnameLength + zoneLength, rackLength);
+        return true;
+    }
+
+    bool StatsDatagram::parseKey(std::string_view hex, Key& key)
+    {
+        if(hex.size() != 2 * key.size())
+            return false;
+        auto digit = [](char c) -> int
+        {
+            if(c >= '0' && c <= '9')
+                return c - '0';
+            if(c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            if(c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+            return -1;
+        };
+        for(size_t idx = 0 ; idx < key.size() ; idx++)
+        {
+            const int high = digit(hex[2 * idx]);
+            const int low = digit(hex[2 * idx + 1]);
+            if(high < 0 || low < 0)
+                return false;
+            key[idx] = uint8_t(high << 4 | low);
+        }
+        return true;
+    }
+
+    uint64_t StatsDatagram::mac(const Key& key, const char* data, size_t size)
+    {
+        const uint64_t k0 = get64(reinterpret_cast<const char*>(key.data()));
+        const uint64_t k1 = get64(reinterpret_cast<const char*>(key.data()) + 8);
+        uint64_t v0 = 0x736f6d6570736575ull ^ k0;
+        uint64_t v1 = 0x646f72616e646f6dull ^ k1;
+        uint64_t v2 = 0x6c7967656e657261ull ^ k0;
+        uint64_t v3 = 0x7465646279746573ull ^ k1;
+
+        const size_t whole = size / 8 * 8;
+        for(size_t offset = 0 ; offset < whole ; offset += 8)
+        {
+            const uint64_t word = get64(data + offset);
+            v3 ^= word;
+            sipRound(v0, v1, v2, v3);
+            sipRound(v0, v1, v2, v3);
+            v0 ^= word;
+        }
+
+        uint64_t last = uint64_t(size) << 56;
+        for(size_t idx = whole ; idx < size ; idx++)
+            last |= uint64_t(uint8_t(data[idx])) << (8 * (idx - whole));
+        v3 ^= last;
+        sipRound(v0, v1, v2, v3);
+        sipRound(v0, v1, v2, v3);
+        v0 ^= last;
+
+        v2 ^= 0xff;
+        for(int round = 0 ; round < 4 ; round++)
+            sipRound(v0, v1, v2, v3);
+        return v0 ^ v1 ^ v2 ^ v3;
+    }
+}
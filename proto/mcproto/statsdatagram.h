@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace mcproto
+{
+    class Stats;
+
+    /// The figures the server ranks a node by, in one fixed layout UDP packet of about 100
+    /// bytes, for fleets where a gRPC call per report costs more than the report. Little endian
+    /// on the wire, the fixed part first and the hostname, zone and rack after it. Packets are
+    /// signed with SipHash-2-4 when client and server share a key, a retransmitted or replayed
+    /// packet is turned away by its sequence like a gRPC report is.
+    struct StatsDatagram
+    {
+        using Key = std::array<uint8_t, 16>;
+
+        static constexpr uint32_t magic = 0x3144434du;     // "MCD1"
+        static constexpr size_t fixedSize = 76;
+        static constexpr size_t macSize = 8;
+        static constexpr size_t maxNameLength = 255;
+        static constexpr size_t maxSize = fixedSize + 3 * maxNameLength + macSize;
+
+        // the names are views, into the Stats or the packet they came from
+        std::string_view hostname;
+        std::string_view zone;
+        std::string_view rack;
+        uint64_t runId = 0;
+        uint64_t sequence = 0;
+        uint64_t collectedAtMs = 0;
+        float cpuIdlePercent = 0.f;
+        uint64_t diskSpaceAvailable = 0;    // KB
+        uint32_t networkBandwidthUsed = 0;  // bytes/sec
+        uint64_t ramAvailable = 0;          // MB
+        uint8_t ramAvailablePercent = 0;
+        uint8_t swapAvailablePercent = 0;
+        float pressure = 0.f;               // highest avg10 stall percentage
+        int64_t appInFlight = 0;
+        uint32_t nextReportMs = 0;
+
+        /// the figures of a report as the server ranks by them, with the headroom of the
+        /// cgroups folded in: a slice running out of its own limits makes the node as
+        /// unattractive as the host running out
+        static StatsDatagram from(const Stats& stats);
+
+        /// returns the size of the packet, 0 when it does not fit into size or a name is too long
+        size_t encode(char* buffer, size_t size, const Key* key = nullptr) const;
+        /// false for anything but an intact packet, signed with key when there is one, with
+        /// finite figures. The names point into buffer.
+        bool decode(const char* buffer, size_t size, const Key* key = nullptr);
+
+        /// 32 hex digits
+        static bool parseKey(std::string_view hex, Key& key);
+        /// SipHash-2-4
+        static uint64_t mac(const Key& key, const char* data, size_t size);
+    };
+}
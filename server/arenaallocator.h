@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include <google/protobuf/arena.h>
+#include <grpcpp/support/message_allocator.h>
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Hands out the request and response of a callback unary call on a per-call protobuf arena.
+/// Every arena starts out on an inline block and is pooled once the call is done, so a call whose
+/// messages fit the block does not touch the heap for its messages.
+template <typename RequestT, typename ResponseT, size_t BlockSize = 4096>
+class ArenaMessageAllocator : public grpc::MessageAllocator<RequestT, ResponseT>
+{
+    class Holder : public grpc::MessageHolder<RequestT, ResponseT>
+    {
+        ArenaMessageAllocator& owner_;
+        alignas(std::max_align_t) char block_[BlockSize];
+        google::protobuf::Arena arena_;
+
+        static google::protobuf::ArenaOptions arenaOptions(char* block)
+        {
+            google::protobuf::ArenaOptions options;
+            options.initial_block = block;
+            options.initial_block_size = BlockSize;
+            return options;
+        }
+
+    public:
+        explicit Holder(ArenaMessageAllocator& owner) : owner_(owner), arena_(arenaOptions(block_))
+        {}
+
+        void reset()
+        {
+            this->set_request(google::protobuf::Arena::CreateMessage<RequestT>(&arena_));
+            this->set_response(google::protobuf::Arena::CreateMessage<ResponseT>(&arena_));
+        }
+
+        void Release() override
+        {
+            // keeps the inline block, frees anything a large message needed on top of it
+            arena_.Reset();
+            owner_.recycle(this);
+        }
+    };
+
+    std::mutex protect_;
+    std::vector<std::unique_ptr<Holder>> holders_;
+    std::vector<Holder*> free_;
+
+    void recycle(Holder* holder)
+    {
+        std::lock_guard<std::mutex> guard(protect_);
+        free_.push_back(holder);
+    }
+
+public:
+    /// preallocated is the number of calls expected in flight at once, more are added on demand
+    explicit ArenaMessageAllocator(size_t preallocated = 64)
+    {
+        holders_.reserve(preallocated);
+        free_.reserve(preallocated);
+        for(size_t idx = 0 ; idx < preallocated ; idx++)
+        {
+            holders_.emplace_back(new Holder(*this));
+            free_.push_back(holders_.back().get());
+        }
+    }
+
+    grpc::MessageHolder<RequestT, ResponseT>* AllocateMessages() override
+    {
+        Holder* holder;
+        {
+            std::lock_guard<std::mutex> guard(protect_);
+            if(free_.empty())
+            {
+                holders_.emplace_back(new Holder(*this));
+                free_.reserve(holders_.capacity());
+                holder = holders_.back().get();
+            }
+            else
+            {
+                holder = free_.back();
+                free_.pop_back();
+            }
+        }
+        holder->reset();
+        return holder;
+    }
+
+    /// number of arenas, the peak of calls in flight at once
+    size_t pooled()
+    {
+        std::lock_guard<std::mutex> guard(protect_);
+        return holders_.size();
+    }
+};
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "assignmentledger.h"
+
+#include <algorithm>
+
+AssignmentLedger::AssignmentLedger(Config config):
+    config_(config),
+    cost_(config.initialCost)
+{}
+
+void AssignmentLedger::add(uint32_t slot)
+{
+    while(counters_.size() <= slot)
+        counters_.emplace_back();
+}
+
+void AssignmentLedger::report(uint32_t slot, float previousScore, float score)
+{
+    Counters& counters = counters_[slot];
+    const uint32_t assigned = counters.sinceReport.exchange(0, std::memory_order_relaxed);
+
+    // the drop per assignment, whatever else changed on the node is noise the average smooths out
+    if(assigned)
+    {
+        const float observed = std::clamp((previousScore - score) / assigned, config_.minCost, config_.maxCost);
+        cost_ += config_.learningRate * (observed - cost_);
+    }
+
+    const uint32_t pending = counters.pending.load(std::memory_order_relaxed);
+    counters.pending.store(uint32_t(pending * config_.keep), std::memory_order_relaxed);
+}
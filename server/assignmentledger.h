@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+/// The nodes handed out since their last report. A node that just reported is the best until its
+/// next report shows the load it got, every router picking it in the meantime herds onto it. The
+/// ledger counts the assignments per node and charges each with an estimated cost in score
+/// points, learned from how much the score of assigned nodes dropped by their next report.
+///
+/// assign() is a relaxed atomic add and safe among any number of routers holding the store
+/// shared. add() and report() change the ledger and run under the exclusive lock of ingest.
+class AssignmentLedger
+{
+public:
+    struct Config
+    {
+        /// score points an assignment costs until the first reports tell better
+        float initialCost = 2.f;
+        /// requests finished before the report show no drop at all, without a floor short
+        /// requests would teach a cost of zero and the herding would be back
+        float minCost = 0.5f;
+        float maxCost = 25.f;
+        /// weight of the cost observed by one report
+        float learningRate = 0.05f;
+        /// share of the pending assignments still counted after a report: a sample already shows
+        /// most of the load handed out before it was taken, the rest is still starting up
+        float keep = 0.5f;
+    };
+
+    explicit AssignmentLedger(Config config);
+    AssignmentLedger(): AssignmentLedger(Config{}) {}
+    AssignmentLedger(const AssignmentLedger&) = delete;
+    AssignmentLedger& operator=(const AssignmentLedger&) = delete;
+
+    /// slots are handed out densely, the next one
+    void add(uint32_t slot);
+    void assign(uint32_t slot)
+    {
+        counters_[slot].pending.fetch_add(unit, std::memory_order_relaxed);
+        counters_[slot].sinceReport.fetch_add(1, std::memory_order_relaxed);
+    }
+    /// a fresh report of the slot: learns from its score change and decays what is pending
+    void report(uint32_t slot, float previousScore, float score);
+
+    /// assignments still counted against the slot
+    float pending(uint32_t slot) const { return float(counters_[slot].pending.load(std::memory_order_relaxed)) / unit; }
+    /// score points to take off the reported score of the slot
+    float penalty(uint32_t slot) const { return cost_ * pending(slot); }
+    float cost() const { return cost_; }
+    size_t size() const { return counters_.size(); }
+
+private:
+    /// fixed point, so that decaying keeps fractions of an assignment
+    static constexpr uint32_t unit = 256;
+
+    struct Counters
+    {
+        std::atomic<uint32_t> pending{0};
+        std::atomic<uint32_t> sinceReport{0};
+    };
+
+    Config config_;
+    // a deque never moves the atomics when it grows
+    std::deque<Counters> counters_;
+    float cost_;
+};
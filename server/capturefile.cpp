@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "capturefile.h"
+
+#include <mcproto/infoupdate.pb.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+    constexpr size_t maxVarintBytes = 10;
+
+    std::system_error lastError(const std::string& what)
+    {
+        return std::system_error(std::error_code(errno, std::system_category()), what);
+    }
+
+    char* putVarint(char* out, uint64_t value)
+    {
+        while(value >= 0x80)
+        {
+            *out++ = char(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = char(value);
+        return out;
+    }
+
+    bool getVarint(const char*& in, const char* end, uint64_t& value)
+    {
+        value = 0;
+        for(uint32_t shift = 0 ; in < end && shift < 64 ; shift += 7)
+        {
+            const uint8_t byte = uint8_t(*in++);
+            value |= uint64_t(byte & 0x7f) << shift;
+            if(!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    void writeAll(int fd, const char* data, size_t size)
+    {
+        while(size)
+        {
+            const ssize_t written = write(fd, data, size);
+            if(written == -1)
+            {
+                if(errno == EINTR)
+                    continue;
+                // a full disk loses the rest of the capture, not the server
+                return;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+}
+
+CaptureWriter::CaptureWriter(const std::string& path, const Config& config):
+    fd_(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+    config_(config),
+    start_(std::chrono::steady_clock::now()),
+    lastOffsetUs_(0),
+    recorded_(0),
+    dropped_(0),
+    bytes_(capture::headerSize),
+    flushing_(false),
+    stop_(false)
+{
+    if(fd_ == -1)
+        throw lastError("cannot create capture " + path);
+
+    char header[capture::headerSize];
+    std::memcpy(header, capture::magic, sizeof(capture::magic));
+    uint64_t startWallUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    for(size_t idx = 0 ; idx < sizeof(startWallUs) ; idx++)
+        header[sizeof(capture::magic) + idx] = char(startWallUs >> (8 * idx));
+    writeAll(fd_, header, sizeof(header));
+
+    active_.reserve(config_.bufferBytes);
+    writing_.reserve(config_.bufferBytes);
+    thread_ = std::thread(&CaptureWriter::run, this);
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    close(fd_);
+}
+
+bool CaptureWriter::record(const mcproto::Stats& stats)
+{
+    return append(stats, false);
+}
+
+bool CaptureWriter::record(const mcproto::StatsBatch& batch)
+{
+    return append(batch, true);
+}
+
+template <typename Message>
+bool CaptureWriter::append(const Message& message, bool batch)
+{
+    const size_t size = message.ByteSizeLong();
+    const uint64_t offsetUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t needed = 2 * maxVarintBytes + size;
+    if(active_.size() + needed > config_.bufferBytes)
+    {
+        // the thread is still busy with the other buffer, or the report would not fit into any
+        if(!writing_.empty() || needed > config_.bufferBytes)
+        {
+            dropped_++;
+            return false;
+        }
+        std::swap(active_, writing_);
+        wake_.notify_one();
+    }
+
+    // reports taken by other threads may get here in a different order than their clocks say
+    const uint64_t deltaUs = offsetUs > lastOffsetUs_ ? offsetUs - lastOffsetUs_ : 0;
+    lastOffsetUs_ = std::max(lastOffsetUs_, offsetUs);
+
+    const size_t begin = active_.size();
+    // within the capacity reserved, no allocation
+    active_.resize(begin + needed);
+    char* out = putVarint(active_.data() + begin, deltaUs);
+    out = putVarint(out, uint64_t(size) << 1 | (batch ? 1 : 0));
+    message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(out));
+    active_.resize(out + size - active_.data());
+    recorded_++;
+    return true;
+}
+
+void CaptureWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    flushing_ = true;
+    wake_.notify_one();
+    drained_.wait(lock, [this]{ return !flushing_; });
+}
+
+uint64_t CaptureWriter::recorded() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return recorded_;
+}
+
+uint64_t CaptureWriter::dropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
+
+uint64_t CaptureWriter::bytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
+
+void CaptureWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for(;;)
+    {
+        wake_.wait_for(lock, config_.flushInterval, [this]{ return stop_ || flushing_ || !writing_.empty(); });
+        // a full buffer handed over, or what there is once a flush interval
+        if(writing_.empty())
+            std::swap(active_, writing_);
+
+        if(!writing_.empty())
+        {
+            lock.unlock();
+            writeAll(fd_, writing_.data(), writing_.size());
+            lock.lock();
+            bytes_ += writing_.size();
+            writing_.clear();
+            // what was recorded while writing goes out before a flush or the end is done
+            if(!active_.empty() && (flushing_ || stop_))
+                continue;
+        }
+
+        if(flushing_)
+        {
+            flushing_ = false;
+            drained_.notify_all();
+        }
+        if(stop_)
+            return;
+    }
+}
+
+CaptureReader::CaptureReader(const std::string& path):
+    data_(nullptr),
+    size_(0),
+    position_(capture::headerSize),
+    offsetUs_(0),
+    startWallUs_(0),
+    truncated_(false)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        throw lastError("cannot open capture " + path);
+
+    struct stat status;
+    if(fstat(fd, &status) == -1)
+    {
+        std::system_error error = lastError("cannot open capture " + path);
+        close(fd);
+        throw error;
+    }
+    size_ = status.st_size;
+    if(size_ < capture::headerSize)
+    {
+        close(fd);
+        throw std::invalid_argument(path + " is not a capture");
+    }
+
+    void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED)
+        throw lastError("cannot map capture " + path);
+    data_ = static_cast<const char*>(mapped);
+    // read front to back
+    madvise(mapped, size_, MADV_SEQUENTIAL);
+
+    if(std::memcmp(data_, capture::magic, sizeof(capture::magic)))
+    {
+        munmap(mapped, size_);
+        throw std::invalid_argument(path + " is not a capture");
+    }
+    for(size_t idx = 0 ; idx < sizeof(startWallUs_) ; idx++)
+        startWallUs_ |= uint64_t(uint8_t(data_[sizeof(capture::magic) + idx])) << (8 * idx);
+}
+
+CaptureReader::~CaptureReader()
+{
+    munmap(const_cast<char*>(data_), size_);
+}
+
+bool CaptureReader::next(Record& record)
+{
+    if(position_ == size_)
+        return false;
+
+    const char* in = data_ + position_;
+    const char* end = data_ + size_;
+    uint64_t deltaUs, size;
+    if(!getVarint(in, end, deltaUs) || !getVarint(in, end, size) || uint64_t(end - in) < (size >> 1))
+    {
+        truncated_ = true;
+        position_ = size_;
+        return false;
+    }
+
+    offsetUs_ += deltaUs;
+    record.offsetUs = offsetUs_;
+    record.batch = size & 1;
+    record.payload = std::string_view(in, size >> 1);
+    position_ = in + (size >> 1) - data_;
+    return true;
+}
+
+void CaptureReader::rewind()
+{
+    position_ = capture::headerSize;
+    offsetUs_ = 0;
+    truncated_ = false;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace mcproto
+{
+    class Stats;
+    class StatsBatch;
+}
+
+/// A capture is the stats traffic a server took, as it arrived, for replaying real traffic
+/// shapes against a server later: bursts, fleets reporting in step, nodes flapping. The file
+/// starts with a magic and the wall clock time the capture started at. Every record after that
+/// is the time since the record before in us and the size of the message, both as varints, the
+/// lowest bit of the size telling a StatsBatch from a Stats, then the serialized message.
+namespace capture
+{
+    constexpr char magic[8] = {'M', 'C', 'C', 'A', 'P', 'T', 'R', '1'};
+    constexpr size_t headerSize = sizeof(magic) + sizeof(uint64_t);
+}
+
+/// Records the reports a server takes into a capture. record() serializes into a buffer in
+/// memory, a thread of its own writes full buffers out, and one partly filled once a second.
+/// The ingest path never waits for the disk: while the thread is still writing out one buffer
+/// and the other fills up, reports are dropped from the capture and counted.
+///
+/// record() is safe among any number of threads.
+class CaptureWriter
+{
+public:
+    struct Config
+    {
+        /// each of the two buffers
+        size_t bufferBytes = 4 << 20;
+        /// a buffer that is not full yet goes out that often
+        std::chrono::milliseconds flushInterval{1000};
+    };
+
+    /// throws std::system_error when the file cannot be created
+    CaptureWriter(const std::string& path, const Config& config);
+    explicit CaptureWriter(const std::string& path): CaptureWriter(path, Config{}) {}
+    /// writes out what is buffered
+    ~CaptureWriter();
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    /// false when the report was dropped from the capture
+    bool record(const mcproto::Stats& stats);
+    bool record(const mcproto::StatsBatch& batch);
+    /// returns once everything recorded so far is written out
+    void flush();
+
+    uint64_t recorded() const;
+    uint64_t dropped() const;
+    /// written out so far, header included
+    uint64_t bytes() const;
+
+private:
+    int fd_;
+    Config config_;
+    std::chrono::steady_clock::time_point start_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable drained_;
+    std::vector<char> active_;
+    std::vector<char> writing_;
+    uint64_t lastOffsetUs_;
+    uint64_t recorded_;
+    uint64_t dropped_;
+    uint64_t bytes_;
+    bool flushing_;
+    bool stop_;
+    std::thread thread_;
+
+    template <typename Message>
+    bool append(const Message& message, bool batch);
+    void run();
+};
+
+/// Reads a capture back, record by record. The file is mapped, the payloads point into it.
+class CaptureReader
+{
+public:
+    struct Record
+    {
+        /// since the start of the capture
+        uint64_t offsetUs;
+        bool batch;
+        /// a serialized mcproto::StatsBatch when batch is set, an mcproto::Stats otherwise
+        std::string_view payload;
+    };
+
+    /// throws std::system_error when the file cannot be read, std::invalid_argument when it is
+    /// not a capture
+    explicit CaptureReader(const std::string& path);
+    ~CaptureReader();
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    /// false at the end, and at a record cut short by a writer that died
+    bool next(Record& record);
+    /// starts over with the first record
+    void rewind();
+    uint64_t startWallUs() const { return startWallUs_; }
+    /// the capture ends in a record cut short
+    bool truncated() const { return truncated_; }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t position_;
+    uint64_t offsetUs_;
+    uint64_t startWallUs_;
+    bool truncated_;
+};
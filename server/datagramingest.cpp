@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "datagramingest.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+    // how soon a receiver notices it is to stop
+    constexpr int pollTimeoutMs = 200;
+    // reports the applier takes from a ring at a time, so one busy receiver cannot starve the rest
+    constexpr size_t drainBatch = 1024;
+    // the rings of a receiver are not made smaller than this to share its slots out over the shards
+    constexpr uint32_t minRingSlots = 256;
+    // socket buffer asked for, the kernel caps it at net.core.rmem_max
+    constexpr int receiveBufferBytes = 4 << 20;
+
+    int bindSocket(uint16_t port)
+    {
+        const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if(fd == -1)
+            throw std::system_error(std::error_code(errno, std::system_category()), "cannot create datagram socket");
+
+        const int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBufferBytes, sizeof(receiveBufferBytes));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if(bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+        {
+            std::system_error error(std::error_code(errno, std::system_category()), "cannot bind datagram port " + std::to_string(port));
+            close(fd);
+            throw error;
+        }
+        return fd;
+    }
+
+    uint16_t boundPort(int fd)
+    {
+        sockaddr_in address{};
+        socklen_t size = sizeof(address);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size);
+        return ntohs(address.sin_port);
+    }
+}
+
+DatagramIngest::DatagramIngest(InfoUpdateService& service, const Config& config):
+    service_(service),
+    config_(config),
+    port_(config.port),
+    shards_(service.shards()),
+    applied_(0),
+    stop_(false),
+    stopAppliers_(false)
+{
+    if(!config_.threads)
+        config_.threads = std::max(1u, std::thread::hardware_concurrency());
+    if(!config_.batch)
+        config_.batch = 1;
+    if(!config_.ringSlots || (config_.ringSlots & (config_.ringSlots - 1)))
+        throw std::invalid_argument("datagram ring slots must be a power of two");
+    ringSlots_ = config_.ringSlots;
+    while(ringSlots_ > minRingSlots && size_t(ringSlots_) * shards_ > config_.ringSlots)
+        ringSlots_ /= 2;
+
+    try
+    {
+        for(uint32_t idx = 0 ; idx < config_.threads ; idx++)
+        {
+            auto receiver = std::make_unique<Receiver>();
+            receiver->rings = std::make_unique<Ring[]>(shards_);
+            for(size_t shard = 0 ; shard < shards_ ; shard++)
+                receiver->rings[shard].slots = std::make_unique<Slot[]>(ringSlots_);
+            receiver->socket = bindSocket(port_);
+            // the first socket picks the port when asked for any, the others join it there
+            port_ = boundPort(receiver->socket);
+            receivers_.push_back(std::move(receiver));
+        }
+    }
+    catch(...)
+    {
+        for(const std::unique_ptr<Receiver>& receiver : receivers_)
+            close(receiver->socket);
+        throw;
+    }
+
+    for(const std::unique_ptr<Receiver>& receiver : receivers_)
+        receiver->thread = std::thread(&DatagramIngest::receive, this, std::ref(*receiver));
+    for(size_t shard = 0 ; shard < shards_ ; shard++)
+        appliers_.emplace_back(&DatagramIngest::apply, this, shard);
+}
+
+DatagramIngest::~DatagramIngest()
+{
+    stop_ = true;
+    for(const std::unique_ptr<Receiver>& receiver : receivers_)
+        receiver->thread.join();
+    stopAppliers_ = true;
+    for(std::thread& applier : appliers_)
+        applier.join();
+    for(const std::unique_ptr<Receiver>& receiver : receivers_)
+        close(receiver->socket);
+}
+
+uint64_t DatagramIngest::received() const
+{
+    uint64_t total = 0;
+    for(const std::unique_ptr<Receiver>& receiver : receivers_)
+        total += receiver->received.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t DatagramIngest::rejected() const
+{
+    uint64_t total = 0;
+    for(const std::unique_ptr<Receiver>& receiver : receivers_)
+        total += receiver->rejected.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t DatagramIngest::dropped() const
+{
+    uint64_t total = 0;
+    for(const std::unique_ptr<Receiver>& receiver : receivers_)
+        total += receiver->dropped.load(std::memory_order_relaxed);
+    return total;
+}
+
+void DatagramIngest::receive(Receiver& receiver)
+{
+    const size_t batch = config_.batch;
+    const uint64_t mask = ringSlots_ - 1;
+    const mcproto::StatsDatagram::Key* key = config_.key ? &*config_.key : nullptr;
+    std::vector<char> buffers(batch * mcproto::StatsDatagram::maxSize);
+    std::vector<iovec> vectors(batch);
+    std::vector<mmsghdr> messages(batch);
+    for(size_t idx = 0 ; idx < batch ; idx++)
+    {
+        vectors[idx] = {buffers.data() + idx * mcproto::StatsDatagram::maxSize, mcproto::StatsDatagram::maxSize};
+        messages[idx].msg_hdr = {};
+        messages[idx].msg_hdr.msg_iov = &vectors[idx];
+        messages[idx].msg_hdr.msg_iovlen = 1;
+    }
+
+    // the ends of the rings as this receiver last saw them, a tail is only read again once the
+    // ring looks full
+    std::vector<uint64_t> heads(shards_);
+    std::vector<uint64_t> tails(shards_);
+    for(size_t shard = 0 ; shard < shards_ ; shard++)
+        heads[shard] = receiver.rings[shard].head.load(std::memory_order_relaxed);
+
+    pollfd pfd{receiver.socket, POLLIN, 0};
+    while(!stop_)
+    {
+        if(poll(&pfd, 1, pollTimeoutMs) <= 0)
+            continue;
+
+        // under steady traffic the socket never runs dry, the stop is checked between batches
+        int count;
+        while(!stop_ && (count = recvmmsg(receiver.socket, messages.data(), batch, MSG_DONTWAIT, nullptr)) > 0)
+        {
+            uint64_t received = 0, rejected = 0, dropped = 0;
+            for(int idx = 0 ; idx < count ; idx++)
+            {
+                mcproto::StatsDatagram datagram;
+                // a datagram larger than the largest report was truncated, and not one of ours
+                if((messages[idx].msg_hdr.msg_flags & MSG_TRUNC) || !datagram.decode(static_cast<const char*>(vectors[idx].iov_base), messages[idx].msg_len, key))
+                {
+                    rejected++;
+                    continue;
+                }
+                received++;
+                const size_t shard = service_.shardOf(datagram.hostname);
+                Ring& ring = receiver.rings[shard];
+                uint64_t& head = heads[shard];
+                if(head - tails[shard] == ringSlots_)
+                    tails[shard] = ring.tail.load(std::memory_order_acquire);
+                if(head - tails[shard] == ringSlots_)
+                {
+                    dropped++;
+                    continue;
+                }
+
+                Slot& slot = ring.slots[head & mask];
+                slot.hostnameLength = uint8_t(datagram.hostname.size());
+                slot.zoneLength = uint8_t(datagram.zone.size());
+                slot.rackLength = uint8_t(datagram.rack.size());
+                // the names follow each other in the datagram
+                std::memcpy(slot.names, datagram.hostname.data(), datagram.hostname.size() + datagram.zone.size() + datagram.rack.size());
+                slot.stats = InfoUpdateService::nodeStats(datagram);
+                head++;
+            }
+            for(size_t shard = 0 ; shard < shards_ ; shard++)
+                receiver.rings[shard].head.store(heads[shard], std::memory_order_release);
+            receiver.received.fetch_add(received, std::memory_order_relaxed);
+            receiver.rejected.fetch_add(rejected, std::memory_order_relaxed);
+            receiver.dropped.fetch_add(dropped, std::memory_order_relaxed);
+            for(int idx = 0 ; idx < count ; idx++)
+                messages[idx].msg_hdr.msg_flags = 0;
+        }
+    }
+}
+
+size_t DatagramIngest::drain(size_t shard, std::vector<InfoUpdateService::Report>& reports)
+{
+    const uint64_t mask = ringSlots_ - 1;
+    size_t total = 0;
+    for(const std::unique_ptr<Receiver>& receiver : receivers_)
+    {
+        Ring& ring = receiver->rings[shard];
+        const uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        const uint64_t head = std::min(ring.head.load(std::memory_order_acquire), tail + drainBatch);
+        if(head == tail)
+            continue;
+
+        reports.clear();
+        for(uint64_t idx = tail ; idx < head ; idx++)
+        {
+            const Slot& slot = ring.slots[idx & mask];
+            const char* names = slot.names;
+            reports.push_back({{names, slot.hostnameLength},
+                               {names + slot.hostnameLength, slot.zoneLength},
+                               {names + slot.hostnameLength + slot.zoneLength, slot.rackLength},
+                               slot.stats});
+        }
+        service_.ingest(shard, reports.data(), reports.size());
+        // the slots are the receiver's again only once the service is done with the names
+        ring.tail.store(head, std::memory_order_release);
+        total += reports.size();
+    }
+    applied_.fetch_add(total, std::memory_order_relaxed);
+    return total;
+}
+
+void DatagramIngest::apply(size_t shard)
+{
+    std::vector<InfoUpdateService::Report> reports;
+    reports.reserve(drainBatch);
+    while(!stopAppliers_)
+    {
+        if(!drain(shard, reports))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // the receivers are gone, what they left is applied still
+    while(drain(shard, reports));
+}
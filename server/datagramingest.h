@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include "infoupdateservice.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+/// Takes reports as mcproto::StatsDatagram over UDP, for fleets reporting faster than a gRPC
+/// call per report allows. One receiver thread per socket, all sockets bound to the same port
+/// with SO_REUSEPORT so the kernel spreads the clients over them, each reading a batch of
+/// datagrams per recvmmsg call. A receiver checks and decodes what it reads into a ring per
+/// shard of the service, the node's. Every shard has an applier of its own that drains its rings
+/// and hands what it found to the service under one hold of the shard's lock, so the shards are
+/// written in parallel, the receivers never wait for a lock nor for each other and an applier
+/// only ever waits for the queries. A full ring loses the datagram like a full socket buffer
+/// would, the client's next report replaces it.
+///
+/// gRPC stays the transport for everything else, queries, spooled replays and the report
+/// interval the server asks for.
+class DatagramIngest
+{
+public:
+    struct Config
+    {
+        /// 0 takes any free one
+        uint16_t port = 0;
+        /// receivers, 0 for one per core
+        uint32_t threads = 0;
+        /// datagrams not signed with it are turned away, none takes unsigned ones
+        std::optional<mcproto::StatsDatagram::Key> key;
+        /// datagrams per recvmmsg call
+        uint32_t batch = 64;
+        /// decoded reports a receiver keeps for the appliers, a power of two shared out over the
+        /// rings of the shards
+        uint32_t ringSlots = 4096;
+    };
+
+    /// throws std::system_error when the port cannot be bound, std::invalid_argument for ring
+    /// slots not a power of two
+    DatagramIngest(InfoUpdateService& service, const Config& config);
+    explicit DatagramIngest(InfoUpdateService& service): DatagramIngest(service, Config{}) {}
+    ~DatagramIngest();
+
+    uint16_t port() const { return port_; }
+    /// intact datagrams read
+    uint64_t received() const;
+    /// datagrams that were not reports or not signed with the key
+    uint64_t rejected() const;
+    /// reports lost to a full ring
+    uint64_t dropped() const;
+    /// reports in the store
+    uint64_t applied() const { return applied_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot
+    {
+        uint8_t hostnameLength;
+        uint8_t zoneLength;
+        uint8_t rackLength;
+        char names[3 * mcproto::StatsDatagram::maxNameLength];
+        NodeStats stats;
+    };
+
+    /// single producer single consumer
+    struct alignas(64) Ring
+    {
+        std::unique_ptr<Slot[]> slots;
+        alignas(64) std::atomic<uint64_t> head{0};     // written by the receiver
+        alignas(64) std::atomic<uint64_t> tail{0};     // written by the applier
+    };
+
+    /// the socket, rings and counters of one receiver, a ring per shard
+    struct alignas(64) Receiver
+    {
+        int socket = -1;
+        std::unique_ptr<Ring[]> rings;
+        alignas(64) std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> dropped{0};
+        std::thread thread;
+    };
+
+    InfoUpdateService& service_;
+    Config config_;
+    uint16_t port_;
+    size_t shards_;
+    // of every ring
+    uint32_t ringSlots_;
+    std::vector<std::unique_ptr<Receiver>> receivers_;
+    std::atomic<uint64_t> applied_;
+    std::atomic<bool> stop_;
+    // set once the receivers are gone
+    std::atomic<bool> stopAppliers_;
+    // by shard
+    std::vector<std::thread> appliers_;
+
+    void receive(Receiver& receiver);
+    void apply(size_t shard);
+    /// hands what the rings of the shard hold to the service, returns how many reports that was
+    size_t drain(size_t shard, std::vector<InfoUpdateService::Report>& reports);
+};
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "freshnesstracker.h"
+
+#include <algorithm>
+
+size_t AgeHistogram::bucket(uint64_t ageMs)
+{
+    const size_t bits = ageMs ? 64 - __builtin_clzll(ageMs) : 0;
+    return std::min(bits, buckets - 1);
+}
+
+void AgeHistogram::record(uint64_t ageMs)
+{
+    counts_[bucket(ageMs)]++;
+}
+
+void AgeHistogram::add(const AgeHistogram& other)
+{
+    for(size_t idx = 0 ; idx < buckets ; idx++)
+        counts_[idx] += other.counts_[idx];
+}
+
+uint64_t AgeHistogram::total() const
+{
+    uint64_t total = 0;
+    for(uint32_t count : counts_)
+        total += count;
+    return total;
+}
+
+FreshnessTracker::FreshnessTracker(size_t expectedNodes):
+    duplicates_(0),
+    reordered_(0)
+{
+    nodes_.reserve(expectedNodes);
+}
+
+void FreshnessTracker::add(uint32_t slot)
+{
+    if(nodes_.size() <= slot)
+        nodes_.resize(slot + 1);
+}
+
+void FreshnessTracker::received(uint32_t slot, uint64_t collectedAtMs, uint64_t receivedAtMs)
+{
+    Node& node = nodes_[slot];
+    if(receivedAtMs)
+        node.receivedAtMs = receivedAtMs;
+    if(!collectedAtMs || !receivedAtMs || receivedAtMs < collectedAtMs)
+        return;
+    node.latency.record(receivedAtMs - collectedAtMs);
+    latency_.record(receivedAtMs - collectedAtMs);
+}
+
+void FreshnessTracker::dropped(uint32_t slot, bool duplicate)
+{
+    Node& node = nodes_[slot];
+    if(duplicate)
+    {
+        node.duplicates++;
+        duplicates_++;
+    }
+    else
+    {
+        node.reordered++;
+        reordered_++;
+    }
+}
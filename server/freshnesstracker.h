@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Counts of ages in ms, bucketed by powers of two: bucket 0 holds 0ms, bucket n up to 2^n - 1ms
+/// and the last one everything older.
+class AgeHistogram
+{
+public:
+    static constexpr size_t buckets = 20;
+
+private:
+    std::array<uint32_t, buckets> counts_{};
+
+public:
+    static size_t bucket(uint64_t ageMs);
+    /// the oldest age of the bucket, the last one has none
+    static uint64_t upperBoundMs(size_t bucket) { return (uint64_t(1) << bucket) - 1; }
+
+    void record(uint64_t ageMs);
+    /// the counts of another as well
+    void add(const AgeHistogram& other);
+    uint32_t count(size_t bucket) const { return counts_[bucket]; }
+    uint64_t total() const;
+};
+
+/// How fresh the stats of every node are: the time from collection on the client to ingest,
+/// per node and over the fleet, when the server last took a report of each node, and the
+/// reports that were turned away as duplicates or for arriving out of order.
+class FreshnessTracker
+{
+    struct Node
+    {
+        AgeHistogram latency;
+        uint64_t receivedAtMs = 0;
+        uint32_t duplicates = 0;
+        uint32_t reordered = 0;
+    };
+
+    std::vector<Node> nodes_;
+    AgeHistogram latency_;
+    uint64_t duplicates_;
+    uint64_t reordered_;
+
+public:
+    explicit FreshnessTracker(size_t expectedNodes = 0);
+
+    /// slots are handed out densely, the next one
+    void add(uint32_t slot);
+    /// a report taken in, the latency is left out when either time is not known or the clocks
+    /// disagree on their order
+    void received(uint32_t slot, uint64_t collectedAtMs, uint64_t receivedAtMs);
+    /// a report turned away, as the same sample again or as one older than the node's
+    void dropped(uint32_t slot, bool duplicate);
+
+    /// 0 for a node whose reports came without the time they arrived
+    uint64_t receivedAtMs(uint32_t slot) const { return nodes_[slot].receivedAtMs; }
+    const AgeHistogram& latency(uint32_t slot) const { return nodes_[slot].latency; }
+    uint32_t duplicates(uint32_t slot) const { return nodes_[slot].duplicates; }
+    uint32_t reordered(uint32_t slot) const { return nodes_[slot].reordered; }
+
+    /// over the fleet
+    const AgeHistogram& latency() const { return latency_; }
+    uint64_t duplicates() const { return duplicates_; }
+    uint64_t reordered() const { return reordered_; }
+};
@@ -0,0 +1,671 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "historystore.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace
+{
+    constexpr uint64_t segmentMagic = 0x313054534948434dull;    // "MCHIST01"
+    constexpr uint32_t blockMagic = 0x4b42434du;                // "MCBK"
+    constexpr size_t segmentHeaderSize = 64;
+    constexpr size_t streamCount = HistoryStore::metricCount + 1;
+    constexpr uint16_t maxBlockSamples = std::numeric_limits<uint16_t>::max();
+    // leading zeros of a value's XOR go into 5 bits
+    constexpr uint32_t maxLeading = 31;
+    constexpr uint8_t noWindow = 0xff;
+
+    struct SegmentHeader
+    {
+        uint64_t magic;
+        uint64_t size;
+    };
+
+    /// followed by the hostname padded to 8 bytes and the streams, timestamps first, each
+    /// padded to whole words
+    struct BlockHeader
+    {
+        uint32_t magic;
+        uint16_t hostnameLength;
+        uint16_t count;
+        uint64_t firstMs;
+        uint64_t lastMs;
+        uint32_t bits[streamCount];
+        uint64_t checksum;
+    };
+
+    size_t padded(size_t bytes)
+    {
+        return (bytes + 7) / 8 * 8;
+    }
+
+    size_t words(uint32_t bits)
+    {
+        return (bits + 63) / 64;
+    }
+
+    uint64_t checksum(const uint64_t* words, size_t count)
+    {
+        uint64_t sum = 0x9e3779b97f4a7c15ull;
+        for(size_t idx = 0 ; idx < count ; idx++)
+            sum = (sum ^ words[idx]) * 0x100000001b3ull + (sum >> 29);
+        return sum;
+    }
+
+    std::system_error lastError(const std::string& what)
+    {
+        return std::system_error(std::error_code(errno, std::system_category()), what);
+    }
+
+    uint64_t mask(uint32_t bits)
+    {
+        return bits == 64 ? ~0ull : (1ull << bits) - 1;
+    }
+
+    int64_t signExtend(uint64_t value, uint32_t bits)
+    {
+        return int64_t(value << (64 - bits)) >> (64 - bits);
+    }
+
+    /// most significant bit first, clear() keeps the words allocated
+    class BitWriter
+    {
+        std::vector<uint64_t> words_;
+        uint32_t bits_ = 0;
+
+    public:
+        void write(uint64_t value, uint32_t count)
+        {
+            if(!count)
+                return;
+            value &= mask(count);
+            const uint32_t used = bits_ % 64;
+            if(!used)
+                words_.push_back(0);
+            const uint32_t room = 64 - used;
+            if(count <= room)
+                words_.back() |= value << (room - count);
+            else
+            {
+                words_.back() |= value >> (count - room);
+                words_.push_back(value << (64 - (count - room)));
+            }
+            bits_ += count;
+        }
+
+        void clear()
+        {
+            words_.clear();
+            bits_ = 0;
+        }
+
+        uint32_t bits() const { return bits_; }
+        const uint64_t* data() const { return words_.data(); }
+    };
+
+    class BitReader
+    {
+        const uint64_t* words_;
+        uint32_t position_ = 0;
+
+    public:
+        explicit BitReader(const uint64_t* words): words_(words) {}
+
+        uint64_t read(uint32_t count)
+        {
+            if(!count)
+                return 0;
+            const uint64_t word = words_[position_ / 64];
+            const uint32_t room = 64 - position_ % 64;
+            uint64_t value;
+            if(count <= room)
+                value = word >> (room - count);
+            else
+                value = word << (count - room) | words_[position_ / 64 + 1] >> (64 - (count - room));
+            position_ += count;
+            return value & mask(count);
+        }
+    };
+
+    /// delta of delta buckets of Gorilla, with the lengths in ms
+    void writeTimestamp(BitWriter& stream, int64_t deltaOfDelta)
+    {
+        if(!deltaOfDelta)
+            stream.write(0, 1);
+        else if(deltaOfDelta >= -64 && deltaOfDelta < 64)
+        {
+            stream.write(0b10, 2);
+            stream.write(deltaOfDelta, 7);
+        }
+        else if(deltaOfDelta >= -256 && deltaOfDelta < 256)
+        {
+            stream.write(0b110, 3);
+            stream.write(deltaOfDelta, 9);
+        }
+        else if(deltaOfDelta >= -2048 && deltaOfDelta < 2048)
+        {
+            stream.write(0b1110, 4);
+            stream.write(deltaOfDelta, 12);
+        }
+        else
+        {
+            stream.write(0b1111, 4);
+            stream.write(deltaOfDelta, 32);
+        }
+    }
+
+    int64_t readTimestamp(BitReader& stream)
+    {
+        if(!stream.read(1))
+            return 0;
+        if(!stream.read(1))
+            return signExtend(stream.read(7), 7);
+        if(!stream.read(1))
+            return signExtend(stream.read(9), 9);
+        if(!stream.read(1))
+            return signExtend(stream.read(12), 12);
+        return signExtend(stream.read(32), 32);
+    }
+
+    /// a value equal to the previous one takes a bit, one whose meaningful bits fall within
+    /// the window of the previous one takes two bits and those, otherwise the window moves
+    void writeValue(BitWriter& stream, uint64_t previous, uint64_t value, uint8_t& leading, uint8_t& trailing)
+    {
+        const uint64_t diff = previous ^ value;
+        if(!diff)
+        {
+            stream.write(0, 1);
+            return;
+        }
+
+        const uint32_t lead = std::min<uint32_t>(maxLeading, __builtin_clzll(diff));
+        const uint32_t trail = __builtin_ctzll(diff);
+        if(leading != noWindow && lead >= leading && trail >= trailing)
+        {
+            stream.write(0b10, 2);
+            stream.write(diff >> trailing, 64 - leading - trailing);
+            return;
+        }
+
+        const uint32_t meaningful = 64 - lead - trail;
+        stream.write(0b11, 2);
+        stream.write(lead, 5);
+        stream.write(meaningful - 1, 6);
+        stream.write(diff >> trail, meaningful);
+        leading = lead;
+        trailing = trail;
+    }
+
+    uint64_t readValue(BitReader& stream, uint64_t previous, uint8_t& leading, uint8_t& trailing)
+    {
+        if(!stream.read(1))
+            return previous;
+        if(stream.read(1))
+        {
+            leading = stream.read(5);
+            const uint32_t meaningful = stream.read(6) + 1;
+            trailing = 64 - leading - meaningful;
+        }
+        return previous ^ stream.read(64 - leading - trailing) << trailing;
+    }
+
+    uint64_t bitsOf(double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    double valueOf(uint64_t bits)
+    {
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    /// calls visit(timestampMs, value) for every sample of the block, oldest first, until it
+    /// returns false
+    template<typename Visit>
+    void decode(uint64_t firstMs, uint16_t count, const uint64_t* timestamps, const uint64_t* values, Visit visit)
+    {
+        BitReader timestampStream(timestamps);
+        BitReader valueStream(values);
+        uint64_t timestampMs = firstMs;
+        int64_t delta = 0;
+        uint64_t value = 0;
+        uint8_t leading = noWindow;
+        uint8_t trailing = 0;
+        for(uint16_t idx = 0 ; idx < count ; idx++)
+        {
+            if(idx)
+            {
+                delta += readTimestamp(timestampStream);
+                timestampMs += delta;
+                value = readValue(valueStream, value, leading, trailing);
+            }
+            else
+                value = valueStream.read(64);
+            if(!visit(timestampMs, valueOf(value)))
+                return;
+        }
+    }
+}
+
+struct HistoryStore::Segment
+{
+    std::string path;
+    int fd = -1;
+    char* data = nullptr;
+    size_t size = 0;
+    size_t used = segmentHeaderSize;
+
+    ~Segment()
+    {
+        if(data)
+            munmap(data, size);
+        if(fd != -1)
+            close(fd);
+    }
+};
+
+struct HistoryStore::OpenBlock
+{
+    uint16_t count = 0;
+    uint64_t firstMs = 0;
+    uint64_t lastMs = 0;
+    int64_t lastDelta = 0;
+    std::array<BitWriter, streamCount> streams;
+    std::array<uint64_t, metricCount> lastValue{};
+    std::array<uint8_t, metricCount> leading{};
+    std::array<uint8_t, metricCount> trailing{};
+
+    uint64_t bytes() const
+    {
+        uint64_t bytes = 0;
+        for(const BitWriter& stream : streams)
+            bytes += words(stream.bits()) * 8;
+        return bytes;
+    }
+};
+
+struct HistoryStore::Series
+{
+    struct Block
+    {
+        uint32_t segment;
+        uint32_t offset;
+        uint64_t firstMs;
+        uint64_t lastMs;
+    };
+
+    std::string hostname;
+    std::vector<Block> blocks;
+    /// the newest sample appended or sealed before a restart, 0 before any
+    uint64_t lastMs = 0;
+    /// false once a block overlaps an earlier one, queries merge the blocks by time then
+    bool ordered = true;
+
+    OpenBlock current;
+    /// samples older than lastMs that came late, a client replaying its spool after an outage
+    OpenBlock late;
+};
+
+HistoryStore::HistoryStore(std::string directory, Config config):
+    directory_(std::move(directory)),
+    config_(config),
+    samples_(0),
+    sealedBytes_(0)
+{
+    if(config_.segmentBytes > std::numeric_limits<uint32_t>::max() || config_.segmentBytes < segmentHeaderSize + 4 * config_.blockBytes)
+        throw std::invalid_argument("history segments must hold a few blocks and be at most 4GB");
+
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    if(error)
+        throw std::system_error(error, "cannot create history directory " + directory_);
+
+    // segments are numbered from 0, a gap ends the history
+    for(uint32_t index = 0 ; ; index++)
+    {
+        auto segment = std::make_unique<Segment>();
+        segment->path = directory_ + "/history-" + std::to_string(index) + ".seg";
+        segment->fd = open(segment->path.c_str(), O_RDWR | O_CLOEXEC);
+        if(segment->fd == -1)
+        {
+            if(errno == ENOENT)
+                break;
+            throw lastError("cannot open history segment " + segment->path);
+        }
+
+        struct stat status;
+        if(fstat(segment->fd, &status) == -1)
+            throw lastError("cannot size history segment " + segment->path);
+        segment->size = status.st_size;
+        if(segment->size < segmentHeaderSize)
+            break;
+        void* mapped = mmap(nullptr, segment->size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+        if(mapped == MAP_FAILED)
+            throw lastError("cannot map history segment " + segment->path);
+        segment->data = static_cast<char*>(mapped);
+
+        const SegmentHeader* header = reinterpret_cast<const SegmentHeader*>(segment->data);
+        if(header->magic != segmentMagic || header->size != segment->size)
+            break;
+        recover(*segment, index);
+        segments_.push_back(std::move(segment));
+    }
+}
+
+HistoryStore::~HistoryStore()
+{
+    flush();
+}
+
+void HistoryStore::recover(Segment& segment, uint32_t index)
+{
+    while(segment.used + sizeof(BlockHeader) <= segment.size)
+    {
+        const BlockHeader* header = reinterpret_cast<const BlockHeader*>(segment.data + segment.used);
+        if(header->magic != blockMagic || !header->count || header->lastMs < header->firstMs)
+            break;
+
+        size_t streamWords = 0;
+        for(uint32_t bits : header->bits)
+            streamWords += words(bits);
+        const size_t bodyBytes = padded(header->hostnameLength) + streamWords * 8;
+        if(segment.used + sizeof(BlockHeader) + bodyBytes > segment.size)
+            break;
+        const uint64_t* body = reinterpret_cast<const uint64_t*>(header + 1);
+        if(checksum(body, bodyBytes / 8) != header->checksum)
+            break;
+
+        Series& node = series(std::string_view(reinterpret_cast<const char*>(body), header->hostnameLength));
+        if(!node.blocks.empty() && header->firstMs <= node.lastMs)
+            node.ordered = false;
+        node.blocks.push_back({index, uint32_t(segment.used), header->firstMs, header->lastMs});
+        node.lastMs = std::max(node.lastMs, header->lastMs);
+        samples_ += header->count;
+        sealedBytes_ += sizeof(BlockHeader) + bodyBytes;
+        segment.used += sizeof(BlockHeader) + bodyBytes;
+    }
+}
+
+HistoryStore::Segment& HistoryStore::openSegment()
+{
+    auto segment = std::make_unique<Segment>();
+    segment->path = directory_ + "/history-" + std::to_string(segments_.size()) + ".seg";
+    // a segment cut short by a crash before its header was written is started over
+    segment->fd = open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(segment->fd == -1)
+        throw lastError("cannot create history segment " + segment->path);
+    segment->size = config_.segmentBytes;
+    if(ftruncate(segment->fd, segment->size) == -1)
+        throw lastError("cannot size history segment " + segment->path);
+    void* mapped = mmap(nullptr, segment->size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if(mapped == MAP_FAILED)
+        throw lastError("cannot map history segment " + segment->path);
+    segment->data = static_cast<char*>(mapped);
+
+    SegmentHeader* header = reinterpret_cast<SegmentHeader*>(segment->data);
+    header->size = segment->size;
+    header->magic = segmentMagic;
+    segments_.push_back(std::move(segment));
+    return *segments_.back();
+}
+
+HistoryStore::Series& HistoryStore::series(std::string_view hostname)
+{
+    auto slotIter = slots_.find(hostname);
+    if(slotIter != slots_.end())
+        return *series_[slotIter->second];
+
+    auto& node = series_.emplace_back(std::make_unique<Series>());
+    node->hostname = hostname;
+    slots_.emplace(node->hostname, series_.size() - 1);
+    return *node;
+}
+
+bool HistoryStore::append(std::string_view hostname, uint64_t timestampMs, const std::array<double, metricCount>& values)
+{
+    Series& node = series(hostname);
+    // a retried report
+    if(timestampMs == node.lastMs)
+        return false;
+
+    if(timestampMs > node.lastMs)
+    {
+        node.lastMs = timestampMs;
+        write(node, node.current, timestampMs, values);
+        return true;
+    }
+
+    // older than what the node reported since, the late samples go into blocks of their own that
+    // queries merge back in by time
+    node.ordered = false;
+    if(node.late.count && timestampMs <= node.late.lastMs)
+        seal(node, node.late);
+    write(node, node.late, timestampMs, values);
+    return true;
+}
+
+void HistoryStore::write(Series& node, OpenBlock& block, uint64_t timestampMs, const std::array<double, metricCount>& values)
+{
+    const int64_t delta = timestampMs - block.lastMs;
+    if(block.count && (delta - block.lastDelta < std::numeric_limits<int32_t>::min() || delta - block.lastDelta > std::numeric_limits<int32_t>::max()))
+        seal(node, block);
+
+    if(!block.count)
+    {
+        block.firstMs = timestampMs;
+        block.lastDelta = 0;
+        block.leading.fill(noWindow);
+        for(size_t metric = 0 ; metric < metricCount ; metric++)
+        {
+            block.lastValue[metric] = bitsOf(values[metric]);
+            block.streams[metric + 1].write(block.lastValue[metric], 64);
+        }
+    }
+    else
+    {
+        writeTimestamp(block.streams[0], delta - block.lastDelta);
+        block.lastDelta = delta;
+        for(size_t metric = 0 ; metric < metricCount ; metric++)
+        {
+            const uint64_t value = bitsOf(values[metric]);
+            writeValue(block.streams[metric + 1], block.lastValue[metric], value, block.leading[metric], block.trailing[metric]);
+            block.lastValue[metric] = value;
+        }
+    }
+
+    block.lastMs = timestampMs;
+    block.count++;
+    samples_++;
+    if(block.count == maxBlockSamples || block.bytes() >= config_.blockBytes)
+        seal(node, block);
+}
+
+void HistoryStore::seal(Series& node, OpenBlock& block)
+{
+    if(!block.count)
+        return;
+
+    const size_t hostnameLength = std::min<size_t>(node.hostname.size(), std::numeric_limits<uint16_t>::max());
+    const size_t bodyBytes = padded(hostnameLength) + block.bytes();
+    const size_t blockBytes = sizeof(BlockHeader) + bodyBytes;
+    if(segments_.empty() || segments_.back()->used + blockBytes > segments_.back()->size)
+        openSegment();
+
+    Segment& segment = *segments_.back();
+    if(segment.used + blockBytes <= segment.size)
+    {
+        BlockHeader* header = reinterpret_cast<BlockHeader*>(segment.data + segment.used);
+        char* body = reinterpret_cast<char*>(header + 1);
+        std::memset(body, 0, padded(hostnameLength));
+        std::memcpy(body, node.hostname.data(), hostnameLength);
+        char* stream = body + padded(hostnameLength);
+        for(size_t idx = 0 ; idx < streamCount ; idx++)
+        {
+            header->bits[idx] = block.streams[idx].bits();
+            std::memcpy(stream, block.streams[idx].data(), words(block.streams[idx].bits()) * 8);
+            stream += words(block.streams[idx].bits()) * 8;
+        }
+        header->hostnameLength = hostnameLength;
+        header->count = block.count;
+        header->firstMs = block.firstMs;
+        header->lastMs = block.lastMs;
+        header->checksum = checksum(reinterpret_cast<const uint64_t*>(body), bodyBytes / 8);
+        // published last, a reader of the segment after a crash stops at a block without it
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = blockMagic;
+
+        node.blocks.push_back({uint32_t(segments_.size() - 1), uint32_t(segment.used), block.firstMs, block.lastMs});
+        segment.used += blockBytes;
+        sealedBytes_ += blockBytes;
+    }
+
+    block.count = 0;
+    for(BitWriter& stream : block.streams)
+        stream.clear();
+}
+
+void HistoryStore::flush()
+{
+    for(auto& node : series_)
+    {
+        seal(*node, node->current);
+        seal(*node, node->late);
+    }
+    for(auto& segment : segments_)
+        msync(segment->data, segment->used, MS_SYNC);
+}
+
+bool HistoryStore::query(std::string_view hostname, Metric metric, uint64_t fromMs, uint64_t toMs, uint64_t stepMs,
+                         std::vector<Point>& points, size_t limit) const
+{
+    points.clear();
+    auto slotIter = slots_.find(hostname);
+    if(slotIter == slots_.end() || size_t(metric) >= metricCount || fromMs > toMs)
+        return true;
+    const Series& node = *series_[slotIter->second];
+
+    // the mean is kept as the sum until the end
+    bool complete = true;
+    auto point = [&](uint64_t timestampMs, double value)
+    {
+        if(timestampMs < fromMs)
+            return true;
+        if(timestampMs > toMs)
+            return false;
+
+        const uint64_t bucketMs = stepMs ? fromMs + (timestampMs - fromMs) / stepMs * stepMs : timestampMs;
+        if(stepMs && !points.empty() && points.back().timestampMs == bucketMs)
+        {
+            Point& bucket = points.back();
+            bucket.value += value;
+            bucket.min = std::min(bucket.min, value);
+            bucket.max = std::max(bucket.max, value);
+            bucket.count++;
+            return true;
+        }
+        if(points.size() == limit)
+        {
+            complete = false;
+            return false;
+        }
+        points.push_back({bucketMs, value, value, value, 1});
+        return true;
+    };
+
+    auto decodeBlock = [this, metric](const Series::Block& block, auto visit)
+    {
+        const BlockHeader* header = reinterpret_cast<const BlockHeader*>(segments_[block.segment]->data + block.offset);
+        const uint64_t* timestamps = reinterpret_cast<const uint64_t*>(header + 1) + padded(header->hostnameLength) / 8;
+        const uint64_t* values = timestamps;
+        for(size_t idx = 0 ; idx <= size_t(metric) ; idx++)
+            values += words(header->bits[idx]);
+        decode(header->firstMs, header->count, timestamps, values, visit);
+    };
+    auto decodeOpen = [metric](const OpenBlock& block, auto visit)
+    {
+        decode(block.firstMs, block.count, block.streams[0].data(), block.streams[size_t(metric) + 1].data(), visit);
+    };
+
+    if(node.ordered)
+    {
+        for(const Series::Block& block : node.blocks)
+        {
+            if(block.lastMs < fromMs)
+                continue;
+            if(block.firstMs > toMs || !complete)
+                break;
+            decodeBlock(block, point);
+        }
+
+        if(node.current.count && node.current.lastMs >= fromMs && node.current.firstMs <= toMs && complete)
+            decodeOpen(node.current, point);
+    }
+    else
+    {
+        // late samples put the blocks out of order, the ones in range are merged by time first
+        std::vector<std::pair<uint64_t, double>> samples;
+        auto gather = [&](uint64_t timestampMs, double value)
+        {
+            if(timestampMs > toMs)
+                return false;
+            if(timestampMs >= fromMs)
+                samples.emplace_back(timestampMs, value);
+            return true;
+        };
+        for(const Series::Block& block : node.blocks)
+            if(block.lastMs >= fromMs && block.firstMs <= toMs)
+                decodeBlock(block, gather);
+        for(const OpenBlock* block : {&node.current, &node.late})
+            if(block->count && block->lastMs >= fromMs && block->firstMs <= toMs)
+                decodeOpen(*block, gather);
+
+        std::stable_sort(samples.begin(), samples.end(), [](const auto& left, const auto& right){ return left.first < right.first; });
+        for(size_t idx = 0 ; idx < samples.size() ; idx++)
+        {
+            // a replay delivered twice
+            if(idx && samples[idx].first == samples[idx - 1].first)
+                continue;
+            if(!point(samples[idx].first, samples[idx].second))
+                break;
+        }
+    }
+
+    if(stepMs)
+        for(Point& bucket : points)
+            bucket.value /= bucket.count;
+    return complete;
+}
+
+uint64_t HistoryStore::openBytes() const
+{
+    uint64_t bytes = 0;
+    for(const auto& node : series_)
+        bytes += node->current.bytes() + node->late.bytes();
+    return bytes;
+}
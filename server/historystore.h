@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include "metricindex.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Every sample of every node, for capacity planning and for replaying routing policies against.
+/// Each node has a block open in memory with one bit stream of timestamps and one per metric,
+/// compressed the way Gorilla does: timestamps as deltas of their deltas, values as the XOR with
+/// the previous value of the same metric, spelled out as its meaningful bits only. A typical
+/// sample of all metrics fits in 20 odd bytes.
+///
+/// Blocks that reach their size are sealed into memory mapped segment files that are only ever
+/// appended to. A sealed block is published by writing its magic last and carries a checksum, on
+/// opening the segments are scanned up to the first block that is not intact. The blocks still
+/// open are lost when the process dies without flush().
+///
+/// Not thread safe, the service appends under its exclusive lock and queries under its shared one.
+class HistoryStore
+{
+public:
+    static constexpr size_t metricCount = MetricIndex::metricCount;
+
+    struct Config
+    {
+        /// size of every segment file, at most 4GB
+        size_t segmentBytes = 64 << 20;
+        /// a block is sealed once its streams take this much. Larger blocks cost less per
+        /// sample on disk but more memory per node while they are open
+        size_t blockBytes = 2048;
+    };
+
+    struct Point
+    {
+        uint64_t timestampMs;
+        /// the sample, or the mean over the step
+        double value;
+        double min;
+        double max;
+        uint32_t count;
+    };
+
+private:
+    struct Segment;
+    struct OpenBlock;
+    struct Series;
+
+    std::string directory_;
+    Config config_;
+    std::vector<std::unique_ptr<Segment>> segments_;
+    std::vector<std::unique_ptr<Series>> series_;
+    std::unordered_map<std::string_view, uint32_t> slots_;
+    uint64_t samples_;
+    uint64_t sealedBytes_;
+
+    Series& series(std::string_view hostname);
+    void recover(Segment& segment, uint32_t index);
+    Segment& openSegment();
+    void write(Series& series, OpenBlock& block, uint64_t timestampMs, const std::array<double, metricCount>& values);
+    void seal(Series& series, OpenBlock& block);
+
+public:
+    /// opens the segments in directory, creating it when it does not exist. Throws
+    /// std::system_error when the directory or a segment cannot be opened or mapped.
+    HistoryStore(std::string directory, Config config);
+    explicit HistoryStore(std::string directory): HistoryStore(std::move(directory), Config{}) {}
+    HistoryStore(const HistoryStore&) = delete;
+    HistoryStore& operator=(const HistoryStore&) = delete;
+    ~HistoryStore();
+
+    /// values by Metric. A sample at the time of the node's newest is a retry and dropped,
+    /// returns false for those. Older ones, a spool replayed after an outage, are kept in blocks
+    /// of their own that queries merge in by time, the first of equal timestamps wins there
+    bool append(std::string_view hostname, uint64_t timestampMs, const std::array<double, metricCount>& values);
+    /// seals every open block and writes the segments back
+    void flush();
+
+    /// the samples of metric within [fromMs, toMs] oldest first, with stepMs 0 as they are,
+    /// otherwise one point per step from fromMs on. Returns false when there were more than
+    /// limit points, points then holds the first limit of them.
+    bool query(std::string_view hostname, Metric metric, uint64_t fromMs, uint64_t toMs, uint64_t stepMs,
+               std::vector<Point>& points, size_t limit = ~size_t(0)) const;
+
+    const std::string& directory() const { return directory_; }
+    size_t nodes() const { return series_.size(); }
+    uint64_t samples() const { return samples_; }
+    /// in sealed blocks, headers included
+    uint64_t sealedBytes() const { return sealedBytes_; }
+    /// of the streams of the blocks still open
+    uint64_t openBytes() const;
+};
@@ -0,0 +1,640 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "infoupdateservice.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+    void print(const mcproto::Stats& request)
+    {
+        std::cout << "hostname: " << request.hostname() << '\n';
+
+        if(request.has_topology())
+            std::cout << "zone: " << request.topology().zone() << " rack: " << request.topology().rack() << '\n';
+
+        if(request.has_cpuload())
+            std::cout << "Cpu Load(%): " << double(request.cpuload().cpuload()) / 100. << '\n';
+
+        if(request.has_diskinfo())
+            std::cout << "DiskSpace(KB): " << request.diskinfo().availablespace() << '\n';
+
+        if(request.has_netinfo())
+            std::cout << "Network Speed(bytes/sec): " << request.netinfo().bandwidthusage() << '\n';
+
+        if(request.has_meminfo())
+        {
+            std::cout << "Memory Info:\n";
+            std::cout << "Available Ram(MB): " << request.meminfo().availableram() << '\n';
+            std::cout << "Available Swap(MB): " << request.meminfo().availableswap() << '\n';
+            std::cout << "Available Ram(%): " << request.meminfo().availablerampercent() << '\n';
+            std::cout << "Available Swap(%): " << request.meminfo().availableswappercent() << '\n';
+            std::cout << "Avg10 stall info(us): " << request.meminfo().avg10processstalltime() << '\n';
+        }
+
+        if(request.has_pressure())
+        {
+            std::cout << "Pressure Info:\n";
+            std::cout << "Cpu avg10 stall(%): " << request.pressure().cpuavg10() << '\n';
+            std::cout << "Memory avg10 stall(%): " << request.pressure().memoryavg10() << '\n';
+            std::cout << "Io avg10 stall(%): " << request.pressure().ioavg10() << '\n';
+            if(request.pressure().triggered())
+                std::cout << "Out-of-band report, triggered by(mask): " << request.pressure().triggered() << '\n';
+        }
+
+        for(const mcproto::CgroupInfo& cgroup : request.cgroups())
+        {
+            std::cout << "Cgroup: " << cgroup.cgroup() << '\n';
+            std::cout << "Cpu usage/limit(%): " << cgroup.cpuusage() / 100. << '/' << cgroup.cpulimit() / 100. << '\n';
+            std::cout << "Cpu throttled(%): " << cgroup.cputhrottled() / 100. << '\n';
+            std::cout << "Memory current/limit(MB): " << cgroup.memorycurrent() << '/' << cgroup.memorylimit() << '\n';
+            std::cout << "Memory/Io avg10 stall(%): " << cgroup.memorypressureavg10() << '/' << cgroup.iopressureavg10() << '\n';
+        }
+
+        for(const mcproto::AppLoad& appload : request.apploads())
+        {
+            std::cout << "Service: " << appload.service() << '\n';
+            std::cout << "In flight/queued: " << appload.inflight() << '/' << appload.queuedepth() << '\n';
+            std::cout << "Requests/sec, mean latency(us): " << appload.requestspersec() << ", " << appload.meanlatencyus() << '\n';
+        }
+
+        std::cout << "============================================================" << std::endl;
+    }
+
+    void fill(const AgeHistogram& histogram, mcproto::AgeHistogram& reply)
+    {
+        for(size_t idx = 0 ; idx < AgeHistogram::buckets ; idx++)
+        {
+            reply.add_upperboundms(idx + 1 < AgeHistogram::buckets ? AgeHistogram::upperBoundMs(idx) : std::numeric_limits<uint64_t>::max());
+            reply.add_counts(histogram.count(idx));
+        }
+    }
+}
+
+InfoUpdateService::InfoUpdateService(bool verbose, uint32_t maxReportsPerSec, size_t expectedNodes, HistoryStore* history, CaptureWriter* capture,
+                                     size_t shards):
+    nodes_(0),
+    governor_(maxReportsPerSec),
+    history_(history),
+    capture_(capture),
+    verbose_(verbose),
+    batchAllocator_(4)
+{
+    if(!shards)
+        shards = 1;
+    for(size_t idx = 0 ; idx < shards ; idx++)
+    {
+        shards_.push_back(std::make_unique<Shard>((expectedNodes + shards - 1) / shards));
+        shards_.back()->poolNames.reserve(64);
+    }
+    SetMessageAllocatorFor_SendStats(&allocator_);
+    SetMessageAllocatorFor_SendStatsBatch(&batchAllocator_);
+}
+
+NodeStats InfoUpdateService::nodeStats(const mcproto::Stats& request)
+{
+    return nodeStats(mcproto::StatsDatagram::from(request));
+}
+
+NodeCapacity InfoUpdateService::nodeCapacity(const mcproto::Inventory& inventory)
+{
+    uint64_t lineRate = 0;
+    for(const mcproto::Nic& nic : inventory.nics())
+        if(nic.name() == inventory.defaultinterface())
+            lineRate = uint64_t(nic.speedmbps()) * 1000 * 1000 / 8;
+    return NodeStore::capacity(inventory.cores(), lineRate);
+}
+
+NodeStats InfoUpdateService::nodeStats(const mcproto::StatsDatagram& datagram)
+{
+    NodeStats stats;
+    stats.cpuIdlePercent = datagram.cpuIdlePercent;
+    stats.diskSpaceAvailable = datagram.diskSpaceAvailable;
+    stats.networkBandwidthUsed = datagram.networkBandwidthUsed;
+    stats.ramAvailable = datagram.ramAvailable;
+    stats.ramAvailablePercent = datagram.ramAvailablePercent;
+    stats.swapAvailablePercent = datagram.swapAvailablePercent;
+    stats.pressure = datagram.pressure;
+    stats.collectedAtMs = datagram.collectedAtMs;
+    stats.appInFlight = datagram.appInFlight;
+    stats.runId = datagram.runId;
+    stats.sequence = datagram.sequence;
+    stats.nextReportMs = datagram.nextReportMs;
+    return stats;
+}
+
+size_t InfoUpdateService::shardOf(std::string_view hostname) const
+{
+    return shards_.size() > 1 ? std::hash<std::string_view>()(hostname) % shards_.size() : 0;
+}
+
+void InfoUpdateService::ingest(const mcproto::Stats& request, mcproto::StatsReply& response)
+{
+    if(verbose_)
+        print(request);
+
+    const NodeStats stats = nodeStats(request);
+    const uint64_t nowMs = wallClockMs();
+    // outside the lock, the capture keeps its own
+    if(capture_)
+        capture_->record(request);
+
+    Shard& shard = *shards_[shardOf(request.hostname())];
+    std::lock_guard<std::shared_mutex> guard(shard.protect);
+    // the pools of a report turned away are as stale as its stats
+    bool accepted;
+    const uint32_t slot = update(shard, request.hostname(), stats, request.topology().zone(), request.topology().rack(), nowMs, &accepted);
+    if(accepted)
+        join(shard, slot, request);
+    record(shard, request.hostname(), slot, stats, nowMs);
+    sweep(shard, nowMs);
+    response.set_reportintervalms(govern(1));
+    response.set_inventorywanted(!inventoried(shard, slot, request.hostname()));
+}
+
+void InfoUpdateService::ingest(const mcproto::StatsBatch& request, mcproto::StatsReply& response)
+{
+    if(verbose_ && request.stats_size())
+        std::cout << "replay of " << request.stats_size() << " samples from " << request.stats(0).hostname() << std::endl;
+
+    const uint64_t nowMs = wallClockMs();
+    if(capture_)
+        capture_->record(request);
+    // a replay is of one node, its shard is held once for all of it
+    std::unique_lock<std::shared_mutex> guard;
+    bool inventoryWanted = false;
+    for(const mcproto::Stats& sample : request.stats())
+    {
+        Shard& shard = *shards_[shardOf(sample.hostname())];
+        if(guard.mutex() != &shard.protect)
+            guard = std::unique_lock<std::shared_mutex>(shard.protect);
+
+        const NodeStats stats = nodeStats(sample);
+        // a backfilled sample would only be turned away by the node, a node not heard of yet
+        // is still taken from it
+        uint32_t slot = request.backfill() ? shard.store.slot(sample.hostname()) : RankIndex::npos;
+        if(slot == RankIndex::npos)
+        {
+            bool accepted;
+            slot = update(shard, sample.hostname(), stats, sample.topology().zone(), sample.topology().rack(), nowMs, &accepted);
+            if(accepted)
+                join(shard, slot, sample);
+        }
+        record(shard, sample.hostname(), slot, stats, nowMs);
+        inventoryWanted |= !inventoried(shard, slot, sample.hostname());
+        sweep(shard, nowMs);
+    }
+    response.set_reportintervalms(govern(request.stats_size()));
+    response.set_inventorywanted(inventoryWanted);
+}
+
+void InfoUpdateService::ingest(size_t shard, const Report* reports, size_t count)
+{
+    if(!count)
+        return;
+
+    const uint64_t nowMs = wallClockMs();
+    Shard& owner = *shards_[shard];
+    {
+        std::lock_guard<std::shared_mutex> guard(owner.protect);
+        for(const Report* report = reports ; report != reports + count ; report++)
+        {
+            const uint32_t slot = update(owner, report->hostname, report->stats, report->zone, report->rack, nowMs);
+            record(owner, report->hostname, slot, report->stats, nowMs);
+            // datagrams carry no pools, the node stays in those of its last report over grpc.
+            // No reply to ask for an inventory, one sent before the first datagram still applies
+            inventoried(owner, slot, report->hostname);
+        }
+        sweep(owner, nowMs);
+    }
+    // datagram clients get no reply to learn the interval from, the governor still sees the rate
+    govern(uint32_t(count));
+}
+
+void InfoUpdateService::ingest(const Report* reports, size_t count)
+{
+    if(shards_.size() == 1)
+        return ingest(0, reports, count);
+
+    std::vector<std::vector<Report>> byShard(shards_.size());
+    for(const Report* report = reports ; report != reports + count ; report++)
+        byShard[shardOf(report->hostname)].push_back(*report);
+    for(size_t shard = 0 ; shard < byShard.size() ; shard++)
+        ingest(shard, byShard[shard].data(), byShard[shard].size());
+}
+
+uint32_t InfoUpdateService::update(Shard& shard, std::string_view hostname, const NodeStats& stats, std::string_view zone, std::string_view rack,
+                                   uint64_t nowMs, bool* accepted)
+{
+    const size_t size = shard.store.size();
+    const uint32_t slot = shard.store.update(hostname, stats, zone, rack, nowMs, accepted);
+    if(shard.store.size() != size)
+        nodes_.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+uint32_t InfoUpdateService::govern(uint32_t reports)
+{
+    std::lock_guard<std::mutex> guard(governorLock_);
+    return governor_.record(nodes_.load(std::memory_order_relaxed), reports);
+}
+
+void InfoUpdateService::record(const Shard& shard, std::string_view hostname, uint32_t slot, const NodeStats& stats, uint64_t nowMs)
+{
+    if(!history_)
+        return;
+
+    std::array<double, HistoryStore::metricCount> values;
+    const float score = NodeStore::score(stats, shard.store.columns().capacity(slot));
+    for(size_t metric = 0 ; metric < values.size() ; metric++)
+        values[metric] = MetricIndex::value(stats, score, Metric(metric));
+    // samples of clients that do not say when they took them are as old as their arrival
+    std::lock_guard<std::shared_mutex> guard(historyLock_);
+    history_->append(hostname, stats.collectedAtMs ? stats.collectedAtMs : nowMs, values);
+}
+
+void InfoUpdateService::join(Shard& shard, uint32_t slot, const mcproto::Stats& request)
+{
+    shard.poolNames.clear();
+    for(const std::string& pool : request.pools())
+        shard.poolNames.push_back(pool);
+    shard.store.setPools(slot, shard.poolNames.data(), shard.poolNames.size());
+}
+
+bool InfoUpdateService::inventoried(Shard& shard, uint32_t slot, std::string_view hostname)
+{
+    if(slot < shard.inventories.size() && !shard.inventories[slot].hostname().empty())
+        return true;
+    if(shard.pendingInventories.empty())
+        return false;
+
+    auto pending = shard.pendingInventories.find(std::string(hostname));
+    if(pending == shard.pendingInventories.end())
+        return false;
+    setInventory(shard, slot, std::move(pending->second));
+    shard.pendingInventories.erase(pending);
+    return true;
+}
+
+void InfoUpdateService::setInventory(Shard& shard, uint32_t slot, mcproto::Inventory&& inventory)
+{
+    if(slot >= shard.inventories.size())
+        shard.inventories.resize(shard.store.size());
+    shard.store.setCapacity(slot, nodeCapacity(inventory));
+    shard.inventories[slot] = std::move(inventory);
+}
+
+void InfoUpdateService::sweep(Shard& shard, uint64_t nowMs)
+{
+    if(nowMs < shard.lastSweepMs + overdueSweepMs)
+        return;
+    shard.lastSweepMs = nowMs;
+    shard.overdue = shard.store.discountOverdue(nowMs);
+}
+
+std::vector<std::shared_lock<std::shared_mutex>> InfoUpdateService::lockShared()
+{
+    std::vector<std::shared_lock<std::shared_mutex>> guards;
+    guards.reserve(shards_.size());
+    for(const std::unique_ptr<Shard>& shard : shards_)
+        guards.emplace_back(shard->protect);
+    return guards;
+}
+
+uint64_t InfoUpdateService::wallClockMs()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+grpc::Status InfoUpdateService::query(const mcproto::NodeQuery& request, mcproto::NodeQueryReply& response)
+{
+    // enums arrive as whatever number the client sent
+    auto metric = [](int value) { return value >= 0 && value < int(MetricIndex::metricCount); };
+    if(!metric(request.objective()))
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "unknown objective");
+
+    MetricIndex::Query query;
+    query.objective = Metric(request.objective());
+    query.ascending = request.ascending();
+    query.limit = request.limit() ? std::min(request.limit(), maxQueryLimit) : defaultQueryLimit;
+    query.constraints.reserve(request.constraints_size());
+    for(const mcproto::Constraint& constraint : request.constraints())
+    {
+        if(!metric(constraint.metric()))
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "unknown metric in constraint");
+        MetricIndex::Constraint& bounds = query.constraints.emplace_back(MetricIndex::Constraint{Metric(constraint.metric())});
+        if(constraint.has_min())
+            bounds.min = constraint.min();
+        if(constraint.has_max())
+            bounds.max = constraint.max();
+        if(bounds.min > bounds.max)
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "constraint min is above its max");
+    }
+
+    std::vector<MetricIndex::Match> matches;
+    std::vector<MetricIndex::Match> found;
+    size_t scanned = 0;
+    auto guards = lockShared();
+    for(size_t shard = 0 ; shard < shards_.size() ; shard++)
+    {
+        scanned += shards_[shard]->store.index().query(query, found);
+        for(const MetricIndex::Match& match : found)
+            matches.push_back({id(shard, match.slot), match.value});
+    }
+    // the best of every shard, in the order of the index by id
+    if(shards_.size() > 1)
+    {
+        std::sort(matches.begin(), matches.end(), [&query](const MetricIndex::Match& lhs, const MetricIndex::Match& rhs) {
+            if(lhs.value != rhs.value)
+                return query.ascending ? lhs.value < rhs.value : lhs.value > rhs.value;
+            return lhs.slot < rhs.slot;
+        });
+        matches.resize(std::min(matches.size(), query.limit));
+    }
+
+    response.set_scanned(scanned);
+    for(const MetricIndex::Match& match : matches)
+    {
+        mcproto::NodeMatch* node = response.add_nodes();
+        node->set_hostname(std::string(shardOfId(match.slot).store.hostname(slotOfId(match.slot))));
+        node->set_value(match.value);
+    }
+    return grpc::Status::OK;
+}
+
+grpc::ServerUnaryReactor* InfoUpdateService::QueryNodes(grpc::CallbackServerContext* context, const mcproto::NodeQuery* request, mcproto::NodeQueryReply* response)
+{
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(query(*request, *response));
+    return reactor;
+}
+
+void InfoUpdateService::pick(const mcproto::PickRequest& request, mcproto::NodeQueryReply& response)
+{
+    const size_t count = std::min(request.count() ? request.count() : 1, maxQueryLimit);
+    std::vector<uint32_t> ids;
+
+    auto guards = lockShared();
+    if(shards_.size() > 1)
+        merge(request, count, ids);
+    else if(!request.pool().empty())
+        shards_[0]->store.pools().top(request.pool(), count, ids);
+    else if(request.spread())
+        shards_[0]->store.topology().spread(count, ids);
+    else
+        shards_[0]->store.topology().nearest(request.zone(), request.rack(), count, ids);
+
+    response.set_scanned(ids.size());
+    for(uint32_t id : ids)
+    {
+        NodeStore& store = shardOfId(id).store;
+        const uint32_t slot = slotOfId(id);
+        store.assigned(slot);
+        mcproto::NodeMatch* node = response.add_nodes();
+        node->set_hostname(std::string(store.hostname(slot)));
+        node->set_value(store.ranking().score(slot) - store.ledger().penalty(slot));
+    }
+}
+
+void InfoUpdateService::merge(const mcproto::PickRequest& request, size_t count, std::vector<uint32_t>& ids) const
+{
+    // the candidates of every shard by id, with their score less their penalty
+    std::vector<std::pair<uint32_t, float>> candidates;
+    std::vector<uint32_t> slots;
+    for(size_t shard = 0 ; shard < shards_.size() ; shard++)
+    {
+        const NodeStore& store = shards_[shard]->store;
+        if(!request.pool().empty())
+            store.pools().top(request.pool(), count, slots);
+        else if(request.spread())
+            store.topology().spreadCandidates(count, slots);
+        else
+            store.topology().nearest(request.zone(), request.rack(), count, slots);
+        for(uint32_t slot : slots)
+            candidates.emplace_back(id(shard, slot), store.ranking().score(slot) - store.ledger().penalty(slot));
+    }
+
+    ids.clear();
+    if(!request.pool().empty())
+    {
+        // a pool ranks its members by score alone, the count best of every shard hold the best of all
+        std::sort(candidates.begin(), candidates.end(), [](const std::pair<uint32_t, float>& lhs, const std::pair<uint32_t, float>& rhs) {
+            return lhs.second != rhs.second ? lhs.second > rhs.second : lhs.first < rhs.first;
+        });
+        for(size_t idx = 0 ; idx < candidates.size() && idx < count ; idx++)
+            ids.push_back(candidates[idx].first);
+        return;
+    }
+
+    // the picks of a tree holding just the candidates, their penalties taken off already
+    std::sort(candidates.begin(), candidates.end());
+    TopologyTree merged(candidates.size());
+    for(uint32_t local = 0 ; local < candidates.size() ; local++)
+    {
+        const uint32_t id = candidates[local].first;
+        const TopologyTree& topology = shardOfId(id).store.topology();
+        merged.update(local, topology.zone(slotOfId(id)), topology.rack(slotOfId(id)), candidates[local].second);
+    }
+    if(request.spread())
+        merged.spread(count, ids);
+    else
+        merged.nearest(request.zone(), request.rack(), count, ids);
+    for(uint32_t& local : ids)
+        local = candidates[local].first;
+}
+
+grpc::ServerUnaryReactor* InfoUpdateService::PickNodes(grpc::CallbackServerContext* context, const mcproto::PickRequest* request, mcproto::NodeQueryReply* response)
+{
+    pick(*request, *response);
+
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(grpc::Status::OK);
+    return reactor;
+}
+
+grpc::Status InfoUpdateService::history(const mcproto::HistoryQuery& request, mcproto::HistoryReply& response)
+{
+    if(!history_)
+        return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "the server keeps no history");
+    if(request.metric() < 0 || request.metric() >= int(HistoryStore::metricCount))
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "unknown metric");
+    const uint64_t toMs = request.toms() ? request.toms() : std::numeric_limits<uint64_t>::max();
+    if(request.fromms() > toMs)
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "history range ends before it starts");
+
+    std::vector<HistoryStore::Point> points;
+    std::shared_lock<std::shared_mutex> guard(historyLock_);
+    response.set_truncated(!history_->query(request.hostname(), Metric(request.metric()), request.fromms(), toMs, request.stepms(), points, maxHistoryPoints));
+    for(const HistoryStore::Point& point : points)
+    {
+        mcproto::HistoryPoint* reply = response.add_points();
+        reply->set_timestampms(point.timestampMs);
+        reply->set_value(point.value);
+        reply->set_min(point.min);
+        reply->set_max(point.max);
+        reply->set_count(point.count);
+    }
+    return grpc::Status::OK;
+}
+
+grpc::ServerUnaryReactor* InfoUpdateService::QueryHistory(grpc::CallbackServerContext* context, const mcproto::HistoryQuery* request, mcproto::HistoryReply* response)
+{
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(history(*request, *response));
+    return reactor;
+}
+
+void InfoUpdateService::freshness(const std::string& hostname, mcproto::NodeFreshness& node) const
+{
+    const NodeStore& store = shards_[shardOf(hostname)]->store;
+    const uint32_t slot = store.slot(hostname);
+    const uint64_t nowMs = wallClockMs();
+    const NodeStats stats = store.stats(slot);
+    const uint64_t collectedAtMs = stats.collectedAtMs ? stats.collectedAtMs : store.freshness().receivedAtMs(slot);
+    fill(store.freshness().latency(slot), *node.mutable_latency());
+    node.set_agems(collectedAtMs && nowMs > collectedAtMs ? nowMs - collectedAtMs : 0);
+    node.set_keep(store.freshness(slot, nowMs));
+    node.set_duplicates(store.freshness().duplicates(slot));
+    node.set_reordered(store.freshness().reordered(slot));
+    node.set_outliers(store.filter().outliers(slot));
+}
+
+grpc::Status InfoUpdateService::freshness(const mcproto::FreshnessRequest& request, mcproto::FreshnessReply& response)
+{
+    AgeHistogram ages;
+    AgeHistogram latency;
+    auto guards = lockShared();
+    if(!request.hostname().empty())
+    {
+        if(shards_[shardOf(request.hostname())]->store.slot(request.hostname()) == RankIndex::npos)
+            return grpc::Status(grpc::StatusCode::NOT_FOUND, "no such node");
+        freshness(request.hostname(), *response.mutable_node());
+    }
+
+    const uint64_t nowMs = wallClockMs();
+    uint64_t duplicates = 0, reordered = 0, overdue = 0, outliers = 0;
+    for(const std::unique_ptr<Shard>& shard : shards_)
+    {
+        const NodeStore& store = shard->store;
+        store.ages(nowMs, ages);
+        latency.add(store.freshness().latency());
+        duplicates += store.freshness().duplicates();
+        reordered += store.freshness().reordered();
+        overdue += shard->overdue;
+        outliers += store.filter().outliers();
+    }
+    fill(latency, *response.mutable_latency());
+    fill(ages, *response.mutable_ages());
+    response.set_duplicates(duplicates);
+    response.set_reordered(reordered);
+    response.set_overdue(overdue);
+    response.set_outliers(outliers);
+    return grpc::Status::OK;
+}
+
+grpc::ServerUnaryReactor* InfoUpdateService::GetFreshness(grpc::CallbackServerContext* context, const mcproto::FreshnessRequest* request, mcproto::FreshnessReply* response)
+{
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(freshness(*request, *response));
+    return reactor;
+}
+
+grpc::Status InfoUpdateService::inventory(const mcproto::Inventory& request, mcproto::InventoryReply& response)
+{
+    if(request.hostname().empty())
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "inventory without a hostname");
+
+    const size_t index = shardOf(request.hostname());
+    Shard& shard = *shards_[index];
+    std::lock_guard<std::shared_mutex> guard(shard.protect);
+    const uint32_t slot = shard.store.slot(request.hostname());
+    if(slot == RankIndex::npos)
+    {
+        // the bound is shared out evenly, hostnames spread over the shards alike
+        auto pending = shard.pendingInventories.find(request.hostname());
+        if(pending != shard.pendingInventories.end())
+            pending->second = request;
+        else if(shard.pendingInventories.size() < (maxPendingInventories + shards_.size() - 1) / shards_.size())
+            shard.pendingInventories.emplace(request.hostname(), request);
+        else
+            return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "too many inventories of nodes that never reported");
+        response.set_nodeid(0);
+        return grpc::Status::OK;
+    }
+
+    setInventory(shard, slot, mcproto::Inventory(request));
+    response.set_nodeid(id(index, slot) + 1);
+    return grpc::Status::OK;
+}
+
+grpc::ServerUnaryReactor* InfoUpdateService::SendInventory(grpc::CallbackServerContext* context, const mcproto::Inventory* request, mcproto::InventoryReply* response)
+{
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(inventory(*request, *response));
+    return reactor;
+}
+
+grpc::Status InfoUpdateService::inventory(const mcproto::InventoryQuery& request, mcproto::Inventory& response)
+{
+    Shard& shard = request.nodeid() ? shardOfId(request.nodeid() - 1) : *shards_[shardOf(request.hostname())];
+    std::shared_lock<std::shared_mutex> guard(shard.protect);
+    const uint32_t slot = request.nodeid() ? slotOfId(request.nodeid() - 1) : shard.store.slot(request.hostname());
+    if(slot < shard.inventories.size() && !shard.inventories[slot].hostname().empty())
+    {
+        response = shard.inventories[slot];
+        return grpc::Status::OK;
+    }
+    if(!request.nodeid())
+    {
+        auto pending = shard.pendingInventories.find(request.hostname());
+        if(pending != shard.pendingInventories.end())
+        {
+            response = pending->second;
+            return grpc::Status::OK;
+        }
+    }
+    return grpc::Status(grpc::StatusCode::NOT_FOUND, "no inventory of the node");
+}
+
+grpc::ServerUnaryReactor* InfoUpdateService::GetInventory(grpc::CallbackServerContext* context, const mcproto::InventoryQuery* request, mcproto::Inventory* response)
+{
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(inventory(*request, *response));
+    return reactor;
+}
+
+grpc::ServerUnaryReactor* InfoUpdateService::SendStats(grpc::CallbackServerContext* context, const mcproto::Stats* request, mcproto::StatsReply* response)
+{
+    ingest(*request, *response);
+
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(grpc::Status::OK);
+    return reactor;
+}
+
+grpc::ServerUnaryReactor* InfoUpdateService::SendStatsBatch(grpc::CallbackServerContext* context, const mcproto::StatsBatch* request, mcproto::StatsReply* response)
+{
+    ingest(*request, *response);
+
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(grpc::Status::OK);
+    return reactor;
+}
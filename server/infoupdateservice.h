@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include "arenaallocator.h"
+#include "capturefile.h"
+#include "historystore.h"
+#include "ingestgovernor.h"
+#include "nodestore.h"
+
+#include <mcproto/infoupdate.grpc.pb.h>
+#include <mcproto/statsdatagram.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// The nodes are split over shards by hostname, each with a store and a lock of its own, so the
+/// reports of nodes in different shards are taken in parallel. Queries hold every shard shared
+/// and merge what each one finds. A node's id is its slot in its shard's store times the number
+/// of shards plus the shard, with one shard the slot itself.
+class InfoUpdateService final : public mcproto::InfoUpdate::CallbackService
+{
+    struct Shard
+    {
+        explicit Shard(size_t expectedNodes): store(expectedNodes) {}
+
+        NodeStore store;
+        // exclusive for ingest, shared for the routing queries
+        std::shared_mutex protect;
+        uint64_t lastSweepMs = 0;
+        // at the last sweep
+        size_t overdue = 0;
+        // by slot, without a hostname for nodes that sent none
+        std::vector<mcproto::Inventory> inventories;
+        // of nodes that have not reported stats yet
+        std::unordered_map<std::string, mcproto::Inventory> pendingInventories;
+        // the pools of a report, kept to spare allocating on every one
+        std::vector<std::string_view> poolNames;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    // the store sizes summed, for the governor
+    std::atomic<size_t> nodes_;
+    IngestGovernor governor_;
+    std::mutex governorLock_;
+    HistoryStore* history_;
+    // exclusive for appends, shared for queries
+    std::shared_mutex historyLock_;
+    CaptureWriter* capture_;
+    bool verbose_;
+    ArenaMessageAllocator<mcproto::Stats, mcproto::StatsReply> allocator_;
+    ArenaMessageAllocator<mcproto::StatsBatch, mcproto::StatsReply> batchAllocator_;
+
+    static uint64_t wallClockMs();
+    /// the store's update(), counting the node when it is new
+    uint32_t update(Shard& shard, std::string_view hostname, const NodeStats& stats, std::string_view zone, std::string_view rack,
+                    uint64_t nowMs, bool* accepted = nullptr);
+    void record(const Shard& shard, std::string_view hostname, uint32_t slot, const NodeStats& stats, uint64_t nowMs);
+    /// whether the server has the inventory of the node, applies one that came before the
+    /// node's first stats. With the shard's lock held exclusively
+    bool inventoried(Shard& shard, uint32_t slot, std::string_view hostname);
+    /// with the shard's lock held exclusively
+    void join(Shard& shard, uint32_t slot, const mcproto::Stats& request);
+    void setInventory(Shard& shard, uint32_t slot, mcproto::Inventory&& inventory);
+    /// discounts the overdue nodes once a second, with the shard's lock held exclusively
+    void sweep(Shard& shard, uint64_t nowMs);
+    uint32_t govern(uint32_t reports);
+    /// holds every shard shared, in order
+    std::vector<std::shared_lock<std::shared_mutex>> lockShared();
+    uint32_t id(size_t shard, uint32_t slot) const { return slot * shards_.size() + shard; }
+    /// the shard of a node by id and the node's slot there
+    Shard& shardOfId(uint32_t id) const { return *shards_[id % shards_.size()]; }
+    uint32_t slotOfId(uint32_t id) const { return id / shards_.size(); }
+    void freshness(const std::string& hostname, mcproto::NodeFreshness& node) const;
+    /// pick() of a pool, the nearest nodes or spread ones over more than one shard
+    void merge(const mcproto::PickRequest& request, size_t count, std::vector<uint32_t>& ids) const;
+
+public:
+    static constexpr uint32_t defaultQueryLimit = 10;
+    static constexpr uint32_t maxQueryLimit = 1000;
+    static constexpr uint32_t maxHistoryPoints = 10000;
+    static constexpr uint32_t overdueSweepMs = 1000;
+    /// inventories of nodes yet to report kept at most
+    static constexpr size_t maxPendingInventories = 65536;
+
+    /// every sample ingested goes into history as well, when there is one, and every report
+    /// taken over grpc into the capture
+    InfoUpdateService(bool verbose = false, uint32_t maxReportsPerSec = 20000, size_t expectedNodes = 1024, HistoryStore* history = nullptr, CaptureWriter* capture = nullptr,
+                      size_t shards = 1);
+
+    /// stats as the ranking sees them, with the cgroup headroom folded in
+    static NodeStats nodeStats(const mcproto::Stats& request);
+    static NodeStats nodeStats(const mcproto::StatsDatagram& datagram);
+    /// what the node's hardware makes of its stats, the line rate is that of the interface the
+    /// bandwidth is measured on
+    static NodeCapacity nodeCapacity(const mcproto::Inventory& inventory);
+
+    /// a report that came without a call, over the datagram transport
+    struct Report
+    {
+        std::string_view hostname;
+        std::string_view zone;
+        std::string_view rack;
+        NodeStats stats;
+    };
+    /// reports of nodes of the shard, all of them under one hold of its lock
+    void ingest(size_t shard, const Report* reports, size_t count);
+    /// reports of any nodes, one hold of the lock of every shard they are in
+    void ingest(const Report* reports, size_t count);
+
+    grpc::ServerUnaryReactor* SendStats(grpc::CallbackServerContext* context, const mcproto::Stats* request, mcproto::StatsReply* response) override;
+    /// the part of SendStats independent of the call itself
+    void ingest(const mcproto::Stats& request, mcproto::StatsReply& response);
+    /// samples a client spooled while it could not reach us
+    grpc::ServerUnaryReactor* SendStatsBatch(grpc::CallbackServerContext* context, const mcproto::StatsBatch* request, mcproto::StatsReply* response) override;
+    void ingest(const mcproto::StatsBatch& request, mcproto::StatsReply& response);
+    /// the best nodes meeting hard constraints on their metrics, INVALID_ARGUMENT for unknown
+    /// metrics and empty ranges
+    grpc::ServerUnaryReactor* QueryNodes(grpc::CallbackServerContext* context, const mcproto::NodeQuery* request, mcproto::NodeQueryReply* response) override;
+    grpc::Status query(const mcproto::NodeQuery& request, mcproto::NodeQueryReply& response);
+    /// the best nodes of a service pool, close to the caller's zone and rack, or spread over
+    /// failure domains. The nodes picked count as assigned to until their next report
+    grpc::ServerUnaryReactor* PickNodes(grpc::CallbackServerContext* context, const mcproto::PickRequest* request, mcproto::NodeQueryReply* response) override;
+    void pick(const mcproto::PickRequest& request, mcproto::NodeQueryReply& response);
+    /// FAILED_PRECONDITION when the server keeps no history, INVALID_ARGUMENT for unknown
+    /// metrics and empty ranges
+    grpc::ServerUnaryReactor* QueryHistory(grpc::CallbackServerContext* context, const mcproto::HistoryQuery* request, mcproto::HistoryReply* response) override;
+    grpc::Status history(const mcproto::HistoryQuery& request, mcproto::HistoryReply& response);
+    /// NOT_FOUND when asked for a node that never reported
+    grpc::ServerUnaryReactor* GetFreshness(grpc::CallbackServerContext* context, const mcproto::FreshnessRequest* request, mcproto::FreshnessReply* response) override;
+    grpc::Status freshness(const mcproto::FreshnessRequest& request, mcproto::FreshnessReply& response);
+    /// kept for the node's lifetime on this server, INVALID_ARGUMENT without a hostname,
+    /// RESOURCE_EXHAUSTED when too many nodes that never reported sent theirs
+    grpc::ServerUnaryReactor* SendInventory(grpc::CallbackServerContext* context, const mcproto::Inventory* request, mcproto::InventoryReply* response) override;
+    grpc::Status inventory(const mcproto::Inventory& request, mcproto::InventoryReply& response);
+    /// NOT_FOUND for nodes that sent none
+    grpc::ServerUnaryReactor* GetInventory(grpc::CallbackServerContext* context, const mcproto::InventoryQuery* request, mcproto::Inventory* response) override;
+    grpc::Status inventory(const mcproto::InventoryQuery& request, mcproto::Inventory& response);
+
+    size_t shards() const { return shards_.size(); }
+    /// the shard the node is in
+    size_t shardOf(std::string_view hostname) const;
+    /// callers hold the lock of the shard for as long as they look at its store
+    std::shared_mutex& lock(size_t shard = 0) { return shards_[shard]->protect; }
+    const NodeStore& store(size_t shard = 0) const { return shards_[shard]->store; }
+};
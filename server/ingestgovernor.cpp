@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "ingestgovernor.h"
+
+#include <algorithm>
+
+IngestGovernor::IngestGovernor(uint32_t maxReportsPerSec):
+    maxReportsPerSec_(maxReportsPerSec),
+    windowStart_(std::chrono::steady_clock::now()),
+    windowReports_(0),
+    reportsPerSec_(0)
+{}
+
+uint32_t IngestGovernor::record(size_t nodeCount, std::chrono::steady_clock::time_point now)
+{
+    return record(nodeCount, 1, now);
+}
+
+uint32_t IngestGovernor::record(size_t nodeCount, uint32_t reports, std::chrono::steady_clock::time_point now)
+{
+    using namespace std::chrono;
+    windowReports_ += reports;
+    const auto elapsedMs = duration_cast<milliseconds>(now - windowStart_).count();
+    if(elapsedMs >= 1000)
+    {
+        reportsPerSec_ = uint64_t(windowReports_) * 1000 / elapsedMs;
+        windowReports_ = 0;
+        windowStart_ = now;
+    }
+
+    // no limit configured, the rate is still measured
+    if(maxReportsPerSec_ == 0)
+        return 0;
+
+    // with every node reporting once per interval the fleet sends nodeCount * 1000 / interval
+    // reports per second, which bounds the interval from below
+    uint64_t floorMs = (uint64_t(nodeCount) * 1000 + maxReportsPerSec_ - 1) / maxReportsPerSec_;
+
+    // out-of-band and fast reporters can still push the rate over, stretch proportionally
+    if(reportsPerSec_ > maxReportsPerSec_)
+        floorMs = std::max<uint64_t>(floorMs, 1) * reportsPerSec_ / maxReportsPerSec_;
+
+    return uint32_t(floorMs);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/// Works out the reporting interval the clients are asked not to go below so that the
+/// fleet as a whole stays within the number of reports the server can take per second.
+class IngestGovernor
+{
+    uint32_t maxReportsPerSec_;
+    std::chrono::steady_clock::time_point windowStart_;
+    uint32_t windowReports_;
+    uint32_t reportsPerSec_;
+
+public:
+    /// maxReportsPerSec of 0 puts no floor on the interval
+    IngestGovernor(uint32_t maxReportsPerSec = 20000);
+
+    /// counts a report from one of nodeCount nodes, returns the interval floor in ms to hand out
+    uint32_t record(size_t nodeCount, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    /// counts a batch of reports
+    uint32_t record(size_t nodeCount, uint32_t reports, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    /// rate measured over the last complete second
+    uint32_t reportsPerSec() const { return reportsPerSec_; }
+};
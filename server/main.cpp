@@ -12,114 +12,140 @@
  * General Public License Version 3 for more details.
  */
 
-#include <iostream>
-
-#include <mcproto/networkinfo.grpc.pb.h>
-#include <mcproto/cpuloadinfo.grpc.pb.h>
-#include <mcproto/diskinfo.grpc.pb.h>
-#include <mcproto/memoryinfo.grpc.pb.h>
-#include <mcproto/infoupdate.grpc.pb.h>
+#include "datagramingest.h"
+#include "infoupdateservice.h"
 
 #include <grpc/grpc.h>
 #include <grpcpp/server_builder.h>
 
-#include <mutex>
-#include <set>
-#include <unordered_map>
+#include <pthread.h>
+#include <signal.h>
 
-class InfoUpdateService final : public mcproto::InfoUpdate::Service
-{
-    struct Stat
-    {
-        Stat():cpuIdlePercent(0.f), diskSpaceAvailable(0), networkBandwidthUsed(0), ramUsedPercent(0), swapUsedPercent(0)
-        {}
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
 
-        std::string hostanme;
-        float cpuIdlePercent;
-        unsigned long diskSpaceAvailable;
-        unsigned int networkBandwidthUsed;
-        unsigned char ramUsedPercent;
-        unsigned char swapUsedPercent;
-    };
+namespace
+{
+    // what calls in flight get to finish once the server is told to stop
+    constexpr std::chrono::seconds shutdownGrace{5};
+}
 
-    struct compare
+int main(int argc, char* argv[])
+{
+    bool verbose = false;
+    uint32_t maxReportsPerSec = 20000;
+    std::string historyDirectory;
+    std::string capturePath;
+    DatagramIngest::Config datagrams;
+    bool udp = false;
+    // 0 for one per core over udp, one otherwise
+    size_t shards = 0;
+    try
     {
-        bool operator()(const Stat* l, const Stat* r) const
+        for(int idx = 1 ; idx < argc ; idx++)
         {
-            return l->cpuIdlePercent > r->cpuIdlePercent &&
-            l->diskSpaceAvailable > r->diskSpaceAvailable &&
-            l->networkBandwidthUsed < r->networkBandwidthUsed &&
-            (l->ramUsedPercent + l->swapUsedPercent) > (r->ramUsedPercent + r->swapUsedPercent);
+            if(!strcmp(argv[idx], "--verbose"))
+                verbose = true;
+            else if(!strcmp(argv[idx], "--max-reports-per-sec") && idx + 1 < argc)
+                maxReportsPerSec = std::stoul(argv[++idx]);
+            else if(!strcmp(argv[idx], "--history") && idx + 1 < argc)
+                historyDirectory = argv[++idx];
+            else if(!strcmp(argv[idx], "--capture") && idx + 1 < argc)
+                capturePath = argv[++idx];
+            else if(!strcmp(argv[idx], "--shards") && idx + 1 < argc)
+                shards = std::stoul(argv[++idx]);
+            else if(!strcmp(argv[idx], "--udp-port") && idx + 1 < argc)
+            {
+                datagrams.port = uint16_t(std::stoul(argv[++idx]));
+                udp = true;
+            }
+            else if(!strcmp(argv[idx], "--udp-threads") && idx + 1 < argc)
+                datagrams.threads = std::stoul(argv[++idx]);
+            else if(!strcmp(argv[idx], "--udp-key") && idx + 1 < argc)
+            {
+                mcproto::StatsDatagram::Key key;
+                if(!mcproto::StatsDatagram::parseKey(argv[++idx], key))
+                    throw std::invalid_argument(argv[idx]);
+                datagrams.key = key;
+            }
+            else
+                throw std::invalid_argument(argv[idx]);
         }
-    };
-
-    std::set<Stat*, compare> node_list;
-    std::unordered_map<std::string, Stat*> node_list_mapping;
-    std::mutex protect;
-
-public:
-    virtual ::grpc::Status SendStats(::grpc::ServerContext* context, const ::mcproto::Stats* request, ::mcproto::Empty* response) override
+    }
+    catch(const std::logic_error&)
     {
-        Stat* stat = new Stat;
-        std::cout << "hostname: " << request->hostname() << '\n';
-        stat->hostanme = request->hostname();
-
-        if(request->has_cpuload())
-        {
-            std::cout << "Cpu Load(%): " << double(request->cpuload().cpuload()) / 100. << '\n';
-            stat->cpuIdlePercent = 100. - double(request->cpuload().cpuload()) / 100.;
-        }
-
-        if(request->has_diskinfo())
-        {
-            std::cout << "DiskSpace(KB): " << request->diskinfo().availablespace() << '\n';
-            stat->diskSpaceAvailable = request->diskinfo().availablespace();
-        }
-
-        if(request->has_netinfo())
-        {
-            std::cout << "Network Speed(bytes/sec): " << request->netinfo().bandwidthusage() << '\n';
-            stat->networkBandwidthUsed = request->netinfo().bandwidthusage();
-        }
-
-        if(request->has_meminfo())
-        {
-            std::cout << "Memory Info:\n";
-            std::cout << "Available Ram(MB): " << request->meminfo().availableram() << '\n';
-            std::cout << "Available Swap(MB): " << request->meminfo().availableswap() << '\n';
-            std::cout << "Available Ram(%): " << request->meminfo().availablerampercent() << '\n';
-            std::cout << "Available Swap(%): " << request->meminfo().availableswappercent() << '\n';
-            std::cout << "Avg10 stall info(us): " << request->meminfo().avg10processstalltime() << '\n';
-            stat->ramUsedPercent = request->meminfo().availablerampercent();
-            stat->swapUsedPercent = request->meminfo().availableswappercent();
-        }
-
-        std::cout << "============================================================" << std::endl;
-
-        std::lock_guard<std::mutex> guard(protect);
-        auto node_iter = node_list_mapping.find(stat->hostanme);
-        if(node_iter != node_list_mapping.cend())
-        {
-            node_list.erase(node_iter->second);
-            node_list_mapping.erase(node_iter);
-            delete node_iter->second;
-        }
-
-        node_list_mapping.insert(std::make_pair(stat->hostanme, stat));
-        node_list.insert(stat);
-
-        return grpc::Status::OK;
+        std::cerr << "usage: mclearsrv [--verbose] [--max-reports-per-sec <reports>] [--history <directory>]\n"
+                     "                 [--capture <file>] [--shards <shards>]\n"
+                     "                 [--udp-port <port> [--udp-threads <threads>] [--udp-key <32 hex digits>]]\n";
+        return EXIT_FAILURE;
     }
-};
 
-int main()
-{
+    // SIGINT and SIGTERM are waited for by a thread of their own, blocked before any other
+    // thread starts so none of them takes the signal instead
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
     grpc::ServerBuilder builder;
     builder.AddListeningPort("0.0.0.0:50051", grpc::InsecureServerCredentials());
 
-    InfoUpdateService service;
+    std::unique_ptr<HistoryStore> history;
+    std::unique_ptr<CaptureWriter> capture;
+    try
+    {
+        if(!historyDirectory.empty())
+            history = std::make_unique<HistoryStore>(historyDirectory);
+        if(!capturePath.empty())
+            capture = std::make_unique<CaptureWriter>(capturePath);
+    }
+    catch(const std::system_error& error)
+    {
+        std::cerr << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if(!shards)
+        shards = udp ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+    InfoUpdateService service(verbose, maxReportsPerSec, 1024, history.get(), capture.get(), shards);
     builder.RegisterService(&service);
 
+    std::unique_ptr<DatagramIngest> datagramIngest;
+    try
+    {
+        if(udp)
+            datagramIngest = std::make_unique<DatagramIngest>(service, datagrams);
+    }
+    catch(const std::system_error& error)
+    {
+        std::cerr << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
     std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+    if(!server)
+    {
+        std::cerr << "cannot listen on 0.0.0.0:50051" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::thread stopper([&server, &signals]
+    {
+        int signal;
+        sigwait(&signals, &signal);
+        server->Shutdown(std::chrono::system_clock::now() + shutdownGrace);
+    });
     server->Wait();
-}
\ No newline at end of file
+    stopper.join();
+    // the datagram receivers stop before the service, the history and the capture are flushed
+    // as they go
+    datagramIngest.reset();
+    return EXIT_SUCCESS;
+}
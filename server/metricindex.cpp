@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "metricindex.h"
+#include "nodestore.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    constexpr size_t percentBuckets = 101;
+    // 0, then 4 per power of two up to 2^63
+    constexpr size_t logBuckets = 256;
+    // scores weighted by the capacity of their node go well past 100. 0, then 32 per power of
+    // two up to 2^20, as fine as whole points around 50 and finer below
+    constexpr size_t scoreStepsPerOctave = 32;
+    constexpr size_t scoreBuckets = 1 + 20 * scoreStepsPerOctave;
+
+    bool logarithmic(Metric metric)
+    {
+        return metric == Metric::RamAvailableMb || metric == Metric::DiskAvailableKb
+            || metric == Metric::BandwidthUsed || metric == Metric::AppInFlight;
+    }
+
+    struct Better
+    {
+        bool ascending;
+
+        bool operator()(const MetricIndex::Match& lhs, const MetricIndex::Match& rhs) const
+        {
+            if(lhs.value != rhs.value)
+                return ascending ? lhs.value < rhs.value : lhs.value > rhs.value;
+            return lhs.slot < rhs.slot;
+        }
+    };
+}
+
+MetricIndex::MetricIndex(size_t slots):
+    size_(0)
+{
+    for(size_t metric = 0 ; metric < metricCount ; metric++)
+        columns_[metric].buckets.resize(bucketCount(Metric(metric)));
+    reserve(slots);
+}
+
+void MetricIndex::reserve(size_t slots)
+{
+    for(Column& column : columns_)
+    {
+        column.values.reserve(slots);
+        column.bucketOf.reserve(slots);
+        column.position.reserve(slots);
+    }
+}
+
+size_t MetricIndex::bucketCount(Metric metric)
+{
+    if(metric == Metric::Score)
+        return scoreBuckets;
+    return logarithmic(metric) ? logBuckets : percentBuckets;
+}
+
+uint16_t MetricIndex::bucket(Metric metric, double value)
+{
+    // monotonic, a higher bucket only holds higher values
+    if(!(value >= 1.))
+        return 0;
+    if(metric == Metric::Score)
+        return uint16_t(std::min<double>(scoreBuckets - 1, 1 + std::floor(std::log2(value) * scoreStepsPerOctave)));
+    if(logarithmic(metric))
+        return uint16_t(std::min<double>(logBuckets - 1, 1 + std::floor(std::log2(value) * 4)));
+    return uint16_t(std::min<double>(percentBuckets - 1, std::floor(value)));
+}
+
+double MetricIndex::value(const NodeStats& stats, float score, Metric metric)
+{
+    switch(metric)
+    {
+    case Metric::Score:                 return score;
+    case Metric::CpuIdlePercent:        return stats.cpuIdlePercent;
+    case Metric::RamAvailableMb:        return double(stats.ramAvailable);
+    case Metric::RamAvailablePercent:   return stats.ramAvailablePercent;
+    case Metric::SwapAvailablePercent:  return stats.swapAvailablePercent;
+    case Metric::DiskAvailableKb:       return double(stats.diskSpaceAvailable);
+    case Metric::BandwidthUsed:         return stats.networkBandwidthUsed;
+    case Metric::Pressure:              return stats.pressure;
+    case Metric::AppInFlight:           return double(stats.appInFlight);
+    case Metric::Count:                 break;
+    }
+    return 0.;
+}
+
+void MetricIndex::update(uint32_t slot, const NodeStats& stats, float score)
+{
+    const bool added = slot >= size_;
+    if(added)
+        size_ = slot + 1;
+
+    for(size_t metric = 0 ; metric < metricCount ; metric++)
+    {
+        Column& column = columns_[metric];
+        const double value = MetricIndex::value(stats, score, Metric(metric));
+        const uint16_t target = bucket(Metric(metric), value);
+
+        if(added)
+        {
+            column.values.push_back(value);
+            column.bucketOf.push_back(target);
+            column.position.push_back(column.buckets[target].size());
+            column.buckets[target].push_back(slot);
+            continue;
+        }
+
+        column.values[slot] = value;
+        const uint16_t current = column.bucketOf[slot];
+        if(current == target)
+            continue;
+
+        // swap with the last of the old bucket, the order within a bucket does not matter
+        std::vector<uint32_t>& from = column.buckets[current];
+        const uint32_t last = from.back();
+        from[column.position[slot]] = last;
+        column.position[last] = column.position[slot];
+        from.pop_back();
+
+        column.bucketOf[slot] = target;
+        column.position[slot] = column.buckets[target].size();
+        column.buckets[target].push_back(slot);
+    }
+}
+
+bool MetricIndex::meets(uint32_t slot, const Query& query) const
+{
+    for(const Constraint& constraint : query.constraints)
+    {
+        const double value = columns_[size_t(constraint.metric)].values[slot];
+        if(value < constraint.min || value > constraint.max)
+            return false;
+    }
+    return true;
+}
+
+size_t MetricIndex::query(const Query& query, std::vector<Match>& matches) const
+{
+    matches.clear();
+    if(!size_ || !query.limit)
+        return 0;
+
+    // the constraint ruling out the most nodes, and how many nodes all of them leave together
+    // going by the bucket sizes and taking the metrics to be independent
+    const Constraint* narrowest = nullptr;
+    size_t narrowestCount = size_;
+    double selectivity = 1.;
+    for(const Constraint& constraint : query.constraints)
+    {
+        if(constraint.min > constraint.max)
+            return 0;
+        const Column& column = columns_[size_t(constraint.metric)];
+        size_t count = 0;
+        for(size_t idx = bucket(constraint.metric, constraint.min), last = bucket(constraint.metric, constraint.max) ; idx <= last ; idx++)
+            count += column.buckets[idx].size();
+        selectivity *= double(count) / size_;
+        if(count <= narrowestCount)
+        {
+            narrowest = &constraint;
+            narrowestCount = count;
+        }
+    }
+
+    const Better better{query.ascending};
+    const Column& objective = columns_[size_t(query.objective)];
+    const double orderedCost = selectivity > 0. ? query.limit / selectivity : double(size_);
+    size_t scanned = 0;
+
+    if(!narrowest || orderedCost < narrowestCount)
+    {
+        // whole buckets best first, a bucket only holds values worse than those before it
+        std::vector<Match> candidates;
+        const size_t buckets = objective.buckets.size();
+        for(size_t step = 0 ; step < buckets && matches.size() < query.limit ; step++)
+        {
+            const std::vector<uint32_t>& slots = objective.buckets[query.ascending ? step : buckets - 1 - step];
+            scanned += slots.size();
+            candidates.clear();
+            for(uint32_t slot : slots)
+                if(meets(slot, query))
+                    candidates.push_back({slot, objective.values[slot]});
+
+            const size_t take = std::min(candidates.size(), query.limit - matches.size());
+            std::partial_sort(candidates.begin(), candidates.begin() + take, candidates.end(), better);
+            matches.insert(matches.end(), candidates.begin(), candidates.begin() + take);
+        }
+        return scanned;
+    }
+
+    // the k best of the nodes within the narrowest constraint, the worst kept on top of the heap
+    const Column& column = columns_[size_t(narrowest->metric)];
+    for(size_t idx = bucket(narrowest->metric, narrowest->min), last = bucket(narrowest->metric, narrowest->max) ; idx <= last ; idx++)
+    {
+        scanned += column.buckets[idx].size();
+        for(uint32_t slot : column.buckets[idx])
+        {
+            if(!meets(slot, query))
+                continue;
+            const Match match{slot, objective.values[slot]};
+            if(matches.size() < query.limit)
+            {
+                matches.push_back(match);
+                std::push_heap(matches.begin(), matches.end(), better);
+            }
+            else if(better(match, matches.front()))
+            {
+                std::pop_heap(matches.begin(), matches.end(), better);
+                matches.back() = match;
+                std::push_heap(matches.begin(), matches.end(), better);
+            }
+        }
+    }
+    std::sort_heap(matches.begin(), matches.end(), better);
+    return scanned;
+}
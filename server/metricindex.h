@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+struct NodeStats;
+
+/// numbered like mcproto::Metric
+enum class Metric : uint8_t
+{
+    Score,
+    CpuIdlePercent,
+    RamAvailableMb,
+    RamAvailablePercent,
+    SwapAvailablePercent,
+    DiskAvailableKb,
+    BandwidthUsed,
+    Pressure,
+    AppInFlight,
+    Count
+};
+
+/// Answers "the best k nodes by one metric among those within bounds on others" without looking
+/// at every node. Every metric keeps its value per slot in a column plus the slots bucketed by
+/// value: percentages by whole percent, byte counts and the like in quarter powers of two, the
+/// score, which a node's capacity takes past 100, in 32nds of a power of two. An update moves
+/// a slot between buckets in O(1) without allocating once the buckets have grown.
+///
+/// A query either walks the objective's buckets best first and stops at the first bucket that
+/// completes the k matches, or, when a constraint rules out more nodes than that walk is
+/// expected to skip, walks only the buckets within that constraint and keeps the k best. The
+/// bucket sizes give the estimate of either.
+class MetricIndex
+{
+public:
+    static constexpr size_t metricCount = size_t(Metric::Count);
+
+    struct Constraint
+    {
+        Metric metric;
+        double min = -std::numeric_limits<double>::infinity();
+        double max = std::numeric_limits<double>::infinity();
+    };
+
+    struct Query
+    {
+        std::vector<Constraint> constraints;
+        Metric objective = Metric::Score;
+        /// lowest first instead of highest first
+        bool ascending = false;
+        size_t limit = 10;
+    };
+
+    struct Match
+    {
+        uint32_t slot;
+        double value;       // of the objective
+    };
+
+    explicit MetricIndex(size_t slots = 0);
+
+    /// makes room for slots so that updates do not allocate
+    void reserve(size_t slots);
+    /// slots are handed out densely, a slot is either updated in place or the next one
+    void update(uint32_t slot, const NodeStats& stats, float score);
+    size_t size() const { return size_; }
+    double value(uint32_t slot, Metric metric) const { return columns_[size_t(metric)].values[slot]; }
+
+    static double value(const NodeStats& stats, float score, Metric metric);
+
+    /// best first, ties by slot. Returns the number of nodes looked at
+    size_t query(const Query& query, std::vector<Match>& matches) const;
+
+private:
+    struct Column
+    {
+        std::vector<double> values;
+        std::vector<uint16_t> bucketOf;
+        std::vector<uint32_t> position;     // of the slot within its bucket
+        std::vector<std::vector<uint32_t>> buckets;
+    };
+
+    std::array<Column, metricCount> columns_;
+    size_t size_;
+
+    static size_t bucketCount(Metric metric);
+    static uint16_t bucket(Metric metric, double value);
+    bool meets(uint32_t slot, const Query& query) const;
+};
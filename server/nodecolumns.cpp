@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "nodecolumns.h"
+
+#include <algorithm>
+
+namespace
+{
+    // the score saturates at 100GB of free disk and at the line rate. Bandwidth beyond 2GB/s
+    // counts as 2GB/s
+    constexpr uint64_t diskCap = 100ull * 1000 * 1000;
+    constexpr uint32_t bandwidthCap = 0x7fffffff;
+}
+
+/// weighs cpu and memory headroom highest as those saturate first, free disk counts up to
+/// 100GB, beyond that nodes are equally good. Bandwidth counts as the share of the line rate
+/// used, 100MB/s by default. A node stalling on any resource loses the same share of its score,
+/// and a node with more of the hardware than a reference node gets more of it.
+float NodeColumns::score(float cpuIdlePercent, uint8_t ramAvailablePercent, uint8_t swapAvailablePercent,
+                         uint64_t diskSpaceAvailable, uint32_t networkBandwidthUsed, float pressure,
+                         float bandwidthUnit, float weight)
+{
+    const float diskGb = std::min(100.f, float(std::min(diskSpaceAvailable, diskCap)) / (1000.f * 1000.f));
+    const float bandwidthPercent = std::min(100.f, float(std::min(networkBandwidthUsed, bandwidthCap)) / bandwidthUnit);
+    const float headroom = 0.4f * cpuIdlePercent
+                         + 0.3f * ramAvailablePercent
+                         + 0.1f * swapAvailablePercent
+                         + 0.1f * diskGb
+                         + 0.1f * (100.f - bandwidthPercent);
+    return headroom * (1.f - std::clamp(pressure, 0.f, 100.f) / 100.f) * weight;
+}
+
+NodeColumns::NodeColumns(size_t expectedNodes)
+{
+    reserve(expectedNodes);
+}
+
+void NodeColumns::reserve(size_t slots)
+{
+    cpuIdlePercent_.reserve(slots);
+    diskSpaceAvailable_.reserve(slots);
+    networkBandwidthUsed_.reserve(slots);
+    ramAvailable_.reserve(slots);
+    ramAvailablePercent_.reserve(slots);
+    swapAvailablePercent_.reserve(slots);
+    pressure_.reserve(slots);
+    collectedAtMs_.reserve(slots);
+    appInFlight_.reserve(slots);
+    runId_.reserve(slots);
+    sequence_.reserve(slots);
+    nextReportMs_.reserve(slots);
+    bandwidthUnit_.reserve(slots);
+    weight_.reserve(slots);
+}
+
+uint32_t NodeColumns::add(const NodeStats& stats)
+{
+    const uint32_t slot = size();
+    cpuIdlePercent_.push_back(stats.cpuIdlePercent);
+    diskSpaceAvailable_.push_back(stats.diskSpaceAvailable);
+    networkBandwidthUsed_.push_back(stats.networkBandwidthUsed);
+    ramAvailable_.push_back(stats.ramAvailable);
+    ramAvailablePercent_.push_back(stats.ramAvailablePercent);
+    swapAvailablePercent_.push_back(stats.swapAvailablePercent);
+    pressure_.push_back(stats.pressure);
+    collectedAtMs_.push_back(stats.collectedAtMs);
+    appInFlight_.push_back(stats.appInFlight);
+    runId_.push_back(stats.runId);
+    sequence_.push_back(stats.sequence);
+    nextReportMs_.push_back(stats.nextReportMs);
+    bandwidthUnit_.push_back(defaultBandwidthUnit);
+    weight_.push_back(1.f);
+    return slot;
+}
+
+void NodeColumns::set(uint32_t slot, const NodeStats& stats)
+{
+    cpuIdlePercent_[slot] = stats.cpuIdlePercent;
+    diskSpaceAvailable_[slot] = stats.diskSpaceAvailable;
+    networkBandwidthUsed_[slot] = stats.networkBandwidthUsed;
+    ramAvailable_[slot] = stats.ramAvailable;
+    ramAvailablePercent_[slot] = stats.ramAvailablePercent;
+    swapAvailablePercent_[slot] = stats.swapAvailablePercent;
+    pressure_[slot] = stats.pressure;
+    collectedAtMs_[slot] = stats.collectedAtMs;
+    appInFlight_[slot] = stats.appInFlight;
+    runId_[slot] = stats.runId;
+    sequence_[slot] = stats.sequence;
+    nextReportMs_[slot] = stats.nextReportMs;
+}
+
+NodeStats NodeColumns::get(uint32_t slot) const
+{
+    NodeStats stats;
+    stats.cpuIdlePercent = cpuIdlePercent_[slot];
+    stats.diskSpaceAvailable = diskSpaceAvailable_[slot];
+    stats.networkBandwidthUsed = networkBandwidthUsed_[slot];
+    stats.ramAvailable = ramAvailable_[slot];
+    stats.ramAvailablePercent = ramAvailablePercent_[slot];
+    stats.swapAvailablePercent = swapAvailablePercent_[slot];
+    stats.pressure = pressure_[slot];
+    stats.collectedAtMs = collectedAtMs_[slot];
+    stats.appInFlight = appInFlight_[slot];
+    stats.runId = runId_[slot];
+    stats.sequence = sequence_[slot];
+    stats.nextReportMs = nextReportMs_[slot];
+    return stats;
+}
+
+void NodeColumns::setCapacity(uint32_t slot, const NodeCapacity& capacity)
+{
+    bandwidthUnit_[slot] = capacity.bandwidthUnit;
+    weight_[slot] = capacity.weight;
+}
+
+float NodeColumns::score(uint32_t slot) const
+{
+    return score(cpuIdlePercent_[slot], ramAvailablePercent_[slot], swapAvailablePercent_[slot],
+                 diskSpaceAvailable_[slot], networkBandwidthUsed_[slot], pressure_[slot],
+                 bandwidthUnit_[slot], weight_[slot]);
+}
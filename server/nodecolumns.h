@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct NodeStats
+{
+    float cpuIdlePercent = 0.f;
+    uint64_t diskSpaceAvailable = 0;    // KB
+    uint32_t networkBandwidthUsed = 0;  // bytes/sec
+    uint64_t ramAvailable = 0;          // MB
+    uint8_t ramAvailablePercent = 0;
+    uint8_t swapAvailablePercent = 0;
+    float pressure = 0.f;               // highest avg10 stall percentage
+    uint64_t collectedAtMs = 0;         // 0 when the client did not say
+    int64_t appInFlight = 0;            // requests in flight over the services publishing their load
+    uint64_t runId = 0;                 // of the client process, 0 for clients that do not count samples
+    uint64_t sequence = 0;              // of the sample within the run
+    uint32_t nextReportMs = 0;          // the client's wait before its next sample, 0 when it did not say
+};
+
+/// What the hardware of a node makes of its stats in the score, NodeStore::capacity() derives it
+/// from the node's inventory. The defaults leave the score as it is without one.
+struct NodeCapacity
+{
+    /// bytes/sec that are a percent of the bandwidth, a hundredth of the line rate. A line rate
+    /// of 100MB/s when it is unknown
+    float bandwidthUnit = 1000.f * 1000.f;
+    /// the headroom of the node counts this many times that of a reference node
+    float weight = 1.f;
+};
+
+/// The stats of every node by slot, one dense array per field, so that a pass over the fleet
+/// streams through the few columns it reads instead of whole records.
+class NodeColumns
+{
+    std::vector<float> cpuIdlePercent_;
+    std::vector<uint64_t> diskSpaceAvailable_;
+    std::vector<uint32_t> networkBandwidthUsed_;
+    std::vector<uint64_t> ramAvailable_;
+    std::vector<uint8_t> ramAvailablePercent_;
+    std::vector<uint8_t> swapAvailablePercent_;
+    std::vector<float> pressure_;
+    std::vector<uint64_t> collectedAtMs_;
+    std::vector<int64_t> appInFlight_;
+    std::vector<uint64_t> runId_;
+    std::vector<uint64_t> sequence_;
+    std::vector<uint32_t> nextReportMs_;
+    std::vector<float> bandwidthUnit_;
+    std::vector<float> weight_;
+
+public:
+    static constexpr float defaultBandwidthUnit = NodeCapacity{}.bandwidthUnit;
+
+    /// higher is better, see NodeStore::score
+    static float score(float cpuIdlePercent, uint8_t ramAvailablePercent, uint8_t swapAvailablePercent,
+                       uint64_t diskSpaceAvailable, uint32_t networkBandwidthUsed, float pressure,
+                       float bandwidthUnit = defaultBandwidthUnit, float weight = 1.f);
+
+    explicit NodeColumns(size_t expectedNodes = 0);
+
+    void reserve(size_t slots);
+    size_t size() const { return cpuIdlePercent_.size(); }
+    /// returns the slot of the new node, with the default capacity
+    uint32_t add(const NodeStats& stats);
+    /// leaves the capacity of the node as it is
+    void set(uint32_t slot, const NodeStats& stats);
+    NodeStats get(uint32_t slot) const;
+    void setCapacity(uint32_t slot, const NodeCapacity& capacity);
+    NodeCapacity capacity(uint32_t slot) const { return {bandwidthUnit_[slot], weight_[slot]}; }
+    uint64_t collectedAtMs(uint32_t slot) const { return collectedAtMs_[slot]; }
+    uint64_t runId(uint32_t slot) const { return runId_[slot]; }
+    uint64_t sequence(uint32_t slot) const { return sequence_[slot]; }
+    uint32_t nextReportMs(uint32_t slot) const { return nextReportMs_[slot]; }
+    float score(uint32_t slot) const;
+};
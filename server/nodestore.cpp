@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "nodestore.h"
+
+#include <algorithm>
+
+NodeStore::NodeStore(size_t expectedNodes, ScoreFilter::Config filter):
+    columns_(expectedNodes),
+    ranking_(expectedNodes),
+    index_(expectedNodes),
+    topology_(expectedNodes, &ledger_),
+    pools_(expectedNodes, &ledger_),
+    freshness_(expectedNodes),
+    filter_(filter, expectedNodes)
+{
+    slots_.reserve(expectedNodes);
+    discounted_.reserve(expectedNodes);
+}
+
+uint32_t NodeStore::update(std::string_view hostname, const NodeStats& stats, std::string_view zone, std::string_view rack,
+                           uint64_t receivedAtMs, bool* accepted)
+{
+    if(accepted)
+        *accepted = false;
+    auto slotIter = slots_.find(hostname);
+    uint32_t slot;
+    float score;
+    if(slotIter != slots_.end())
+    {
+        slot = slotIter->second;
+        // the clocks of the client may step within a run, the sequence does not. A restarted
+        // client starts a new run, the sample has to be newer by its clock then
+        if(stats.sequence && stats.runId == columns_.runId(slot))
+        {
+            if(stats.sequence <= columns_.sequence(slot))
+            {
+                freshness_.dropped(slot, stats.sequence == columns_.sequence(slot));
+                return slot;
+            }
+        }
+        else if(stats.collectedAtMs < columns_.collectedAtMs(slot))
+        {
+            freshness_.dropped(slot, false);
+            return slot;
+        }
+        // the ledger learns from the scores without the outliers, and ranks by what the filter makes of them
+        const float previous = filter_.filtered(slot);
+        score = filter_.update(slot, NodeStore::score(stats, columns_.capacity(slot)));
+        ledger_.report(slot, previous, filter_.filtered(slot));
+        columns_.set(slot, stats);
+    }
+    else
+    {
+        slot = columns_.add(stats);
+        score = filter_.add(slot, NodeStore::score(stats));
+        hostnames_.emplace_back(hostname);
+        slots_.emplace(hostnames_.back(), slot);
+        ledger_.add(slot);
+        freshness_.add(slot);
+        discounted_.push_back(false);
+    }
+
+    if(accepted)
+        *accepted = true;
+    freshness_.received(slot, stats.collectedAtMs, receivedAtMs);
+    discounted_[slot] = false;
+    ranking_.update(slot, score);
+    index_.update(slot, stats, score);
+    topology_.update(slot, zone, rack, score);
+    pools_.update(slot, score);
+    return slot;
+}
+
+NodeCapacity NodeStore::capacity(uint32_t cores, uint64_t lineRate)
+{
+    NodeCapacity capacity;
+    if(cores)
+        capacity.weight = float(cores) / referenceCores;
+    // within what the bandwidth column holds
+    if(lineRate)
+        capacity.bandwidthUnit = float(std::min<uint64_t>(lineRate, 0xffffffffu)) / 100.f;
+    return capacity;
+}
+
+void NodeStore::setCapacity(uint32_t slot, const NodeCapacity& capacity)
+{
+    columns_.setCapacity(slot, capacity);
+    // the scores before are on another scale. An overdue node is discounted again by the next sweep
+    filter_.reset(slot, columns_.score(slot));
+    const float score = filter_.ranked(slot);
+    ranking_.update(slot, score);
+    index_.update(slot, columns_.get(slot), score);
+    topology_.update(slot, topology_.zone(slot), topology_.rack(slot), score);
+    pools_.update(slot, score);
+}
+
+float NodeStore::freshness(uint32_t slot, uint64_t nowMs) const
+{
+    const uint64_t receivedAtMs = freshness_.receivedAtMs(slot);
+    if(!receivedAtMs)
+        return 1.f;
+    const uint32_t waitMs = columns_.nextReportMs(slot) ? columns_.nextReportMs(slot) : defaultReportMs;
+    const uint64_t dueMs = receivedAtMs + waitMs + graceMs;
+    if(nowMs <= dueMs)
+        return 1.f;
+    return 1.f - std::min(1.f, float(nowMs - dueMs) / worthlessAfterMs);
+}
+
+size_t NodeStore::discountOverdue(uint64_t nowMs)
+{
+    size_t overdue = 0;
+    for(uint32_t slot = 0 ; slot < columns_.size() ; slot++)
+    {
+        const float keep = freshness(slot, nowMs);
+        if(keep == 1.f && !discounted_[slot])
+            continue;
+        overdue += keep < 1.f;
+        discounted_[slot] = keep < 1.f;
+        const float score = filter_.ranked(slot) * keep;
+        if(score != ranking_.score(slot))
+        {
+            ranking_.update(slot, score);
+            index_.update(slot, columns_.get(slot), score);
+            topology_.update(slot, topology_.zone(slot), topology_.rack(slot), score);
+            pools_.update(slot, score);
+        }
+    }
+    return overdue;
+}
+
+void NodeStore::ages(uint64_t nowMs, AgeHistogram& histogram) const
+{
+    for(uint32_t slot = 0 ; slot < columns_.size() ; slot++)
+    {
+        const uint64_t collectedAtMs = columns_.collectedAtMs(slot) ? columns_.collectedAtMs(slot) : freshness_.receivedAtMs(slot);
+        if(collectedAtMs)
+            histogram.record(nowMs > collectedAtMs ? nowMs - collectedAtMs : 0);
+    }
+}
+
+uint32_t NodeStore::assign()
+{
+    const uint32_t slot = best();
+    if(slot != RankIndex::npos)
+        ledger_.assign(slot);
+    return slot;
+}
+
+uint32_t NodeStore::slot(std::string_view hostname) const
+{
+    auto slotIter = slots_.find(hostname);
+    return slotIter != slots_.end() ? slotIter->second : RankIndex::npos;
+}
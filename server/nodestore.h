@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include "assignmentledger.h"
+#include "freshnesstracker.h"
+#include "metricindex.h"
+#include "nodecolumns.h"
+#include "poolindex.h"
+#include "rankindex.h"
+#include "scorefilter.h"
+#include "topologytree.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Latest stats of every node, kept in columns indexed by a slot that stays the same for the
+/// lifetime of the node. Hostnames are interned on the first report, later reports update their
+/// columns in place and move it within the ranking, the metric index and the topology without
+/// allocating.
+///
+/// The scores of the reports go through a ScoreFilter before they are ranked, an outlier or a
+/// change within the hysteresis band leaves the node where it is.
+///
+/// A node that does not report by the time it said it would loses score the longer it is
+/// overdue, down to nothing. The ranking, the index and the topology all see the discounted
+/// score, discountOverdue() brings it up to date.
+class NodeStore
+{
+    std::deque<std::string> hostnames_;
+    std::unordered_map<std::string_view, uint32_t> slots_;
+    NodeColumns columns_;
+    RankIndex ranking_;
+    AssignmentLedger ledger_;
+    MetricIndex index_;
+    TopologyTree topology_;
+    PoolIndex pools_;
+    FreshnessTracker freshness_;
+    ScoreFilter filter_;
+    // the slots ranked below their reported score
+    std::vector<bool> discounted_;
+
+public:
+    explicit NodeStore(size_t expectedNodes = 1024, ScoreFilter::Config filter = {});
+    NodeStore(const NodeStore&) = delete;
+    NodeStore& operator=(const NodeStore&) = delete;
+
+    /// the wait before a report of a client that does not say when it reports next
+    static constexpr uint32_t defaultReportMs = 5000;
+    /// allowance for delivery and ingest on top of the wait
+    static constexpr uint32_t graceMs = 1000;
+    /// overdue by this much a node is worth nothing
+    static constexpr uint32_t worthlessAfterMs = 30000;
+
+    /// a node with this many cores has a weight of 1
+    static constexpr uint32_t referenceCores = 8;
+
+    /// higher is better
+    static float score(const NodeStats& stats, const NodeCapacity& capacity = {})
+    {
+        return NodeColumns::score(stats.cpuIdlePercent, stats.ramAvailablePercent, stats.swapAvailablePercent,
+                                  stats.diskSpaceAvailable, stats.networkBandwidthUsed, stats.pressure,
+                                  capacity.bandwidthUnit, capacity.weight);
+    }
+    /// the percentages a node reports are of its own hardware, a node with twice the cores of
+    /// another has twice the headroom at the same load. lineRate in bytes/sec, 0 for what the
+    /// node did not tell
+    static NodeCapacity capacity(uint32_t cores, uint64_t lineRate);
+
+    /// returns the slot of the node. Stats that come after the node's by sequence within the
+    /// run of its client, or by the time they were collected otherwise, are taken. The others
+    /// are turned away, a client replaying its spool or a retried rpc must not roll the node
+    /// back. receivedAtMs is the server's wall clock, 0 leaves the node out of the freshness
+    /// accounting. accepted, when given, tells whether the stats were taken.
+    uint32_t update(std::string_view hostname, const NodeStats& stats, std::string_view zone = {}, std::string_view rack = {},
+                    uint64_t receivedAtMs = 0, bool* accepted = nullptr);
+    /// the service pools the node is in from now on, see PoolIndex::join
+    void setPools(uint32_t slot, const std::string_view* names, size_t count) { pools_.join(slot, names, count, ranking_.score(slot)); }
+    /// weighs the node's stats by its hardware from now on, re-ranking it
+    void setCapacity(uint32_t slot, const NodeCapacity& capacity);
+    /// share of its score an overdue node keeps, 1 for one on time
+    float freshness(uint32_t slot, uint64_t nowMs) const;
+    /// ranks the nodes with the score they keep at nowMs, returns the number of overdue ones
+    size_t discountOverdue(uint64_t nowMs);
+    /// of the latest stats of every node at nowMs, by the clock of their clients
+    void ages(uint64_t nowMs, AgeHistogram& histogram) const;
+    /// RankIndex::npos for unknown nodes
+    uint32_t slot(std::string_view hostname) const;
+
+    size_t size() const { return columns_.size(); }
+    std::string_view hostname(uint32_t slot) const { return hostnames_[slot]; }
+    NodeStats stats(uint32_t slot) const { return columns_.get(slot); }
+    /// for passes over every node, like re-scoring the fleet
+    const NodeColumns& columns() const { return columns_; }
+    const RankIndex& ranking() const { return ranking_; }
+    const MetricIndex& index() const { return index_; }
+    const TopologyTree& topology() const { return topology_; }
+    const PoolIndex& pools() const { return pools_; }
+    const AssignmentLedger& ledger() const { return ledger_; }
+    const FreshnessTracker& freshness() const { return freshness_; }
+    const ScoreFilter& filter() const { return filter_; }
+    /// the node with the highest score less the penalty of its assignments since its report,
+    /// RankIndex::npos when no node has reported yet
+    uint32_t best() const { return ranking_.best([this](uint32_t slot) { return ledger_.penalty(slot); }); }
+    /// best() counted as assigned. Safe among concurrent callers that hold the store shared
+    uint32_t assign();
+    /// counts a node picked some other way as assigned, same as assign()
+    void assigned(uint32_t slot) { ledger_.assign(slot); }
+};
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "poolindex.h"
+
+#include <algorithm>
+#include <functional>
+
+PoolIndex::PoolIndex(size_t expectedNodes, const AssignmentLedger* ledger):
+    ledger_(ledger)
+{
+    memberships_.reserve(expectedNodes);
+    score_.reserve(expectedNodes);
+}
+
+uint32_t PoolIndex::poolId(std::string_view name)
+{
+    auto poolIter = poolIds_.find(name);
+    if(poolIter != poolIds_.end())
+        return poolIter->second;
+
+    const uint32_t id = pools_.size();
+    Pool& added = pools_.emplace_back();
+    added.name = name;
+    poolIds_.emplace(added.name, id);
+    return id;
+}
+
+void PoolIndex::attach(uint32_t slot, uint32_t pool)
+{
+    Pool& target = pools_[pool];
+    const uint32_t local = target.members.size();
+    target.members.push_back(slot);
+    target.ranking.update(local, score_[slot]);
+    memberships_[slot].push_back({pool, local});
+}
+
+void PoolIndex::detach(const Membership& membership)
+{
+    Pool& pool = pools_[membership.pool];
+    const uint32_t last = pool.members.size() - 1;
+
+    // the last member of the pool takes the freed local index
+    pool.ranking.remove(membership.local);
+    if(membership.local != last)
+    {
+        const uint32_t moved = pool.members[last];
+        pool.ranking.remove(last);
+        pool.members[membership.local] = moved;
+        pool.ranking.update(membership.local, score_[moved]);
+        for(Membership& other : memberships_[moved])
+            if(other.pool == membership.pool)
+                other.local = membership.local;
+    }
+    pool.members.pop_back();
+}
+
+void PoolIndex::erase(uint32_t pool)
+{
+    // the last pool takes the freed id, its name is keyed by where the string is
+    poolIds_.erase(pools_[pool].name);
+    const uint32_t last = pools_.size() - 1;
+    if(pool != last)
+    {
+        poolIds_.erase(pools_[last].name);
+        pools_[pool] = std::move(pools_[last]);
+        poolIds_.emplace(pools_[pool].name, pool);
+        for(uint32_t slot : pools_[pool].members)
+            for(Membership& membership : memberships_[slot])
+                if(membership.pool == last)
+                    membership.pool = pool;
+    }
+    pools_.pop_back();
+}
+
+void PoolIndex::join(uint32_t slot, const std::string_view* names, size_t count, float score)
+{
+    if(slot >= memberships_.size())
+    {
+        memberships_.resize(slot + 1);
+        score_.resize(slot + 1, 0.f);
+    }
+
+    // the pools of a node rarely change, comparing the names spares the lookups. A name may
+    // come more than once, the node is in each pool once
+    std::vector<Membership>& current = memberships_[slot];
+    bool same = current.size() <= count;
+    for(size_t idx = 0 ; same && idx < count ; idx++)
+        same = std::any_of(current.begin(), current.end(), [&](const Membership& membership) { return pools_[membership.pool].name == names[idx]; });
+    for(size_t idx = 0 ; same && idx < current.size() ; idx++)
+        same = std::find(names, names + count, pools_[current[idx].pool].name) != names + count;
+    if(same)
+    {
+        update(slot, score);
+        return;
+    }
+
+    const std::vector<Membership> previous = std::move(current);
+    current.clear();
+    score_[slot] = score;
+    std::vector<uint32_t> wanted;
+    wanted.reserve(count);
+    for(size_t idx = 0 ; idx < count ; idx++)
+    {
+        const uint32_t pool = poolId(names[idx]);
+        if(std::find(wanted.begin(), wanted.end(), pool) == wanted.end())
+            wanted.push_back(pool);
+    }
+
+    // the memberships the node keeps stay where they are in their pools
+    std::vector<uint32_t> emptied;
+    for(const Membership& membership : previous)
+    {
+        if(std::find(wanted.begin(), wanted.end(), membership.pool) != wanted.end())
+            continue;
+        detach(membership);
+        if(pools_[membership.pool].members.empty())
+            emptied.push_back(membership.pool);
+    }
+    for(uint32_t pool : wanted)
+    {
+        auto kept = std::find_if(previous.begin(), previous.end(), [pool](const Membership& membership) { return membership.pool == pool; });
+        if(kept == previous.end())
+            attach(slot, pool);
+        else
+        {
+            current.push_back(*kept);
+            pools_[pool].ranking.update(kept->local, score);
+        }
+    }
+
+    // the highest id first, the last pool moving into a freed id is never one still to go
+    std::sort(emptied.begin(), emptied.end(), std::greater<uint32_t>());
+    for(uint32_t pool : emptied)
+        erase(pool);
+}
+
+void PoolIndex::update(uint32_t slot, float score)
+{
+    if(slot >= memberships_.size())
+        return;
+    score_[slot] = score;
+    for(const Membership& membership : memberships_[slot])
+        pools_[membership.pool].ranking.update(membership.local, score);
+}
+
+void PoolIndex::top(std::string_view pool, size_t count, std::vector<uint32_t>& slots) const
+{
+    slots.clear();
+    auto poolIter = poolIds_.find(pool);
+    if(poolIter == poolIds_.end())
+        return;
+
+    const Pool& found = pools_[poolIter->second];
+    if(ledger_)
+        found.ranking.top(count, slots, [&](uint32_t local) { return ledger_->penalty(found.members[local]); });
+    else
+        found.ranking.top(count, slots);
+    for(uint32_t& slot : slots)
+        slot = found.members[slot];
+}
+
+uint32_t PoolIndex::best(std::string_view pool) const
+{
+    // without a ledger the top of the pool's heap, a pick costs the lookup of the name more than a global one
+    if(!ledger_)
+    {
+        auto poolIter = poolIds_.find(pool);
+        if(poolIter == poolIds_.end())
+            return npos;
+        const Pool& found = pools_[poolIter->second];
+        const uint32_t local = found.ranking.best();
+        return local == npos ? npos : found.members[local];
+    }
+    std::vector<uint32_t> slots;
+    top(pool, 1, slots);
+    return slots.empty() ? npos : slots.front();
+}
+
+size_t PoolIndex::members(std::string_view pool) const
+{
+    auto poolIter = poolIds_.find(pool);
+    return poolIter != poolIds_.end() ? pools_[poolIter->second].members.size() : 0;
+}
+
+void PoolIndex::pools(uint32_t slot, std::vector<std::string_view>& names) const
+{
+    names.clear();
+    if(slot >= memberships_.size())
+        return;
+    for(const Membership& membership : memberships_[slot])
+        names.push_back(pools_[membership.pool].name);
+}
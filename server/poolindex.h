@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include "assignmentledger.h"
+#include "rankindex.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// The service pools nodes advertise themselves in, each with a ranking of its own. A pool
+/// ranks its members by a local index like the racks of a TopologyTree, so a pick within a pool
+/// walks a heap of the pool's size and is as cheap as the global pick. The stats of a node stay
+/// in the NodeStore once, a pool only holds its slot.
+///
+/// A score change is passed on to every pool the node is in, O(pools of the node * log pool
+/// size). Memberships change only when a node reports a different set of pools, a node keeping
+/// its pools costs a comparison of the names per report. A pool is dropped with its last member.
+///
+/// With a ledger, members are picked by their score less the penalty of their assignments.
+class PoolIndex
+{
+public:
+    explicit PoolIndex(size_t expectedNodes = 1024, const AssignmentLedger* ledger = nullptr);
+    PoolIndex(const PoolIndex&) = delete;
+    PoolIndex& operator=(const PoolIndex&) = delete;
+
+    /// the pools of the slot from now on, pools not heard of before are created and pools
+    /// left without members dropped
+    void join(uint32_t slot, const std::string_view* names, size_t count, float score);
+    /// the score of a node that stays in its pools
+    void update(uint32_t slot, float score);
+
+    /// up to count members of the pool, best first, none for an unknown pool
+    void top(std::string_view pool, size_t count, std::vector<uint32_t>& slots) const;
+    /// RankIndex::npos for an unknown or empty pool
+    uint32_t best(std::string_view pool) const;
+    /// 0 for an unknown pool
+    size_t members(std::string_view pool) const;
+    size_t poolCount() const { return pools_.size(); }
+    /// of the slot, in the order it first reported them
+    void pools(uint32_t slot, std::vector<std::string_view>& names) const;
+
+private:
+    static constexpr uint32_t npos = RankIndex::npos;
+
+    struct Pool
+    {
+        std::string name;
+        std::vector<uint32_t> members;      // slots by local index
+        RankIndex ranking;                  // local index by score
+    };
+
+    struct Membership
+    {
+        uint32_t pool;
+        uint32_t local;
+    };
+
+    std::deque<Pool> pools_;
+    std::unordered_map<std::string_view, uint32_t> poolIds_;
+    // by slot
+    std::vector<std::vector<Membership>> memberships_;
+    std::vector<float> score_;
+    const AssignmentLedger* ledger_;
+
+    uint32_t poolId(std::string_view name);
+    void attach(uint32_t slot, uint32_t pool);
+    void detach(const Membership& membership);
+    /// of a pool no node is in any more
+    void erase(uint32_t pool);
+};
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "rankindex.h"
+
+#include <algorithm>
+#include <utility>
+
+RankIndex::RankIndex(size_t slots)
+{
+    reserve(slots);
+}
+
+void RankIndex::reserve(size_t slots)
+{
+    heap_.reserve(slots);
+    position_.reserve(slots);
+    score_.reserve(slots);
+}
+
+void RankIndex::swap(uint32_t l, uint32_t r)
+{
+    std::swap(heap_[l], heap_[r]);
+    position_[heap_[l]] = l;
+    position_[heap_[r]] = r;
+}
+
+void RankIndex::siftUp(uint32_t idx)
+{
+    while(idx)
+    {
+        const uint32_t parent = (idx - 1) / 2;
+        if(score_[heap_[parent]] >= score_[heap_[idx]])
+            break;
+        swap(parent, idx);
+        idx = parent;
+    }
+}
+
+void RankIndex::siftDown(uint32_t idx)
+{
+    for(;;)
+    {
+        const uint32_t left = 2 * idx + 1;
+        const uint32_t right = left + 1;
+        uint32_t largest = idx;
+        if(left < heap_.size() && score_[heap_[left]] > score_[heap_[largest]])
+            largest = left;
+        if(right < heap_.size() && score_[heap_[right]] > score_[heap_[largest]])
+            largest = right;
+        if(largest == idx)
+            break;
+        swap(largest, idx);
+        idx = largest;
+    }
+}
+
+void RankIndex::update(uint32_t slot, float score)
+{
+    if(slot >= position_.size())
+    {
+        position_.resize(slot + 1, npos);
+        score_.resize(slot + 1, 0.f);
+    }
+
+    const float previous = score_[slot];
+    score_[slot] = score;
+    if(position_[slot] == npos)
+    {
+        position_[slot] = heap_.size();
+        heap_.push_back(slot);
+        siftUp(position_[slot]);
+    }
+    else if(score > previous)
+    {
+        siftUp(position_[slot]);
+    }
+    else
+    {
+        siftDown(position_[slot]);
+    }
+}
+
+void RankIndex::remove(uint32_t slot)
+{
+    if(!contains(slot))
+        return;
+
+    const uint32_t idx = position_[slot];
+    const uint32_t last = heap_.size() - 1;
+    if(idx != last)
+    {
+        swap(idx, last);
+        heap_.pop_back();
+        position_[slot] = npos;
+        siftDown(idx);
+        siftUp(idx);
+    }
+    else
+    {
+        heap_.pop_back();
+        position_[slot] = npos;
+    }
+}
+
+void RankIndex::top(size_t k, std::vector<uint32_t>& slots) const
+{
+    slots.clear();
+    if(heap_.empty() || !k)
+        return;
+
+    // best-first walk of the heap, the frontier holds heap indexes
+    auto lower = [this](uint32_t l, uint32_t r) { return score_[heap_[l]] < score_[heap_[r]]; };
+    std::vector<uint32_t> frontier{0};
+    while(!frontier.empty() && slots.size() < k)
+    {
+        std::pop_heap(frontier.begin(), frontier.end(), lower);
+        const uint32_t idx = frontier.back();
+        frontier.pop_back();
+        slots.push_back(heap_[idx]);
+        for(uint32_t child : {2 * idx + 1, 2 * idx + 2})
+        {
+            if(child < heap_.size())
+            {
+                frontier.push_back(child);
+                std::push_heap(frontier.begin(), frontier.end(), lower);
+            }
+        }
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/// Max-heap of node slots ordered by score which keeps track of where every slot sits, so the
+/// score of a node can be changed in O(log n) without the allocation a std::set erase/insert does.
+class RankIndex
+{
+    std::vector<uint32_t> heap_;
+    std::vector<uint32_t> position_;
+    std::vector<float> score_;
+
+    void siftUp(uint32_t idx);
+    void siftDown(uint32_t idx);
+    void swap(uint32_t l, uint32_t r);
+
+public:
+    static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+
+    explicit RankIndex(size_t slots = 0);
+
+    /// makes room for slots so that updates do not allocate
+    void reserve(size_t slots);
+    /// inserts the slot or moves it to its new place
+    void update(uint32_t slot, float score);
+    void remove(uint32_t slot);
+    bool contains(uint32_t slot) const { return slot < position_.size() && position_[slot] != npos; }
+    float score(uint32_t slot) const { return score_[slot]; }
+    size_t size() const { return heap_.size(); }
+    bool empty() const { return heap_.empty(); }
+    /// npos when empty
+    uint32_t best() const { return heap_.empty() ? npos : heap_.front(); }
+    /// the k best slots, best first, in O(k log k)
+    void top(size_t k, std::vector<uint32_t>& slots) const;
+
+    /// the slot with the highest score less penalty(slot). The heap is walked best first and
+    /// the walk stops at the first score no higher than the best found, as penalties are never
+    /// negative, so only the slots that lost their lead to a penalty are looked at
+    template<typename Penalty>
+    uint32_t best(Penalty penalty) const
+    {
+        std::vector<uint32_t> slots;
+        top(1, slots, penalty);
+        return slots.empty() ? npos : slots.front();
+    }
+
+    /// the k best slots by score less penalty(slot), best first
+    template<typename Penalty>
+    void top(size_t k, std::vector<uint32_t>& slots, Penalty penalty) const
+    {
+        slots.clear();
+        if(heap_.empty() || !k)
+            return;
+
+        // the best k so far with the worst on top, and the frontier of the walk as heap indexes
+        using Candidate = std::pair<float, uint32_t>;
+        auto better = [](const Candidate& l, const Candidate& r) { return l.first != r.first ? l.first > r.first : l.second < r.second; };
+        auto lower = [this](uint32_t l, uint32_t r) { return score_[heap_[l]] < score_[heap_[r]]; };
+        std::vector<Candidate> found;
+        std::vector<uint32_t> frontier{0};
+        while(!frontier.empty())
+        {
+            std::pop_heap(frontier.begin(), frontier.end(), lower);
+            const uint32_t idx = frontier.back();
+            frontier.pop_back();
+
+            const uint32_t slot = heap_[idx];
+            if(found.size() == k && score_[slot] <= found.front().first)
+                break;
+            const Candidate candidate{score_[slot] - penalty(slot), slot};
+            if(found.size() < k)
+            {
+                found.push_back(candidate);
+                std::push_heap(found.begin(), found.end(), better);
+            }
+            else if(better(candidate, found.front()))
+            {
+                std::pop_heap(found.begin(), found.end(), better);
+                found.back() = candidate;
+                std::push_heap(found.begin(), found.end(), better);
+            }
+
+            for(uint32_t child : {2 * idx + 1, 2 * idx + 2})
+            {
+                if(child < heap_.size())
+                {
+                    frontier.push_back(child);
+                    std::push_heap(frontier.begin(), frontier.end(), lower);
+                }
+            }
+        }
+
+        std::sort_heap(found.begin(), found.end(), better);
+        for(const Candidate& candidate : found)
+            slots.push_back(candidate.second);
+    }
+};
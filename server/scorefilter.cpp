@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "scorefilter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // scales the median absolute deviation to the standard deviation of normally distributed scores
+    constexpr float madScale = 1.4826f;
+
+    float median(std::array<float, ScoreFilter::window>& values, size_t count)
+    {
+        std::nth_element(values.begin(), values.begin() + count / 2, values.begin() + count);
+        return values[count / 2];
+    }
+}
+
+ScoreFilter::ScoreFilter(Config config, size_t expectedNodes):
+    config_(config),
+    outliers_(0)
+{
+    nodes_.reserve(expectedNodes);
+}
+
+float ScoreFilter::add(uint32_t slot, float score)
+{
+    nodes_.emplace_back();
+    if(config_.enabled && config_.warmup > 1)
+        nodes_[slot].reports = 1;
+    reset(slot, score);
+    return nodes_[slot].ranked;
+}
+
+void ScoreFilter::reset(uint32_t slot, float score)
+{
+    if(!std::isfinite(score))
+        score = 0.f;
+    Node& node = nodes_[slot];
+    node.scores[0] = score;
+    node.count = 1;
+    node.next = 1;
+    node.filtered = score;
+    node.ranked = score;
+    if(node.reports && node.reports < config_.warmup)
+    {
+        node.lowest = score;
+        node.ranked = score * node.reports / config_.warmup;
+    }
+}
+
+float ScoreFilter::update(uint32_t slot, float score)
+{
+    Node& node = nodes_[slot];
+    // nothing ranks against it, and it would get past every comparison below
+    if(!std::isfinite(score))
+    {
+        node.outliers++;
+        outliers_++;
+        return node.ranked;
+    }
+    if(!config_.enabled)
+    {
+        node.filtered = node.ranked = score;
+        return score;
+    }
+
+    // the outlier goes into the window as well, a lasting change takes over the median
+    node.scores[node.next] = score;
+    node.next = (node.next + 1) % window;
+    node.count = std::min<uint8_t>(node.count + 1, window);
+
+    node.filtered = score;
+    // a median of two says nothing
+    if(node.count >= 3)
+    {
+        std::array<float, window> values = node.scores;
+        const float center = median(values, node.count);
+        for(size_t idx = 0 ; idx < node.count ; idx++)
+            values[idx] = std::fabs(node.scores[idx] - center);
+        const float deviation = madScale * median(values, node.count);
+        const float limit = std::max({config_.threshold * deviation, config_.minDeviation, config_.minRelativeDeviation * std::fabs(center)});
+        if(std::fabs(score - center) > limit)
+        {
+            node.filtered = center;
+            node.outliers++;
+            outliers_++;
+        }
+    }
+
+    if(node.reports && node.reports < config_.warmup)
+    {
+        node.reports++;
+        node.lowest = std::min(node.lowest, node.filtered);
+        // the last report of the warmup has a median to go by
+        if(node.reports < config_.warmup)
+        {
+            node.ranked = node.lowest * node.reports / config_.warmup;
+            return node.ranked;
+        }
+    }
+
+    const float band = std::max(config_.band, config_.relativeBand * std::fabs(node.ranked));
+    if(std::fabs(node.filtered - node.ranked) > band)
+        node.ranked = node.filtered;
+    return node.ranked;
+}
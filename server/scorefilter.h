@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Stands between the scores of the reports and the ranking. One spiky sample, a bogus reading
+/// or a /proc/stat delta over next to no time, would otherwise throw a node to the top or the
+/// bottom and every router with it. Two stages per node:
+///
+/// - a Hampel filter over the node's last scores: a score further from their median than a few
+///   median absolute deviations is taken as the median instead. A lasting change gets through
+///   once it makes up most of the window.
+/// - a hysteresis band: the ranked score only moves when the filtered one leaves a band around
+///   it, nodes about as good as each other do not swap places on every report.
+///
+/// Every node has a fixed window, updating is a couple of selections over a handful of floats.
+class ScoreFilter
+{
+public:
+    static constexpr size_t window = 5;
+
+    struct Config
+    {
+        /// median absolute deviations from the median a score may be off before it is an outlier
+        float threshold = 3.f;
+        /// nodes reporting the same score over and over have no deviation, changes of less than
+        /// this many score points, or this share of the median, are never outliers
+        float minDeviation = 5.f;
+        float minRelativeDeviation = 0.1f;
+        /// the ranked score stays as it is while the filtered one is within this many points of
+        /// it, or this share of it
+        float band = 1.f;
+        float relativeBand = 0.02f;
+        /// a node that just joined ranks with the lowest score it sent so far, scaled by the
+        /// share of this many reports it sent, so that an outlier on joining does not throw it
+        /// to the top before the window can tell. 1 ranks the first score as it is
+        uint8_t warmup = 3;
+        /// false passes every score through as it is
+        bool enabled = true;
+    };
+
+    explicit ScoreFilter(Config config, size_t expectedNodes = 0);
+    ScoreFilter(): ScoreFilter(Config{}) {}
+
+    /// slots are handed out densely, the next one. Returns the score to rank the node with,
+    /// a score that is not a number ranks it with 0
+    float add(uint32_t slot, float score);
+    /// a fresh score of the slot, returns the score to rank the node with. A score that is
+    /// not a number is an outlier and stays out of the window
+    float update(uint32_t slot, float score);
+    /// forgets what the slot reported before, after its scores changed scale. A node that
+    /// has warmed up stays warm
+    void reset(uint32_t slot, float score);
+
+    /// the score the node is ranked with, before any discount for being overdue
+    float ranked(uint32_t slot) const { return nodes_[slot].ranked; }
+    /// the latest score with the outliers taken out, before the hysteresis
+    float filtered(uint32_t slot) const { return nodes_[slot].filtered; }
+    uint32_t outliers(uint32_t slot) const { return nodes_[slot].outliers; }
+    /// over the fleet
+    uint64_t outliers() const { return outliers_; }
+    const Config& config() const { return config_; }
+
+private:
+    struct Node
+    {
+        std::array<float, window> scores;
+        uint8_t count = 0;
+        uint8_t next = 0;
+        float filtered = 0.f;
+        float ranked = 0.f;
+        /// while warming up
+        float lowest = 0.f;
+        uint8_t reports = 0;
+        uint32_t outliers = 0;
+    };
+
+    Config config_;
+    std::vector<Node> nodes_;
+    uint64_t outliers_;
+};
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include "topologytree.h"
+
+#include <algorithm>
+
+TopologyTree::TopologyTree(size_t expectedNodes, const AssignmentLedger* ledger):
+    ledger_(ledger)
+{
+    rackOf_.reserve(expectedNodes);
+    localOf_.reserve(expectedNodes);
+    score_.reserve(expectedNodes);
+}
+
+uint32_t TopologyTree::rackId(std::string_view zone, std::string_view rack)
+{
+    auto zoneIter = zoneIds_.find(zone);
+    uint32_t zoneId;
+    if(zoneIter != zoneIds_.end())
+        zoneId = zoneIter->second;
+    else
+    {
+        zoneId = zones_.size();
+        Domain& added = zones_.emplace_back();
+        added.name = zone;
+        added.parent = npos;
+        added.local = zoneId;
+        zoneIds_.emplace(added.name, zoneId);
+    }
+
+    Domain& parent = zones_[zoneId];
+    auto rackIter = parent.racks.find(rack);
+    if(rackIter != parent.racks.end())
+        return rackIter->second;
+
+    const uint32_t id = racks_.size();
+    Domain& added = racks_.emplace_back();
+    added.name = rack;
+    added.parent = zoneId;
+    added.local = parent.children.size();
+    parent.children.push_back(id);
+    parent.racks.emplace(added.name, id);
+    return id;
+}
+
+uint32_t TopologyTree::findRack(std::string_view zone, std::string_view rack) const
+{
+    auto zoneIter = zoneIds_.find(zone);
+    if(zoneIter == zoneIds_.end())
+        return npos;
+    const Domain& parent = zones_[zoneIter->second];
+    auto rackIter = parent.racks.find(rack);
+    return rackIter != parent.racks.end() ? rackIter->second : npos;
+}
+
+void TopologyTree::attach(uint32_t slot, uint32_t rack)
+{
+    Domain& domain = racks_[rack];
+    Domain& zone = zones_[domain.parent];
+    rackOf_[slot] = rack;
+    localOf_[slot] = domain.children.size();
+    domain.children.push_back(slot);
+    domain.ranking.update(localOf_[slot], score_[slot]);
+    domain.nodes++;
+    domain.scoreTotal += score_[slot];
+    zone.nodes++;
+    zone.scoreTotal += score_[slot];
+}
+
+void TopologyTree::detach(uint32_t slot)
+{
+    Domain& domain = racks_[rackOf_[slot]];
+    Domain& zone = zones_[domain.parent];
+    const uint32_t local = localOf_[slot];
+    const uint32_t last = domain.children.size() - 1;
+
+    // the last node of the rack takes the freed local index
+    domain.ranking.remove(local);
+    if(local != last)
+    {
+        const uint32_t moved = domain.children[last];
+        domain.ranking.remove(last);
+        domain.children[local] = moved;
+        localOf_[moved] = local;
+        domain.ranking.update(local, score_[moved]);
+    }
+    domain.children.pop_back();
+    domain.nodes--;
+    domain.scoreTotal -= score_[slot];
+    zone.nodes--;
+    zone.scoreTotal -= score_[slot];
+    rackOf_[slot] = localOf_[slot] = npos;
+}
+
+void TopologyTree::propagate(uint32_t rack)
+{
+    const Domain& domain = racks_[rack];
+    Domain& zone = zones_[domain.parent];
+    if(domain.ranking.empty())
+        zone.ranking.remove(domain.local);
+    else
+        zone.ranking.update(domain.local, domain.ranking.score(domain.ranking.best()));
+
+    if(zone.ranking.empty())
+        root_.remove(zone.local);
+    else
+        root_.update(zone.local, zone.ranking.score(zone.ranking.best()));
+}
+
+void TopologyTree::update(uint32_t slot, std::string_view zone, std::string_view rack, float score)
+{
+    if(slot >= rackOf_.size())
+    {
+        rackOf_.resize(slot + 1, npos);
+        localOf_.resize(slot + 1, npos);
+        score_.resize(slot + 1, 0.f);
+    }
+
+    // the labels of a node rarely change, comparing them spares the lookups
+    const uint32_t current = rackOf_[slot];
+    uint32_t target = current;
+    if(current == npos || racks_[current].name != rack || zones_[racks_[current].parent].name != zone)
+        target = rackId(zone, rack);
+
+    if(target != current)
+    {
+        if(current != npos)
+        {
+            detach(slot);
+            propagate(current);
+        }
+        score_[slot] = score;
+        attach(slot, target);
+        propagate(target);
+        return;
+    }
+
+    Domain& domain = racks_[current];
+    domain.scoreTotal += score - score_[slot];
+    zones_[domain.parent].scoreTotal += score - score_[slot];
+    score_[slot] = score;
+    domain.ranking.update(localOf_[slot], score);
+    propagate(current);
+}
+
+float TopologyTree::adjusted(const Domain& rack, uint32_t local) const
+{
+    const float score = rack.ranking.score(local);
+    return ledger_ ? score - ledger_->penalty(rack.children[local]) : score;
+}
+
+void TopologyTree::topNodes(const Domain& rack, size_t count, std::vector<uint32_t>& locals) const
+{
+    if(!ledger_)
+        return rack.ranking.top(count, locals);
+    rack.ranking.top(count, locals, [&](uint32_t local) { return ledger_->penalty(rack.children[local]); });
+}
+
+float TopologyTree::adjustedBest(const Domain& domain, bool zone, uint32_t& slot) const
+{
+    std::vector<uint32_t> locals;
+    if(zone)
+    {
+        topChildren(domain, 1, locals);
+        return adjustedBest(racks_[domain.children[locals.front()]], false, slot);
+    }
+    topNodes(domain, 1, locals);
+    slot = domain.children[locals.front()];
+    return adjusted(domain, locals.front());
+}
+
+void TopologyTree::topChildren(const Domain& zone, size_t count, std::vector<uint32_t>& locals) const
+{
+    if(!ledger_)
+        return zone.ranking.top(count, locals);
+    // a rack ranks by its best reported score, the penalties below only ever take from it
+    zone.ranking.top(count, locals, [&](uint32_t local) {
+        uint32_t slot;
+        return zone.ranking.score(local) - adjustedBest(racks_[zone.children[local]], false, slot);
+    });
+}
+
+void TopologyTree::topZones(size_t count, std::vector<uint32_t>& zones) const
+{
+    if(!ledger_)
+        return root_.top(count, zones);
+    root_.top(count, zones, [&](uint32_t id) {
+        uint32_t slot;
+        return root_.score(id) - adjustedBest(zones_[id], true, slot);
+    });
+}
+
+uint32_t TopologyTree::bestOf(const Domain& domain, bool zone) const
+{
+    if(domain.ranking.empty())
+        return npos;
+    uint32_t slot;
+    adjustedBest(domain, zone, slot);
+    return slot;
+}
+
+uint32_t TopologyTree::best() const
+{
+    if(root_.empty())
+        return npos;
+    std::vector<uint32_t> zones;
+    topZones(1, zones);
+    return bestOf(zones_[zones.front()], true);
+}
+
+void TopologyTree::collect(const Domain& domain, bool zone, size_t count, std::vector<std::pair<float, uint32_t>>& candidates) const
+{
+    std::vector<uint32_t> locals;
+    if(!zone)
+    {
+        topNodes(domain, count, locals);
+        for(uint32_t local : locals)
+            candidates.emplace_back(adjusted(domain, local), domain.children[local]);
+        return;
+    }
+
+    // the best count nodes of a zone are in no more than the count racks with the best nodes
+    topChildren(domain, count, locals);
+    for(uint32_t local : locals)
+        collect(racks_[domain.children[local]], false, count, candidates);
+}
+
+void TopologyTree::take(std::vector<std::pair<float, uint32_t>>& candidates, size_t count, std::vector<uint32_t>& slots)
+{
+    std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, uint32_t>& lhs, const std::pair<float, uint32_t>& rhs) {
+        return lhs.first != rhs.first ? lhs.first > rhs.first : lhs.second < rhs.second;
+    });
+    for(const std::pair<float, uint32_t>& candidate : candidates)
+    {
+        if(slots.size() >= count)
+            break;
+        if(std::find(slots.begin(), slots.end(), candidate.second) == slots.end())
+            slots.push_back(candidate.second);
+    }
+    candidates.clear();
+}
+
+void TopologyTree::nearest(std::string_view zone, std::string_view rack, size_t count, std::vector<uint32_t>& slots) const
+{
+    slots.clear();
+    std::vector<std::pair<float, uint32_t>> candidates;
+    std::vector<uint32_t> locals;
+
+    const uint32_t own = findRack(zone, rack);
+    if(own != npos)
+    {
+        collect(racks_[own], false, count, candidates);
+        take(candidates, count, slots);
+    }
+
+    auto zoneIter = zoneIds_.find(zone);
+    const uint32_t ownZone = zoneIter != zoneIds_.end() ? zoneIter->second : npos;
+    if(slots.size() < count && ownZone != npos)
+    {
+        // one more rack than needed, the own one may be among them
+        const Domain& domain = zones_[ownZone];
+        topChildren(domain, count - slots.size() + 1, locals);
+        for(uint32_t local : locals)
+            if(domain.children[local] != own)
+                collect(racks_[domain.children[local]], false, count - slots.size(), candidates);
+        take(candidates, count, slots);
+    }
+
+    if(slots.size() < count)
+    {
+        topZones(count - slots.size() + 1, locals);
+        for(uint32_t id : locals)
+            if(id != ownZone)
+                collect(zones_[id], true, count - slots.size(), candidates);
+        take(candidates, count, slots);
+    }
+}
+
+void TopologyTree::spread(size_t count, std::vector<uint32_t>& slots) const
+{
+    slots.clear();
+    std::vector<std::pair<float, uint32_t>> candidates;
+    std::vector<uint32_t> zones;
+    std::vector<uint32_t> locals;
+
+    // the best node of each of the best zones
+    topZones(count, zones);
+    for(uint32_t id : zones)
+    {
+        const uint32_t slot = bestOf(zones_[id], true);
+        candidates.emplace_back(score(slot), slot);
+    }
+    take(candidates, count, slots);
+    if(slots.size() >= count)
+        return;
+
+    // then the best node of the racks that did not get one, still in as many zones as possible
+    topZones(zones_.size(), zones);
+    for(uint32_t id : zones)
+    {
+        const Domain& domain = zones_[id];
+        topChildren(domain, count - slots.size() + 1, locals);
+        for(size_t idx = 1 ; idx < locals.size() ; idx++)
+        {
+            const uint32_t slot = bestOf(racks_[domain.children[locals[idx]]], false);
+            candidates.emplace_back(score(slot), slot);
+        }
+    }
+    take(candidates, count, slots);
+    if(slots.size() >= count)
+        return;
+
+    // then whatever is best, the racks have run out
+    for(uint32_t id : zones)
+        collect(zones_[id], true, count, candidates);
+    take(candidates, count, slots);
+}
+
+void TopologyTree::spreadCandidates(size_t count, std::vector<uint32_t>& slots) const
+{
+    slots.clear();
+    std::vector<std::pair<float, uint32_t>> candidates;
+    std::vector<uint32_t> zones;
+    std::vector<uint32_t> locals;
+
+    topZones(count, zones);
+    for(uint32_t id : zones)
+        slots.push_back(bestOf(zones_[id], true));
+    // with as many zones here, there are as many in all and spread() stops at them
+    if(zones.size() >= count)
+        return;
+
+    // another tree may hold more zones, never fewer racks would be looked at
+    for(uint32_t id : zones)
+    {
+        const Domain& domain = zones_[id];
+        topChildren(domain, count - zones.size() + 1, locals);
+        for(size_t idx = 1 ; idx < locals.size() ; idx++)
+            slots.push_back(bestOf(racks_[domain.children[locals[idx]]], false));
+        collect(domain, true, count, candidates);
+    }
+    for(const std::pair<float, uint32_t>& candidate : candidates)
+        slots.push_back(candidate.second);
+    std::sort(slots.begin(), slots.end());
+    slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+}
+
+float TopologyTree::score(uint32_t slot) const
+{
+    return ledger_ ? score_[slot] - ledger_->penalty(slot) : score_[slot];
+}
+
+TopologyTree::Load TopologyTree::zoneLoad(std::string_view zone) const
+{
+    auto zoneIter = zoneIds_.find(zone);
+    if(zoneIter == zoneIds_.end())
+        return {};
+    const Domain& domain = zones_[zoneIter->second];
+    if(!domain.nodes)
+        return {};
+    return {domain.nodes, float(domain.scoreTotal / domain.nodes), domain.ranking.score(domain.ranking.best())};
+}
+
+TopologyTree::Load TopologyTree::rackLoad(std::string_view zone, std::string_view rack) const
+{
+    const uint32_t id = findRack(zone, rack);
+    if(id == npos || !racks_[id].nodes)
+        return {};
+    const Domain& domain = racks_[id];
+    return {domain.nodes, float(domain.scoreTotal / domain.nodes), domain.ranking.score(domain.ranking.best())};
+}
+
+std::string_view TopologyTree::zone(uint32_t slot) const
+{
+    return slot < rackOf_.size() && rackOf_[slot] != npos ? std::string_view(zones_[racks_[rackOf_[slot]].parent].name) : std::string_view();
+}
+
+std::string_view TopologyTree::rack(uint32_t slot) const
+{
+    return slot < rackOf_.size() && rackOf_[slot] != npos ? std::string_view(racks_[rackOf_[slot]].name) : std::string_view();
+}
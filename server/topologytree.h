@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include "assignmentledger.h"
+#include "rankindex.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Node slots grouped by zone and rack. Every rack ranks its nodes, every zone its racks by the
+/// best node in them and the root its zones the same way, so a score change propagates up in
+/// O(depth * log fanout) and the best node of any scope is found walking down the best child.
+/// Racks and zones also keep their node count and score total for their mean load.
+///
+/// With a ledger, nodes are picked by their score less the penalty of the assignments they got
+/// since their report, in every scope. Zones and racks stay ranked by the reported score of their
+/// best node, an upper bound of what any node below them is worth once penalized, and the picks
+/// walk them best first until no further one can beat what was found.
+///
+/// A node without labels is in the zone "" and rack "", like any other.
+class TopologyTree
+{
+public:
+    struct Load
+    {
+        uint32_t nodes = 0;
+        float meanScore = 0.f;
+        float bestScore = 0.f;
+    };
+
+    explicit TopologyTree(size_t expectedNodes = 1024, const AssignmentLedger* ledger = nullptr);
+    TopologyTree(const TopologyTree&) = delete;
+    TopologyTree& operator=(const TopologyTree&) = delete;
+
+    /// a slot seen the first time is added, one that moved rack is moved along
+    void update(uint32_t slot, std::string_view zone, std::string_view rack, float score);
+
+    /// RankIndex::npos when empty
+    uint32_t best() const;
+    /// up to count slots, best first: those in the rack, then the rest of the zone, then the others
+    void nearest(std::string_view zone, std::string_view rack, size_t count, std::vector<uint32_t>& slots) const;
+    /// up to count slots in as many zones as there are, then in as many racks, then any
+    void spread(size_t count, std::vector<uint32_t>& slots) const;
+    /// the slots spread() could pick, ascending. A tree of the candidates of several trees, each
+    /// with the score it has there, spreads as one of all their nodes would. The same holds of
+    /// the slots each gives for nearest()
+    void spreadCandidates(size_t count, std::vector<uint32_t>& slots) const;
+
+    /// nodes is 0 for an unknown zone or rack
+    Load zoneLoad(std::string_view zone) const;
+    Load rackLoad(std::string_view zone, std::string_view rack) const;
+    std::string_view zone(uint32_t slot) const;
+    std::string_view rack(uint32_t slot) const;
+    size_t zoneCount() const { return zones_.size(); }
+    size_t rackCount() const { return racks_.size(); }
+
+private:
+    static constexpr uint32_t npos = RankIndex::npos;
+
+    /// a zone or a rack, its children are indexed locally so an index only grows with its fanout
+    struct Domain
+    {
+        std::string name;
+        uint32_t parent;                    // zone of a rack, npos for zones
+        uint32_t local;                     // within the parent
+        std::vector<uint32_t> children;     // rack or node slots by local index
+        RankIndex ranking;                  // local index by the best score below
+        std::unordered_map<std::string_view, uint32_t> racks;   // of a zone, by name
+        uint32_t nodes = 0;
+        double scoreTotal = 0.;
+    };
+
+    std::deque<Domain> zones_;
+    std::deque<Domain> racks_;
+    std::unordered_map<std::string_view, uint32_t> zoneIds_;
+    RankIndex root_;
+    std::vector<uint32_t> rackOf_;
+    std::vector<uint32_t> localOf_;         // of the slot within its rack
+    std::vector<float> score_;
+    const AssignmentLedger* ledger_;
+
+    uint32_t rackId(std::string_view zone, std::string_view rack);
+    uint32_t findRack(std::string_view zone, std::string_view rack) const;
+    void attach(uint32_t slot, uint32_t rack);
+    void detach(uint32_t slot);
+    /// passes the best score of a rack on to its zone and of the zone on to the root
+    void propagate(uint32_t rack);
+    uint32_t bestOf(const Domain& domain, bool zone) const;
+    /// of the best node below a zone or rack less its penalty, which is put in slot
+    float adjustedBest(const Domain& domain, bool zone, uint32_t& slot) const;
+    /// the count racks of a zone, or zones, with the best nodes less their penalties, best first
+    void topChildren(const Domain& zone, size_t count, std::vector<uint32_t>& locals) const;
+    void topZones(size_t count, std::vector<uint32_t>& zones) const;
+    /// the best count slots below a zone or rack, appended with their score, skipping those picked
+    void collect(const Domain& domain, bool zone, size_t count, std::vector<std::pair<float, uint32_t>>& candidates) const;
+    /// the count best nodes of a rack less their penalties
+    void topNodes(const Domain& rack, size_t count, std::vector<uint32_t>& locals) const;
+    float adjusted(const Domain& rack, uint32_t local) const;
+    /// reported, less the penalty with a ledger
+    float score(uint32_t slot) const;
+    static void take(std::vector<std::pair<float, uint32_t>>& candidates, size_t count, std::vector<uint32_t>& slots);
+};
@@ -0,0 +1,752 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include "datagramingest.h"
+#include "capturefile.h"
+#include "datagramsender.h"
+#include "infoupdateservice.h"
+#include "gossipnetwork.h"
+#include "historystore.h"
+#include "ioring.h"
+#include "metricindex.h"
+#include "nodecolumns.h"
+#include "poolindex.h"
+#include "procfile.h"
+#include "sampler.h"
+#include "scorefilter.h"
+#include "topologytree.h"
+
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/server_credentials.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sys/mman.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+TEST_CASE("ingest throughput of a 10k node fleet", "[InfoUpdateService][benchmark]")
+{
+    constexpr size_t nodes = 10000;
+    InfoUpdateService service(false, 1000000, nodes);
+    // the same again, recording everything it takes
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / ("mclear-bench-capture-" + std::to_string(getpid()));
+    CaptureWriter capture(path.string());
+    InfoUpdateService captured(false, 1000000, nodes, nullptr, &capture);
+    ArenaMessageAllocator<mcproto::Stats, mcproto::StatsReply> allocator(1);
+
+    std::vector<std::string> wire(nodes);
+    for(size_t idx = 0 ; idx < nodes ; idx++)
+    {
+        mcproto::Stats stats;
+        stats.set_hostname("node" + std::to_string(idx));
+        stats.mutable_cpuload()->set_cpuload(idx % 10000);
+        stats.mutable_meminfo()->set_availablerampercent(idx % 100);
+        stats.mutable_meminfo()->set_availableswappercent(100);
+        stats.mutable_diskinfo()->set_availablespace(50 * 1000 * 1000);
+        stats.mutable_netinfo()->set_bandwidthusage(idx * 100);
+        stats.SerializeToString(&wire[idx]);
+    }
+
+    size_t next = 0;
+    auto call = [&](InfoUpdateService& target)
+    {
+        grpc::MessageHolder<mcproto::Stats, mcproto::StatsReply>* holder = allocator.AllocateMessages();
+        holder->request()->ParseFromString(wire[next++ % nodes]);
+        target.ingest(*holder->request(), *holder->response());
+        const uint32_t interval = holder->response()->reportintervalms();
+        holder->Release();
+        return interval;
+    };
+
+    for(size_t idx = 0 ; idx < nodes ; idx++)
+    {
+        call(service);
+        call(captured);
+    }
+
+    BENCHMARK("parse and ingest one report")
+    {
+        return call(service);
+    };
+
+    BENCHMARK("parse and ingest one report into a capture")
+    {
+        return call(captured);
+    };
+
+    capture.flush();
+    std::cout << capture.recorded() << " reports captured in " << capture.bytes() << " bytes, " << capture.dropped() << " dropped" << std::endl;
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("constrained top-k queries over 100k nodes", "[MetricIndex][benchmark]")
+{
+    constexpr size_t nodes = 100000;
+    std::mt19937 random(100);
+    NodeStore store(nodes);
+    for(size_t idx = 0 ; idx < nodes ; idx++)
+    {
+        NodeStats stats;
+        stats.cpuIdlePercent = std::uniform_real_distribution<float>(0.f, 100.f)(random);
+        stats.ramAvailable = std::uniform_int_distribution<uint64_t>(512, 512 * 1024)(random);
+        stats.ramAvailablePercent = std::uniform_int_distribution<int>(0, 100)(random);
+        stats.swapAvailablePercent = std::uniform_int_distribution<int>(0, 100)(random);
+        stats.diskSpaceAvailable = std::uniform_int_distribution<uint64_t>(0, 4000ull * 1000 * 1000)(random);
+        stats.networkBandwidthUsed = std::uniform_int_distribution<uint32_t>(0, 1000 * 1000 * 1000)(random);
+        stats.pressure = std::exponential_distribution<float>(0.5f)(random);
+        stats.appInFlight = std::uniform_int_distribution<int64_t>(0, 1000)(random);
+        store.update("node" + std::to_string(idx), stats);
+    }
+
+    // constraints of between one and three metrics, bounds taken from random nodes
+    std::vector<MetricIndex::Query> queries(256);
+    for(MetricIndex::Query& query : queries)
+    {
+        query.objective = Metric(random() % MetricIndex::metricCount);
+        query.ascending = random() % 2;
+        for(int idx = 1 + random() % 3 ; idx > 0 ; idx--)
+        {
+            MetricIndex::Constraint constraint{Metric(random() % MetricIndex::metricCount)};
+            const double bound = store.index().value(random() % nodes, constraint.metric);
+            (random() % 2 ? constraint.min : constraint.max) = bound;
+            query.constraints.push_back(constraint);
+        }
+    }
+
+    std::vector<MetricIndex::Match> matches;
+    size_t next = 0;
+    uint64_t scanned = 0;
+    for(const MetricIndex::Query& query : queries)
+        scanned += store.index().query(query, matches);
+    std::cout << "random constraint mixes look at " << scanned / queries.size() << " of " << nodes << " nodes on average" << std::endl;
+
+    BENCHMARK("top 10 under random constraints")
+    {
+        return store.index().query(queries[next++ % queries.size()], matches);
+    };
+
+    MetricIndex::Query example;
+    example.constraints = {{Metric::RamAvailableMb, 8192.}, {Metric::DiskAvailableKb, 50. * 1000 * 1000}};
+    example.objective = Metric::CpuIdlePercent;
+    BENCHMARK("8GB ram, 50GB disk, lowest cpu")
+    {
+        return store.index().query(example, matches);
+    };
+
+    BENCHMARK("full scan for comparison")
+    {
+        const MetricIndex::Query& query = queries[next++ % queries.size()];
+        size_t found = 0;
+        for(uint32_t slot = 0 ; slot < nodes ; slot++)
+        {
+            bool meets = true;
+            for(const MetricIndex::Constraint& constraint : query.constraints)
+            {
+                const double value = store.index().value(slot, constraint.metric);
+                meets &= value >= constraint.min && value <= constraint.max;
+            }
+            found += meets;
+        }
+        return found;
+    };
+}
+
+TEST_CASE("re-scoring 100k nodes by layout", "[NodeColumns][benchmark]")
+{
+    constexpr uint32_t nodes = 100000;
+    std::mt19937 random(41);
+    // the heap records the service kept before the slab, reached through a hash map
+    std::unordered_map<std::string, std::unique_ptr<NodeStats>> records;
+    std::vector<NodeStats> slab;
+    NodeColumns columns(nodes);
+    for(uint32_t idx = 0 ; idx < nodes ; idx++)
+    {
+        NodeStats stats;
+        stats.cpuIdlePercent = std::uniform_real_distribution<float>(0.f, 100.f)(random);
+        stats.ramAvailablePercent = std::uniform_int_distribution<int>(0, 100)(random);
+        stats.swapAvailablePercent = std::uniform_int_distribution<int>(0, 100)(random);
+        stats.diskSpaceAvailable = std::uniform_int_distribution<uint64_t>(0, 4000ull * 1000 * 1000)(random);
+        stats.networkBandwidthUsed = std::uniform_int_distribution<uint32_t>(0, 1000 * 1000 * 1000)(random);
+        stats.pressure = std::exponential_distribution<float>(0.5f)(random);
+        records.emplace("node" + std::to_string(idx), std::make_unique<NodeStats>(stats));
+        slab.push_back(stats);
+        columns.add(stats);
+    }
+
+    std::vector<float> scores(nodes);
+    BENCHMARK("heap records through a hash map")
+    {
+        float* score = scores.data();
+        for(const auto& record : records)
+            *score++ = NodeStore::score(*record.second);
+        return scores.back();
+    };
+
+    BENCHMARK("slab of records")
+    {
+        for(uint32_t slot = 0 ; slot < nodes ; slot++)
+            scores[slot] = NodeStore::score(slab[slot]);
+        return scores.back();
+    };
+
+    BENCHMARK("columns")
+    {
+        for(uint32_t slot = 0 ; slot < nodes ; slot++)
+            scores[slot] = columns.score(slot);
+        return scores.back();
+    };
+}
+
+TEST_CASE("filtering the scores of a 10k node fleet", "[ScoreFilter][benchmark]")
+{
+    constexpr size_t nodes = 10000;
+    std::mt19937 random(47);
+    std::normal_distribution<float> noise(50.f, 3.f);
+    // noisy scores with a spike now and then
+    std::vector<float> scores(1 << 16);
+    for(size_t idx = 0 ; idx < scores.size() ; idx++)
+        scores[idx] = idx % 97 ? noise(random) : 99.f;
+
+    ScoreFilter filter(ScoreFilter::Config{}, nodes);
+    for(uint32_t slot = 0 ; slot < nodes ; slot++)
+        filter.add(slot, scores[slot]);
+
+    size_t next = 0;
+    BENCHMARK("filter one score")
+    {
+        const uint32_t slot = next % nodes;
+        return filter.update(slot, scores[next++ % scores.size()]);
+    };
+}
+
+TEST_CASE("history of a 10k node fleet", "[HistoryStore][benchmark]")
+{
+    // 10 minutes of reports every second, with stats that drift the way real ones do
+    constexpr uint32_t nodes = 10000;
+    constexpr int reports = 600;
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / ("mclear-history-benchmark-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+    std::mt19937 random(42);
+    std::vector<NodeStats> fleet(nodes);
+    std::vector<std::string> hostnames;
+    for(uint32_t idx = 0 ; idx < nodes ; idx++)
+    {
+        hostnames.push_back("node" + std::to_string(idx) + ".example.com");
+        fleet[idx].cpuIdlePercent = 50.f;
+        fleet[idx].ramAvailable = 64 * 1024;
+        fleet[idx].ramAvailablePercent = 50;
+        fleet[idx].swapAvailablePercent = 100;
+        fleet[idx].diskSpaceAvailable = 500ull * 1000 * 1000;
+    }
+
+    {
+        HistoryStore history(directory.string());
+        std::array<double, HistoryStore::metricCount> values;
+        double seconds = 0.;
+        for(int report = 0 ; report < reports ; report++)
+        {
+            // generating the stats is left out of the time
+            std::vector<std::pair<uint64_t, std::array<double, HistoryStore::metricCount>>> samples(nodes);
+            for(uint32_t idx = 0 ; idx < nodes ; idx++)
+            {
+                NodeStats& stats = fleet[idx];
+                const uint32_t cpuLoad = std::clamp<int>(10000 - stats.cpuIdlePercent * 100 + int(random() % 401) - 200, 0, 10000);
+                stats.cpuIdlePercent = 100. - double(cpuLoad) / 100.;
+                stats.ramAvailable = std::clamp<int64_t>(stats.ramAvailable + int(random() % 65) - 32, 0, 128 * 1024);
+                stats.ramAvailablePercent = stats.ramAvailable * 100 / (128 * 1024);
+                stats.diskSpaceAvailable -= random() % 100;
+                stats.networkBandwidthUsed = random() % (100 * 1000 * 1000);
+                stats.pressure = random() % 20 ? 0.f : float(random() % 1000) / 100.f;
+                stats.appInFlight = random() % 50;
+                const float score = NodeStore::score(stats);
+                for(size_t metric = 0 ; metric < values.size() ; metric++)
+                    samples[idx].second[metric] = MetricIndex::value(stats, score, Metric(metric));
+                samples[idx].first = 1700000000000ull + 1000ull * report + random() % 40;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            for(uint32_t idx = 0 ; idx < nodes ; idx++)
+                history.append(hostnames[idx], samples[idx].first, samples[idx].second);
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        const uint64_t points = history.samples() * HistoryStore::metricCount;
+        std::cout << history.samples() / seconds << " samples/s appended, "
+                  << double(history.sealedBytes() + history.openBytes()) / points << " bytes per point with block headers, "
+                  << history.sealedBytes() / (1024 * 1024) << "MB sealed" << std::endl;
+
+        std::vector<HistoryStore::Point> result;
+        uint32_t next = 0;
+        BENCHMARK("10 minutes of one metric of a node")
+        {
+            history.query(hostnames[next++ % nodes], Metric::CpuIdlePercent, 0, ~0ull, 0, result);
+            return result.size();
+        };
+
+        BENCHMARK("the same in 1 minute steps")
+        {
+            history.query(hostnames[next++ % nodes], Metric::CpuIdlePercent, 1700000000000ull, ~0ull, 60000, result);
+            return result.size();
+        };
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("topology aware picks over 100k nodes", "[TopologyTree][benchmark]")
+{
+    // 10 zones of 100 racks of 100 nodes
+    constexpr uint32_t nodes = 100000;
+    std::mt19937 random(39);
+    TopologyTree tree(nodes);
+    std::vector<std::string> zones, racks;
+    for(int idx = 0 ; idx < 10 ; idx++)
+        zones.push_back("zone" + std::to_string(idx));
+    for(int idx = 0 ; idx < 100 ; idx++)
+        racks.push_back("rack" + std::to_string(idx));
+    for(uint32_t slot = 0 ; slot < nodes ; slot++)
+        tree.update(slot, zones[slot / 10000], racks[slot / 100 % 100], std::uniform_real_distribution<float>(0.f, 100.f)(random));
+
+    std::vector<uint32_t> slots;
+    uint32_t next = 0;
+    BENCHMARK("report moving a node's score")
+    {
+        const uint32_t slot = (next += 7919) % nodes;
+        tree.update(slot, zones[slot / 10000], racks[slot / 100 % 100], float(next % 100));
+        return slot;
+    };
+
+    BENCHMARK("best node in the caller's rack")
+    {
+        next++;
+        tree.nearest(zones[next % 10], racks[next % 100], 1, slots);
+        return slots.size();
+    };
+
+    BENCHMARK("3 replicas in different zones")
+    {
+        tree.spread(3, slots);
+        return slots.size();
+    };
+}
+
+TEST_CASE("picks within service pools over 100k nodes", "[PoolIndex][benchmark]")
+{
+    // every node in 3 of 100 pools, a pool holds about 3k nodes
+    constexpr uint32_t nodes = 100000;
+    std::mt19937 random(50);
+    RankIndex ranking(nodes);
+    PoolIndex pools(nodes);
+    std::vector<std::string> names;
+    for(int idx = 0 ; idx < 100 ; idx++)
+        names.push_back("service" + std::to_string(idx));
+    for(uint32_t slot = 0 ; slot < nodes ; slot++)
+    {
+        const float score = std::uniform_real_distribution<float>(0.f, 100.f)(random);
+        const std::string_view joined[] = {names[random() % 100], names[random() % 100], names[random() % 100]};
+        ranking.update(slot, score);
+        pools.join(slot, joined, 3, score);
+    }
+
+    std::vector<uint32_t> slots;
+    uint32_t next = 0;
+    BENCHMARK("report moving a node's score")
+    {
+        const uint32_t slot = (next += 7919) % nodes;
+        ranking.update(slot, float(next % 100));
+        pools.update(slot, float(next % 100));
+        return slot;
+    };
+
+    BENCHMARK("best node of the fleet")
+    {
+        return ranking.best();
+    };
+
+    BENCHMARK("best node of a pool")
+    {
+        return pools.best(names[++next % 100]);
+    };
+
+    BENCHMARK("top 10 of the fleet")
+    {
+        ranking.top(10, slots);
+        return slots.size();
+    };
+
+    BENCHMARK("top 10 of a pool")
+    {
+        pools.top(names[++next % 100], 10, slots);
+        return slots.size();
+    };
+}
+
+TEST_CASE("herding between reports with and without the assignment ledger", "[AssignmentLedger][benchmark]")
+{
+    // 100 nodes reporting every 5s out of phase, a router handing out 200 requests/s that keep a
+    // node 4% busier each for 2s
+    constexpr uint32_t nodes = 100;
+    constexpr int stepMs = 5;
+    constexpr int requestMs = 2000;
+    constexpr int reportMs = 5000;
+    constexpr int durationMs = 60000;
+
+    auto simulate = [&](bool ledger)
+    {
+        std::mt19937 random(40);
+        NodeStore store(nodes);
+        std::vector<float> baseBusy(nodes);
+        std::vector<int> active(nodes, 0);
+        std::vector<int> phase(nodes);
+        std::vector<std::pair<int, uint32_t>> finishing;
+        for(uint32_t idx = 0 ; idx < nodes ; idx++)
+        {
+            baseBusy[idx] = std::uniform_real_distribution<float>(0.f, 30.f)(random);
+            phase[idx] = std::uniform_int_distribution<int>(0, reportMs / stepMs - 1)(random) * stepMs;
+        }
+
+        auto report = [&](uint32_t idx, int now)
+        {
+            NodeStats stats;
+            stats.cpuIdlePercent = std::max(0.f, 100.f - baseBusy[idx] - 4.f * active[idx]);
+            stats.ramAvailablePercent = 60;
+            stats.collectedAtMs = now;
+            store.update("node" + std::to_string(idx), stats);
+        };
+        for(uint32_t idx = 0 ; idx < nodes ; idx++)
+            report(idx, 0);
+
+        int peak = 0;
+        double maxSum = 0.;
+        int samples = 0;
+        for(int now = stepMs ; now <= durationMs ; now += stepMs)
+        {
+            finishing.erase(std::remove_if(finishing.begin(), finishing.end(), [&](const std::pair<int, uint32_t>& request) {
+                if(request.first > now)
+                    return false;
+                active[request.second]--;
+                return true;
+            }), finishing.end());
+            for(uint32_t idx = 0 ; idx < nodes ; idx++)
+                if(now % reportMs == phase[idx])
+                    report(idx, now);
+
+            const uint32_t slot = ledger ? store.assign() : store.ranking().best();
+            active[slot]++;
+            finishing.emplace_back(now + requestMs, slot);
+
+            const int busiest = *std::max_element(active.begin(), active.end());
+            peak = std::max(peak, busiest);
+            maxSum += busiest;
+            samples++;
+        }
+        return std::make_pair(peak, maxSum / samples);
+    };
+
+    const auto naive = simulate(false);
+    const auto ledger = simulate(true);
+    std::cout << "busiest node, requests in flight: peak " << naive.first << " and mean " << naive.second << " by reported score alone, peak "
+              << ledger.first << " and mean " << ledger.second << " with the assignment ledger, 4 on average" << std::endl;
+    REQUIRE(ledger.first * 2 < naive.first);
+}
+
+TEST_CASE("gossip dissemination among 1k simulated peers", "[Gossip][benchmark]")
+{
+    using namespace std::chrono_literals;
+    constexpr size_t peers = 1000;
+
+    for(double loss : {0., 0.05})
+    {
+        // everyone joins through the first member within half a second, until every member knows every other
+        GossipNetwork network(peers, {}, loss);
+        network.joinAll();
+        const int64_t convergedMs = network.until([&]{
+            for(size_t idx = 0 ; idx < peers ; idx++)
+                if(network.node(idx).members().size() != peers - 1)
+                    return false;
+            return true;
+        }, 120s);
+        REQUIRE(convergedMs >= 0);
+
+        // a few members change load one after the other, the time until the last member knows
+        std::vector<int64_t> latencies;
+        uint64_t bytes = 0;
+        for(size_t idx = 0 ; idx < peers ; idx++)
+            bytes -= network.node(idx).bytesSent();
+        const GossipNetwork::Clock::time_point start = network.now();
+
+        for(size_t change = 0 ; change < 20 ; change++)
+        {
+            const size_t changed = (change * 389 + 7) % peers;
+            GossipNode& node = network.node(changed);
+            node.setLoad({uint32_t(change * 100), 0, 50, 0});
+            const uint32_t version = node.self().version;
+            latencies.push_back(network.until([&]{
+                for(size_t idx = 0 ; idx < peers ; idx++)
+                {
+                    const GossipNode::Member* member = network.node(idx).member(changed + 1);
+                    if(idx != changed && (!member || member->version < version))
+                        return false;
+                }
+                return true;
+            }, 30s));
+        }
+
+        size_t falselyDead = 0;
+        for(size_t idx = 0 ; idx < peers ; idx++)
+        {
+            bytes += network.node(idx).bytesSent();
+            falselyDead += peers - 1 - network.node(idx).aliveCount();
+        }
+        const double seconds = std::chrono::duration<double>(network.now() - start).count();
+        std::sort(latencies.begin(), latencies.end());
+
+        std::cout << "gossip, " << peers << " peers, " << loss * 100 << "% loss: converged after " << convergedMs << "ms,"
+                  << " load change known everywhere after " << latencies[latencies.size() / 2] << "ms median, "
+                  << latencies.back() << "ms worst, " << bytes / seconds / peers << " bytes/s per peer, "
+                  << falselyDead << " of " << peers * (peers - 1) << " entries falsely dead" << std::endl;
+        REQUIRE(latencies.front() >= 0);
+    }
+}
+
+TEST_CASE("loopback ingest over grpc and over udp datagrams", "[DatagramIngest][benchmark]")
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr size_t nodes = 10000;
+    constexpr size_t reports = 200000;
+
+    std::vector<mcproto::Stats> samples(nodes);
+    std::vector<const mcproto::Stats*> pointers;
+    for(size_t idx = 0 ; idx < nodes ; idx++)
+    {
+        mcproto::Stats& stats = samples[idx];
+        stats.set_hostname("node" + std::to_string(idx));
+        stats.mutable_cpuload()->set_cpuload(idx % 10000);
+        stats.mutable_meminfo()->set_availablerampercent(idx % 100);
+        stats.mutable_meminfo()->set_availableswappercent(100);
+        stats.mutable_diskinfo()->set_availablespace(50 * 1000 * 1000);
+        stats.mutable_netinfo()->set_bandwidthusage(idx * 100);
+        pointers.push_back(&stats);
+    }
+
+    {
+        InfoUpdateService service(false, 10000000, nodes);
+        grpc::ServerBuilder builder;
+        int port = 0;
+        builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+        builder.RegisterService(&service);
+        std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+        REQUIRE(port != 0);
+        std::unique_ptr<mcproto::InfoUpdate::Stub> stub = mcproto::InfoUpdate::NewStub(grpc::CreateChannel("127.0.0.1:" + std::to_string(port), grpc::InsecureChannelCredentials()));
+
+        // a call per report, as the clients make them, for a second
+        mcproto::StatsReply reply;
+        size_t sent = 0;
+        const Clock::time_point start = Clock::now();
+        while(Clock::now() - start < std::chrono::seconds(1))
+        {
+            grpc::ClientContext context;
+            REQUIRE(stub->SendStats(&context, samples[sent++ % nodes], &reply).ok());
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << "grpc SendStats over loopback: " << size_t(sent / seconds) << " reports/s" << std::endl;
+        server->Shutdown();
+    }
+
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for(auto [shards, sign] : {std::pair<size_t, bool>{1, false}, {cores, false}, {cores, true}})
+    {
+        InfoUpdateService service(false, 10000000, nodes, nullptr, nullptr, shards);
+        DatagramIngest::Config config;
+        mcproto::StatsDatagram::Key key{};
+        if(sign)
+            config.key = key;
+        DatagramIngest ingest(service, config);
+        DatagramSender sender("127.0.0.1:" + std::to_string(ingest.port()), config.key);
+
+        // sendmmsg in batches, paced only by the kernel taking them
+        const Clock::time_point start = Clock::now();
+        size_t sent = 0;
+        while(sent < reports)
+        {
+            const size_t count = std::min<size_t>(64, reports - sent);
+            sent += sender.send(pointers.data() + sent % nodes, std::min(count, nodes - sent % nodes));
+        }
+        // until the applier is done, what a full socket buffer lost never shows up
+        Clock::time_point done = Clock::now();
+        for(uint64_t handled = 0 ; handled < sent && Clock::now() - done < std::chrono::milliseconds(100) ; )
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if(ingest.applied() + ingest.dropped() != handled)
+            {
+                handled = ingest.applied() + ingest.dropped();
+                done = Clock::now();
+            }
+        }
+        const double seconds = std::chrono::duration<double>(done - start).count();
+        std::cout << "udp datagrams over loopback" << (sign ? ", signed" : "") << ", " << cores << " receivers, " << shards << " shards: "
+                  << size_t(ingest.applied() / seconds) << " reports/s applied, " << sent << " sent, " << ingest.received() << " received, "
+                  << ingest.dropped() << " dropped at the rings" << std::endl;
+        REQUIRE(ingest.applied() > 0);
+    }
+}
+
+TEST_CASE("applying reports into one shard and into one per core", "[InfoUpdateService][benchmark]")
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr size_t nodes = 100000;
+    constexpr size_t batch = 1024;
+    constexpr int rounds = 10;
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::string> hostnames;
+    for(size_t idx = 0 ; idx < nodes ; idx++)
+        hostnames.push_back("node" + std::to_string(idx));
+    const std::string zones[] = {"zone0", "zone1", "zone2", "zone3"};
+    const std::string racks[] = {"rack0", "rack1", "rack2", "rack3", "rack4", "rack5", "rack6", "rack7"};
+
+    for(size_t shards : {size_t(1), cores})
+    {
+        InfoUpdateService service(false, 100000000, nodes, nullptr, nullptr, shards);
+        // the reports of every shard, as its applier would find them in the rings
+        std::vector<std::vector<InfoUpdateService::Report>> reports(shards);
+        for(size_t idx = 0 ; idx < nodes ; idx++)
+        {
+            InfoUpdateService::Report report{hostnames[idx], zones[idx % 4], racks[idx / 4 % 8], {}};
+            report.stats.ramAvailablePercent = idx % 100;
+            report.stats.swapAvailablePercent = 100;
+            reports[service.shardOf(report.hostname)].push_back(report);
+        }
+
+        // every round moves every node
+        auto apply = [&](size_t shard, std::mt19937& random)
+        {
+            std::vector<InfoUpdateService::Report>& mine = reports[shard];
+            for(InfoUpdateService::Report& report : mine)
+                report.stats.cpuIdlePercent = float(random() % 100);
+            for(size_t at = 0 ; at < mine.size() ; at += batch)
+                service.ingest(shard, mine.data() + at, std::min(batch, mine.size() - at));
+        };
+        std::mt19937 random(3);
+        for(size_t shard = 0 ; shard < shards ; shard++)
+            apply(shard, random);
+
+        const Clock::time_point start = Clock::now();
+        std::vector<std::thread> appliers;
+        for(size_t shard = 0 ; shard < shards ; shard++)
+            appliers.emplace_back([&apply, shard]{
+                std::mt19937 random(shard);
+                for(int round = 0 ; round < rounds ; round++)
+                    apply(shard, random);
+            });
+        for(std::thread& applier : appliers)
+            applier.join();
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << "apply into " << shards << " shards, an applier each: " << size_t(rounds * nodes / seconds) << " reports/s" << std::endl;
+        REQUIRE(service.store().size() == reports[0].size());
+    }
+}
+
+TEST_CASE("collector tick latency under memory pressure, synchronous and through io_uring", "[IoRing][benchmark]")
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr uint32_t ticks = 2000;
+    constexpr size_t hogBytes = 256 << 20;
+
+    // threads faulting anonymous memory in and handing it back, for as long as the ticks run
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> hogs;
+    for(int idx = 0 ; idx < 2 ; idx++)
+    {
+        hogs.emplace_back([&stop]{
+            char* memory = static_cast<char*>(mmap(nullptr, hogBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if(memory == MAP_FAILED)
+                return;
+            while(!stop)
+            {
+                for(size_t offset = 0 ; offset < hogBytes && !stop ; offset += 4096)
+                    memory[offset] = char(offset);
+                madvise(memory, hogBytes, MADV_DONTNEED);
+            }
+            munmap(memory, hogBytes);
+        });
+    }
+
+    // read syscalls of the process so far, the io-wq workers do not count as syscalls
+    ProcFile io("/proc/self/io");
+    auto readSyscalls = [&io]{
+        uint64_t count = 0;
+        if(!io.read())
+            return count;
+        TextScanner scanner(io.content());
+        std::string_view key;
+        while(scanner.readWord(key))
+        {
+            if(key == "syscr:")
+            {
+                scanner.readUint(count);
+                break;
+            }
+            scanner.nextLine();
+        }
+        return count;
+    };
+
+    for(bool uring : {false, true})
+    {
+        Sampler sampler({});
+        sampler.configure("app", false, 0);
+        if(uring && !sampler.useIoRing())
+        {
+            std::cout << "io_uring unavailable" << std::endl;
+            break;
+        }
+        for(int idx = 0 ; idx < 3 ; idx++)
+            sampler.update(0);
+
+        std::vector<double> latencies;
+        latencies.reserve(ticks);
+        const uint64_t syscallsBefore = readSyscalls();
+        const uint64_t enterBefore = uring ? sampler.ioRing()->syscalls() : 0;
+        for(uint32_t tick = 0 ; tick < ticks ; tick++)
+        {
+            const Clock::time_point start = Clock::now();
+            sampler.update(0);
+            latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+        }
+        // the read of /proc/self/io itself aside
+        const double reads = double(readSyscalls() - syscallsBefore - 1) / ticks;
+        const double enters = uring ? double(sampler.ioRing()->syscalls() - enterBefore) / ticks : 0.;
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << (uring ? "io_uring   " : "synchronous") << " tick under memory churn: p50 " << latencies[ticks / 2] << "us, p99 "
+                  << latencies[ticks * 99 / 100] << "us, max " << latencies.back() << "us, " << reads << " read syscalls + "
+                  << enters << " io_uring_enter per tick" << std::endl;
+    }
+
+    stop = true;
+    for(std::thread& hog : hogs)
+        hog.join();
+}
@@ -17,9 +17,117 @@
 #include "adjustoomscore.h"
 #include "uname.h"
 #include "memoryinfo.h"
+#include "pressureinfo.h"
+#include "pressuremonitor.h"
+#include "reportinterval.h"
+#include "cgroupinfo.h"
+#include "options.h"
+#include "procfile.h"
+#include "collectors.h"
+#include "sampler.h"
+#include "spool.h"
+#include "endpointset.h"
+#include "snapshotpublisher.h"
+#include "gossip.h"
+#include "gossipagent.h"
+#include "gossipnetwork.h"
+#include "datagramsender.h"
+#include "ipv4address.h"
+#include "ioring.h"
+#include "inventoryinfo.h"
+#include "allocationcounter.h"
+#include "spoolreplay.h"
+
+#include <mcproto/infoupdate.pb.h>
+
+#include <grpcpp/security/server_credentials.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
 
 #include <filesystem>
+#include <atomic>
+#include <cstdlib>
 #include <fstream>
+#include <mutex>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+    struct CountingCollector
+    {
+        static constexpr const char* name = "counting";
+        int updates = 0;
+        bool succeeds = true;
+
+        explicit CountingCollector(const CollectorContext&) {}
+        bool update() { updates++; return succeeds; }
+        void fill(mcproto::Stats& stats) const { stats.set_hostname("filled"); }
+        void clear(mcproto::Stats& stats) const { stats.clear_hostname(); }
+    };
+
+    /// answers every report after a delay with its id in place of the interval floor, or fails
+    /// it. Keeps the batches it gets
+    class DelayedServer final : public mcproto::InfoUpdate::Service
+    {
+        uint32_t id_;
+        std::chrono::milliseconds delay_;
+        bool fails_;
+        std::unique_ptr<grpc::Server> server_;
+        int port_ = 0;
+        std::atomic<uint32_t> reports_{0};
+        std::mutex protect_;
+        std::vector<mcproto::StatsBatch> batches_;
+
+    public:
+        DelayedServer(uint32_t id, std::chrono::milliseconds delay, bool fails = false) : id_(id), delay_(delay), fails_(fails)
+        {
+            grpc::ServerBuilder builder;
+            builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port_);
+            builder.RegisterService(this);
+            server_ = builder.BuildAndStart();
+        }
+
+        ~DelayedServer()
+        {
+            server_->Shutdown(std::chrono::system_clock::now());
+        }
+
+        std::string address() const { return "127.0.0.1:" + std::to_string(port_); }
+
+        uint32_t reports() const { return reports_; }
+
+        grpc::Status SendStats(grpc::ServerContext*, const mcproto::Stats*, mcproto::StatsReply* reply) override
+        {
+            reports_++;
+            std::this_thread::sleep_for(delay_);
+            if(fails_)
+                return grpc::Status(grpc::StatusCode::UNAVAILABLE, "failing");
+            reply->set_reportintervalms(id_);
+            return grpc::Status::OK;
+        }
+
+        grpc::Status SendStatsBatch(grpc::ServerContext*, const mcproto::StatsBatch* batch, mcproto::StatsReply* reply) override
+        {
+            std::lock_guard<std::mutex> guard(protect_);
+            batches_.push_back(*batch);
+            reply->set_reportintervalms(id_);
+            return grpc::Status::OK;
+        }
+
+        std::vector<mcproto::StatsBatch> batches()
+        {
+            std::lock_guard<std::mutex> guard(protect_);
+            return batches_;
+        }
+    };
+}
 
 TEST_CASE("Linux Version Test", "[LinuxVersion]")
 {
@@ -133,3 +241,1053 @@ TEST_CASE("check memory info parsing", "[MemoryInfo]")
         std::filesystem::remove(filePath);
     }
 }
+
+TEST_CASE("check pressure info parsing and triggers", "[PressureInfo]")
+{
+    auto pressureDir = std::filesystem::temp_directory_path() / ("mclear_pressure_" + std::to_string(getpid()));
+    std::filesystem::create_directories(pressureDir);
+    auto writePressureFile = [&pressureDir](const char* resource, const char* avg10){
+        std::ofstream file(pressureDir / resource);
+        file << "some avg10=" << avg10 << " avg60=0.00 avg300=0.00 total=109101\n";
+        file << "full avg10=0.00 avg60=0.00 avg300=0.00 total=80290\n";
+    };
+    writePressureFile("cpu", "1.50");
+    writePressureFile("memory", "2.25");
+    writePressureFile("io", "0.00");
+
+    SECTION("check pressure info for systems < Linux 4.20")
+    {
+        PressureInfo info(pressureDir.c_str(), "4.19.0-110-generic");
+        REQUIRE_FALSE(info.available());
+        REQUIRE(info.update());
+        REQUIRE(info.avg10(PressureInfo::Cpu) == -1.f);
+        REQUIRE(info.avg10(PressureInfo::Io) == -1.f);
+
+        PressureMonitor monitor(info, 150000, 1000000, 1);
+        REQUIRE(monitor.armedMask() == 0);
+        REQUIRE(monitor.wait(5) == 0);
+    }
+
+    SECTION("check avg10 of all the resources is parsed")
+    {
+        PressureInfo info(pressureDir.c_str(), "5.4.0-110-generic");
+        REQUIRE(info.update());
+        REQUIRE(info.avg10(PressureInfo::Cpu) == 1.50f);
+        REQUIRE(info.avg10(PressureInfo::Memory) == 2.25f);
+        REQUIRE(info.avg10(PressureInfo::Io) == 0.f);
+    }
+
+    SECTION("check threshold crossings are reported when triggers are not available")
+    {
+        PressureInfo info(pressureDir.c_str(), "5.4.0-110-generic");
+        // 150ms of stall in a 1s window is a threshold of 15%
+        PressureMonitor monitor(info, 150000, 1000000, 1);
+
+        // regular files never take a kernel trigger
+        REQUIRE(monitor.armedMask() == 0);
+        REQUIRE(monitor.wait(5) == 0);
+
+        writePressureFile("memory", "40.00");
+        writePressureFile("io", "15.00");
+        REQUIRE(monitor.wait(1000) == ((1u << PressureInfo::Memory) | (1u << PressureInfo::Io)));
+
+        // still over the threshold but already reported
+        REQUIRE(monitor.wait(5) == 0);
+
+        writePressureFile("memory", "3.00");
+        REQUIRE(monitor.wait(5) == 0);
+        writePressureFile("memory", "20.00");
+        REQUIRE(monitor.wait(1000) == (1u << PressureInfo::Memory));
+    }
+
+    std::filesystem::remove_all(pressureDir);
+}
+
+TEST_CASE("check the report interval adapts to the rate of change", "[ReportInterval]")
+{
+    ReportInterval interval(1000, 30000, 5000);
+    const ReportInterval::Sample idle{500, 80, 1000, 0.f};
+
+    SECTION("check a stable node backs off up to the maximum")
+    {
+        REQUIRE(interval.adapt(idle) == 5000);
+        REQUIRE(interval.adapt(idle) == 7500);
+        for(int i = 0 ; i < 10 ; i++)
+            interval.adapt(idle);
+        REQUIRE(interval.intervalMs() == 30000);
+    }
+
+    SECTION("check a volatile node reports faster down to the minimum")
+    {
+        interval.adapt(idle);
+        REQUIRE(interval.adapt({5000, 80, 1000, 0.f}) == 2500);
+        REQUIRE(interval.adapt({5000, 40, 1000, 0.f}) == 1250);
+        REQUIRE(interval.adapt({5000, 40, 1000, 30.f}) == 1000);
+        // changes in between keep the interval
+        REQUIRE(interval.adapt({5500, 40, 1000, 30.f}) == 1000);
+    }
+
+    SECTION("check the server floor takes precedence")
+    {
+        interval.setServerFloor(20000);
+        REQUIRE(interval.adapt(idle) == 20000);
+        interval.setServerFloor(0);
+        REQUIRE(interval.intervalMs() == 5000);
+    }
+
+    SECTION("check bandwidth changes are relative")
+    {
+        REQUIRE(ReportInterval::change({0, 0, 0, 0.f}, {0, 0, 500 * 1000, 0.f}) == 50.f);
+        REQUIRE(ReportInterval::change({0, 0, 100 * 1000 * 1000, 0.f}, {0, 0, 90 * 1000 * 1000, 0.f}) == 10.f);
+    }
+}
+
+TEST_CASE("check cgroup v2 parsing", "[CgroupInfo]")
+{
+    auto cgroupRoot = std::filesystem::temp_directory_path() / ("mclear_cgroup_" + std::to_string(getpid()));
+    auto slice = cgroupRoot / "system.slice" / "web.service";
+    std::filesystem::create_directories(slice);
+    auto writeFile = [&slice](const char* name, const std::string& content){
+        std::ofstream file(slice / name);
+        file << content;
+    };
+    auto writeCpuStat = [&writeFile](uint64_t usageUs, uint64_t throttledUs){
+        writeFile("cpu.stat", "usage_usec " + std::to_string(usageUs) + "\nuser_usec 0\nsystem_usec 0\n"
+                              "nr_periods 10\nnr_throttled 2\nthrottled_usec " + std::to_string(throttledUs) + "\n");
+    };
+    writeCpuStat(1000000, 0);
+    writeFile("cpu.max", "200000 100000\n");
+    writeFile("memory.current", "750000000\n");
+    writeFile("memory.max", "1000000000\n");
+    writeFile("memory.pressure", "some avg10=12.50 avg60=0.00 avg300=0.00 total=1\nfull avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+    writeFile("io.pressure", "some avg10=3.00 avg60=0.00 avg300=0.00 total=1\nfull avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+    writeFile("cpu.pressure", "some avg10=0.00 avg60=0.00 avg300=0.00 total=1\n");
+
+    CgroupInfo info("system.slice/web.service", cgroupRoot.c_str(), "5.4.0-110-generic");
+    const auto start = std::chrono::steady_clock::now();
+
+    SECTION("check headroom relative to the limits")
+    {
+        REQUIRE(info.update(start));
+        REQUIRE(info.cpuLimit() == 20000);
+        REQUIRE(info.cpuUsage() == 0);
+        REQUIRE(info.memoryCurrent() == 750);
+        REQUIRE(info.memoryLimit() == 1000);
+        REQUIRE(info.memoryHeadroomPercent() == 25);
+        REQUIRE(info.memoryPressure() == 12.5f);
+        REQUIRE(info.ioPressure() == 3.f);
+
+        // 1.5 cpus worth of time in one second, a quarter of it throttled
+        writeCpuStat(2500000, 250000);
+        REQUIRE(info.update(start + std::chrono::seconds(1)));
+        REQUIRE(info.cpuUsage() == 15000);
+        REQUIRE(info.cpuHeadroom() == 2500);
+        REQUIRE(info.cpuThrottled() == 2500);
+    }
+
+    SECTION("check slices without limits")
+    {
+        writeFile("cpu.max", "max 100000\n");
+        writeFile("memory.max", "max\n");
+        REQUIRE(info.update(start));
+        REQUIRE(info.cpuLimit() == 10000 * sysconf(_SC_NPROCESSORS_ONLN));
+        REQUIRE(info.memoryLimit() == 0);
+        REQUIRE(info.memoryHeadroomPercent() == 100);
+    }
+
+    SECTION("check a missing slice fails the update")
+    {
+        CgroupInfo missing("system.slice/missing.service", cgroupRoot.c_str(), "5.4.0-110-generic");
+        REQUIRE_FALSE(missing.update());
+    }
+
+    std::filesystem::remove_all(cgroupRoot);
+}
+
+TEST_CASE("check the hardware inventory from sysfs", "[InventoryInfo]")
+{
+    auto sysfs = std::filesystem::temp_directory_path() / ("mclear_sysfs_" + std::to_string(getpid()));
+    auto writeFile = [](const std::filesystem::path& path, const std::string& content){
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream file(path);
+        file << content;
+    };
+    writeFile(sysfs / "devices/system/cpu/online", "0-5,8,10-11\n");
+    writeFile(sysfs / "devices/system/node/node0/cpulist", "0-5\n");
+    writeFile(sysfs / "devices/system/node/node0/meminfo", "Node 0 MemTotal:       16777216 kB\nNode 0 MemFree:         1048576 kB\n");
+    writeFile(sysfs / "devices/system/node/node1/cpulist", "8,10-11\n");
+    writeFile(sysfs / "devices/system/node/node1/meminfo", "Node 1 MemTotal:        8388608 kB\n");
+    writeFile(sysfs / "devices/system/node/possible", "0-1\n");
+    writeFile(sysfs / "class/net/eth0/speed", "25000\n");
+    writeFile(sysfs / "class/net/eth0/device/vendor", "0x15b3\n");
+    // down, the driver refuses the speed
+    writeFile(sysfs / "class/net/eth1/speed", "-1\n");
+    writeFile(sysfs / "class/net/eth1/device/vendor", "0x8086\n");
+    // virtual, no device
+    writeFile(sysfs / "class/net/docker0/speed", "10000\n");
+    writeFile(sysfs / "block/nvme0n1/size", "3907029168\n");
+    writeFile(sysfs / "block/loop0/size", "1024\n");
+    writeFile(sysfs / "block/sr0/size", "0\n");
+
+    const InventoryInfo info(sysfs.c_str());
+    REQUIRE(info.cores() == 9);
+    mcproto::Inventory inventory;
+    info.get(inventory);
+    REQUIRE(inventory.cores() == 9);
+    REQUIRE(inventory.numanodes_size() == 2);
+    REQUIRE(inventory.numanodes(0).cpus() == 6);
+    REQUIRE(inventory.numanodes(0).memorymb() == 16384);
+    REQUIRE(inventory.numanodes(1).cpus() == 3);
+    REQUIRE(inventory.numanodes(1).memorymb() == 8192);
+    REQUIRE(inventory.ramtotalmb() > 0);
+    REQUIRE(inventory.nics_size() == 1);
+    REQUIRE(inventory.nics(0).name() == "eth0");
+    REQUIRE(inventory.nics(0).speedmbps() == 25000);
+    REQUIRE(inventory.disks_size() == 1);
+    REQUIRE(inventory.disks(0).name() == "nvme0n1");
+    REQUIRE(inventory.disks(0).sizekb() == 2000398934ull);
+
+    REQUIRE(InventoryInfo::countCpus("0") == 1);
+    REQUIRE(InventoryInfo::countCpus("") == 0);
+    // no sysfs at all, the cpus online still count
+    REQUIRE(InventoryInfo((sysfs / "missing").c_str()).cores() == uint32_t(sysconf(_SC_NPROCESSORS_ONLN)));
+
+    std::filesystem::remove_all(sysfs);
+}
+
+TEST_CASE("check command line parsing", "[Options]")
+{
+    SECTION("check the defaults")
+    {
+        const char* argv[] = {"mclearcli"};
+        Options options = Options::parse(1, argv);
+        REQUIRE(options.reportIntervalMs == 5000);
+        REQUIRE(options.cgroups.empty());
+        REQUIRE(options.spoolSizeKb == 4096);
+        REQUIRE(options.servers == std::vector<std::string>{"localhost:50051"});
+    }
+
+    SECTION("check the values are taken")
+    {
+        const char* argv[] = {"mclearcli", "--cgroup", "a.slice", "--min-interval-ms", "500", "--cgroup", "b.slice"};
+        Options options = Options::parse(7, argv);
+        REQUIRE(options.minReportIntervalMs == 500);
+        REQUIRE(options.cgroups == std::vector<std::string>{"a.slice", "b.slice"});
+
+        const char* gossip[] = {"mclearcli", "--gossip-port", "7946", "--gossip-seed", "peer:7946"};
+        options = Options::parse(5, gossip);
+        REQUIRE(options.gossipPort == 7946);
+        REQUIRE(options.gossipSeeds == std::vector<std::string>{"peer:7946"});
+
+        const char* udp[] = {"mclearcli", "--udp", "server:50052", "--udp-key", "00112233445566778899aabbccddeeff"};
+        options = Options::parse(5, udp);
+        REQUIRE(options.udpServer == "server:50052");
+        REQUIRE(options.udpKey == "00112233445566778899aabbccddeeff");
+
+        const char* topology[] = {"mclearcli", "--zone", "z1", "--rack", "r2", "--pool", "web", "--pool", "search"};
+        options = Options::parse(9, topology);
+        REQUIRE(options.zone == "z1");
+        REQUIRE(options.rack == "r2");
+        REQUIRE(options.pools == std::vector<std::string>{"web", "search"});
+
+        const char* bench[] = {"mclearbench", "--bench-iterations", "50"};
+        options = Options::parse(3, bench);
+        REQUIRE(options.benchIterations == 50);
+
+        const char* collectors[] = {"mclearcli", "--disable", "cpu", "--period", "disk=30000", "--period", "cpu=10"};
+        options = Options::parse(7, collectors);
+        REQUIRE(options.collectors.size() == 2);
+        REQUIRE(options.collectors[0].name == "cpu");
+        REQUIRE_FALSE(options.collectors[0].enabled);
+        REQUIRE(options.collectors[0].periodMs == 10);
+        REQUIRE(options.collectors[1].name == "disk");
+        REQUIRE(options.collectors[1].enabled);
+        REQUIRE(options.collectors[1].periodMs == 30000);
+    }
+
+    SECTION("check malformed command lines are rejected")
+    {
+        const char* missing[] = {"mclearcli", "--cgroup"};
+        REQUIRE_THROWS_AS(Options::parse(2, missing), std::invalid_argument);
+        const char* unknown[] = {"mclearcli", "--cgroups", "a"};
+        REQUIRE_THROWS_AS(Options::parse(3, unknown), std::invalid_argument);
+        const char* number[] = {"mclearcli", "--interval-ms", "often"};
+        REQUIRE_THROWS_AS(Options::parse(3, number), std::invalid_argument);
+        const char* spoolSize[] = {"mclearcli", "--spool-size-kb", "lots"};
+        REQUIRE_THROWS_AS(Options::parse(3, spoolSize), std::invalid_argument);
+        const char* collector[] = {"mclearcli", "--disable", "gpu"};
+        REQUIRE_THROWS_AS(Options::parse(3, collector), std::invalid_argument);
+        const char* period[] = {"mclearcli", "--period", "disk"};
+        REQUIRE_THROWS_AS(Options::parse(3, period), std::invalid_argument);
+        const char* seedOnly[] = {"mclearcli", "--gossip-seed", "peer:7946"};
+        REQUIRE_THROWS_AS(Options::parse(3, seedOnly), std::invalid_argument);
+        const char* shortKey[] = {"mclearcli", "--udp", "server:50052", "--udp-key", "0011"};
+        REQUIRE_THROWS_AS(Options::parse(5, shortKey), std::invalid_argument);
+        const char* keyOnly[] = {"mclearcli", "--udp-key", "00112233445566778899aabbccddeeff"};
+        REQUIRE_THROWS_AS(Options::parse(3, keyOnly), std::invalid_argument);
+    }
+}
+
+TEST_CASE("check proc file scanning", "[ProcFile]")
+{
+    std::FILE* tmpf = std::tmpfile();
+    auto filePath = std::filesystem::read_symlink(std::filesystem::path("/proc/self/fd") / std::to_string(fileno(tmpf)));
+    {
+        std::ofstream file(filePath);
+        file << "cpu  10132153 290696 3084719 46828483\ncpu0 1 2 3 4\n";
+    }
+
+    SECTION("check the content is read and scanned line by line")
+    {
+        ProcFile procFile(filePath, 8);
+        REQUIRE(procFile.read());
+        REQUIRE(procFile.content().size() == 51);
+
+        TextScanner scanner(procFile.content());
+        std::string_view word;
+        uint64_t value = 0;
+        REQUIRE(scanner.readWord(word));
+        REQUIRE(word == "cpu");
+        for(int column = 0 ; column < 4 ; column++)
+            REQUIRE(scanner.readUint(value));
+        REQUIRE(value == 46828483);
+        REQUIRE_FALSE(scanner.readUint(value));
+        REQUIRE(scanner.nextLine());
+        REQUIRE(scanner.readWord(word));
+        REQUIRE(word == "cpu0");
+    }
+
+    SECTION("check the file is re-read in place")
+    {
+        ProcFile procFile(filePath);
+        REQUIRE(procFile.read());
+        {
+            std::ofstream file(filePath);
+            file << "some avg10=1.25 avg60=0.00\n";
+        }
+        REQUIRE(procFile.read());
+        TextScanner scanner(procFile.content());
+        float avg10 = 0.f;
+        REQUIRE(scanner.skipPast('='));
+        REQUIRE(scanner.readFloat(avg10));
+        REQUIRE(avg10 == 1.25f);
+    }
+
+    SECTION("check missing files")
+    {
+        ProcFile procFile("/proc/mclear/missing");
+        REQUIRE_FALSE(procFile.read());
+        REQUIRE(procFile.content().empty());
+    }
+
+    fclose(tmpf);
+    std::filesystem::remove(filePath);
+}
+
+TEST_CASE("check the io ring reads files as read() does", "[IoRing]")
+{
+    std::unique_ptr<IoRing> ring;
+    try
+    {
+        ring = std::make_unique<IoRing>(4);
+    }
+    catch(const std::system_error& error)
+    {
+        WARN("io_uring unavailable: " << error.what());
+        return;
+    }
+
+    auto directory = std::filesystem::temp_directory_path() / ("mclear_ioring_" + std::to_string(getpid()));
+    std::filesystem::create_directories(directory);
+    auto writeFile = [&directory](const std::string& name, const std::string& content){
+        std::ofstream file(directory / name);
+        file << content;
+    };
+    // more files than the ring has entries, one outgrowing its buffer and one missing
+    std::vector<ProcFile> files;
+    for(int idx = 0 ; idx < 6 ; idx++)
+    {
+        writeFile("file" + std::to_string(idx), "value " + std::to_string(idx) + "\n");
+        files.emplace_back((directory / ("file" + std::to_string(idx))).string(), 64);
+    }
+    writeFile("large", std::string(100, 'x'));
+    files.emplace_back((directory / "large").string(), 64);
+    files.emplace_back((directory / "missing").string(), 64);
+    std::vector<ProcFile*> batch;
+    for(ProcFile& file : files)
+        batch.push_back(&file);
+
+    ring->read(batch);
+    for(int idx = 0 ; idx < 6 ; idx++)
+    {
+        REQUIRE(files[idx].read());
+        REQUIRE(files[idx].content() == "value " + std::to_string(idx) + "\n");
+    }
+    REQUIRE(files[6].read());
+    REQUIRE(files[6].content() == std::string(100, 'x'));
+    REQUIRE_FALSE(files[7].read());
+
+    // registered once, one enter per ring full after that, and what changed is read again
+    ring->read(batch);
+    for(ProcFile& file : files)
+        file.discard();
+    writeFile("file0", "changed\n");
+    const uint64_t syscalls = ring->syscalls();
+    ring->read(batch);
+    REQUIRE(ring->syscalls() - syscalls == 2);
+    REQUIRE(files[0].read());
+    REQUIRE(files[0].content() == "changed\n");
+
+    // a read ahead nobody took does not hide a later change
+    files[1].discard();
+    writeFile("file1", "later\n");
+    REQUIRE(files[1].read());
+    REQUIRE(files[1].content() == "later\n");
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("check the sampler does not allocate once warmed up", "[Sampler]")
+{
+    auto cgroupRoot = std::filesystem::temp_directory_path() / ("mclear_sampler_" + std::to_string(getpid()));
+    std::filesystem::create_directories(cgroupRoot / "test.slice");
+    auto writeFile = [&cgroupRoot](const char* name, const char* content){
+        std::ofstream file(cgroupRoot / "test.slice" / name);
+        file << content;
+    };
+    writeFile("cpu.stat", "usage_usec 1000\nthrottled_usec 0\n");
+    writeFile("cpu.max", "max 100000\n");
+    writeFile("memory.current", "1000000\n");
+    writeFile("memory.max", "max\n");
+    writeFile("memory.pressure", "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+    writeFile("io.pressure", "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+    writeFile("cpu.pressure", "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+
+    const std::string segment = "/mclear-appload-sampler-" + std::to_string(getpid());
+    Sampler sampler({"test.slice"}, cgroupRoot.c_str(), segment.c_str());
+    sampler.setTopology("eu-west-1a", "r12");
+    AppLoadPublisher load("checkout", segment.c_str());
+    load.started();
+    sampler.update(0);
+    sampler.update(0);
+
+    const uint64_t warmedUp = AllocationCounter::allocations();
+    for(uint32_t tick = 0 ; tick < 20 ; tick++)
+        sampler.update(tick & 1);
+    const uint64_t steadyState = AllocationCounter::allocations();
+
+    REQUIRE(warmedUp > 0);
+    REQUIRE(steadyState == warmedUp);
+    REQUIRE(sampler.arenaOverflow() == 0);
+    REQUIRE(sampler.stats().cgroups_size() == 1);
+    REQUIRE(sampler.stats().cgroups(0).cgroup() == "test.slice");
+    REQUIRE(sampler.stats().pressure().triggered() == 1);
+    REQUIRE(sampler.stats().apploads_size() == 1);
+    REQUIRE(sampler.stats().topology().zone() == "eu-west-1a");
+    REQUIRE(sampler.stats().topology().rack() == "r12");
+    REQUIRE(sampler.stats().sequence() == 22);
+    sampler.setNextReportMs(5000);
+    REQUIRE(sampler.stats().nextreportms() == 5000);
+
+    // the same through io_uring, one syscall per tick for all the files
+    Sampler uring({"test.slice"}, cgroupRoot.c_str(), segment.c_str());
+    if(uring.useIoRing())
+    {
+        uring.update(0);
+        uring.update(0);
+        const uint64_t allocated = AllocationCounter::allocations();
+        const uint64_t syscalls = uring.ioRing()->syscalls();
+        for(uint32_t tick = 0 ; tick < 20 ; tick++)
+            uring.update(0);
+        REQUIRE(AllocationCounter::allocations() == allocated);
+        REQUIRE(uring.ioRing()->syscalls() - syscalls == 20);
+
+        writeFile("memory.current", "250000000\n");
+        uring.update(0);
+        REQUIRE(uring.stats().cgroups(0).memorycurrent() == 250);
+    }
+
+    // a sampler of the next run counts again, under another run id
+    Sampler restarted({}, cgroupRoot.c_str(), segment.c_str());
+    restarted.update(0);
+    REQUIRE(restarted.stats().sequence() == 1);
+    REQUIRE(restarted.stats().runid() != sampler.stats().runid());
+
+    std::filesystem::remove_all(cgroupRoot);
+    shm_unlink(segment.c_str());
+}
+
+TEST_CASE("check the spool keeps undelivered samples across restarts", "[Spool]")
+{
+    auto spoolPath = std::filesystem::temp_directory_path() / ("mclear_spool_" + std::to_string(getpid()));
+    std::filesystem::remove(spoolPath);
+    std::vector<std::string_view> records;
+
+    SECTION("check records come back oldest first")
+    {
+        Spool spool(spoolPath, 1024);
+        REQUIRE(spool.empty());
+        REQUIRE(spool.push("first"));
+        REQUIRE(spool.push("second"));
+        REQUIRE(spool.push("third"));
+        REQUIRE(spool.size() == 3);
+
+        REQUIRE(spool.peek(records, 11) == 2);
+        REQUIRE(records[0] == "first");
+        REQUIRE(records[1] == "second");
+        spool.pop(2);
+
+        // a single record larger than the limit still goes out
+        REQUIRE(spool.peek(records, 1) == 1);
+        REQUIRE(records[0] == "third");
+        spool.pop();
+        REQUIRE(spool.empty());
+        REQUIRE_FALSE(spool.push(std::string(600, 'x')));
+    }
+
+    SECTION("check a full spool drops the oldest records")
+    {
+        Spool spool(spoolPath, 256);
+        // 8 bytes of record header, 48 bytes a record
+        for(int idx = 0 ; idx < 10 ; idx++)
+            REQUIRE(spool.push(std::string(40, 'a' + idx)));
+
+        // five records and the 16 bytes at the end of the ring no record fits into
+        REQUIRE(spool.size() == 5);
+        REQUIRE(spool.dropped() == 5);
+        REQUIRE(spool.peek(records, 1024) == 5);
+        REQUIRE(records.front() == std::string(40, 'f'));
+        REQUIRE(records.back() == std::string(40, 'j'));
+    }
+
+    SECTION("check the records survive reopening and torn records are cut off")
+    {
+        {
+            Spool spool(spoolPath, 1024);
+            spool.push("first");
+            spool.push("second");
+            spool.push("third");
+            spool.pop();
+        }
+
+        {
+            Spool spool(spoolPath, 1024);
+            REQUIRE(spool.size() == 2);
+            REQUIRE(spool.peek(records, 1024) == 2);
+            REQUIRE(records[0] == "second");
+            REQUIRE(records[1] == "third");
+        }
+
+        // flip a byte of the last record
+        {
+            std::fstream file(spoolPath, std::ios::in | std::ios::out | std::ios::binary);
+            std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            const size_t pos = content.find("third");
+            REQUIRE(pos != std::string::npos);
+            file.seekp(pos);
+            file.put('T');
+        }
+
+        {
+            Spool spool(spoolPath, 1024);
+            REQUIRE(spool.size() == 1);
+            REQUIRE(spool.peek(records, 1024) == 1);
+            REQUIRE(records[0] == "second");
+            REQUIRE(spool.push("fourth"));
+            REQUIRE(spool.size() == 2);
+        }
+
+        // a spool of a different size is started over
+        Spool spool(spoolPath, 2048);
+        REQUIRE(spool.empty());
+    }
+
+    std::filesystem::remove(spoolPath);
+}
+
+TEST_CASE("check a spool is replayed oldest first as backfill", "[SpoolReplay]")
+{
+    auto spoolPath = std::filesystem::temp_directory_path() / ("mclear_replay_spool_" + std::to_string(getpid()));
+    std::filesystem::remove(spoolPath);
+    DelayedServer server(1, std::chrono::milliseconds(0));
+    EndpointSet endpoints({server.address()}, 800);
+    Spool spool(spoolPath, 64 * 1024);
+    SpoolReplay replay(128);
+    mcproto::StatsReply reply;
+    REQUIRE_FALSE(replay.send(spool, endpoints, reply));
+
+    std::string encoded;
+    for(int idx = 0 ; idx < 40 ; idx++)
+    {
+        mcproto::Stats stats;
+        stats.set_hostname("node1");
+        stats.set_sequence(idx + 1);
+        stats.set_collectedatms(1000 * (idx + 1));
+        REQUIRE(stats.SerializeToString(&encoded));
+        REQUIRE(spool.push(encoded));
+    }
+    REQUIRE(spool.push("not a sample"));
+
+    size_t batches = 0;
+    while(replay.send(spool, endpoints, reply))
+    {
+        REQUIRE(reply.reportintervalms() == 1);
+        batches++;
+    }
+    REQUIRE(spool.empty());
+    REQUIRE(batches > 1);
+
+    uint64_t sequence = 0;
+    for(const mcproto::StatsBatch& batch : server.batches())
+    {
+        REQUIRE(batch.backfill());
+        for(const mcproto::Stats& stats : batch.stats())
+            REQUIRE(stats.sequence() == ++sequence);
+    }
+    REQUIRE(sequence == 40);
+    std::filesystem::remove(spoolPath);
+}
+
+TEST_CASE("check reports are hedged to the next server", "[EndpointSet]")
+{
+    using namespace std::chrono;
+    DelayedServer fast(1, milliseconds(0));
+    mcproto::Stats stats;
+    stats.set_hostname("node1");
+    mcproto::StatsReply reply;
+
+    SECTION("check a hanging server costs a report the hedge budget only")
+    {
+        DelayedServer slow(2, milliseconds(1000));
+        EndpointSet endpoints({slow.address(), fast.address()}, 800);
+        REQUIRE(endpoints.preferred() == slow.address());
+
+        const auto start = steady_clock::now();
+        REQUIRE(endpoints.send(stats, reply));
+        REQUIRE(steady_clock::now() - start < milliseconds(600));
+        REQUIRE(reply.reportintervalms() == 1);
+
+        // the loser of the race is ranked behind the winner
+        REQUIRE(endpoints.preferred() == fast.address());
+        REQUIRE(endpoints.send(stats, reply));
+        REQUIRE(reply.reportintervalms() == 1);
+    }
+
+    SECTION("check a server that is down is failed over right away")
+    {
+        EndpointSet endpoints({"127.0.0.1:1", fast.address()}, 800);
+        const auto start = steady_clock::now();
+        REQUIRE(endpoints.send(stats, reply));
+        REQUIRE(steady_clock::now() - start < milliseconds(200));
+        REQUIRE(endpoints.preferred() == fast.address());
+    }
+
+    SECTION("check a runner-up that is backed off is not hedged to")
+    {
+        DelayedServer slow(2, milliseconds(200));
+        DelayedServer broken(3, milliseconds(0), true);
+        EndpointSet endpoints({slow.address(), broken.address()}, 400);
+        REQUIRE(endpoints.send(stats, reply));
+        REQUIRE(reply.reportintervalms() == 2);
+        REQUIRE(broken.reports() == 1);
+
+        REQUIRE(endpoints.send(stats, reply));
+        REQUIRE(reply.reportintervalms() == 2);
+        REQUIRE(broken.reports() == 1);
+    }
+
+    SECTION("check no server answering fails the report")
+    {
+        EndpointSet endpoints({"127.0.0.1:1"}, 200);
+        REQUIRE_FALSE(endpoints.send(stats, reply));
+        REQUIRE_THROWS_AS(EndpointSet({}), std::invalid_argument);
+    }
+}
+
+TEST_CASE("check collectors are switched and paced on their own", "[CollectorSet]")
+{
+    using namespace std::chrono;
+    const std::vector<std::string> cgroups;
+    CollectorSet<CountingCollector, CpuLoadCollector> collectors(CollectorContext{cgroups, "/sys/fs/cgroup"});
+    CountingCollector& counting = collectors.get<CountingCollector>();
+    mcproto::Stats stats;
+
+    REQUIRE(decltype(collectors)::has("counting"));
+    REQUIRE(decltype(collectors)::has("cpu"));
+    REQUIRE_FALSE(decltype(collectors)::has("gpu"));
+    REQUIRE_FALSE(collectors.configure("gpu", false, 0));
+
+    const auto start = steady_clock::now();
+    collectors.update(stats, start);
+    REQUIRE(counting.updates == 1);
+    REQUIRE(stats.hostname() == "filled");
+    REQUIRE(stats.has_cpuload());
+
+    SECTION("check a collector samples no more often than its period")
+    {
+        REQUIRE(collectors.configure("counting", true, 1000));
+        collectors.update(stats, start + milliseconds(1));
+        REQUIRE(counting.updates == 2);
+        collectors.update(stats, start + milliseconds(500));
+        REQUIRE(counting.updates == 2);
+        collectors.update(stats, start + milliseconds(1001));
+        REQUIRE(counting.updates == 3);
+    }
+
+    SECTION("check turned off collectors are left out")
+    {
+        REQUIRE(collectors.configure("counting", false, 0));
+        int visited = 0;
+        collectors.forEach([&visited](auto&){ visited++; });
+        REQUIRE(visited == 1);
+
+        stats.Clear();
+        collectors.update(stats, start + milliseconds(1));
+        REQUIRE(counting.updates == 1);
+        REQUIRE(stats.hostname().empty());
+        REQUIRE(stats.has_cpuload());
+    }
+
+    SECTION("check a failed update clears what the collector reported")
+    {
+        counting.succeeds = false;
+        collectors.update(stats, start + milliseconds(1));
+        REQUIRE(stats.hostname().empty());
+    }
+}
+
+TEST_CASE("check services publish their load through shared memory", "[AppLoad]")
+{
+    using namespace std::chrono;
+    const std::string segment = "/mclear-appload-test-" + std::to_string(getpid());
+    const std::vector<std::string> cgroups;
+    AppLoadCollector collector(CollectorContext{cgroups, "/sys/fs/cgroup", segment.c_str()});
+    REQUIRE(collector.segment);
+    mcproto::Stats stats;
+
+    auto publisher = std::make_unique<AppLoadPublisher>("checkout", segment.c_str());
+    REQUIRE(publisher->published());
+    for(int idx = 0 ; idx < 3 ; idx++)
+        publisher->started();
+    publisher->queued(5);
+
+    const auto start = steady_clock::now();
+    REQUIRE(collector.update(start));
+    collector.fill(stats);
+    REQUIRE(stats.apploads_size() == 1);
+    REQUIRE(stats.apploads(0).service() == "checkout");
+    REQUIRE(stats.apploads(0).inflight() == 3);
+    REQUIRE(stats.apploads(0).queuedepth() == 5);
+    REQUIRE(stats.apploads(0).requestspersec() == 0);
+
+    publisher->finished(1000);
+    publisher->finished(3000);
+    publisher->dequeued(2);
+    REQUIRE(collector.update(start + milliseconds(500)));
+    collector.fill(stats);
+    REQUIRE(stats.apploads(0).inflight() == 1);
+    REQUIRE(stats.apploads(0).queuedepth() == 3);
+    REQUIRE(stats.apploads(0).requestspersec() == 4);
+    REQUIRE(stats.apploads(0).meanlatencyus() == 2000);
+
+    SECTION("check a service that is gone is dropped")
+    {
+        publisher.reset();
+        REQUIRE(collector.update(start + milliseconds(1000)));
+        collector.fill(stats);
+        REQUIRE(stats.apploads_size() == 0);
+    }
+
+    SECTION("check the slot of a service that died is reclaimed")
+    {
+        const pid_t child = fork();
+        if(!child)
+            _exit(0);
+        waitpid(child, nullptr, 0);
+
+        AppLoadSegment* table = AppLoadSegment::map(segment.c_str());
+        REQUIRE(table);
+        table->slots[0].pid.store(child);
+        REQUIRE(collector.update(start + milliseconds(1000)));
+        collector.fill(stats);
+        REQUIRE(stats.apploads_size() == 0);
+        REQUIRE(table->slots[0].state.load() == AppLoadSlot::Free);
+        AppLoadSegment::unmap(table);
+    }
+
+    SECTION("check a full table leaves the service publishing nowhere")
+    {
+        std::vector<std::unique_ptr<AppLoadPublisher>> publishers;
+        for(uint32_t idx = 1 ; idx < AppLoadSegment::slotCount ; idx++)
+            publishers.push_back(std::make_unique<AppLoadPublisher>("filler", segment.c_str()));
+        AppLoadPublisher overflow("overflow", segment.c_str());
+        REQUIRE_FALSE(overflow.published());
+        overflow.started();
+    }
+
+    publisher.reset();
+    shm_unlink(segment.c_str());
+}
+
+TEST_CASE("check the latest sample is readable from shared memory", "[StatsSnapshot]")
+{
+    const std::string name = "/mclear-stats-test-" + std::to_string(getpid());
+    StatsSnapshot snapshot;
+
+    {
+        StatsSnapshotReader early(name.c_str());
+        REQUIRE_FALSE(early.available());
+        REQUIRE_FALSE(early.read(snapshot));
+    }
+
+    SnapshotPublisher publisher(name);
+    StatsSnapshotReader reader(name.c_str());
+    REQUIRE(reader.available());
+    REQUIRE_FALSE(reader.read(snapshot));
+
+    SECTION("check a report turns into a snapshot")
+    {
+        mcproto::Stats stats;
+        stats.set_collectedatms(1234);
+        stats.mutable_cpuload()->set_cpuload(4200);
+        stats.mutable_meminfo()->set_availablerampercent(55);
+        stats.mutable_meminfo()->set_availableram(2048);
+        stats.mutable_diskinfo();
+        publisher.publish(stats);
+
+        REQUIRE(reader.read(snapshot));
+        REQUIRE(reader.sequence() == 2);
+        REQUIRE(snapshot.collectedAtMs == 1234);
+        REQUIRE(snapshot.cpuLoad == 4200);
+        REQUIRE(snapshot.availableRamPercent == 55);
+        REQUIRE(snapshot.availableRam == 2048);
+        REQUIRE(snapshot.valid == (StatsSnapshot::CpuLoad | StatsSnapshot::Memory));
+        REQUIRE(snapshot.cpuPressure == -1.f);
+    }
+
+    SECTION("check readers never see a torn snapshot")
+    {
+        std::atomic<bool> done{false};
+        std::thread writer([&]{
+            StatsSnapshot written{};
+            for(uint32_t idx = 1 ; !done ; idx++)
+            {
+                written.collectedAtMs = written.diskSpaceAvailable = written.availableRam = written.availableSwap = idx;
+                written.cpuLoad = written.bandwidthUsage = written.valid = idx;
+                publisher.publish(written);
+            }
+        });
+
+        bool coherent = true;
+        for(int idx = 0 ; idx < 200000 ; idx++)
+        {
+            if(!reader.read(snapshot))
+                continue;
+            coherent &= snapshot.collectedAtMs == snapshot.availableSwap && snapshot.cpuLoad == snapshot.valid
+                     && snapshot.cpuLoad == uint32_t(snapshot.collectedAtMs);
+        }
+        done = true;
+        writer.join();
+        REQUIRE(coherent);
+        REQUIRE(reader.sequence() % 2 == 0);
+    }
+
+    SECTION("check a writer that died in the middle of an update does not hang readers")
+    {
+        StatsSnapshot written{};
+        written.cpuLoad = 4200;
+        publisher.publish(written);
+        const int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+        REQUIRE(fd != -1);
+        void* mapped = mmap(nullptr, sizeof(StatsSnapshotPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        REQUIRE(mapped != MAP_FAILED);
+        StatsSnapshotPage* page = static_cast<StatsSnapshotPage*>(mapped);
+        page->sequence.fetch_add(1);
+        REQUIRE_FALSE(reader.read(snapshot));
+
+        // the next mclearcli to start finishes the update
+        SnapshotPublisher restarted(name);
+        REQUIRE(reader.read(snapshot));
+        REQUIRE(snapshot.cpuLoad == 4200);
+        munmap(mapped, sizeof(StatsSnapshotPage));
+    }
+
+    shm_unlink(name.c_str());
+}
+
+TEST_CASE("check the gossip group converges and detects failures", "[Gossip]")
+{
+    using namespace std::chrono_literals;
+    constexpr size_t peers = 200;
+    GossipNetwork network(peers);
+    network.joinAll();
+
+    auto everyoneKnows = [&](auto check) {
+        return [&network, check]{
+            for(size_t idx = 0 ; idx < network.size() ; idx++)
+                if(network.up(idx) && !check(network.node(idx)))
+                    return false;
+            return true;
+        };
+    };
+    REQUIRE(network.until(everyoneKnows([](const GossipNode& node){ return node.aliveCount() == peers - 1; }), 60s) >= 0);
+
+    SECTION("check a load change reaches every member")
+    {
+        network.node(17).setLoad({1500, 1000, 80, 2});
+        REQUIRE(network.until(everyoneKnows([](const GossipNode& node){
+            const GossipNode::Member* member = node.member(18);
+            return node.id() == 18 || (member && member->version == 1 && member->load.cpuLoad == 1500);
+        }), 10s) >= 0);
+
+        std::vector<const GossipNode::Member*> best;
+        network.node(3).setLoad({9000, 0, 10, 50});
+        network.node(40).best(3, best);
+        REQUIRE(best.size() == 3);
+        REQUIRE(best[0]->id == 18);
+        REQUIRE(GossipNode::score(best[0]->load) >= GossipNode::score(best[1]->load));
+    }
+
+    SECTION("check a failed member is declared dead and nobody else")
+    {
+        network.setUp(5, false);
+        REQUIRE(network.until(everyoneKnows([](const GossipNode& node){
+            const GossipNode::Member* member = node.member(6);
+            return member && member->state == GossipNode::State::Dead;
+        }), 20s) >= 0);
+        network.advance(5s);
+        REQUIRE(everyoneKnows([](const GossipNode& node){ return node.aliveCount() == peers - 2; })());
+    }
+
+    SECTION("check a member that was suspected refutes once it is back")
+    {
+        network.setUp(9, false);
+        REQUIRE(network.until([&]{
+            for(size_t idx = 0 ; idx < peers ; idx++)
+                if(idx != 9 && network.node(idx).member(10)->state != GossipNode::State::Alive)
+                    return true;
+            return false;
+        }, 10s) >= 0);
+        network.setUp(9, true);
+        REQUIRE(network.until(everyoneKnows([](const GossipNode& node){
+            const GossipNode::Member* member = node.member(10);
+            return node.id() == 10 || (member->state == GossipNode::State::Alive && member->incarnation > 0);
+        }), 20s) >= 0);
+    }
+}
+
+TEST_CASE("check lossy links are not mistaken for failures", "[Gossip]")
+{
+    using namespace std::chrono_literals;
+    constexpr size_t peers = 100;
+    GossipNetwork network(peers, {}, 0.05);
+    network.joinAll();
+    network.advance(30s);
+
+    for(size_t idx = 0 ; idx < peers ; idx++)
+    {
+        REQUIRE(network.node(idx).aliveCount() == peers - 1);
+        for(const GossipNode::Member& member : network.node(idx).members())
+            REQUIRE(member.state != GossipNode::State::Dead);
+    }
+}
+
+TEST_CASE("check gossip agents find each other over udp", "[Gossip]")
+{
+    GossipNode::Config config;
+    config.period = std::chrono::milliseconds(50);
+    config.pingTimeout = std::chrono::milliseconds(20);
+    GossipAgent first(0, {}, config);
+    GossipAgent second(0, {"127.0.0.1:" + std::to_string(first.port())}, config);
+
+    mcproto::Stats stats;
+    stats.mutable_cpuload()->set_cpuload(1234);
+    stats.mutable_meminfo()->set_availablerampercent(60);
+    second.publish(stats);
+
+    // a local router asking the first agent for the best nodes it knows of
+    const int router = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    REQUIRE(router != -1);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(first.port());
+
+    char buffer[GossipNode::maxMessageSize];
+    std::vector<GossipNode::Member> table;
+    bool found = false;
+    for(int attempt = 0 ; attempt < 250 && !found ; attempt++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        const size_t size = GossipNode::encodeQuery(buffer, 5);
+        sendto(router, buffer, size, 0, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        pollfd pfd{router, POLLIN, 0};
+        if(poll(&pfd, 1, 50) <= 0)
+            continue;
+        const ssize_t received = recv(router, buffer, sizeof(buffer), 0);
+        REQUIRE(GossipNode::decodeTable(buffer, received, table));
+        for(const GossipNode::Member& member : table)
+            found |= member.address.port == second.port() && member.load.cpuLoad == 1234;
+    }
+    close(router);
+
+    REQUIRE(found);
+    REQUIRE(table.size() == 2);
+    REQUIRE(table[0].load.cpuLoad == 1234);
+}
+
+TEST_CASE("check samples go out as signed datagrams", "[DatagramSender]")
+{
+    const int server = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    REQUIRE(server != -1);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    socklen_t addressSize = sizeof(address);
+    getsockname(server, reinterpret_cast<sockaddr*>(&address), &addressSize);
+
+    mcproto::StatsDatagram::Key key;
+    REQUIRE(mcproto::StatsDatagram::parseKey("00112233445566778899aabbccddeeff", key));
+    DatagramSender sender("127.0.0.1:" + std::to_string(ntohs(address.sin_port)), key);
+
+    std::vector<mcproto::Stats> samples(100);
+    std::vector<const mcproto::Stats*> batch;
+    for(size_t idx = 0 ; idx < samples.size() ; idx++)
+    {
+        samples[idx].set_hostname("node" + std::to_string(idx));
+        samples[idx].set_sequence(idx);
+        samples[idx].mutable_topology()->set_rack("r1");
+        batch.push_back(&samples[idx]);
+    }
+    REQUIRE(sender.send(samples[0]));
+    REQUIRE(sender.send(batch.data(), batch.size()) == batch.size());
+
+    char buffer[mcproto::StatsDatagram::maxSize];
+    mcproto::StatsDatagram datagram;
+    for(size_t idx = 0 ; idx <= samples.size() ; idx++)
+    {
+        pollfd pfd{server, POLLIN, 0};
+        REQUIRE(poll(&pfd, 1, 1000) == 1);
+        const ssize_t size = recv(server, buffer, sizeof(buffer), 0);
+        REQUIRE(datagram.decode(buffer, size, &key));
+        REQUIRE(datagram.hostname == samples[idx ? idx - 1 : 0].hostname());
+        REQUIRE(datagram.sequence == (idx ? idx - 1 : 0));
+        REQUIRE(datagram.rack == "r1");
+    }
+    close(server);
+
+    REQUIRE_THROWS_AS(DatagramSender("nowhere"), std::invalid_argument);
+}
+
+TEST_CASE("check host:port resolves to an ipv4 address", "[Ipv4Address]")
+{
+    const sockaddr_in address = Ipv4Address::resolve("127.0.0.1:50052");
+    REQUIRE(address.sin_family == AF_INET);
+    REQUIRE(ntohl(address.sin_addr.s_addr) == INADDR_LOOPBACK);
+    REQUIRE(ntohs(address.sin_port) == 50052);
+    REQUIRE(ntohl(Ipv4Address::resolve("localhost:1").sin_addr.s_addr) >> 24 == 127);
+    REQUIRE_THROWS_AS(Ipv4Address::resolve("127.0.0.1"), std::invalid_argument);
+    REQUIRE_THROWS_AS(Ipv4Address::resolve("no.such.host.invalid:1"), std::invalid_argument);
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include "gossip.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+/// Many GossipNodes in one process on a simulated network with latency and loss, driven in
+/// virtual time so a thousand of them run in seconds and every run is the same. Node idx
+/// listens on 10.0.0.1:idx+1.
+class GossipNetwork
+{
+public:
+    using Clock = GossipNode::Clock;
+
+    GossipNetwork(size_t count, GossipNode::Config config = {}, double loss = 0., uint64_t seed = 1):
+        loss_(loss),
+        random_(seed),
+        now_(Clock::time_point() + std::chrono::hours(1)),
+        sequence_(0)
+    {
+        endpoints_.reserve(count);
+        for(size_t idx = 0 ; idx < count ; idx++)
+            endpoints_.push_back(std::make_unique<Endpoint>(*this, idx));
+        for(size_t idx = 0 ; idx < count ; idx++)
+            nodes_.push_back(std::make_unique<GossipNode>(idx + 1, address(idx), *endpoints_[idx], config, seed * 7919 + idx));
+    }
+
+    static GossipAddress address(size_t idx) { return {0x0a000001, uint16_t(idx + 1)}; }
+
+    size_t size() const { return nodes_.size(); }
+    GossipNode& node(size_t idx) { return *nodes_[idx]; }
+    Clock::time_point now() const { return now_; }
+    bool up(size_t idx) const { return endpoints_[idx]->up; }
+    /// a node that is down neither sends nor receives
+    void setUp(size_t idx, bool up) { endpoints_[idx]->up = up; }
+    uint64_t datagrams() const { return datagrams_; }
+
+    /// every node joins through node 0, spread over the first periods like a rollout would
+    void joinAll()
+    {
+        for(size_t idx = 1 ; idx < nodes_.size() ; idx++)
+        {
+            nodes_[idx]->join(address(0), now_);
+            if(idx % 10 == 0)
+                advance(std::chrono::milliseconds(5));
+        }
+    }
+
+    void advance(std::chrono::milliseconds duration)
+    {
+        const Clock::time_point until = now_ + duration;
+        while(now_ < until)
+        {
+            now_ += step_;
+            while(!inFlight_.empty() && inFlight_.top().at <= now_)
+            {
+                const Datagram& datagram = inFlight_.top();
+                if(datagram.to < nodes_.size() && endpoints_[datagram.to]->up)
+                    nodes_[datagram.to]->receive(datagram.data.data(), datagram.data.size(), address(datagram.from), now_);
+                inFlight_.pop();
+            }
+            for(size_t idx = 0 ; idx < nodes_.size() ; idx++)
+                if(endpoints_[idx]->up)
+                    nodes_[idx]->tick(now_);
+        }
+    }
+
+    /// advances until check() holds, returns the virtual time it took or -1 past the limit
+    template<typename Check>
+    int64_t until(Check check, std::chrono::milliseconds limit)
+    {
+        const Clock::time_point start = now_;
+        while(!check())
+        {
+            if(now_ - start >= limit)
+                return -1;
+            advance(step_);
+        }
+        return std::chrono::duration_cast<std::chrono::milliseconds>(now_ - start).count();
+    }
+
+private:
+    struct Datagram
+    {
+        Clock::time_point at;
+        uint64_t sequence;
+        size_t from;
+        size_t to;
+        std::string data;
+
+        bool operator>(const Datagram& other) const { return at != other.at ? at > other.at : sequence > other.sequence; }
+    };
+
+    struct Endpoint: GossipTransport
+    {
+        GossipNetwork& network;
+        size_t idx;
+        bool up = true;
+
+        Endpoint(GossipNetwork& network, size_t idx): network(network), idx(idx) {}
+
+        void send(const GossipAddress& to, const char* data, size_t size) override
+        {
+            if(up)
+                network.deliver(idx, to, data, size);
+        }
+    };
+
+    static constexpr std::chrono::milliseconds step_{5};
+
+    double loss_;
+    std::mt19937_64 random_;
+    Clock::time_point now_;
+    uint64_t sequence_;
+    uint64_t datagrams_ = 0;
+    std::vector<std::unique_ptr<Endpoint>> endpoints_;
+    std::vector<std::unique_ptr<GossipNode>> nodes_;
+    std::priority_queue<Datagram, std::vector<Datagram>, std::greater<Datagram>> inFlight_;
+
+    void deliver(size_t from, const GossipAddress& to, const char* data, size_t size)
+    {
+        datagrams_++;
+        if(std::bernoulli_distribution(loss_)(random_))
+            return;
+        // 0.2 to 2ms one way, a datacenter network
+        const auto latency = std::chrono::microseconds(std::uniform_int_distribution<int>(200, 2000)(random_));
+        inFlight_.push({now_ + latency, sequence_++, from, size_t(to.port) - 1, std::string(data, size)});
+    }
+};
@@ -0,0 +1,2056 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "allocationcounter.h"
+#include "assignmentledger.h"
+#include "capturefile.h"
+#include "clustersim.h"
+#include "datagramingest.h"
+#include "historystore.h"
+#include "ingestgovernor.h"
+#include "infoupdateservice.h"
+#include "metricindex.h"
+#include "nodecolumns.h"
+#include "nodestore.h"
+#include "poolindex.h"
+#include "rankindex.h"
+#include "scorefilter.h"
+#include "topologytree.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    mcproto::Stats makeStats(const std::string& hostname, uint32_t cpuLoad, uint32_t ramAvailablePercent)
+    {
+        mcproto::Stats stats;
+        stats.set_hostname(hostname);
+        stats.mutable_cpuload()->set_cpuload(cpuLoad);
+        stats.mutable_meminfo()->set_availablerampercent(ramAvailablePercent);
+        stats.mutable_meminfo()->set_availableswappercent(100);
+        stats.mutable_diskinfo()->set_availablespace(50 * 1000 * 1000);
+        stats.mutable_netinfo()->set_bandwidthusage(1000);
+        return stats;
+    }
+
+    NodeStats randomStats(std::mt19937& random)
+    {
+        NodeStats stats;
+        stats.cpuIdlePercent = std::uniform_real_distribution<float>(0.f, 100.f)(random);
+        stats.ramAvailable = std::uniform_int_distribution<uint64_t>(0, 256 * 1024)(random);
+        stats.ramAvailablePercent = std::uniform_int_distribution<int>(0, 100)(random);
+        stats.swapAvailablePercent = std::uniform_int_distribution<int>(0, 100)(random);
+        stats.diskSpaceAvailable = std::uniform_int_distribution<uint64_t>(0, 2000ull * 1000 * 1000)(random);
+        stats.networkBandwidthUsed = std::uniform_int_distribution<uint32_t>(0, 1000 * 1000 * 1000)(random);
+        stats.pressure = std::uniform_real_distribution<float>(0.f, 10.f)(random);
+        stats.appInFlight = std::uniform_int_distribution<int64_t>(0, 500)(random);
+        return stats;
+    }
+
+    /// ranks a node that joins with its first score, for the tests that are not about the warmup
+    ScoreFilter::Config warm()
+    {
+        ScoreFilter::Config config;
+        config.warmup = 1;
+        return config;
+    }
+}
+
+TEST_CASE("check the reporting interval floor", "[IngestGovernor]")
+{
+    using namespace std::chrono;
+    IngestGovernor governor(1000);
+    const auto start = steady_clock::now();
+
+    SECTION("check the floor follows the fleet size")
+    {
+        REQUIRE(governor.record(10, start) == 10);
+        REQUIRE(governor.record(5000, start) == 5000);
+    }
+
+    SECTION("check a batch counts as all the reports in it")
+    {
+        governor.record(1000, 2999, start);
+        REQUIRE(governor.record(1000, 1, start + milliseconds(1000)) == 3000);
+    }
+
+    SECTION("check the floor is stretched when the measured rate is over the limit")
+    {
+        for(int i = 0 ; i < 3000 ; i++)
+            governor.record(1000, start + milliseconds(i / 3));
+        REQUIRE(governor.record(1000, start + milliseconds(1000)) == 3001);
+        REQUIRE(governor.reportsPerSec() == 3001);
+    }
+
+    SECTION("check no limit means no floor")
+    {
+        IngestGovernor unlimited(0);
+        for(int i = 0 ; i < 3000 ; i++)
+            REQUIRE(unlimited.record(1000, start + milliseconds(i / 3)) == 0);
+        REQUIRE(unlimited.record(1000, start + milliseconds(2000)) == 0);
+        REQUIRE(unlimited.reportsPerSec() > 0);
+    }
+}
+
+TEST_CASE("check the rank index keeps the best slot on top", "[RankIndex]")
+{
+    RankIndex ranking(8);
+    ranking.update(0, 10.f);
+    ranking.update(1, 30.f);
+    ranking.update(2, 20.f);
+    REQUIRE(ranking.best() == 1);
+
+    SECTION("check score changes move the slot both ways")
+    {
+        ranking.update(1, 5.f);
+        REQUIRE(ranking.best() == 2);
+        ranking.update(0, 50.f);
+        REQUIRE(ranking.best() == 0);
+    }
+
+    SECTION("check the top slots come best first")
+    {
+        ranking.update(3, 25.f);
+        std::vector<uint32_t> slots;
+        ranking.top(3, slots);
+        REQUIRE(slots == std::vector<uint32_t>{1, 3, 2});
+        ranking.top(10, slots);
+        REQUIRE(slots.size() == 4);
+    }
+
+    SECTION("check removal")
+    {
+        ranking.remove(1);
+        REQUIRE_FALSE(ranking.contains(1));
+        REQUIRE(ranking.size() == 2);
+        REQUIRE(ranking.best() == 2);
+        ranking.remove(2);
+        ranking.remove(0);
+        REQUIRE(ranking.best() == RankIndex::npos);
+    }
+}
+
+TEST_CASE("check the node store updates records in place", "[NodeStore]")
+{
+    NodeStore store(16, warm());
+    NodeStats idle;
+    idle.cpuIdlePercent = 90.f;
+    idle.ramAvailablePercent = 80;
+    NodeStats busy;
+    busy.cpuIdlePercent = 10.f;
+    busy.ramAvailablePercent = 20;
+
+    const uint32_t first = store.update("node1", idle);
+    const uint32_t second = store.update("node2", busy);
+    REQUIRE(store.size() == 2);
+    REQUIRE(store.best() == first);
+
+    SECTION("check a node keeps its slot")
+    {
+        REQUIRE(store.update("node1", busy) == first);
+        REQUIRE(store.update("node2", idle) == second);
+        REQUIRE(store.size() == 2);
+        REQUIRE(store.best() == second);
+        REQUIRE(store.hostname(second) == "node2");
+        REQUIRE(store.slot("node3") == RankIndex::npos);
+    }
+
+    SECTION("check pressure stalls lower the score")
+    {
+        NodeStats stalled = idle;
+        stalled.pressure = 50.f;
+        REQUIRE(NodeStore::score(stalled) == NodeStore::score(idle) / 2);
+    }
+}
+
+TEST_CASE("check reports are taken in the order of their sequence", "[NodeStore]")
+{
+    NodeStore store(16);
+    NodeStats stats;
+    stats.cpuIdlePercent = 50.f;
+    auto report = [&](uint64_t runId, uint64_t sequence, uint64_t collectedAtMs)
+    {
+        stats.runId = runId;
+        stats.sequence = sequence;
+        stats.collectedAtMs = collectedAtMs;
+        stats.cpuIdlePercent += 1.f;
+        const uint32_t slot = store.update("node1", stats, {}, {}, collectedAtMs + 3);
+        return store.stats(slot).cpuIdlePercent == stats.cpuIdlePercent;
+    };
+
+    REQUIRE(report(7, 1, 1000));
+    REQUIRE_FALSE(report(7, 1, 1000));
+    REQUIRE(store.freshness().duplicates() == 1);
+    REQUIRE(report(7, 3, 3000));
+    REQUIRE_FALSE(report(7, 2, 2000));
+    REQUIRE(store.freshness().reordered() == 1);
+    // the client's clock stepped back within the run
+    REQUIRE(report(7, 4, 500));
+
+    // a restart, whose first sample is late behind the clock of the previous run
+    REQUIRE_FALSE(report(8, 1, 400));
+    REQUIRE(report(8, 1, 5000));
+    // a client that does not count its samples
+    REQUIRE_FALSE(report(0, 0, 4000));
+    REQUIRE(report(0, 0, 6000));
+
+    const uint32_t slot = store.slot("node1");
+    REQUIRE(store.freshness().reordered(slot) == 3);
+    REQUIRE(store.freshness().duplicates(slot) == 1);
+    REQUIRE(store.freshness().latency(slot).count(AgeHistogram::bucket(3)) == 5);
+    REQUIRE(store.freshness().latency().total() == 5);
+    REQUIRE(store.freshness().receivedAtMs(slot) == 6003);
+    REQUIRE(AgeHistogram::bucket(0) == 0);
+    REQUIRE(AgeHistogram::bucket(3) == 2);
+    REQUIRE(AgeHistogram::upperBoundMs(AgeHistogram::bucket(1000)) >= 1000);
+    REQUIRE(AgeHistogram::bucket(~0ull) == AgeHistogram::buckets - 1);
+}
+
+TEST_CASE("check overdue nodes rank lower", "[NodeStore]")
+{
+    NodeStore store(16, warm());
+    NodeStats stats;
+    stats.cpuIdlePercent = 90.f;
+    stats.nextReportMs = 1000;
+    const uint32_t prompt = store.update("prompt", stats, "a", "1", 10000);
+    stats.cpuIdlePercent = 85.f;
+    stats.nextReportMs = 10000;
+    const uint32_t patient = store.update("patient", stats, "a", "1", 10000);
+    const float promptScore = store.ranking().score(prompt);
+
+    // due at 12000, with the grace
+    REQUIRE(store.discountOverdue(12000) == 0);
+    REQUIRE(store.best() == prompt);
+
+    REQUIRE(store.discountOverdue(15000) == 1);
+    REQUIRE(store.freshness(prompt, 15000) == 0.9f);
+    REQUIRE(store.ranking().score(prompt) == promptScore * 0.9f);
+    REQUIRE(store.index().value(prompt, Metric::Score) == double(promptScore * 0.9f));
+    REQUIRE(store.best() == patient);
+    REQUIRE(store.topology().best() == patient);
+
+    REQUIRE(store.discountOverdue(100000) == 2);
+    REQUIRE(store.ranking().score(prompt) == 0.f);
+    REQUIRE(store.ranking().score(patient) == 0.f);
+
+    // a report puts the node back at its full score
+    stats.cpuIdlePercent = 90.f;
+    stats.nextReportMs = 1000;
+    store.update("prompt", stats, "a", "1", 100000);
+    REQUIRE(store.ranking().score(prompt) == promptScore);
+    REQUIRE(store.discountOverdue(100500) == 1);
+    REQUIRE(store.ranking().score(prompt) == promptScore);
+    REQUIRE(store.best() == prompt);
+}
+
+TEST_CASE("check bigger nodes have more headroom at the same load", "[NodeStore]")
+{
+    NodeStore store(16, warm());
+    NodeStats stats;
+    stats.cpuIdlePercent = 50.f;
+    stats.ramAvailablePercent = 50;
+    stats.networkBandwidthUsed = 80 * 1000 * 1000;
+    const uint32_t small = store.update("small", stats, "a", "1");
+    const uint32_t big = store.update("big", stats, "a", "1");
+    const uint32_t plain = store.update("plain", stats, "a", "1");
+    const float plainScore = store.ranking().score(plain);
+    REQUIRE(store.ranking().score(big) == plainScore);
+
+    // without what the node did not tell, the score is as without an inventory
+    REQUIRE(NodeStore::score(stats, NodeStore::capacity(0, 0)) == plainScore);
+    REQUIRE(NodeStore::score(stats, NodeStore::capacity(NodeStore::referenceCores, 100 * 1000 * 1000)) == plainScore);
+
+    store.setCapacity(small, NodeStore::capacity(4, 0));
+    REQUIRE(store.ranking().score(small) == plainScore * 0.5f);
+    // 80MB/s is most of 1GbE but little of 100GbE
+    store.setCapacity(big, NodeStore::capacity(128, 12500ull * 1000 * 1000));
+    REQUIRE(store.ranking().score(big) > 16 * plainScore);
+    REQUIRE(store.best() == big);
+    REQUIRE(store.topology().best() == big);
+    REQUIRE(store.index().value(big, Metric::Score) == double(store.ranking().score(big)));
+
+    // the capacity stays with the node over its reports
+    stats.cpuIdlePercent = 25.f;
+    store.update("big", stats, "a", "1");
+    REQUIRE(store.ranking().score(big) == NodeStore::score(stats, store.columns().capacity(big)));
+    REQUIRE(store.best() == big);
+}
+
+TEST_CASE("check spikes are filtered out and small moves held", "[ScoreFilter]")
+{
+    ScoreFilter filter(warm());
+    filter.add(0, 50.f);
+    REQUIRE(filter.update(0, 51.f) == 50.f);
+    REQUIRE(filter.update(0, 49.f) == 50.f);
+    REQUIRE(filter.update(0, 50.f) == 50.f);
+
+    // one bogus report does not move the node, it counts as an outlier
+    REQUIRE(filter.update(0, 95.f) == 50.f);
+    REQUIRE(filter.filtered(0) == 50.f);
+    REQUIRE(filter.outliers(0) == 1);
+
+    // a lasting change gets through once the window is past its median
+    REQUIRE(filter.update(0, 20.f) == 50.f);
+    REQUIRE(filter.update(0, 20.f) == 20.f);
+    REQUIRE(filter.outliers() == 2);
+
+    // within the band the ranked score holds, a move past it goes through
+    REQUIRE(filter.update(0, 20.5f) == 20.f);
+    REQUIRE(filter.filtered(0) == 20.5f);
+    REQUIRE(filter.update(0, 19.5f) == 20.f);
+    REQUIRE(filter.update(0, 22.f) == 22.f);
+
+    // a new scale starts over
+    filter.reset(0, 400.f);
+    REQUIRE(filter.ranked(0) == 400.f);
+    REQUIRE(filter.update(0, 380.f) == 380.f);
+
+    ScoreFilter::Config config;
+    config.enabled = false;
+    ScoreFilter off(config);
+    off.add(0, 50.f);
+    for(float score : {51.f, 49.f, 50.f, 95.f, 50.5f})
+        REQUIRE(off.update(0, score) == score);
+    REQUIRE(off.outliers() == 0);
+}
+
+TEST_CASE("check a joining node warms up and scores that are not numbers stay out", "[ScoreFilter]")
+{
+    ScoreFilter filter;
+    filter.add(0, 50.f);
+    filter.update(0, 50.f);
+    filter.update(0, 50.f);
+    REQUIRE(filter.ranked(0) == 50.f);
+
+    SECTION("check an outlier on joining does not go to the top")
+    {
+        REQUIRE(filter.add(1, 95.f) == 95.f / 3);
+        REQUIRE(filter.update(1, 40.f) == 40.f * 2 / 3);
+        REQUIRE(filter.update(1, 40.f) == 40.f);
+        REQUIRE(filter.ranked(1) < filter.ranked(0));
+        // once the window is past the first score, the like of it is an outlier
+        REQUIRE(filter.update(1, 40.f) == 40.f);
+        REQUIRE(filter.update(1, 95.f) == 40.f);
+        REQUIRE(filter.outliers(1) == 1);
+
+        // a new scale keeps the node warm, one that is still warming up ranks with its share
+        filter.reset(1, 80.f);
+        REQUIRE(filter.ranked(1) == 80.f);
+        filter.add(2, 60.f);
+        filter.reset(2, 30.f);
+        REQUIRE(filter.ranked(2) == 10.f);
+    }
+
+    SECTION("check scores that are not numbers do not enter the window")
+    {
+        for(float score : {std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()})
+            REQUIRE(filter.update(0, score) == 50.f);
+        REQUIRE(filter.outliers(0) == 3);
+        REQUIRE(filter.filtered(0) == 50.f);
+        REQUIRE(filter.update(0, 50.5f) == 50.f);
+        REQUIRE(filter.update(0, 95.f) == 50.f);
+        REQUIRE(filter.outliers(0) == 4);
+
+        REQUIRE(filter.add(1, std::numeric_limits<float>::quiet_NaN()) == 0.f);
+        REQUIRE(filter.filtered(1) == 0.f);
+
+        ScoreFilter::Config config;
+        config.enabled = false;
+        ScoreFilter off(config);
+        off.add(0, 50.f);
+        REQUIRE(off.update(0, std::numeric_limits<float>::quiet_NaN()) == 50.f);
+        REQUIRE(off.outliers() == 1);
+    }
+}
+
+TEST_CASE("check a joining node does not go to the top with one outlier", "[NodeStore]")
+{
+    NodeStore store(16);
+    NodeStats steady;
+    steady.cpuIdlePercent = 60.f;
+    steady.ramAvailablePercent = 60;
+    for(int idx = 0 ; idx < 3 ; idx++)
+        store.update("steady", steady);
+
+    NodeStats spike = steady;
+    spike.cpuIdlePercent = 100.f;
+    spike.ramAvailablePercent = 100;
+    const uint32_t joined = store.update("joined", spike);
+    REQUIRE(store.best() == store.slot("steady"));
+    REQUIRE(store.topology().best() == store.slot("steady"));
+    store.update("joined", steady);
+    store.update("joined", steady);
+    REQUIRE(store.ranking().score(joined) == store.ranking().score(store.slot("steady")));
+}
+
+TEST_CASE("check noisy reports do not flap the ranking", "[NodeStore]")
+{
+    NodeStore store(16);
+    NodeStats stats;
+    stats.ramAvailablePercent = 50;
+    stats.cpuIdlePercent = 60.f;
+    const uint32_t first = store.update("first", stats, "a", "1");
+    stats.cpuIdlePercent = 58.f;
+    const uint32_t second = store.update("second", stats, "a", "1");
+    for(int idx = 0 ; idx < 5 ; idx++)
+    {
+        stats.cpuIdlePercent = 60.f;
+        store.update("first", stats, "a", "1");
+        stats.cpuIdlePercent = 58.f;
+        store.update("second", stats, "a", "1");
+    }
+    REQUIRE(store.best() == first);
+
+    // the runner-up reads idle for one tick
+    stats.cpuIdlePercent = 100.f;
+    store.update("second", stats, "a", "1");
+    REQUIRE(store.best() == first);
+    REQUIRE(store.topology().best() == first);
+    REQUIRE(store.filter().outliers(second) == 1);
+    // the raw stats are kept for the constraints as they came
+    REQUIRE(store.stats(second).cpuIdlePercent == 100.f);
+
+    // jitter of a few tenths either way leaves the order alone
+    stats.cpuIdlePercent = 60.f;
+    const float firstScore = NodeStore::score(stats);
+    for(int idx = 0 ; idx < 10 ; idx++)
+    {
+        stats.cpuIdlePercent = idx % 2 ? 59.5f : 60.5f;
+        store.update("first", stats, "a", "1");
+        stats.cpuIdlePercent = idx % 2 ? 59.f : 59.8f;
+        store.update("second", stats, "a", "1");
+        REQUIRE(store.best() == first);
+    }
+    REQUIRE(store.ranking().score(first) == firstScore);
+
+    // a lasting change swaps them
+    for(int idx = 0 ; idx < 3 ; idx++)
+    {
+        stats.cpuIdlePercent = 10.f;
+        store.update("first", stats, "a", "1");
+    }
+    REQUIRE(store.best() == second);
+}
+
+TEST_CASE("check the columns score nodes as the store does", "[NodeColumns]")
+{
+    std::mt19937 random(41);
+    NodeColumns columns;
+    // values past the disk and bandwidth caps and out of range pressures
+    for(int idx = 0 ; idx < 1003 ; idx++)
+    {
+        NodeStats stats;
+        stats.cpuIdlePercent = std::uniform_real_distribution<float>(0.f, 100.f)(random);
+        stats.ramAvailablePercent = std::uniform_int_distribution<int>(0, 100)(random);
+        stats.swapAvailablePercent = std::uniform_int_distribution<int>(0, 100)(random);
+        stats.diskSpaceAvailable = idx % 7 ? std::uniform_int_distribution<uint64_t>(0, 200ull * 1000 * 1000)(random) : ~0ull - idx;
+        stats.networkBandwidthUsed = idx % 5 ? std::uniform_int_distribution<uint32_t>(0, 200u * 1000 * 1000)(random) : ~0u - idx;
+        stats.pressure = std::uniform_real_distribution<float>(-10.f, 110.f)(random);
+        stats.collectedAtMs = idx;
+        REQUIRE(columns.add(stats) == uint32_t(idx));
+        REQUIRE(columns.score(idx) == NodeStore::score(stats));
+        // some with their hardware weighed in, the others as without an inventory
+        if(idx % 3 == 1)
+        {
+            const NodeCapacity capacity = NodeStore::capacity(std::uniform_int_distribution<uint32_t>(1, 256)(random),
+                                                              std::uniform_int_distribution<uint64_t>(1000 * 1000, 12500ull * 1000 * 1000)(random));
+            columns.setCapacity(idx, capacity);
+            REQUIRE(columns.score(idx) == NodeStore::score(stats, capacity));
+        }
+    }
+
+    NodeStats stats = columns.get(17);
+    stats.cpuIdlePercent = 100.f;
+    columns.set(17, stats);
+    REQUIRE(columns.get(17).cpuIdlePercent == 100.f);
+    REQUIRE(columns.get(17).collectedAtMs == 17);
+}
+
+TEST_CASE("check constrained queries match a full scan", "[MetricIndex]")
+{
+    std::mt19937 random(38);
+    MetricIndex index(16);
+    std::vector<NodeStats> nodes;
+    for(uint32_t slot = 0 ; slot < 3000 ; slot++)
+    {
+        nodes.push_back(randomStats(random));
+        index.update(slot, nodes.back(), NodeStore::score(nodes.back()));
+    }
+    // moves most slots to other buckets
+    for(int idx = 0 ; idx < 3000 ; idx++)
+    {
+        const uint32_t slot = random() % nodes.size();
+        nodes[slot] = randomStats(random);
+        index.update(slot, nodes[slot], NodeStore::score(nodes[slot]));
+    }
+    REQUIRE(index.size() == 3000);
+
+    auto scan = [&](const MetricIndex::Query& query)
+    {
+        std::vector<MetricIndex::Match> all;
+        for(uint32_t slot = 0 ; slot < nodes.size() ; slot++)
+        {
+            const float score = NodeStore::score(nodes[slot]);
+            bool meets = true;
+            for(const MetricIndex::Constraint& constraint : query.constraints)
+            {
+                const double value = MetricIndex::value(nodes[slot], score, constraint.metric);
+                meets &= value >= constraint.min && value <= constraint.max;
+            }
+            if(meets)
+                all.push_back({slot, MetricIndex::value(nodes[slot], score, query.objective)});
+        }
+        std::sort(all.begin(), all.end(), [&](const MetricIndex::Match& lhs, const MetricIndex::Match& rhs) {
+            if(lhs.value != rhs.value)
+                return query.ascending ? lhs.value < rhs.value : lhs.value > rhs.value;
+            return lhs.slot < rhs.slot;
+        });
+        all.resize(std::min(all.size(), query.limit));
+        return all;
+    };
+
+    SECTION("check the example of the request")
+    {
+        // 8GB ram and 50GB disk free, the lowest cpu load among those
+        MetricIndex::Query query;
+        query.constraints = {{Metric::RamAvailableMb, 8192.}, {Metric::DiskAvailableKb, 50. * 1000 * 1000}};
+        query.objective = Metric::CpuIdlePercent;
+        std::vector<MetricIndex::Match> matches;
+        index.query(query, matches);
+
+        const std::vector<MetricIndex::Match> expected = scan(query);
+        REQUIRE(matches.size() == 10);
+        for(size_t idx = 0 ; idx < expected.size() ; idx++)
+        {
+            REQUIRE(matches[idx].slot == expected[idx].slot);
+            REQUIRE(nodes[matches[idx].slot].ramAvailable >= 8192);
+        }
+    }
+
+    SECTION("check random constraint mixes")
+    {
+        std::vector<MetricIndex::Match> matches;
+        size_t scanned = 0;
+        for(int round = 0 ; round < 500 ; round++)
+        {
+            MetricIndex::Query query;
+            query.objective = Metric(random() % MetricIndex::metricCount);
+            query.ascending = random() % 2;
+            query.limit = 1 + random() % 20;
+            for(int idx = random() % 4 ; idx > 0 ; idx--)
+            {
+                // bounds taken from random nodes so the ranges are neither all nor nothing
+                MetricIndex::Constraint constraint{Metric(random() % MetricIndex::metricCount)};
+                const double lower = index.value(random() % nodes.size(), constraint.metric);
+                const double upper = index.value(random() % nodes.size(), constraint.metric);
+                if(random() % 3)
+                    constraint.min = std::min(lower, upper);
+                if(random() % 3)
+                    constraint.max = std::max(lower, upper);
+                query.constraints.push_back(constraint);
+            }
+
+            scanned += index.query(query, matches);
+            const std::vector<MetricIndex::Match> expected = scan(query);
+            REQUIRE(matches.size() == expected.size());
+            for(size_t idx = 0 ; idx < expected.size() ; idx++)
+            {
+                REQUIRE(matches[idx].slot == expected[idx].slot);
+                REQUIRE(matches[idx].value == expected[idx].value);
+            }
+        }
+        // the buckets spare most of the full scans
+        REQUIRE(scanned < 500 * nodes.size() / 2);
+    }
+
+    SECTION("check empty ranges")
+    {
+        MetricIndex::Query query;
+        query.constraints = {{Metric::Pressure, 50., 40.}};
+        std::vector<MetricIndex::Match> matches;
+        REQUIRE(index.query(query, matches) == 0);
+        REQUIRE(matches.empty());
+        query.constraints = {{Metric::CpuIdlePercent, 101.}};
+        index.query(query, matches);
+        REQUIRE(matches.empty());
+    }
+}
+
+TEST_CASE("check scores weighted past 100 keep the buckets apart", "[MetricIndex]")
+{
+    // an inventoried fleet, most nodes have more cores than the reference
+    constexpr uint32_t nodes = 1000;
+    MetricIndex index(nodes);
+    NodeStats stats;
+    for(uint32_t slot = 0 ; slot < nodes ; slot++)
+    {
+        stats.cpuIdlePercent = float(slot % 100);
+        index.update(slot, stats, 100.f + slot * 1.5f);
+    }
+
+    MetricIndex::Query query;
+    query.limit = 5;
+    std::vector<MetricIndex::Match> matches;
+    REQUIRE(index.query(query, matches) < 50);
+    REQUIRE(matches.size() == 5);
+    REQUIRE(matches[0].slot == nodes - 1);
+    REQUIRE(matches[4].slot == nodes - 5);
+
+    // a bound on the score rules out most of the fleet without a look at it
+    query.objective = Metric::CpuIdlePercent;
+    query.constraints = {{Metric::Score, 1500.}};
+    REQUIRE(index.query(query, matches) < 200);
+    REQUIRE(matches.size() == 5);
+    for(const MetricIndex::Match& match : matches)
+        REQUIRE(index.value(match.slot, Metric::Score) >= 1500.);
+}
+
+TEST_CASE("check selection descends the topology", "[TopologyTree]")
+{
+    TopologyTree tree(16);
+    REQUIRE(tree.best() == RankIndex::npos);
+
+    // slot = zone * 100 + rack * 10 + node, scores all different
+    std::vector<float> scores(300, 0.f);
+    std::mt19937 random(39);
+    for(uint32_t zone = 0 ; zone < 3 ; zone++)
+        for(uint32_t rack = 0 ; rack < 4 ; rack++)
+            for(uint32_t node = 0 ; node < 5 ; node++)
+            {
+                const uint32_t slot = zone * 100 + rack * 10 + node;
+                scores[slot] = std::uniform_real_distribution<float>(0.f, 100.f)(random);
+                tree.update(slot, "z" + std::to_string(zone), "r" + std::to_string(rack), scores[slot]);
+            }
+    auto zoneOf = [](uint32_t slot) { return slot / 100; };
+    auto rackOf = [](uint32_t slot) { return slot / 10; };
+    auto bestOf = [&](auto within) {
+        uint32_t best = RankIndex::npos;
+        for(uint32_t slot = 0 ; slot < scores.size() ; slot++)
+            if(slot % 10 < 5 && slot % 100 < 40 && within(slot) && (best == RankIndex::npos || scores[slot] > scores[best]))
+                best = slot;
+        return best;
+    };
+
+    REQUIRE(tree.zoneCount() == 3);
+    REQUIRE(tree.rackCount() == 12);
+    REQUIRE(tree.zone(123) == "z1");
+    REQUIRE(tree.rack(123) == "r2");
+    std::vector<uint32_t> slots;
+
+    SECTION("check the best node is found walking down")
+    {
+        REQUIRE(tree.best() == bestOf([](uint32_t){ return true; }));
+        // the best node gets worse, the aggregates above it follow
+        const uint32_t previous = tree.best();
+        scores[previous] = -1.f;
+        tree.update(previous, tree.zone(previous), tree.rack(previous), -1.f);
+        REQUIRE(tree.best() == bestOf([](uint32_t){ return true; }));
+        REQUIRE(tree.best() != previous);
+    }
+
+    SECTION("check nearby nodes come first")
+    {
+        tree.nearest("z1", "r2", 3, slots);
+        REQUIRE(slots.size() == 3);
+        for(uint32_t slot : slots)
+            REQUIRE(rackOf(slot) == 12);
+
+        // five in the rack, the next three are the best of the rest of the zone
+        tree.nearest("z1", "r2", 8, slots);
+        REQUIRE(slots.size() == 8);
+        REQUIRE(rackOf(slots[4]) == 12);
+        REQUIRE(zoneOf(slots[5]) == 1);
+        REQUIRE(rackOf(slots[5]) != 12);
+        REQUIRE(slots[5] == bestOf([&](uint32_t slot){ return zoneOf(slot) == 1 && rackOf(slot) != 12; }));
+
+        // all of the zone, then the best of the others
+        tree.nearest("z1", "r2", 22, slots);
+        REQUIRE(slots.size() == 22);
+        REQUIRE(zoneOf(slots[19]) == 1);
+        REQUIRE(slots[20] == bestOf([&](uint32_t slot){ return zoneOf(slot) != 1; }));
+
+        // unknown labels fall back to the best anywhere
+        tree.nearest("z9", "r2", 1, slots);
+        REQUIRE(slots == std::vector<uint32_t>{tree.best()});
+    }
+
+    SECTION("check replicas are spread over failure domains")
+    {
+        tree.spread(3, slots);
+        REQUIRE(slots.size() == 3);
+        REQUIRE(zoneOf(slots[0]) != zoneOf(slots[1]));
+        REQUIRE(zoneOf(slots[1]) != zoneOf(slots[2]));
+        REQUIRE(zoneOf(slots[0]) != zoneOf(slots[2]));
+
+        tree.spread(12, slots);
+        std::vector<uint32_t> racks;
+        for(uint32_t slot : slots)
+            racks.push_back(rackOf(slot));
+        std::sort(racks.begin(), racks.end());
+        REQUIRE(std::unique(racks.begin(), racks.end()) == racks.end());
+
+        tree.spread(100, slots);
+        REQUIRE(slots.size() == 60);
+    }
+
+    SECTION("check a node moving rack takes its load along")
+    {
+        const TopologyTree::Load before = tree.rackLoad("z0", "r0");
+        REQUIRE(before.nodes == 5);
+        tree.update(3, "z2", "r9", 150.f);
+        REQUIRE(tree.rackLoad("z0", "r0").nodes == 4);
+        REQUIRE(tree.rackLoad("z2", "r9").nodes == 1);
+        REQUIRE(tree.zoneLoad("z2").nodes == 21);
+        REQUIRE(tree.zoneLoad("z2").bestScore == 150.f);
+        REQUIRE(tree.best() == 3);
+        REQUIRE(tree.zone(3) == "z2");
+        tree.nearest("z0", "r0", 5, slots);
+        REQUIRE(rackOf(slots[3]) == 0);
+        REQUIRE(rackOf(slots[4]) != 0);
+        REQUIRE(tree.zoneLoad("nowhere").nodes == 0);
+    }
+}
+
+TEST_CASE("check assignments count against nodes in every scope", "[TopologyTree]")
+{
+    AssignmentLedger ledger;
+    TopologyTree tree(16, &ledger);
+
+    // slot = zone * 100 + rack * 10 + node, scores within a few assignments of each other
+    std::vector<float> scores(300, 0.f);
+    std::mt19937 random(40);
+    for(uint32_t slot = 0 ; slot < scores.size() ; slot++)
+        ledger.add(slot);
+    std::vector<uint32_t> nodes;
+    for(uint32_t zone = 0 ; zone < 3 ; zone++)
+        for(uint32_t rack = 0 ; rack < 5 ; rack++)
+            for(uint32_t node = 0 ; node < 4 ; node++)
+            {
+                const uint32_t slot = zone * 100 + rack * 10 + node;
+                scores[slot] = std::uniform_real_distribution<float>(50.f, 60.f)(random);
+                tree.update(slot, "z" + std::to_string(zone), "r" + std::to_string(rack), scores[slot]);
+                nodes.push_back(slot);
+            }
+    auto adjusted = [&](uint32_t slot) { return scores[slot] - ledger.penalty(slot); };
+    auto best = [&](size_t count, auto within) {
+        std::vector<uint32_t> sorted;
+        for(uint32_t slot : nodes)
+            if(within(slot))
+                sorted.push_back(slot);
+        std::sort(sorted.begin(), sorted.end(), [&](uint32_t l, uint32_t r) { return adjusted(l) != adjusted(r) ? adjusted(l) > adjusted(r) : l < r; });
+        sorted.resize(std::min(count, sorted.size()));
+        return sorted;
+    };
+    auto anywhere = [](uint32_t) { return true; };
+
+    std::vector<uint32_t> slots;
+    for(int round = 0 ; round < 200 ; round++)
+    {
+        REQUIRE(tree.best() == best(1, anywhere).front());
+        tree.nearest("", "", 5, slots);
+        REQUIRE(slots == best(5, anywhere));
+        // the own rack first, then the best of the rest of the zone
+        tree.nearest("z1", "r2", 6, slots);
+        REQUIRE(std::vector<uint32_t>(slots.begin(), slots.begin() + 4) == best(4, [](uint32_t slot) { return slot / 10 == 12; }));
+        REQUIRE(std::vector<uint32_t>(slots.begin() + 4, slots.end()) == best(2, [](uint32_t slot) { return slot / 100 == 1 && slot / 10 != 12; }));
+        tree.spread(3, slots);
+        for(uint32_t zone = 0 ; zone < 3 ; zone++)
+            REQUIRE(std::find(slots.begin(), slots.end(), best(1, [zone](uint32_t slot) { return slot / 100 == zone; }).front()) != slots.end());
+
+        // the best node is handed out, now and then one reports
+        ledger.assign(tree.best());
+        const uint32_t reporting = nodes[random() % nodes.size()];
+        ledger.report(reporting, scores[reporting], scores[reporting]);
+    }
+}
+
+TEST_CASE("check pools rank their members on their own", "[PoolIndex]")
+{
+    // nodes in up to four of 50 pools, picks within a pool against a scan of its members
+    std::mt19937 random(50);
+    constexpr uint32_t nodes = 2000;
+    constexpr uint32_t poolCount = 50;
+    std::vector<std::string> names;
+    for(uint32_t pool = 0 ; pool < poolCount ; pool++)
+        names.push_back("service" + std::to_string(pool));
+
+    NodeStore store(nodes);
+    std::vector<std::vector<std::string_view>> memberships(nodes);
+    auto report = [&](uint32_t node)
+    {
+        NodeStats stats;
+        stats.cpuIdlePercent = std::uniform_real_distribution<float>(0.f, 100.f)(random);
+        const uint32_t slot = store.update("node" + std::to_string(node), stats);
+        store.setPools(slot, memberships[node].data(), memberships[node].size());
+        return slot;
+    };
+    auto reassign = [&](uint32_t node)
+    {
+        memberships[node].clear();
+        for(uint32_t count = random() % 5 ; count ; count--)
+        {
+            std::string_view name = names[random() % poolCount];
+            if(std::find(memberships[node].begin(), memberships[node].end(), name) == memberships[node].end())
+                memberships[node].push_back(name);
+        }
+    };
+    for(uint32_t node = 0 ; node < nodes ; node++)
+    {
+        reassign(node);
+        REQUIRE(report(node) == node);
+    }
+    // new scores for all, new pools for some
+    for(int round = 0 ; round < 3 ; round++)
+    {
+        for(uint32_t node = 0 ; node < nodes ; node++)
+        {
+            if(random() % 10 == 0)
+                reassign(node);
+            report(node);
+        }
+    }
+
+    REQUIRE(store.pools().poolCount() == poolCount);
+    std::vector<uint32_t> slots;
+    std::vector<std::string_view> pools;
+    for(const std::string& name : names)
+    {
+        std::vector<std::pair<float, uint32_t>> expected;
+        for(uint32_t node = 0 ; node < nodes ; node++)
+            if(std::find(memberships[node].begin(), memberships[node].end(), name) != memberships[node].end())
+                expected.emplace_back(-store.ranking().score(node), node);
+        std::sort(expected.begin(), expected.end());
+        REQUIRE(store.pools().members(name) == expected.size());
+
+        store.pools().top(name, 10, slots);
+        REQUIRE(slots.size() == std::min<size_t>(10, expected.size()));
+        for(size_t idx = 0 ; idx < slots.size() ; idx++)
+            REQUIRE(store.ranking().score(slots[idx]) == -expected[idx].first);
+        if(!expected.empty())
+            REQUIRE(store.pools().best(name) == slots.front());
+    }
+    for(uint32_t node = 0 ; node < nodes ; node++)
+    {
+        store.pools().pools(node, pools);
+        REQUIRE(pools == memberships[node]);
+    }
+
+    REQUIRE(store.pools().members("unknown") == 0);
+    REQUIRE(store.pools().best("unknown") == RankIndex::npos);
+    store.pools().top("unknown", 10, slots);
+    REQUIRE(slots.empty());
+
+    // picks spread over the members of a pool as the global ones do
+    const uint32_t best = store.pools().best("service7");
+    store.assigned(best);
+    store.assigned(best);
+    store.assigned(best);
+    store.pools().top("service7", 2, slots);
+    REQUIRE(store.ranking().score(slots[0]) - store.ledger().penalty(slots[0]) >= store.ranking().score(slots[1]) - store.ledger().penalty(slots[1]));
+}
+
+TEST_CASE("check pools named twice and pools left empty", "[PoolIndex]")
+{
+    PoolIndex index(16);
+    auto join = [&](uint32_t slot, std::vector<std::string_view> names, float score)
+    {
+        index.join(slot, names.data(), names.size(), score);
+    };
+    auto pools = [&](uint32_t slot)
+    {
+        std::vector<std::string_view> names;
+        index.pools(slot, names);
+        return names;
+    };
+
+    join(0, {"b", "a", "b"}, 10.f);
+    REQUIRE(pools(0) == std::vector<std::string_view>{"b", "a"});
+    REQUIRE(index.members("b") == 1);
+    // the same pools in another order and named again keep the memberships as they are
+    join(0, {"a", "b", "a"}, 20.f);
+    REQUIRE(pools(0) == std::vector<std::string_view>{"b", "a"});
+    join(0, {"a"}, 20.f);
+    REQUIRE(pools(0) == std::vector<std::string_view>{"a"});
+
+    // the pools the last member leaves are dropped, the ones after them keep their members
+    join(1, {"c", "d"}, 30.f);
+    join(2, {"e", "a"}, 40.f);
+    join(3, {"e"}, 50.f);
+    REQUIRE(index.poolCount() == 4);
+    join(1, {"e"}, 60.f);
+    REQUIRE(index.poolCount() == 2);
+    REQUIRE(index.members("b") == 0);
+    REQUIRE(index.members("c") == 0);
+    REQUIRE(index.members("d") == 0);
+    REQUIRE(index.best("c") == RankIndex::npos);
+    REQUIRE(index.members("e") == 3);
+    REQUIRE(index.best("e") == 1);
+    REQUIRE(index.best("a") == 2);
+    REQUIRE(pools(2) == std::vector<std::string_view>{"e", "a"});
+    std::vector<uint32_t> slots;
+    index.top("e", 3, slots);
+    REQUIRE(slots == std::vector<uint32_t>{1, 3, 2});
+    index.update(2, 70.f);
+    REQUIRE(index.best("e") == 2);
+    REQUIRE(index.best("a") == 2);
+
+    // a dropped pool is created again when a node names it
+    join(3, {"c"}, 50.f);
+    REQUIRE(index.poolCount() == 3);
+    REQUIRE(index.best("c") == 3);
+    join(0, {}, 20.f);
+    join(2, {}, 70.f);
+    REQUIRE(index.poolCount() == 2);
+    REQUIRE(index.members("a") == 0);
+    REQUIRE(index.best("e") == 1);
+}
+
+TEST_CASE("check assignments count against a node until it reports", "[AssignmentLedger]")
+{
+    NodeStore store(16, warm());
+    NodeStats stats;
+    stats.cpuIdlePercent = 80.f;
+    stats.ramAvailablePercent = 80;
+    for(int idx = 0 ; idx < 10 ; idx++)
+        store.update("node" + std::to_string(idx), stats);
+
+    SECTION("check equally good nodes take turns")
+    {
+        std::vector<int> assigned(10, 0);
+        for(int idx = 0 ; idx < 50 ; idx++)
+            assigned[store.assign()]++;
+        REQUIRE(std::count(assigned.begin(), assigned.end(), 5) == 10);
+        REQUIRE(store.ledger().pending(0) == 5.f);
+    }
+
+    SECTION("check a better node takes more until the penalty evens it out")
+    {
+        NodeStats better = stats;
+        better.cpuIdlePercent = 100.f;
+        const uint32_t slot = store.update("node3", better);
+        const float lead = NodeStore::score(better) - NodeStore::score(stats);
+        for(int idx = 0 ; idx < 5 ; idx++)
+            REQUIRE(store.assign() == slot);
+        REQUIRE(store.ledger().penalty(slot) == 5 * store.ledger().cost());
+        REQUIRE(lead / store.ledger().cost() < 5);
+        REQUIRE(store.best() != slot);
+    }
+
+    SECTION("check reports decay the pending assignments and teach their cost")
+    {
+        const float initialCost = store.ledger().cost();
+        for(int idx = 0 ; idx < 10 ; idx++)
+            store.assigned(0);
+        // ten assignments took 30 points off, more than the cost assumed
+        NodeStats loaded = stats;
+        loaded.cpuIdlePercent = 80.f - 30.f / 0.4f;
+        store.update("node0", loaded);
+        REQUIRE(store.ledger().pending(0) == 5.f);
+        REQUIRE(store.ledger().cost() > initialCost);
+
+        store.update("node0", loaded);
+        REQUIRE(store.ledger().pending(0) == 2.5f);
+    }
+}
+
+TEST_CASE("check the history store gives back what went in", "[HistoryStore]")
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / ("mclear-history-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+    // small enough for many blocks over several segments
+    HistoryStore::Config config;
+    config.segmentBytes = 32 * 1024;
+    config.blockBytes = 512;
+
+    // jittered reports with a long outage, a random walk, repeats and noise
+    struct Sample
+    {
+        uint64_t timestampMs;
+        std::array<double, HistoryStore::metricCount> values;
+    };
+    std::mt19937 random(42);
+    std::vector<std::vector<Sample>> nodes(3);
+    for(auto& samples : nodes)
+    {
+        uint64_t timestampMs = 1700000000000ull;
+        std::array<double, HistoryStore::metricCount> values{};
+        for(int idx = 0 ; idx < 1500 ; idx++)
+        {
+            timestampMs += idx == 700 ? 40ull * 24 * 3600 * 1000 : 1000 + random() % 40 - 20;
+            values[0] = std::uniform_real_distribution<double>(0., 100.)(random);
+            values[1] = std::clamp(values[1] + std::uniform_real_distribution<double>(-2., 2.)(random), 0., 100.);
+            values[2] = 16384 - idx / 100;
+            values[7] = idx % 10 ? 0. : 1.5;
+            values[8] = random() % 3;
+            samples.push_back({timestampMs, values});
+        }
+    }
+
+    auto check = [&](const HistoryStore& history)
+    {
+        std::vector<HistoryStore::Point> points;
+        for(size_t node = 0 ; node < nodes.size() ; node++)
+        {
+            const std::string hostname = "node" + std::to_string(node);
+            const std::vector<Sample>& samples = nodes[node];
+            for(size_t metric = 0 ; metric < HistoryStore::metricCount ; metric++)
+            {
+                REQUIRE(history.query(hostname, Metric(metric), 0, ~0ull, 0, points));
+                REQUIRE(points.size() == samples.size());
+                for(size_t idx = 0 ; idx < samples.size() ; idx++)
+                {
+                    REQUIRE(points[idx].timestampMs == samples[idx].timestampMs);
+                    REQUIRE(points[idx].value == samples[idx].values[metric]);
+                }
+            }
+
+            const uint64_t fromMs = samples[100].timestampMs;
+            const uint64_t toMs = samples[1200].timestampMs;
+            REQUIRE(history.query(hostname, Metric::CpuIdlePercent, fromMs, toMs, 0, points));
+            REQUIRE(points.size() == 1101);
+            REQUIRE(points.front().timestampMs == fromMs);
+
+            // one minute steps
+            REQUIRE(history.query(hostname, Metric::CpuIdlePercent, fromMs, toMs, 60000, points));
+            size_t counted = 0;
+            for(const HistoryStore::Point& point : points)
+            {
+                double sum = 0., min = 1e9, max = -1e9;
+                uint32_t count = 0;
+                for(const Sample& sample : samples)
+                {
+                    if(sample.timestampMs < point.timestampMs || sample.timestampMs >= point.timestampMs + 60000 || sample.timestampMs > toMs)
+                        continue;
+                    sum += sample.values[1];
+                    min = std::min(min, sample.values[1]);
+                    max = std::max(max, sample.values[1]);
+                    count++;
+                }
+                REQUIRE(point.count == count);
+                REQUIRE(point.value == sum / count);
+                REQUIRE(point.min == min);
+                REQUIRE(point.max == max);
+                counted += count;
+            }
+            REQUIRE(counted == 1101);
+
+            REQUIRE_FALSE(history.query(hostname, Metric::Score, 0, ~0ull, 0, points, 10));
+            REQUIRE(points.size() == 10);
+        }
+        REQUIRE(history.query("node9", Metric::Score, 0, ~0ull, 0, points));
+        REQUIRE(points.empty());
+    };
+
+    {
+        HistoryStore history(directory.string(), config);
+        for(size_t idx = 0 ; idx < 1500 ; idx++)
+            for(size_t node = 0 ; node < nodes.size() ; node++)
+                REQUIRE(history.append("node" + std::to_string(node), nodes[node][idx].timestampMs, nodes[node][idx].values));
+        REQUIRE_FALSE(history.append("node0", nodes[0].back().timestampMs, nodes[0].back().values));
+        REQUIRE(history.samples() == 4500);
+        REQUIRE(history.sealedBytes() > 64 * 1024);
+        // about 20 bytes for the 9 metrics of a sample
+        REQUIRE(history.sealedBytes() + history.openBytes() < 4500 * 30);
+        check(history);
+    }
+
+    SECTION("check a reopened history has every sample")
+    {
+        HistoryStore history(directory.string(), config);
+        REQUIRE(history.samples() == 4500);
+        REQUIRE(history.openBytes() == 0);
+        check(history);
+        REQUIRE_FALSE(history.append("node1", nodes[1].back().timestampMs, nodes[1].back().values));
+        REQUIRE(history.append("node1", nodes[1].back().timestampMs + 1000, nodes[1].back().values));
+    }
+
+    SECTION("check a damaged block cuts its segment short")
+    {
+        {
+            std::fstream segment(directory / "history-0.seg", std::ios::in | std::ios::out | std::ios::binary);
+            segment.seekp(200);
+            segment.put('x');
+        }
+        HistoryStore history(directory.string(), config);
+        REQUIRE(history.samples() < 4500);
+        std::vector<HistoryStore::Point> points;
+        REQUIRE(history.query("node2", Metric::CpuIdlePercent, 0, ~0ull, 0, points));
+        REQUIRE(!points.empty());
+        REQUIRE(points.back().timestampMs == nodes[2].back().timestampMs);
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("check late samples fill the gap they left", "[HistoryStore]")
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / ("mclear-late-history-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+    HistoryStore::Config config;
+    config.segmentBytes = 32 * 1024;
+    config.blockBytes = 512;
+
+    auto values = [](uint64_t timestampMs)
+    {
+        std::array<double, HistoryStore::metricCount> values{};
+        values.fill(double(timestampMs % 977));
+        return values;
+    };
+    auto timestamps = [](const HistoryStore& history, std::string_view hostname, uint64_t fromMs = 0, uint64_t toMs = ~0ull)
+    {
+        std::vector<HistoryStore::Point> points;
+        REQUIRE(history.query(hostname, Metric::Score, fromMs, toMs, 0, points));
+        std::vector<uint64_t> timestamps;
+        for(const HistoryStore::Point& point : points)
+        {
+            REQUIRE(point.value == double(point.timestampMs % 977));
+            timestamps.push_back(point.timestampMs);
+        }
+        return timestamps;
+    };
+
+    std::vector<uint64_t> expected;
+    {
+        HistoryStore history(directory.string(), config);
+        // the live report goes out before the spooled ones after an outage
+        REQUIRE(history.append("node0", 1000, values(1000)));
+        REQUIRE(history.append("node0", 10000, values(10000)));
+        for(uint64_t timestampMs = 2000 ; timestampMs <= 5000 ; timestampMs += 1000)
+            REQUIRE(history.append("node0", timestampMs, values(timestampMs)));
+        REQUIRE(timestamps(history, "node0") == std::vector<uint64_t>{1000, 2000, 3000, 4000, 5000, 10000});
+        REQUIRE(timestamps(history, "node0", 2500, 9000) == std::vector<uint64_t>{3000, 4000, 5000});
+
+        // outages of a node reporting every second, each replayed in batches behind the live
+        // reports that went out in the meantime, one batch delivered twice
+        uint64_t liveMs = 1000000;
+        for(int outage = 0 ; outage < 20 ; outage++)
+        {
+            const uint64_t downMs = liveMs;
+            liveMs += 300 * 1000;
+            for(uint64_t timestampMs = downMs + 1000 ; timestampMs < liveMs ; timestampMs += 1000)
+                expected.push_back(timestampMs);
+            REQUIRE(history.append("node1", downMs, values(downMs)));
+            expected.push_back(downMs);
+            for(uint64_t batchMs = downMs + 1000 ; batchMs < liveMs ; batchMs += 50 * 1000)
+            {
+                const uint64_t reportMs = liveMs + (batchMs - downMs) / 50;
+                REQUIRE(history.append("node1", reportMs, values(reportMs)));
+                expected.push_back(reportMs);
+                for(int repeat = 0 ; repeat < (batchMs == downMs + 1000 ? 2 : 1) ; repeat++)
+                    for(uint64_t timestampMs = batchMs ; timestampMs < std::min(batchMs + 50 * 1000, liveMs) ; timestampMs += 1000)
+                        REQUIRE(history.append("node1", timestampMs, values(timestampMs)));
+            }
+            liveMs += 10 * 1000;
+        }
+        std::sort(expected.begin(), expected.end());
+        REQUIRE(timestamps(history, "node1") == expected);
+    }
+
+    // the late blocks are sealed among the others
+    HistoryStore history(directory.string(), config);
+    REQUIRE(history.openBytes() == 0);
+    REQUIRE(timestamps(history, "node0") == std::vector<uint64_t>{1000, 2000, 3000, 4000, 5000, 10000});
+    REQUIRE(timestamps(history, "node1") == expected);
+    REQUIRE(timestamps(history, "node1", expected[1000], expected[2000]) == std::vector<uint64_t>(expected.begin() + 1000, expected.begin() + 2001));
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("check the ingest path does not allocate", "[InfoUpdateService]")
+{
+    InfoUpdateService service(false, 20000, 16);
+    ArenaMessageAllocator<mcproto::Stats, mcproto::StatsReply> allocator(2);
+    const mcproto::Stats reports[] = {makeStats("node1", 1000, 80), makeStats("node2", 5000, 40)};
+
+    // one report per call as gRPC hands it over, parsed into the call's arena
+    auto call = [&](const mcproto::Stats& report)
+    {
+        grpc::MessageHolder<mcproto::Stats, mcproto::StatsReply>* holder = allocator.AllocateMessages();
+        holder->request()->CopyFrom(report);
+        service.ingest(*holder->request(), *holder->response());
+        holder->Release();
+    };
+
+    // the first report of a node interns its hostname, the ones after it warm the node up
+    for(int idx = 0 ; idx < ScoreFilter::Config{}.warmup ; idx++)
+        for(const mcproto::Stats& report : reports)
+            call(report);
+
+    const uint64_t before = AllocationCounter::allocations();
+    for(int i = 0 ; i < 100 ; i++)
+        call(reports[i % 2]);
+    const uint64_t after = AllocationCounter::allocations();
+
+    REQUIRE(after == before);
+    REQUIRE(allocator.pooled() == 2);
+    std::lock_guard<std::shared_mutex> guard(service.lock());
+    REQUIRE(service.store().size() == 2);
+    REQUIRE(service.store().hostname(service.store().best()) == "node1");
+}
+
+TEST_CASE("check replayed samples do not roll nodes back", "[InfoUpdateService]")
+{
+    InfoUpdateService service(false, 20000, 16);
+    mcproto::StatsReply reply;
+
+    mcproto::Stats live = makeStats("node1", 1000, 80);
+    live.set_collectedatms(5000);
+    service.ingest(live, reply);
+
+    mcproto::StatsBatch batch;
+    for(uint64_t collectedAtMs : {1000, 2000, 3000})
+    {
+        mcproto::Stats* spooled = batch.add_stats();
+        *spooled = makeStats("node1", 9000, 10);
+        spooled->set_collectedatms(collectedAtMs);
+    }
+    *batch.add_stats() = makeStats("node2", 2000, 70);
+    batch.mutable_stats(3)->set_collectedatms(3000);
+    service.ingest(batch, reply);
+
+    std::lock_guard<std::shared_mutex> guard(service.lock());
+    const NodeStore& store = service.store();
+    REQUIRE(store.size() == 2);
+    REQUIRE(store.stats(store.slot("node1")).collectedAtMs == 5000);
+    REQUIRE(store.stats(store.slot("node1")).ramAvailablePercent == 80);
+    REQUIRE(store.stats(store.slot("node2")).ramAvailablePercent == 70);
+    REQUIRE(store.hostname(store.best()) == "node1");
+}
+
+TEST_CASE("check node queries through the service", "[InfoUpdateService]")
+{
+    InfoUpdateService service(false, 20000, 16);
+    mcproto::StatsReply reply;
+    for(int idx = 0 ; idx < 5 ; idx++)
+    {
+        mcproto::Stats stats = makeStats("node" + std::to_string(idx), 1000 * (idx + 1), 50);
+        stats.mutable_meminfo()->set_availableram(4096 * idx);
+        service.ingest(stats, reply);
+    }
+
+    mcproto::NodeQuery request;
+    mcproto::Constraint* ram = request.add_constraints();
+    ram->set_metric(mcproto::RAM_AVAILABLE_MB);
+    ram->set_min(8192);
+    request.set_objective(mcproto::CPU_IDLE_PERCENT);
+    request.set_limit(2);
+
+    mcproto::NodeQueryReply response;
+    REQUIRE(service.query(request, response).ok());
+    REQUIRE(response.nodes_size() == 2);
+    REQUIRE(response.nodes(0).hostname() == "node2");
+    REQUIRE(response.nodes(0).value() == 70.);
+    REQUIRE(response.nodes(1).hostname() == "node3");
+
+    response.Clear();
+    ram->set_max(1024);
+    REQUIRE(service.query(request, response).error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+    ram->clear_max();
+    request.set_objective(mcproto::Metric(42));
+    REQUIRE(service.query(request, response).error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST_CASE("check history through the service", "[InfoUpdateService]")
+{
+    mcproto::HistoryQuery request;
+    request.set_hostname("node1");
+    request.set_metric(mcproto::CPU_IDLE_PERCENT);
+    mcproto::HistoryReply response;
+    {
+        InfoUpdateService service(false, 20000, 16);
+        REQUIRE(service.history(request, response).error_code() == grpc::StatusCode::FAILED_PRECONDITION);
+    }
+
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / ("mclear-service-history-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+    {
+        HistoryStore history(directory.string());
+        InfoUpdateService service(false, 20000, 16, &history);
+        mcproto::StatsReply reply;
+        for(int idx = 0 ; idx < 20 ; idx++)
+        {
+            mcproto::Stats stats = makeStats("node1", 100 * idx, 50);
+            stats.set_collectedatms(1000 * (idx + 1));
+            service.ingest(stats, reply);
+        }
+
+        request.set_fromms(5000);
+        request.set_toms(14000);
+        REQUIRE(service.history(request, response).ok());
+        REQUIRE(response.points_size() == 10);
+        REQUIRE(response.points(0).timestampms() == 5000);
+        REQUIRE(response.points(0).value() == 96.);
+        REQUIRE_FALSE(response.truncated());
+
+        response.Clear();
+        request.set_stepms(5000);
+        REQUIRE(service.history(request, response).ok());
+        REQUIRE(response.points_size() == 2);
+        REQUIRE(response.points(1).timestampms() == 10000);
+        REQUIRE(response.points(1).count() == 5);
+        REQUIRE(response.points(1).min() == 87.);
+        REQUIRE(response.points(1).max() == 91.);
+
+        request.set_toms(1000);
+        REQUIRE(service.history(request, response).error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+        request.set_toms(0);
+        request.set_metric(mcproto::Metric(42));
+        REQUIRE(service.history(request, response).error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("check a replayed spool fills the history only", "[InfoUpdateService]")
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / ("mclear-backfill-history-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+    {
+        HistoryStore history(directory.string());
+        InfoUpdateService service(false, 20000, 16, &history);
+        mcproto::StatsReply reply;
+        auto sample = [](uint32_t idx)
+        {
+            mcproto::Stats stats = makeStats("node1", 100 * idx, 50);
+            stats.set_runid(7);
+            stats.set_sequence(idx + 1);
+            stats.set_collectedatms(1000 * (idx + 1));
+            return stats;
+        };
+
+        // the first report after the outage goes out before the ones spooled through it
+        service.ingest(sample(0), reply);
+        service.ingest(sample(9), reply);
+        mcproto::StatsBatch batch;
+        batch.set_backfill(true);
+        for(uint32_t idx = 1 ; idx < 9 ; idx++)
+            *batch.add_stats() = sample(idx);
+        service.ingest(batch, reply);
+
+        mcproto::NodeQuery query;
+        query.set_objective(mcproto::CPU_IDLE_PERCENT);
+        mcproto::NodeQueryReply nodes;
+        REQUIRE(service.query(query, nodes).ok());
+        REQUIRE(nodes.nodes(0).hostname() == "node1");
+        REQUIRE(nodes.nodes(0).value() == 91.);
+        mcproto::FreshnessRequest freshnessRequest;
+        freshnessRequest.set_hostname("node1");
+        mcproto::FreshnessReply freshness;
+        REQUIRE(service.freshness(freshnessRequest, freshness).ok());
+        REQUIRE(freshness.node().reordered() == 0);
+
+        mcproto::HistoryQuery request;
+        request.set_hostname("node1");
+        request.set_metric(mcproto::CPU_IDLE_PERCENT);
+        mcproto::HistoryReply response;
+        REQUIRE(service.history(request, response).ok());
+        REQUIRE(response.points_size() == 10);
+        for(int idx = 0 ; idx < 10 ; idx++)
+            REQUIRE(response.points(idx).timestampms() == 1000u * (idx + 1));
+
+        // without the flag the batch goes by the node's order as before, and a node the server
+        // has not heard of is taken from its backfill
+        batch.set_backfill(false);
+        service.ingest(batch, reply);
+        freshness.Clear();
+        REQUIRE(service.freshness(freshnessRequest, freshness).ok());
+        REQUIRE(freshness.node().reordered() == 8);
+        batch.set_backfill(true);
+        batch.mutable_stats(0)->set_hostname("node2");
+        service.ingest(batch, reply);
+        nodes.Clear();
+        REQUIRE(service.query(query, nodes).ok());
+        REQUIRE(nodes.nodes_size() == 2);
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("check a capture reads back what the service took", "[CaptureFile]")
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / ("mclear-capture-" + std::to_string(getpid()));
+    {
+        CaptureWriter::Config config;
+        config.bufferBytes = 4096;
+        CaptureWriter capture(path.string(), config);
+        InfoUpdateService service(false, 20000, 16, nullptr, &capture);
+        mcproto::StatsReply reply;
+        for(int idx = 0 ; idx < 200 ; idx++)
+        {
+            service.ingest(makeStats("node" + std::to_string(idx % 7), 100 * idx, 50), reply);
+            // a buffer holds a few dozen reports, flushing now and then keeps any from dropping
+            if(idx % 20 == 19)
+                capture.flush();
+        }
+        mcproto::StatsBatch batch;
+        *batch.add_stats() = makeStats("node3", 1, 2);
+        *batch.add_stats() = makeStats("node3", 3, 4);
+        service.ingest(batch, reply);
+        capture.flush();
+        REQUIRE(capture.recorded() == 201);
+        REQUIRE(capture.dropped() == 0);
+        REQUIRE(capture.bytes() == std::filesystem::file_size(path));
+    }
+
+    {
+        CaptureReader reader(path.string());
+        const uint64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        REQUIRE(reader.startWallUs() <= nowUs);
+        REQUIRE(reader.startWallUs() > nowUs - 60000000);
+
+        CaptureReader::Record record;
+        uint64_t lastOffsetUs = 0;
+        for(int idx = 0 ; idx < 200 ; idx++)
+        {
+            REQUIRE(reader.next(record));
+            REQUIRE_FALSE(record.batch);
+            REQUIRE(record.offsetUs >= lastOffsetUs);
+            lastOffsetUs = record.offsetUs;
+            mcproto::Stats stats;
+            REQUIRE(stats.ParseFromArray(record.payload.data(), int(record.payload.size())));
+            REQUIRE(stats.hostname() == "node" + std::to_string(idx % 7));
+            REQUIRE(stats.cpuload().cpuload() == uint32_t(100 * idx));
+        }
+        REQUIRE(reader.next(record));
+        REQUIRE(record.batch);
+        mcproto::StatsBatch batch;
+        REQUIRE(batch.ParseFromArray(record.payload.data(), int(record.payload.size())));
+        REQUIRE(batch.stats_size() == 2);
+        REQUIRE_FALSE(reader.next(record));
+        REQUIRE_FALSE(reader.truncated());
+
+        reader.rewind();
+        REQUIRE(reader.next(record));
+        REQUIRE(record.payload.size() > 0);
+    }
+
+    // a writer killed mid-record leaves a tail the reader stops at
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+    {
+        CaptureReader reader(path.string());
+        CaptureReader::Record record;
+        int records = 0;
+        while(reader.next(record))
+            records++;
+        REQUIRE(records == 200);
+        REQUIRE(reader.truncated());
+    }
+
+    {
+        CaptureWriter::Config config;
+        config.bufferBytes = 16;
+        CaptureWriter capture(path.string(), config);
+        REQUIRE_FALSE(capture.record(makeStats("node1", 1, 2)));
+        REQUIRE(capture.dropped() == 1);
+        capture.flush();
+        REQUIRE(capture.bytes() == capture::headerSize);
+    }
+
+    std::ofstream(path) << "not a capture at all";
+    REQUIRE_THROWS_AS(CaptureReader(path.string()), std::invalid_argument);
+    std::filesystem::remove(path);
+    REQUIRE_THROWS_AS(CaptureReader(path.string()), std::system_error);
+}
+
+TEST_CASE("check inventories through the service", "[InfoUpdateService]")
+{
+    InfoUpdateService service(false, 20000, 16);
+    mcproto::StatsReply reply;
+    for(int idx = 0 ; idx < ScoreFilter::Config{}.warmup ; idx++)
+    {
+        service.ingest(makeStats("small", 5000, 50), reply);
+        REQUIRE(reply.inventorywanted());
+        service.ingest(makeStats("plain", 5000, 50), reply);
+    }
+    const uint32_t small = service.store().slot("small");
+    const uint32_t plain = service.store().slot("plain");
+    REQUIRE(service.store().ranking().score(small) == service.store().ranking().score(plain));
+
+    mcproto::Inventory inventory;
+    mcproto::InventoryReply inventoryReply;
+    REQUIRE(service.inventory(inventory, inventoryReply).error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+
+    inventory.set_hostname("small");
+    inventory.set_cores(2);
+    inventory.set_defaultinterface("eth0");
+    mcproto::Nic* nic = inventory.add_nics();
+    nic->set_name("eth0");
+    nic->set_speedmbps(1000);
+    REQUIRE(service.inventory(inventory, inventoryReply).ok());
+    REQUIRE(inventoryReply.nodeid() == small + 1);
+    // a quarter of the reference cores, with a little more bandwidth than the default
+    REQUIRE(service.store().ranking().score(small) > service.store().ranking().score(plain) / 4);
+    REQUIRE(service.store().ranking().score(small) < service.store().ranking().score(plain) / 3);
+    service.ingest(makeStats("small", 5000, 50), reply);
+    REQUIRE_FALSE(reply.inventorywanted());
+
+    // one sent before the node's first stats applies with them
+    inventory.set_hostname("big");
+    inventory.set_cores(64);
+    REQUIRE(service.inventory(inventory, inventoryReply).ok());
+    REQUIRE(inventoryReply.nodeid() == 0);
+    mcproto::StatsBatch batch;
+    *batch.add_stats() = makeStats("big", 5000, 50);
+    for(int idx = 0 ; idx < ScoreFilter::Config{}.warmup ; idx++)
+        service.ingest(batch, reply);
+    REQUIRE_FALSE(reply.inventorywanted());
+    const uint32_t big = service.store().slot("big");
+    REQUIRE(service.store().ranking().score(big) > 4 * service.store().ranking().score(plain));
+    REQUIRE(service.store().best() == big);
+
+    mcproto::InventoryQuery query;
+    mcproto::Inventory found;
+    query.set_nodeid(small + 1);
+    REQUIRE(service.inventory(query, found).ok());
+    REQUIRE(found.hostname() == "small");
+    REQUIRE(found.cores() == 2);
+    query.set_nodeid(0);
+    query.set_hostname("big");
+    REQUIRE(service.inventory(query, found).ok());
+    REQUIRE(found.cores() == 64);
+    query.set_hostname("plain");
+    REQUIRE(service.inventory(query, found).error_code() == grpc::StatusCode::NOT_FOUND);
+    query.set_nodeid(1000);
+    REQUIRE(service.inventory(query, found).error_code() == grpc::StatusCode::NOT_FOUND);
+}
+
+TEST_CASE("check freshness through the service", "[InfoUpdateService]")
+{
+    InfoUpdateService service(false, 20000, 16);
+    const uint64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    mcproto::StatsReply reply;
+    mcproto::Stats stats = makeStats("node1", 1000, 50);
+    stats.set_runid(42);
+    stats.set_nextreportms(60000);
+    for(uint64_t sequence : {1, 2, 2, 3, 1})
+    {
+        stats.set_sequence(sequence);
+        stats.set_collectedatms(nowMs - 100);
+        service.ingest(stats, reply);
+    }
+
+    mcproto::FreshnessRequest request;
+    mcproto::FreshnessReply response;
+    REQUIRE(service.freshness(request, response).ok());
+    REQUIRE_FALSE(response.has_node());
+    REQUIRE(response.duplicates() == 1);
+    REQUIRE(response.reordered() == 1);
+    REQUIRE(response.latency().counts_size() == int(AgeHistogram::buckets));
+    REQUIRE(response.latency().upperboundms(0) == 0);
+    REQUIRE(response.ages().counts(AgeHistogram::buckets - 1) == 0);
+    uint64_t reports = 0;
+    for(uint64_t count : response.latency().counts())
+        reports += count;
+    REQUIRE(reports == 3);
+
+    request.set_hostname("node1");
+    REQUIRE(service.freshness(request, response).ok());
+    REQUIRE(response.node().agems() >= 100);
+    REQUIRE(response.node().keep() == 1.f);
+    REQUIRE(response.node().duplicates() == 1);
+
+    request.set_hostname("node2");
+    REQUIRE(service.freshness(request, response).error_code() == grpc::StatusCode::NOT_FOUND);
+}
+
+TEST_CASE("check picks through the service prefer the caller's rack", "[InfoUpdateService]")
+{
+    InfoUpdateService service(false, 20000, 16);
+    mcproto::StatsReply reply;
+    for(int idx = 0 ; idx < 6 ; idx++)
+    {
+        mcproto::Stats stats = makeStats("node" + std::to_string(idx), 1000 * (idx + 1), 50);
+        stats.mutable_topology()->set_zone(idx < 3 ? "a" : "b");
+        stats.mutable_topology()->set_rack(std::to_string(idx % 3));
+        for(int report = 0 ; report < ScoreFilter::Config{}.warmup ; report++)
+            service.ingest(stats, reply);
+    }
+
+    mcproto::PickRequest request;
+    request.set_zone("b");
+    request.set_rack("2");
+    request.set_count(2);
+    mcproto::NodeQueryReply response;
+    service.pick(request, response);
+    REQUIRE(response.nodes_size() == 2);
+    REQUIRE(response.nodes(0).hostname() == "node5");
+    REQUIRE(response.nodes(1).hostname() == "node3");
+
+    response.Clear();
+    request.set_spread(true);
+    service.pick(request, response);
+    REQUIRE(response.nodes_size() == 2);
+    REQUIRE(response.nodes(0).hostname() == "node0");
+    REQUIRE(response.nodes(1).hostname() == "node3");
+}
+
+TEST_CASE("check picks through the service spread over racks as nodes get assigned", "[InfoUpdateService]")
+{
+    // near equal nodes in 3 zones of 5 racks of 4, picked one at a time
+    InfoUpdateService service(false, 20000, 64);
+    mcproto::StatsReply reply;
+    for(int idx = 0 ; idx < 60 ; idx++)
+    {
+        mcproto::Stats stats = makeStats("node" + std::to_string(idx), 1000 + idx, 50);
+        stats.mutable_topology()->set_zone(std::to_string(idx / 20));
+        stats.mutable_topology()->set_rack(std::to_string(idx / 4 % 5));
+        service.ingest(stats, reply);
+    }
+
+    auto picks = [&](bool spread)
+    {
+        std::map<std::string, int> picked;
+        mcproto::PickRequest request;
+        request.set_spread(spread);
+        for(int idx = 0 ; idx < 300 ; idx++)
+        {
+            mcproto::NodeQueryReply response;
+            service.pick(request, response);
+            REQUIRE(response.nodes_size() == 1);
+            picked[response.nodes(0).hostname()]++;
+        }
+        return picked;
+    };
+
+    for(bool spread : {false, true})
+    {
+        const std::map<std::string, int> picked = picks(spread);
+        REQUIRE(picked.size() == 60);
+        for(const auto& [hostname, count] : picked)
+            REQUIRE(count <= 12);
+    }
+}
+
+TEST_CASE("check picks through the service within a pool", "[InfoUpdateService]")
+{
+    InfoUpdateService service(false, 20000, 16);
+    mcproto::StatsReply reply;
+    const char* pools[][2] = {{"web", "search"}, {"web", ""}, {"search", ""}, {"", ""}};
+    for(int idx = 0 ; idx < 4 ; idx++)
+    {
+        mcproto::Stats stats = makeStats("node" + std::to_string(idx), 1000 * (idx + 1), 50);
+        for(const char* pool : pools[idx])
+            if(*pool)
+                stats.add_pools(pool);
+        service.ingest(stats, reply);
+    }
+
+    // node3 is idle but runs none of the services
+    mcproto::PickRequest request;
+    mcproto::NodeQueryReply response;
+    service.pick(request, response);
+    REQUIRE(response.nodes(0).hostname() == "node0");
+
+    request.set_pool("search");
+    request.set_count(5);
+    response.Clear();
+    service.pick(request, response);
+    REQUIRE(response.nodes_size() == 2);
+    REQUIRE(response.nodes(0).hostname() == "node0");
+    REQUIRE(response.nodes(1).hostname() == "node2");
+
+    // a node that leaves a pool is no longer picked from it
+    mcproto::Stats stats = makeStats("node0", 1000, 50);
+    stats.add_pools("web");
+    service.ingest(stats, reply);
+    response.Clear();
+    service.pick(request, response);
+    REQUIRE(response.nodes_size() == 1);
+    REQUIRE(response.nodes(0).hostname() == "node2");
+
+    request.set_pool("mail");
+    response.Clear();
+    service.pick(request, response);
+    REQUIRE(response.nodes_size() == 0);
+
+    // a report turned away as stale does not move the node between pools either
+    stats = makeStats("node2", 3000, 50);
+    stats.add_pools("search");
+    stats.set_runid(7);
+    stats.set_sequence(2);
+    service.ingest(stats, reply);
+    stats.clear_pools();
+    stats.add_pools("mail");
+    stats.set_sequence(1);
+    service.ingest(stats, reply);
+    response.Clear();
+    service.pick(request, response);
+    REQUIRE(response.nodes_size() == 0);
+    request.set_pool("search");
+    response.Clear();
+    service.pick(request, response);
+    REQUIRE(response.nodes_size() == 1);
+    REQUIRE(response.nodes(0).hostname() == "node2");
+}
+
+TEST_CASE("check a sharded service answers as an unsharded one", "[InfoUpdateService]")
+{
+    InfoUpdateService single(false, 20000, 256);
+    InfoUpdateService sharded(false, 20000, 256, nullptr, nullptr, 4);
+    REQUIRE(sharded.shards() == 4);
+
+    // distinct loads, no order is left to ties between nodes of different shards. Up to 8 zones
+    // of 4 racks, picks of more nodes than zones go on to the racks
+    constexpr int nodes = 240;
+    std::mt19937 random(11);
+    std::vector<int> loads(nodes);
+    for(int idx = 0 ; idx < nodes ; idx++)
+        loads[idx] = idx;
+    std::shuffle(loads.begin(), loads.end(), random);
+    const char* pools[] = {"web", "search", "mail"};
+    mcproto::StatsReply reply;
+    for(int idx = 0 ; idx < nodes ; idx++)
+    {
+        mcproto::Stats stats = makeStats("node" + std::to_string(idx), 10 + loads[idx] * 40, 50);
+        stats.mutable_topology()->set_zone("zone" + std::to_string(random() % 8));
+        stats.mutable_topology()->set_rack("rack" + std::to_string(random() % 4));
+        stats.add_pools(pools[idx % 3]);
+        single.ingest(stats, reply);
+        sharded.ingest(stats, reply);
+    }
+    for(size_t shard = 0 ; shard < sharded.shards() ; shard++)
+        REQUIRE(sharded.store(shard).size() > 0);
+
+    // half of them again without a call, the reports of all shards in one go, with loads none
+    // had before
+    std::shuffle(loads.begin(), loads.end(), random);
+    std::vector<std::string> hostnames;
+    std::vector<InfoUpdateService::Report> reports;
+    for(int idx = 0 ; idx < nodes ; idx += 2)
+        hostnames.push_back("node" + std::to_string(idx));
+    for(size_t idx = 0 ; idx < hostnames.size() ; idx++)
+    {
+        const uint32_t slot = single.store().slot(hostnames[idx]);
+        const TopologyTree& topology = single.store().topology();
+        reports.push_back({hostnames[idx], topology.zone(slot), topology.rack(slot), InfoUpdateService::nodeStats(makeStats(hostnames[idx], 30 + loads[idx] * 40, 50))});
+    }
+    single.ingest(reports.data(), reports.size());
+    sharded.ingest(reports.data(), reports.size());
+
+    auto same = [](const mcproto::NodeQueryReply& lhs, const mcproto::NodeQueryReply& rhs)
+    {
+        REQUIRE(lhs.nodes_size() == rhs.nodes_size());
+        for(int idx = 0 ; idx < lhs.nodes_size() ; idx++)
+        {
+            REQUIRE(lhs.nodes(idx).hostname() == rhs.nodes(idx).hostname());
+            REQUIRE(lhs.nodes(idx).value() == rhs.nodes(idx).value());
+        }
+    };
+
+    for(bool ascending : {false, true})
+    {
+        mcproto::NodeQuery query;
+        query.set_objective(mcproto::CPU_IDLE_PERCENT);
+        query.set_ascending(ascending);
+        query.set_limit(25);
+        mcproto::Constraint* constraint = query.add_constraints();
+        constraint->set_metric(mcproto::SCORE);
+        constraint->set_min(10);
+        mcproto::NodeQueryReply lhs, rhs;
+        REQUIRE(single.query(query, lhs).ok());
+        REQUIRE(sharded.query(query, rhs).ok());
+        REQUIRE(lhs.nodes_size() == 25);
+        same(lhs, rhs);
+    }
+
+    // the picks count against the nodes alike in both
+    for(int round = 0 ; round < 60 ; round++)
+    {
+        mcproto::PickRequest request;
+        request.set_count(1 + random() % 12);
+        if(round % 3 == 0)
+            request.set_pool(pools[random() % 3]);
+        else if(round % 3 == 1)
+            request.set_spread(true);
+        else
+        {
+            request.set_zone("zone" + std::to_string(random() % 9));
+            request.set_rack("rack" + std::to_string(random() % 4));
+        }
+        mcproto::NodeQueryReply lhs, rhs;
+        single.pick(request, lhs);
+        sharded.pick(request, rhs);
+        REQUIRE(lhs.nodes_size() == int(request.count()));
+        same(lhs, rhs);
+    }
+
+    // node ids tell the shard apart
+    mcproto::Inventory inventory;
+    inventory.set_cores(16);
+    mcproto::InventoryReply inventoryReply;
+    for(int idx = 0 ; idx < nodes ; idx += 7)
+    {
+        inventory.set_hostname("node" + std::to_string(idx));
+        REQUIRE(sharded.inventory(inventory, inventoryReply).ok());
+        mcproto::InventoryQuery query;
+        query.set_nodeid(inventoryReply.nodeid());
+        mcproto::Inventory found;
+        REQUIRE(sharded.inventory(query, found).ok());
+        REQUIRE(found.hostname() == inventory.hostname());
+    }
+
+    mcproto::FreshnessRequest request;
+    mcproto::FreshnessReply lhs, rhs;
+    REQUIRE(single.freshness(request, lhs).ok());
+    REQUIRE(sharded.freshness(request, rhs).ok());
+    for(int idx = 0 ; idx < lhs.latency().counts_size() ; idx++)
+        REQUIRE(lhs.latency().counts(idx) == rhs.latency().counts(idx));
+    REQUIRE(lhs.duplicates() == rhs.duplicates());
+    REQUIRE(lhs.outliers() == rhs.outliers());
+}
+
+TEST_CASE("check stats datagrams carry what the ranking needs", "[StatsDatagram]")
+{
+    mcproto::StatsDatagram::Key key;
+    REQUIRE(mcproto::StatsDatagram::parseKey("000102030405060708090a0b0c0d0e0F", key));
+    REQUIRE_FALSE(mcproto::StatsDatagram::parseKey("000102", key));
+    REQUIRE_FALSE(mcproto::StatsDatagram::parseKey("000102030405060708090a0b0c0d0e0g", key));
+
+    SECTION("check the mac against the SipHash-2-4 reference vectors")
+    {
+        char message[15];
+        for(int idx = 0 ; idx < 15 ; idx++)
+            message[idx] = char(idx);
+        REQUIRE(mcproto::StatsDatagram::mac(key, message, 0) == 0x726fdb47dd0e0e31ull);
+        REQUIRE(mcproto::StatsDatagram::mac(key, message, 15) == 0xa129ca6149be45e5ull);
+    }
+
+    mcproto::Stats stats = makeStats("node1", 2500, 40);
+    stats.mutable_topology()->set_zone("zone-a");
+    stats.mutable_topology()->set_rack("rack-7");
+    stats.set_runid(0x1122334455667788ull);
+    stats.set_sequence(9);
+    stats.set_collectedatms(1700000000123ull);
+    stats.set_nextreportms(5000);
+    stats.mutable_pressure()->set_ioavg10(12.5f);
+    mcproto::CgroupInfo* cgroup = stats.add_cgroups();
+    cgroup->set_cpuheadroom(5000);
+    cgroup->set_memoryheadroompercent(30);
+    const NodeStats expected = InfoUpdateService::nodeStats(stats);
+    REQUIRE(expected.cpuIdlePercent == 50.f);
+    REQUIRE(expected.ramAvailablePercent == 30);
+
+    char buffer[mcproto::StatsDatagram::maxSize];
+    const mcproto::StatsDatagram::Key* const keys[] = {nullptr, &key};
+    for(const mcproto::StatsDatagram::Key* signing : keys)
+    {
+        const size_t size = mcproto::StatsDatagram::from(stats).encode(buffer, sizeof(buffer), signing);
+        REQUIRE(size == mcproto::StatsDatagram::fixedSize + 5 + 6 + 6 + (signing ? mcproto::StatsDatagram::macSize : 0));
+
+        mcproto::StatsDatagram datagram;
+        REQUIRE(datagram.decode(buffer, size, signing));
+        REQUIRE(datagram.hostname == "node1");
+        REQUIRE(datagram.zone == "zone-a");
+        REQUIRE(datagram.rack == "rack-7");
+        const NodeStats decoded = InfoUpdateService::nodeStats(datagram);
+        REQUIRE(decoded.cpuIdlePercent == expected.cpuIdlePercent);
+        REQUIRE(decoded.diskSpaceAvailable == expected.diskSpaceAvailable);
+        REQUIRE(decoded.networkBandwidthUsed == expected.networkBandwidthUsed);
+        REQUIRE(decoded.ramAvailablePercent == expected.ramAvailablePercent);
+        REQUIRE(decoded.swapAvailablePercent == expected.swapAvailablePercent);
+        REQUIRE(decoded.pressure == 12.5f);
+        REQUIRE(decoded.runId == 0x1122334455667788ull);
+        REQUIRE(decoded.sequence == 9);
+        REQUIRE(decoded.collectedAtMs == 1700000000123ull);
+        REQUIRE(decoded.nextReportMs == 5000);
+
+        // cut short, grown or not what it says it is
+        REQUIRE_FALSE(datagram.decode(buffer, size - 1, signing));
+        REQUIRE_FALSE(datagram.decode(buffer, mcproto::StatsDatagram::fixedSize - 1, signing));
+        buffer[0] ^= 1;
+        REQUIRE_FALSE(datagram.decode(buffer, size, signing));
+        buffer[0] ^= 1;
+        if(signing)
+        {
+            buffer[20] ^= 1;
+            REQUIRE_FALSE(datagram.decode(buffer, size, &key));
+            buffer[20] ^= 1;
+            mcproto::StatsDatagram::Key other = key;
+            other[0] ^= 1;
+            REQUIRE_FALSE(datagram.decode(buffer, size, &other));
+            // any byte of the tag
+            for(size_t idx = size - mcproto::StatsDatagram::macSize ; idx < size ; idx++)
+            {
+                buffer[idx] ^= 0x80;
+                REQUIRE_FALSE(datagram.decode(buffer, size, &key));
+                buffer[idx] ^= 0x80;
+            }
+            REQUIRE(datagram.decode(buffer, size, &key));
+        }
+        else
+            REQUIRE_FALSE(datagram.decode(buffer, size, &key));
+    }
+
+    // figures that are not finite are turned away even from a sender holding the key
+    for(float figure : {std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity()})
+    {
+        mcproto::StatsDatagram datagram = mcproto::StatsDatagram::from(stats);
+        datagram.cpuIdlePercent = figure;
+        size_t size = datagram.encode(buffer, sizeof(buffer), &key);
+        REQUIRE_FALSE(datagram.decode(buffer, size, &key));
+        datagram = mcproto::StatsDatagram::from(stats);
+        datagram.pressure = -figure;
+        size = datagram.encode(buffer, sizeof(buffer), &key);
+        REQUIRE_FALSE(datagram.decode(buffer, size, &key));
+    }
+
+    REQUIRE(mcproto::StatsDatagram::from(stats).encode(buffer, mcproto::StatsDatagram::fixedSize, nullptr) == 0);
+    stats.set_hostname(std::string(256, 'n'));
+    REQUIRE(mcproto::StatsDatagram::from(stats).encode(buffer, sizeof(buffer), nullptr) == 0);
+}
+
+TEST_CASE("check datagrams are ingested over udp", "[DatagramIngest]")
+{
+    // into one store, and through an applier per shard
+    for(size_t shards : {1, 3})
+    {
+        InfoUpdateService service(false, 20000, 64, nullptr, nullptr, shards);
+        mcproto::StatsDatagram::Key key;
+        REQUIRE(mcproto::StatsDatagram::parseKey("00112233445566778899aabbccddeeff", key));
+        DatagramIngest::Config config;
+        config.threads = 2;
+        config.key = key;
+        DatagramIngest ingest(service, config);
+        REQUIRE(ingest.port() != 0);
+
+        const int client = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        REQUIRE(client != -1);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(ingest.port());
+
+        char buffer[mcproto::StatsDatagram::maxSize];
+        for(int idx = 0 ; idx < 32 ; idx++)
+        {
+            mcproto::Stats stats = makeStats("node" + std::to_string(idx), 100 * idx, 50);
+            stats.mutable_topology()->set_zone("z");
+            const size_t size = mcproto::StatsDatagram::from(stats).encode(buffer, sizeof(buffer), &key);
+            REQUIRE(sendto(client, buffer, size, 0, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == ssize_t(size));
+        }
+        // unsigned and garbage
+        const size_t size = mcproto::StatsDatagram::from(makeStats("intruder", 0, 100)).encode(buffer, sizeof(buffer), nullptr);
+        sendto(client, buffer, size, 0, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        sendto(client, "hello", 5, 0, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        close(client);
+
+        for(int attempt = 0 ; attempt < 500 && (ingest.applied() < 32 || ingest.rejected() < 2) ; attempt++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        REQUIRE(ingest.received() == 32);
+        REQUIRE(ingest.applied() == 32);
+        REQUIRE(ingest.rejected() == 2);
+        REQUIRE(ingest.dropped() == 0);
+
+        mcproto::NodeQuery query;
+        mcproto::NodeQueryReply reply;
+        query.set_limit(64);
+        REQUIRE(service.query(query, reply).ok());
+        REQUIRE(reply.nodes_size() == 32);
+        REQUIRE(reply.nodes(0).hostname() == "node0");
+        for(const mcproto::NodeMatch& node : reply.nodes())
+            REQUIRE(node.hostname() != "intruder");
+    }
+}
+
+TEST_CASE("check datagram receivers stop under steady traffic", "[DatagramIngest]")
+{
+    InfoUpdateService service(false, 20000, 64);
+    DatagramIngest::Config config;
+    config.threads = 1;
+    config.batch = 1;
+    auto ingest = std::make_unique<DatagramIngest>(service, config);
+
+    // more senders than the one receiver keeps up with
+    std::atomic<bool> done(false);
+    std::vector<std::thread> floods;
+    auto flood = [&, port = ingest->port()]
+    {
+        const int client = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        char buffer[mcproto::StatsDatagram::maxSize];
+        const size_t size = mcproto::StatsDatagram::from(makeStats("node1", 100, 50)).encode(buffer, sizeof(buffer), nullptr);
+        while(!done)
+            sendto(client, buffer, size, 0, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        close(client);
+    };
+    for(int idx = 0 ; idx < 4 ; idx++)
+        floods.emplace_back(flood);
+    for(int attempt = 0 ; attempt < 500 && !ingest->received() ; attempt++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(ingest->received() > 0);
+
+    const auto start = std::chrono::steady_clock::now();
+    ingest.reset();
+    const auto stopped = std::chrono::steady_clock::now() - start;
+    done = true;
+    for(std::thread& thread : floods)
+        thread.join();
+    REQUIRE(stopped < std::chrono::seconds(5));
+}
+
+TEST_CASE("check cluster simulations are reproducible and tell the policies apart", "[ClusterSimulator]")
+{
+    ClusterSimulator::Config config;
+    config.nodes = 20;
+    config.coresPerNode = 2;
+    config.speedSpread = 0.5;
+    config.durationSec = 20.;
+    config.warmupSec = 2.;
+    const ClusterSimulator simulator(config);
+
+    const ClusterSimulator::Result ledger = simulator.run(ClusterSimulator::Policy::Ledger);
+    const ClusterSimulator::Result again = simulator.run(ClusterSimulator::Policy::Ledger);
+    REQUIRE(ledger.requests > 10000);
+    REQUIRE(again.requests == ledger.requests);
+    REQUIRE(again.p99Ms == ledger.p99Ms);
+    REQUIRE(again.utilizationCv == ledger.utilizationCv);
+    REQUIRE(again.maxQueue == ledger.maxQueue);
+
+    config.seed = 2;
+    REQUIRE(ClusterSimulator(config).run(ClusterSimulator::Policy::Ledger).p99Ms != ledger.p99Ms);
+
+    // the oracle is the bound, the plain score herds onto whoever reported best
+    const ClusterSimulator::Result random = simulator.run(ClusterSimulator::Policy::Random);
+    const ClusterSimulator::Result oracle = simulator.run(ClusterSimulator::Policy::Oracle);
+    const ClusterSimulator::Result score = simulator.run(ClusterSimulator::Policy::Score);
+    REQUIRE(oracle.p99Ms < random.p99Ms);
+    REQUIRE(oracle.p99Ms < ledger.p99Ms);
+    REQUIRE(score.maxQueue > random.maxQueue);
+    REQUIRE(random.meanUtilization > 0.7);
+    REQUIRE(random.meanUtilization < 0.9);
+
+    REQUIRE(ClusterSimulator::policy("round-robin") == ClusterSimulator::Policy::RoundRobin);
+    REQUIRE_THROWS_AS(ClusterSimulator::policy("fastest"), std::invalid_argument);
+    config.warmupSec = config.durationSec;
+    REQUIRE_THROWS_AS(ClusterSimulator{config}, std::invalid_argument);
+}
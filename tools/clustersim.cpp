@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "clustersim.h"
+
+#include "nodestore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <queue>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+    using Micros = uint64_t;
+
+    // the clients' wall clock at the start of the run, the store tells samples apart by it
+    constexpr uint64_t epochMs = 1700000000000ull;
+    constexpr uint32_t sweepMs = 1000;
+
+    enum class EventType : uint8_t { Arrival, Completion, Collect, Deliver, Sweep };
+
+    struct Event
+    {
+        Micros at;
+        // ties go in the order the events were scheduled in
+        uint64_t order;
+        EventType type;
+        uint32_t node;
+        // the arrival of the request a completion is for
+        Micros arrival;
+    };
+
+    struct Later
+    {
+        bool operator()(const Event& l, const Event& r) const { return l.at != r.at ? l.at > r.at : l.order > r.order; }
+    };
+
+    struct Request
+    {
+        Micros arrival;
+        Micros service;
+    };
+
+    struct Node
+    {
+        std::deque<Request> waiting;
+        uint32_t busy = 0;
+        uint32_t inFlight = 0;
+        Micros lastChange = 0;
+        // after the warmup, for the results
+        Micros busyCoreUs = 0;
+        // since the last sample, for the next one
+        Micros sampleBusyCoreUs = 0;
+        Micros sampleQueuedUs = 0;
+        Micros lastSample = 0;
+        uint64_t sequence = 0;
+    };
+
+    struct Delivery
+    {
+        uint32_t node;
+        NodeStats stats;
+    };
+}
+
+ClusterSimulator::ClusterSimulator(const Config& config):
+    config_(config)
+{
+    if(!config_.nodes || !config_.coresPerNode || config_.load <= 0. || config_.meanServiceMs <= 0. || !config_.reportMs
+       || config_.speedSpread < 0. || config_.speedSpread >= 1. || config_.durationSec <= config_.warmupSec)
+        throw std::invalid_argument("simulation needs nodes, cores, load, service time, report interval, a speed spread in [0, 1) "
+                                    "and a duration longer than the warmup");
+
+    // evenly spread, then shuffled so that the speed of a node has nothing to do with its name
+    speeds_.resize(config_.nodes, 1.);
+    for(uint32_t node = 0 ; node < config_.nodes && config_.nodes > 1 ; node++)
+        speeds_[node] = 1. - config_.speedSpread + 2. * config_.speedSpread * node / (config_.nodes - 1);
+    std::mt19937_64 random(config_.seed);
+    std::shuffle(speeds_.begin(), speeds_.end(), random);
+}
+
+ClusterSimulator::Result ClusterSimulator::run(Policy policy) const
+{
+    const auto wallStart = std::chrono::steady_clock::now();
+    const Micros end = Micros(config_.durationSec * 1e6);
+    const Micros warmup = Micros(config_.warmupSec * 1e6);
+    const Micros reportUs = Micros(config_.reportMs) * 1000;
+    const Micros delayUs = Micros(config_.reportDelayMs) * 1000;
+
+    // the arrivals, their service demand and the report phases come from streams of their own,
+    // so that they are the same whatever the policy does with its own
+    std::mt19937_64 workload(config_.seed);
+    std::mt19937_64 phases(config_.seed ^ 0x9e3779b97f4a7c15ull);
+    std::mt19937_64 routing(config_.seed ^ 0xc2b2ae3d27d4eb4full);
+    double capacity = 0.;
+    for(double speed : speeds_)
+        capacity += speed * config_.coresPerNode;
+    std::exponential_distribution<double> interarrivalUs(config_.load * capacity / (config_.meanServiceMs * 1000.));
+    std::exponential_distribution<double> exponentialUs(1. / (config_.meanServiceMs * 1000.));
+    std::lognormal_distribution<double> lognormalUs(std::log(config_.meanServiceMs * 1000.) - config_.serviceSigma * config_.serviceSigma / 2.,
+                                                    config_.serviceSigma);
+    std::uniform_int_distribution<uint32_t> anyNode(0, config_.nodes - 1);
+
+    std::vector<Node> nodes(config_.nodes);
+    std::vector<std::string> hostnames;
+    for(uint32_t node = 0 ; node < config_.nodes ; node++)
+        hostnames.push_back("node" + std::to_string(node));
+    NodeStore store(config_.nodes);
+    std::vector<uint32_t> nodeOfSlot(config_.nodes, 0);
+    // the delay is the same for every report, they arrive in the order they were taken
+    std::deque<Delivery> deliveries;
+
+    std::priority_queue<Event, std::vector<Event>, Later> events;
+    uint64_t order = 0;
+    auto schedule = [&](Micros at, EventType type, uint32_t node = 0, Micros arrival = 0) { events.push({at, order++, type, node, arrival}); };
+
+    // brings the integrals of a node up to now
+    auto advance = [&](Node& node, Micros now)
+    {
+        const Micros elapsed = now - node.lastChange;
+        node.sampleBusyCoreUs += node.busy * elapsed;
+        if(!node.waiting.empty())
+            node.sampleQueuedUs += elapsed;
+        if(now > warmup)
+            node.busyCoreUs += node.busy * (now - std::max(node.lastChange, warmup));
+        node.lastChange = now;
+    };
+
+    auto start = [&](uint32_t index, const Request& request, Micros now)
+    {
+        nodes[index].busy++;
+        schedule(now + std::max<Micros>(1, Micros(request.service / speeds_[index])), EventType::Completion, index, request.arrival);
+    };
+
+    uint32_t nextRoundRobin = 0;
+    auto route = [&]() -> uint32_t
+    {
+        uint32_t slot = RankIndex::npos;
+        switch(policy)
+        {
+        case Policy::Random:
+            return anyNode(routing);
+        case Policy::RoundRobin:
+            return nextRoundRobin++ % config_.nodes;
+        case Policy::Score:
+            slot = store.ranking().best();
+            break;
+        case Policy::Ledger:
+            slot = store.assign();
+            break;
+        case Policy::Oracle:
+        {
+            uint32_t best = 0;
+            double fewest = std::numeric_limits<double>::max();
+            for(uint32_t index = 0 ; index < config_.nodes ; index++)
+            {
+                const double load = (nodes[index].inFlight + 1) / (config_.coresPerNode * speeds_[index]);
+                if(load < fewest)
+                {
+                    fewest = load;
+                    best = index;
+                }
+            }
+            return best;
+        }
+        }
+        // nobody reported yet
+        return slot == RankIndex::npos ? anyNode(routing) : nodeOfSlot[slot];
+    };
+
+    for(uint32_t node = 0 ; node < config_.nodes ; node++)
+        schedule(std::uniform_int_distribution<Micros>(0, reportUs - 1)(phases), EventType::Collect, node);
+    schedule(Micros(interarrivalUs(workload)), EventType::Arrival);
+    schedule(Micros(sweepMs) * 1000, EventType::Sweep);
+
+    Result result;
+    result.policy = policy;
+    std::vector<float> latencies;
+    while(!events.empty() && events.top().at < end)
+    {
+        const Event event = events.top();
+        events.pop();
+        const Micros now = event.at;
+        const uint64_t nowMs = epochMs + now / 1000;
+
+        switch(event.type)
+        {
+        case EventType::Arrival:
+        {
+            const Micros service = Micros(config_.service == Service::Exponential ? exponentialUs(workload) : lognormalUs(workload));
+            schedule(now + Micros(interarrivalUs(workload)), EventType::Arrival);
+
+            const uint32_t index = route();
+            Node& node = nodes[index];
+            advance(node, now);
+            node.inFlight++;
+            if(node.busy < config_.coresPerNode)
+            {
+                start(index, {now, service}, now);
+            }
+            else
+            {
+                node.waiting.push_back({now, service});
+                result.maxQueue = std::max<uint32_t>(result.maxQueue, node.waiting.size());
+            }
+            break;
+        }
+        case EventType::Completion:
+        {
+            Node& node = nodes[event.node];
+            advance(node, now);
+            node.busy--;
+            node.inFlight--;
+            if(event.arrival >= warmup)
+                latencies.push_back((now - event.arrival) / 1000.f);
+            if(!node.waiting.empty())
+            {
+                const Request next = node.waiting.front();
+                node.waiting.pop_front();
+                start(event.node, next, now);
+            }
+            break;
+        }
+        case EventType::Collect:
+        {
+            // what the client would see of its node: the cpu left idle and the time requests
+            // stalled waiting for one since the last sample, as the pressure stall information has it
+            Node& node = nodes[event.node];
+            advance(node, now);
+            const Micros interval = std::max<Micros>(1, now - node.lastSample);
+            NodeStats stats;
+            stats.cpuIdlePercent = float(100. * (1. - std::min(1., double(node.sampleBusyCoreUs) / (double(interval) * config_.coresPerNode))));
+            stats.pressure = float(100. * double(node.sampleQueuedUs) / interval);
+            stats.ramAvailablePercent = 50;
+            stats.swapAvailablePercent = 100;
+            stats.diskSpaceAvailable = 50 * 1000 * 1000;
+            stats.appInFlight = node.inFlight;
+            stats.collectedAtMs = nowMs;
+            stats.runId = event.node + 1;
+            stats.sequence = ++node.sequence;
+            stats.nextReportMs = config_.reportMs;
+            node.sampleBusyCoreUs = node.sampleQueuedUs = 0;
+            node.lastSample = now;
+
+            deliveries.push_back({event.node, stats});
+            schedule(now + delayUs, EventType::Deliver);
+            schedule(now + reportUs, EventType::Collect, event.node);
+            break;
+        }
+        case EventType::Deliver:
+        {
+            const Delivery delivery = deliveries.front();
+            deliveries.pop_front();
+            nodeOfSlot[store.update(hostnames[delivery.node], delivery.stats, {}, {}, nowMs)] = delivery.node;
+            break;
+        }
+        case EventType::Sweep:
+            store.discountOverdue(nowMs);
+            schedule(now + Micros(sweepMs) * 1000, EventType::Sweep);
+            break;
+        }
+    }
+
+    double sum = 0., sumSquares = 0.;
+    for(uint32_t index = 0 ; index < config_.nodes ; index++)
+    {
+        advance(nodes[index], end);
+        const double utilization = double(nodes[index].busyCoreUs) / (double(end - warmup) * config_.coresPerNode);
+        sum += utilization;
+        sumSquares += utilization * utilization;
+        result.maxUtilization = std::max(result.maxUtilization, utilization);
+    }
+    result.meanUtilization = sum / config_.nodes;
+    const double variance = std::max(0., sumSquares / config_.nodes - result.meanUtilization * result.meanUtilization);
+    result.utilizationCv = result.meanUtilization > 0. ? std::sqrt(variance) / result.meanUtilization : 0.;
+
+    result.requests = latencies.size();
+    if(!latencies.empty())
+    {
+        double total = 0.;
+        for(float latency : latencies)
+            total += latency;
+        result.meanMs = total / latencies.size();
+        auto percentile = [&latencies](double share)
+        {
+            auto at = latencies.begin() + size_t(share * (latencies.size() - 1));
+            std::nth_element(latencies.begin(), at, latencies.end());
+            return double(*at);
+        };
+        result.p50Ms = percentile(0.5);
+        result.p99Ms = percentile(0.99);
+        result.p999Ms = percentile(0.999);
+        result.maxMs = *std::max_element(latencies.begin(), latencies.end());
+    }
+    result.wallSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    return result;
+}
+
+const char* ClusterSimulator::name(Policy policy)
+{
+    switch(policy)
+    {
+    case Policy::Random:        return "random";
+    case Policy::RoundRobin:    return "round-robin";
+    case Policy::Score:         return "score";
+    case Policy::Ledger:        return "ledger";
+    case Policy::Oracle:        return "oracle";
+    }
+    return "unknown";
+}
+
+ClusterSimulator::Policy ClusterSimulator::policy(const std::string& name)
+{
+    for(Policy policy : policies())
+        if(name == ClusterSimulator::name(policy))
+            return policy;
+    throw std::invalid_argument("unknown policy " + name);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Discrete event simulation of a cluster routed by the server's own ranking, to tell whether
+/// a change to the ranking balances load better or worse without deploying it. Nodes have a
+/// number of cores each and a speed, requests arrive as a Poisson process and queue first come
+/// first served on the node they are routed to, the nodes report what a client would see of
+/// themselves every report interval and the reports reach the NodeStore after a delay.
+///
+/// Runs are reproducible from the seed. Every policy sees the same arrivals and service demands,
+/// so the differences between policies are down to the routing alone.
+class ClusterSimulator
+{
+public:
+    enum class Policy
+    {
+        Random,
+        RoundRobin,
+        /// the highest reported score, as NodeStore ranks without the assignment ledger
+        Score,
+        /// NodeStore::assign(), the score less the assignments since the node's last report
+        Ledger,
+        /// the node with the fewest requests at the moment, which no router knows, the bound
+        /// the others are measured against
+        Oracle,
+    };
+
+    enum class Service
+    {
+        Exponential,
+        /// heavy tailed, sigma of the underlying normal from Config::serviceSigma
+        LogNormal,
+    };
+
+    struct Config
+    {
+        uint32_t nodes = 100;
+        uint32_t coresPerNode = 4;
+        /// node speeds are spread evenly over [1 - spread, 1 + spread], service times divide by it
+        double speedSpread = 0.;
+        /// arrivals as a share of what the cluster can serve
+        double load = 0.8;
+        Service service = Service::Exponential;
+        double meanServiceMs = 20.;
+        double serviceSigma = 1.;
+        uint32_t reportMs = 1000;
+        uint32_t reportDelayMs = 5;
+        double durationSec = 300.;
+        /// requests that arrive before are left out of the results
+        double warmupSec = 30.;
+        uint64_t seed = 1;
+    };
+
+    struct Result
+    {
+        Policy policy;
+        uint64_t requests = 0;
+        double meanMs = 0.;
+        double p50Ms = 0.;
+        double p99Ms = 0.;
+        double p999Ms = 0.;
+        double maxMs = 0.;
+        /// busy core time over the core time of the node, over the nodes
+        double meanUtilization = 0.;
+        double maxUtilization = 0.;
+        /// standard deviation of the utilization over its mean
+        double utilizationCv = 0.;
+        uint32_t maxQueue = 0;
+        /// wall clock the run took
+        double wallSec = 0.;
+    };
+
+    explicit ClusterSimulator(const Config& config);
+    ClusterSimulator(): ClusterSimulator(Config{}) {}
+
+    Result run(Policy policy) const;
+
+    static const char* name(Policy policy);
+    /// throws std::invalid_argument for an unknown name
+    static Policy policy(const std::string& name);
+    static std::vector<Policy> policies() { return {Policy::Random, Policy::RoundRobin, Policy::Score, Policy::Ledger, Policy::Oracle}; }
+
+private:
+    Config config_;
+    std::vector<double> speeds_;
+};
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "clustersim.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    ClusterSimulator::Config config;
+    std::vector<ClusterSimulator::Policy> policies;
+    try
+    {
+        for(int idx = 1 ; idx < argc ; idx++)
+        {
+            const bool hasValue = idx + 1 < argc;
+            if(!strcmp(argv[idx], "--nodes") && hasValue)
+                config.nodes = std::stoul(argv[++idx]);
+            else if(!strcmp(argv[idx], "--cores") && hasValue)
+                config.coresPerNode = std::stoul(argv[++idx]);
+            else if(!strcmp(argv[idx], "--speed-spread") && hasValue)
+                config.speedSpread = std::stod(argv[++idx]);
+            else if(!strcmp(argv[idx], "--load") && hasValue)
+                config.load = std::stod(argv[++idx]);
+            else if(!strcmp(argv[idx], "--service") && hasValue)
+            {
+                const std::string service = argv[++idx];
+                if(service == "exponential")
+                    config.service = ClusterSimulator::Service::Exponential;
+                else if(service == "lognormal")
+                    config.service = ClusterSimulator::Service::LogNormal;
+                else
+                    throw std::invalid_argument(service);
+            }
+            else if(!strcmp(argv[idx], "--service-ms") && hasValue)
+                config.meanServiceMs = std::stod(argv[++idx]);
+            else if(!strcmp(argv[idx], "--sigma") && hasValue)
+                config.serviceSigma = std::stod(argv[++idx]);
+            else if(!strcmp(argv[idx], "--report-ms") && hasValue)
+                config.reportMs = std::stoul(argv[++idx]);
+            else if(!strcmp(argv[idx], "--report-delay-ms") && hasValue)
+                config.reportDelayMs = std::stoul(argv[++idx]);
+            else if(!strcmp(argv[idx], "--duration-s") && hasValue)
+                config.durationSec = std::stod(argv[++idx]);
+            else if(!strcmp(argv[idx], "--warmup-s") && hasValue)
+                config.warmupSec = std::stod(argv[++idx]);
+            else if(!strcmp(argv[idx], "--seed") && hasValue)
+                config.seed = std::stoull(argv[++idx]);
+            else if(!strcmp(argv[idx], "--policy") && hasValue)
+                policies.push_back(ClusterSimulator::policy(argv[++idx]));
+            else
+                throw std::invalid_argument(argv[idx]);
+        }
+        if(policies.empty())
+            policies = ClusterSimulator::policies();
+
+        const ClusterSimulator simulator(config);
+        std::printf("%u nodes x %u cores, speed spread %.2f, load %.2f, %s service %.1fms, reports every %ums arriving after %ums, "
+                    "%.0fs simulated after %.0fs warmup, seed %llu\n",
+                    config.nodes, config.coresPerNode, config.speedSpread, config.load,
+                    config.service == ClusterSimulator::Service::Exponential ? "exponential" : "lognormal", config.meanServiceMs,
+                    config.reportMs, config.reportDelayMs, config.durationSec - config.warmupSec, config.warmupSec,
+                    static_cast<unsigned long long>(config.seed));
+        std::printf("%-12s %10s %9s %9s %9s %9s %9s %7s %7s %7s %8s %9s\n", "policy", "requests", "mean(ms)", "p50(ms)", "p99(ms)",
+                    "p999(ms)", "max(ms)", "util", "max", "cv", "maxq", "speedup");
+        for(ClusterSimulator::Policy policy : policies)
+        {
+            const ClusterSimulator::Result result = simulator.run(policy);
+            std::printf("%-12s %10llu %9.2f %9.2f %9.2f %9.2f %9.2f %7.3f %7.3f %7.3f %8u %8.0fx\n", ClusterSimulator::name(policy),
+                        static_cast<unsigned long long>(result.requests), result.meanMs, result.p50Ms, result.p99Ms, result.p999Ms,
+                        result.maxMs, result.meanUtilization, result.maxUtilization, result.utilizationCv, result.maxQueue,
+                        config.durationSec / result.wallSec);
+        }
+    }
+    catch(const std::logic_error& error)
+    {
+        std::cerr << "mclearsim: " << error.what() << "\n"
+                     "usage: mclearsim [--nodes <n>] [--cores <per node>] [--speed-spread <0..1>] [--load <share of capacity>]\n"
+                     "                 [--service exponential|lognormal] [--service-ms <mean>] [--sigma <lognormal sigma>]\n"
+                     "                 [--report-ms <ms>] [--report-delay-ms <ms>] [--duration-s <s>] [--warmup-s <s>]\n"
+                     "                 [--seed <n>] [--policy random|round-robin|score|ledger|oracle]...\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2022 Abhinav Sinha
+ *
+ * This work can be distributed under the terms of the GNU GPLv3.
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License Version 3 for more details.
+ */
+#include "capturefile.h"
+
+#include <mcproto/infoupdate.grpc.pb.h>
+
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Message
+    {
+        mcproto::Stats stats;
+        mcproto::StatsBatch batch;
+        bool isBatch;
+    };
+
+    /// Sends the reports of the hosts hashed to it, one after the other, so every host keeps
+    /// its order while the hosts go out in parallel
+    class Worker
+    {
+    public:
+        static constexpr size_t queueLimit = 1024;
+
+        Worker(const std::shared_ptr<grpc::Channel>& channel, std::chrono::milliseconds deadline):
+            stub_(mcproto::InfoUpdate::NewStub(channel)),
+            deadline_(deadline),
+            sent_(0),
+            failed_(0),
+            done_(false),
+            thread_(&Worker::run, this)
+        {
+        }
+
+        ~Worker()
+        {
+            finish();
+        }
+
+        /// blocks while the queue is full, the replay falls behind rather than piling up
+        void push(Message&& message)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_.wait(lock, [this]{ return queue_.size() < queueLimit; });
+            queue_.push_back(std::move(message));
+            ready_.notify_one();
+        }
+
+        /// sends what is queued and stops
+        void finish()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                done_ = true;
+            }
+            ready_.notify_one();
+            if(thread_.joinable())
+                thread_.join();
+        }
+
+        uint64_t sent() const { return sent_; }
+        uint64_t failed() const { return failed_; }
+        const std::vector<uint32_t>& latenciesUs() const { return latenciesUs_; }
+
+    private:
+        std::unique_ptr<mcproto::InfoUpdate::Stub> stub_;
+        std::chrono::milliseconds deadline_;
+        std::mutex mutex_;
+        std::condition_variable ready_;
+        std::condition_variable space_;
+        std::deque<Message> queue_;
+        std::vector<uint32_t> latenciesUs_;
+        uint64_t sent_;
+        uint64_t failed_;
+        bool done_;
+        std::thread thread_;
+
+        void run()
+        {
+            for(;;)
+            {
+                Message message;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    ready_.wait(lock, [this]{ return done_ || !queue_.empty(); });
+                    if(queue_.empty())
+                        return;
+                    message = std::move(queue_.front());
+                    queue_.pop_front();
+                }
+                space_.notify_one();
+
+                grpc::ClientContext context;
+                context.set_deadline(std::chrono::system_clock::now() + deadline_);
+                mcproto::StatsReply reply;
+                const Clock::time_point start = Clock::now();
+                const grpc::Status status = message.isBatch ? stub_->SendStatsBatch(&context, message.batch, &reply)
+                                                            : stub_->SendStats(&context, message.stats, &reply);
+                latenciesUs_.push_back(uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count()));
+                if(status.ok())
+                    sent_++;
+                else
+                    failed_++;
+            }
+        }
+    };
+
+    double percentileMs(std::vector<uint32_t>& valuesUs, double percentile)
+    {
+        if(valuesUs.empty())
+            return 0;
+        const size_t rank = std::min(valuesUs.size() - 1, size_t(percentile * valuesUs.size()));
+        std::nth_element(valuesUs.begin(), valuesUs.begin() + rank, valuesUs.end());
+        return valuesUs[rank] / 1000.0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string path;
+    std::string server = "localhost:50051";
+    // 0 for as fast as the server takes it
+    double speed = 1;
+    uint32_t concurrency = 8;
+    uint32_t deadlineMs = 5000;
+    try
+    {
+        for(int idx = 1 ; idx < argc ; idx++)
+        {
+            const bool hasValue = idx + 1 < argc;
+            if(!strcmp(argv[idx], "--capture") && hasValue)
+                path = argv[++idx];
+            else if(!strcmp(argv[idx], "--server") && hasValue)
+                server = argv[++idx];
+            else if(!strcmp(argv[idx], "--speed") && hasValue)
+            {
+                const std::string value = argv[++idx];
+                speed = value == "max" ? 0 : std::stod(value);
+                if(speed < 0)
+                    throw std::invalid_argument(value);
+            }
+            else if(!strcmp(argv[idx], "--concurrency") && hasValue)
+                concurrency = std::max(1ul, std::stoul(argv[++idx]));
+            else if(!strcmp(argv[idx], "--deadline-ms") && hasValue)
+                deadlineMs = std::stoul(argv[++idx]);
+            else
+                throw std::invalid_argument(argv[idx]);
+        }
+        if(path.empty())
+            throw std::invalid_argument("no capture given");
+    }
+    catch(const std::logic_error& error)
+    {
+        std::cerr << "mclearreplay: " << error.what() << "\n"
+                     "usage: mclearreplay --capture <file> [--server <host:port>] [--speed <times real time>|max]\n"
+                     "                    [--concurrency <connections>] [--deadline-ms <ms>]\n";
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        CaptureReader reader(path);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        for(uint32_t idx = 0 ; idx < concurrency ; idx++)
+        {
+            // a channel each, one http/2 connection would serialize them again
+            grpc::ChannelArguments arguments;
+            arguments.SetInt("mclear.replay.worker", int(idx));
+            workers.push_back(std::make_unique<Worker>(grpc::CreateCustomChannel(server, grpc::InsecureChannelCredentials(), arguments),
+                                                       std::chrono::milliseconds(deadlineMs)));
+        }
+
+        std::vector<uint32_t> latenessUs;
+        uint64_t records = 0;
+        uint64_t malformed = 0;
+        uint64_t lastOffsetUs = 0;
+        const Clock::time_point start = Clock::now();
+        CaptureReader::Record record;
+        while(reader.next(record))
+        {
+            Message message;
+            message.isBatch = record.batch;
+            const bool parsed = record.batch ? message.batch.ParseFromArray(record.payload.data(), int(record.payload.size()))
+                                             : message.stats.ParseFromArray(record.payload.data(), int(record.payload.size()));
+            if(!parsed || (record.batch && !message.batch.stats_size()))
+            {
+                malformed++;
+                continue;
+            }
+
+            if(speed > 0)
+            {
+                const Clock::time_point due = start + std::chrono::microseconds(uint64_t(record.offsetUs / speed));
+                std::this_thread::sleep_until(due);
+                latenessUs.push_back(uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count()));
+            }
+
+            const std::string& hostname = record.batch ? message.batch.stats(0).hostname() : message.stats.hostname();
+            workers[std::hash<std::string>()(hostname) % workers.size()]->push(std::move(message));
+            lastOffsetUs = record.offsetUs;
+            records++;
+        }
+
+        uint64_t sent = 0;
+        uint64_t failed = 0;
+        std::vector<uint32_t> latenciesUs;
+        for(const std::unique_ptr<Worker>& worker : workers)
+        {
+            worker->finish();
+            sent += worker->sent();
+            failed += worker->failed();
+            latenciesUs.insert(latenciesUs.end(), worker->latenciesUs().begin(), worker->latenciesUs().end());
+        }
+        const double wallSec = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::printf("%llu records over %.1fs captured, replayed in %.1fs to %s\n", static_cast<unsigned long long>(records),
+                    lastOffsetUs / 1e6, wallSec, server.c_str());
+        std::printf("sent %llu, failed %llu, malformed %llu%s, %.0f reports/s\n", static_cast<unsigned long long>(sent),
+                    static_cast<unsigned long long>(failed), static_cast<unsigned long long>(malformed),
+                    reader.truncated() ? ", capture cut short" : "", wallSec > 0 ? records / wallSec : 0.0);
+        std::printf("reply p50 %.2fms p99 %.2fms", percentileMs(latenciesUs, 0.5), percentileMs(latenciesUs, 0.99));
+        if(speed > 0)
+            std::printf(", sent late by p50 %.2fms p99 %.2fms", percentileMs(latenessUs, 0.5), percentileMs(latenessUs, 0.99));
+        std::printf("\n");
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    catch(const std::exception& error)
+    {
+        std::cerr << "mclearreplay: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}